@@ -3,5 +3,17 @@ set GLSL_LANG_VALIDATOR=%VULKAN_SDK_PATH%"\Bin32\glslangValidator.exe"
 
 %GLSL_LANG_VALIDATOR% -V shader.vert
 %GLSL_LANG_VALIDATOR% -V shader.frag
+%GLSL_LANG_VALIDATOR% -V virtual.frag -o virtual_frag.spv
+%GLSL_LANG_VALIDATOR% -V -DPACKED_VERTICES shader.vert -o packed_vert.spv
+%GLSL_LANG_VALIDATOR% -V -DPACKED_VERTICES -DVERTEX_COLORS shader.vert -o packed_colors_vert.spv
+%GLSL_LANG_VALIDATOR% -V instanced.vert -o instanced_vert.spv
+%GLSL_LANG_VALIDATOR% -V -DPACKED_VERTICES instanced.vert -o instanced_packed_vert.spv
+%GLSL_LANG_VALIDATOR% -V -DPACKED_VERTICES -DVERTEX_COLORS instanced.vert -o instanced_packed_colors_vert.spv
+%GLSL_LANG_VALIDATOR% -V instances.comp -o instances_comp.spv
+%GLSL_LANG_VALIDATOR% -V -DOCCLUSION_CULLING instances.comp -o instances_occlusion_comp.spv
+%GLSL_LANG_VALIDATOR% -V meshlets.comp -o meshlets_comp.spv
+%GLSL_LANG_VALIDATOR% -V -DOCCLUSION_CULLING meshlets.comp -o meshlets_occlusion_comp.spv
+%GLSL_LANG_VALIDATOR% -V depth_reduce.comp -o depth_reduce_comp.spv
+%GLSL_LANG_VALIDATOR% -V -DMULTISAMPLED depth_reduce.comp -o depth_reduce_ms_comp.spv
 
 pause
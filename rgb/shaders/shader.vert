@@ -2,20 +2,43 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
     mat4 view;
     mat4 proj;
+    vec4 positionOffset;
+    vec4 positionScale;
 } ubo;
 
+// Bound at a different dynamic offset for every object
+layout(binding = 2) uniform ObjectUniforms {
+    mat4 model;
+} object;
+
+// Packed positions are normalized to the mesh bounding box, and the color
+// stream is left out for meshes that are all white
+#ifdef PACKED_VERTICES
+layout(location = 0) in vec4 inPosition;
+#else
 layout(location = 0) in vec3 inPosition;
+#endif
+#if !defined(PACKED_VERTICES) || defined(VERTEX_COLORS)
 layout(location = 1) in vec3 inColor;
+#endif
 layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+#ifdef PACKED_VERTICES
+    vec3 position = ubo.positionOffset.xyz + inPosition.xyz * ubo.positionScale.xyz;
+#else
+    vec3 position = inPosition;
+#endif
+    gl_Position = ubo.proj * ubo.view * object.model * vec4(position, 1.0);
+#if !defined(PACKED_VERTICES) || defined(VERTEX_COLORS)
     fragColor = inColor;
+#else
+    fragColor = vec3(1.0);
+#endif
     fragTexCoord = inTexCoord;
 }
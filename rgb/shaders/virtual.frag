@@ -0,0 +1,65 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Samples a virtual texture through its page table, see virtual_texture.h.
+// PAGE_SIZE and PAGE_BORDER match VirtualTexture.
+
+const float PAGE_SIZE = 128.0;
+const float PAGE_BORDER = 4.0;
+const float TILE_SIZE = PAGE_SIZE + 2.0 * PAGE_BORDER;
+
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 view;
+    mat4 proj;
+    vec4 positionOffset;
+    vec4 positionScale;
+    // xy: share of the virtual texture the image covers, z: pages per side
+    // of level 0, w: level count
+    vec4 virtualTexture;
+} ubo;
+
+layout(binding = 3) uniform sampler2D atlas;
+// Atlas tile in rg and level in b of the finest resident page
+layout(binding = 4) uniform usampler2D pageTable;
+// One bit per page of every level, levels one after the other
+layout(binding = 5) buffer Feedback {
+    uint bits[];
+} feedback;
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    vec2 uv = fract(fragTexCoord) * ubo.virtualTexture.xy;
+    uint pagesPerSide = uint(ubo.virtualTexture.z);
+    int levelCount = int(ubo.virtualTexture.w);
+
+    // Level the hardware would pick if the whole virtual texture had mips
+    vec2 texels = uv * ubo.virtualTexture.z * PAGE_SIZE;
+    vec2 dx = dFdx(texels);
+    vec2 dy = dFdy(texels);
+    float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+    int level = clamp(int(lod), 0, levelCount - 1);
+
+    // Ask for the page at the wanted level. Pages of level 0 come first and
+    // every coarser level follows, so level l starts after
+    // 4 / 3 (P^2 - (P >> l)^2) pages.
+    uint levelPages = pagesPerSide >> level;
+    uvec2 page = min(uvec2(uv * float(levelPages)), uvec2(levelPages - 1u));
+    uint index = (4u * (pagesPerSide * pagesPerSide - levelPages * levelPages)) / 3u + page.y * levelPages + page.x;
+    // Neighbouring fragments want the same few pages, so only the first
+    // ones to find the bit clear pay for the atomic
+    uint word = index >> 5;
+    uint bit = 1u << (index & 31u);
+    if ((feedback.bits[word] & bit) == 0u) {
+        atomicOr(feedback.bits[word], bit);
+    }
+
+    // Sample the finest resident page, which may be coarser than wanted
+    uvec3 entry = texelFetch(pageTable, ivec2(page), level).rgb;
+    float entryPages = float(pagesPerSide >> entry.b);
+    vec2 texel = vec2(entry.rg) * TILE_SIZE + PAGE_BORDER + fract(uv * entryPages) * PAGE_SIZE;
+    outColor = textureLod(atlas, texel / vec2(textureSize(atlas, 0)), 0.0);
+}
@@ -0,0 +1,300 @@
+#include "asset_archive.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "hash.h"
+#include "lz4_block.h"
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+Asset loadLooseAsset(const std::string& path, FileAccess access)
+{
+  Asset asset;
+  if (!asset.file.open(path, access))
+  {
+    std::cerr << "ERROR: Failed to load file! " << path << std::endl;
+    throw std::runtime_error("Failed to load file!");
+  }
+  asset.bytes = asset.file.data();
+  asset.length = asset.file.size();
+  return asset;
+}
+
+bool AssetArchive::open(const std::string& path)
+{
+  close();
+
+  if (!file.open(path))
+  {
+    return false;
+  }
+  this->path = path;
+
+  AssetArchiveHeader header;
+  if (file.size() < sizeof(header))
+  {
+    std::cerr << "WARNING: Asset archive " << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+
+  if (header.magic != ASSET_ARCHIVE_MAGIC || header.version != ASSET_ARCHIVE_VERSION)
+  {
+    std::cerr << "WARNING: Asset archive " << path << " has an unsupported format, repack it" << std::endl;
+    close();
+    return false;
+  }
+
+  const uint64_t tableEnd = sizeof(header) + static_cast<uint64_t>(header.entryCount) * sizeof(AssetArchiveEntry);
+  if (tableEnd + header.nameBytes > file.size())
+  {
+    std::cerr << "WARNING: Asset archive " << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+
+  entries.resize(header.entryCount);
+  memcpy(entries.data(), file.data() + sizeof(header), entries.size() * sizeof(AssetArchiveEntry));
+  names = reinterpret_cast<const char*>(file.data() + tableEnd);
+
+  const uint64_t payloadStart = tableEnd + header.nameBytes;
+  for (size_t i = 0; i < entries.size(); ++i)
+  {
+    const AssetArchiveEntry& entry = entries[i];
+    bool nameInBounds = entry.nameOffset <= header.nameBytes && entry.nameLength <= header.nameBytes - entry.nameOffset;
+    bool inBounds = entry.offset >= payloadStart && entry.offset <= file.size() && entry.storedSize <= file.size() - entry.offset;
+    bool validCompression = entry.compression == AssetCompression::Lz4
+      || (entry.compression == AssetCompression::None && entry.storedSize == entry.size);
+    // Lookups rely on the names being sorted
+    bool sorted = i == 0 || (nameInBounds && getName(entries[i - 1]) < getName(entry));
+    if (!nameInBounds || !inBounds || !validCompression || !sorted || entry.offset % ASSET_ARCHIVE_ALIGNMENT != 0)
+    {
+      std::cerr << "WARNING: Asset archive " << path << " has a malformed table of contents" << std::endl;
+      close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void AssetArchive::close()
+{
+  file.close();
+  entries.clear();
+  names = nullptr;
+}
+
+std::vector<std::string> AssetArchive::getNames() const
+{
+  std::vector<std::string> result;
+  for (const auto& entry : entries)
+  {
+    result.push_back(getName(entry));
+  }
+  return result;
+}
+
+Asset AssetArchive::load(const std::string& name) const
+{
+  const AssetArchiveEntry* entry = findEntry(name);
+  if (entry == nullptr)
+  {
+    std::cerr << "ERROR: Asset " << name << " is not in " << path << std::endl;
+    throw std::runtime_error("Asset is not in the archive!");
+  }
+
+  Asset asset;
+  const uint8_t* stored = file.data() + entry->offset;
+  if (entry->compression == AssetCompression::None)
+  {
+    asset.bytes = stored;
+    asset.length = static_cast<size_t>(entry->size);
+    return asset;
+  }
+
+  asset.storage.resize(static_cast<size_t>(entry->size));
+  if (!lz4Decompress(stored, static_cast<size_t>(entry->storedSize), asset.storage.data(), asset.storage.size())
+    || xxhash64(asset.storage.data(), asset.storage.size()) != entry->hash)
+  {
+    std::cerr << "ERROR: Asset " << name << " in " << path << " is corrupt" << std::endl;
+    throw std::runtime_error("Asset is corrupt!");
+  }
+  asset.bytes = asset.storage.data();
+  asset.length = asset.storage.size();
+  return asset;
+}
+
+bool AssetArchive::isStale(const std::string& name) const
+{
+  const AssetArchiveEntry* entry = findEntry(name);
+  if (entry == nullptr)
+  {
+    return false;
+  }
+
+  std::error_code error;
+  const uint64_t size = std::filesystem::file_size(name, error);
+  if (error)
+  {
+    return false;
+  }
+  if (size != entry->size)
+  {
+    return true;
+  }
+
+  const auto writeTime = std::filesystem::last_write_time(name, error);
+  if (error || static_cast<int64_t>(writeTime.time_since_epoch().count()) == entry->sourceWriteTime)
+  {
+    return false;
+  }
+
+  // Touched, but possibly with the same contents
+  MappedFile source;
+  if (!source.open(name, FileAccess::Sequential))
+  {
+    return false;
+  }
+  return xxhash64(source.data(), source.size()) != entry->hash;
+}
+
+const AssetArchiveEntry* AssetArchive::findEntry(const std::string& name) const
+{
+  auto it = std::lower_bound(entries.begin(), entries.end(), name,
+    [this](const AssetArchiveEntry& entry, const std::string& value) { return getName(entry) < value; });
+  if (it == entries.end() || getName(*it) != name)
+  {
+    return nullptr;
+  }
+  return &*it;
+}
+
+std::string AssetArchive::getName(const AssetArchiveEntry& entry) const
+{
+  return std::string(names + entry.nameOffset, entry.nameLength);
+}
+
+bool AssetArchiveWriter::addFile(const std::string& path)
+{
+  MappedFile source;
+  if (!source.open(path, FileAccess::Sequential))
+  {
+    std::cerr << "WARNING: Failed to read asset " << path << std::endl;
+    return false;
+  }
+
+  PendingEntry entry;
+  entry.name = std::filesystem::path(path).generic_string();
+  entry.size = source.size();
+  entry.hash = xxhash64(source.data(), source.size());
+  std::error_code error;
+  entry.sourceWriteTime = static_cast<int64_t>(std::filesystem::last_write_time(path, error).time_since_epoch().count());
+
+  // Already compressed formats such as JPEG do not shrink, and are worth
+  // more uncompressed since they can then be read in place
+  lz4Compress(source.data(), source.size(), entry.data);
+  entry.compression = AssetCompression::Lz4;
+  if (entry.data.size() > source.size() - source.size() / 8)
+  {
+    entry.data.assign(source.data(), source.data() + source.size());
+    entry.compression = AssetCompression::None;
+  }
+
+  auto position = std::find_if(pending.begin(), pending.end(),
+    [&entry](const PendingEntry& other) { return other.name == entry.name; });
+  if (position != pending.end())
+  {
+    *position = std::move(entry);
+  }
+  else
+  {
+    pending.push_back(std::move(entry));
+  }
+  return true;
+}
+
+bool AssetArchiveWriter::write(const std::string& path) const
+{
+  std::vector<const PendingEntry*> sorted;
+  for (const auto& entry : pending)
+  {
+    sorted.push_back(&entry);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](const PendingEntry* a, const PendingEntry* b) { return a->name < b->name; });
+
+  AssetArchiveHeader header = {};
+  header.magic = ASSET_ARCHIVE_MAGIC;
+  header.version = ASSET_ARCHIVE_VERSION;
+  header.entryCount = static_cast<uint32_t>(sorted.size());
+
+  std::string names;
+  std::vector<AssetArchiveEntry> table(sorted.size());
+  for (size_t i = 0; i < sorted.size(); ++i)
+  {
+    table[i].nameOffset = static_cast<uint32_t>(names.size());
+    table[i].nameLength = static_cast<uint32_t>(sorted[i]->name.size());
+    names += sorted[i]->name;
+  }
+  header.nameBytes = static_cast<uint32_t>(names.size());
+
+  uint64_t offset = alignUp(sizeof(header) + table.size() * sizeof(AssetArchiveEntry) + names.size(), ASSET_ARCHIVE_ALIGNMENT);
+  for (size_t i = 0; i < sorted.size(); ++i)
+  {
+    table[i].compression = sorted[i]->compression;
+    table[i].offset = offset;
+    table[i].storedSize = sorted[i]->data.size();
+    table[i].size = sorted[i]->size;
+    table[i].hash = sorted[i]->hash;
+    table[i].sourceWriteTime = sorted[i]->sourceWriteTime;
+    offset = alignUp(offset + table[i].storedSize, ASSET_ARCHIVE_ALIGNMENT);
+  }
+
+  const std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+      std::cerr << "WARNING: Failed to create asset archive " << temporaryPath << std::endl;
+      return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(AssetArchiveEntry));
+    out.write(names.data(), static_cast<std::streamsize>(names.size()));
+
+    const std::vector<char> padding(ASSET_ARCHIVE_ALIGNMENT, 0);
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+      uint64_t position = static_cast<uint64_t>(out.tellp());
+      out.write(padding.data(), static_cast<std::streamsize>(table[i].offset - position));
+      out.write(reinterpret_cast<const char*>(sorted[i]->data.data()), static_cast<std::streamsize>(sorted[i]->data.size()));
+    }
+
+    if (!out)
+    {
+      std::cerr << "WARNING: Failed to write asset archive " << temporaryPath << std::endl;
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error)
+  {
+    std::cerr << "WARNING: Failed to replace asset archive " << path << ": " << error.message() << std::endl;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Packs the assets the application loads into one file, so that a cold
+// start opens and maps a single file instead of one per asset:
+//
+//   AssetArchiveHeader
+//   AssetArchiveEntry[entryCount], sorted by name
+//   names, not null terminated
+//   entry payloads, each aligned to ASSET_ARCHIVE_ALIGNMENT
+//
+// Entries are named by the path they are loaded from, with forward slashes.
+// Each is stored as it is or compressed with LZ4, whichever the packer found
+// worth it. Stored entries are read straight from the mapping; the page
+// alignment keeps them aligned for any use, staging copies included, and
+// lets each be paged in on its own. All values are little endian.
+//
+// Every entry also records the size, hash and write time of the loose file
+// it was packed from, so that an archive older than the files next to it
+// can be noticed.
+
+const uint32_t ASSET_ARCHIVE_MAGIC = 0x4b504752; // "RGPK"
+const uint32_t ASSET_ARCHIVE_VERSION = 2;
+const uint64_t ASSET_ARCHIVE_ALIGNMENT = 4096;
+
+enum class AssetCompression : uint32_t
+{
+  None = 0,
+  Lz4 = 1
+};
+
+struct AssetArchiveHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t nameBytes;
+};
+
+struct AssetArchiveEntry
+{
+  uint32_t nameOffset;
+  uint32_t nameLength;
+  AssetCompression compression;
+  uint32_t reserved;
+  uint64_t offset;
+  uint64_t storedSize;
+  uint64_t size;
+  // xxhash64 of the uncompressed data, checked after decompressing
+  uint64_t hash;
+  // Write time of the loose file, in ticks of std::filesystem's clock
+  int64_t sourceWriteTime;
+};
+
+// An asset's bytes, pointing into a mapping or into its own storage when it
+// had to be decompressed
+class Asset
+{
+public:
+  const uint8_t* data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  friend class AssetArchive;
+  friend Asset loadLooseAsset(const std::string& path, FileAccess access);
+
+  const uint8_t* bytes = nullptr;
+  size_t length = 0;
+  MappedFile file;
+  std::vector<uint8_t> storage;
+};
+
+// Maps a loose file, throws if it cannot
+Asset loadLooseAsset(const std::string& path, FileAccess access = FileAccess::Sequential);
+
+class AssetArchive
+{
+public:
+  // Maps the archive and validates its table of contents. Returns false if
+  // it is missing or malformed.
+  bool open(const std::string& path);
+  void close();
+
+  bool isOpen() const { return file.isOpen(); }
+  bool contains(const std::string& name) const { return findEntry(name) != nullptr; }
+  std::vector<std::string> getNames() const;
+
+  // Returns the named asset, or throws if it is missing or fails to
+  // decompress. Stored assets reference the mapping and must not outlive
+  // the archive. Safe to call from several threads at once.
+  Asset load(const std::string& name) const;
+
+  // Whether the loose file the named asset was packed from has changed
+  // since. Only reads the file when its size matches but its write time
+  // does not; a missing loose file is not stale.
+  bool isStale(const std::string& name) const;
+
+private:
+  const AssetArchiveEntry* findEntry(const std::string& name) const;
+  std::string getName(const AssetArchiveEntry& entry) const;
+
+  std::string path;
+  MappedFile file;
+  std::vector<AssetArchiveEntry> entries;
+  const char* names = nullptr;
+};
+
+class AssetArchiveWriter
+{
+public:
+  // Reads the loose file at path into the archive under the same name,
+  // returns false if it cannot be read
+  bool addFile(const std::string& path);
+
+  // Writes to a temporary file first so a partially written archive is never picked up
+  bool write(const std::string& path) const;
+
+private:
+  struct PendingEntry
+  {
+    std::string name;
+    AssetCompression compression;
+    std::vector<uint8_t> data;
+    uint64_t size;
+    uint64_t hash;
+    int64_t sourceWriteTime;
+  };
+
+  std::vector<PendingEntry> pending;
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using BenchmarkClock = std::chrono::steady_clock;
+
+inline double elapsedMilliseconds(BenchmarkClock::time_point start, BenchmarkClock::time_point end)
+{
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// Restores a stream's flags and precision when it goes out of scope, so that
+// a log line switching to fixed notation does not change every later one
+class StreamFormatGuard
+{
+public:
+  explicit StreamFormatGuard(std::ostream& stream)
+    : stream(stream), flags(stream.flags()), precision(stream.precision())
+  {
+  }
+
+  ~StreamFormatGuard()
+  {
+    stream.flags(flags);
+    stream.precision(precision);
+  }
+
+  StreamFormatGuard(const StreamFormatGuard&) = delete;
+  StreamFormatGuard& operator=(const StreamFormatGuard&) = delete;
+
+private:
+  std::ostream& stream;
+  std::ios_base::fmtflags flags;
+  std::streamsize precision;
+};
+
+struct TimingSummary
+{
+  size_t count = 0;
+  double min = 0.0;
+  double median = 0.0;
+  double p99 = 0.0;
+  double max = 0.0;
+  double mean = 0.0;
+};
+
+// Nearest-rank percentiles; the samples are taken by value because they get sorted
+inline TimingSummary summarizeTimings(std::vector<double> samples)
+{
+  TimingSummary summary = {};
+  if (samples.empty())
+  {
+    return summary;
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  auto percentile = [&samples](double p)
+  {
+    size_t rank = static_cast<size_t>(p * static_cast<double>(samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+  };
+
+  double total = 0.0;
+  for (double sample : samples)
+  {
+    total += sample;
+  }
+
+  summary.count = samples.size();
+  summary.min = samples.front();
+  summary.median = percentile(0.5);
+  summary.p99 = percentile(0.99);
+  summary.max = samples.back();
+  summary.mean = total / static_cast<double>(samples.size());
+
+  return summary;
+}
+
+inline void printTimingSummary(const std::string& label, const std::vector<double>& samples, const std::string& unit = "ms")
+{
+  if (samples.empty())
+  {
+    std::cerr << "INFO: " << label << ": no samples" << std::endl;
+    return;
+  }
+
+  TimingSummary summary = summarizeTimings(samples);
+  StreamFormatGuard formatGuard(std::cerr);
+  std::cerr << "INFO: " << label << " (" << unit << ", " << summary.count << " samples):"
+    << std::fixed << std::setprecision(3)
+    << " min " << summary.min
+    << " median " << summary.median
+    << " p99 " << summary.p99
+    << " max " << summary.max
+    << std::endl;
+}
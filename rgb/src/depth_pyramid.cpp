@@ -0,0 +1,404 @@
+#include "depth_pyramid.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <stdexcept>
+
+static uint32_t previousPowerOfTwo(uint32_t value)
+{
+  uint32_t result = 1;
+  while (result * 2 <= value)
+  {
+    result *= 2;
+  }
+  return result;
+}
+
+static bool hasStencil(VkFormat format)
+{
+  return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D16_UNORM_S8_UINT;
+}
+
+void DepthPyramid::init(VkDevice device, MemoryAllocator& allocator, VkPipelineCache pipelineCache,
+  const Asset& depthReduceCode, const Asset& levelReduceCode)
+{
+  this->device = device;
+  this->allocator = &allocator;
+
+  std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+  bindings[0].binding = 0;
+  bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  bindings[0].descriptorCount = 1;
+  bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  bindings[1].binding = 1;
+  bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  bindings[1].descriptorCount = 1;
+  bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+  layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+  layoutInfo.pBindings = bindings.data();
+
+  if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &setLayout) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create descriptor set layout!" << std::endl;
+    throw std::runtime_error("Failed to create descriptor set layout!");
+  }
+
+  VkPushConstantRange pushConstantRange = {};
+  pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  pushConstantRange.offset = 0;
+  pushConstantRange.size = sizeof(ReducePushConstants);
+
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+  pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipelineLayoutInfo.setLayoutCount = 1;
+  pipelineLayoutInfo.pSetLayouts = &setLayout;
+  pipelineLayoutInfo.pushConstantRangeCount = 1;
+  pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+  if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create pipeline layout!" << std::endl;
+    throw std::runtime_error("Failed to create pipeline layout!");
+  }
+
+  depthReducePipeline = createPipeline(pipelineCache, depthReduceCode);
+  levelReducePipeline = createPipeline(pipelineCache, levelReduceCode);
+
+  // Reads are texel aligned, so nearest filtering returns exactly one texel
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+  if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create depth pyramid sampler!" << std::endl;
+    throw std::runtime_error("Failed to create depth pyramid sampler!");
+  }
+}
+
+VkPipeline DepthPyramid::createPipeline(VkPipelineCache pipelineCache, const Asset& code)
+{
+  VkShaderModuleCreateInfo moduleInfo = {};
+  moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  moduleInfo.codeSize = code.size();
+  moduleInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+  VkShaderModule shaderModule;
+  if (vkCreateShaderModule(device, &moduleInfo, nullptr, &shaderModule) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create shader module!" << std::endl;
+    throw std::runtime_error("Failed to create shader module!");
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo = {};
+  pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipelineInfo.stage.module = shaderModule;
+  pipelineInfo.stage.pName = "main";
+  pipelineInfo.layout = pipelineLayout;
+
+  VkPipeline pipeline;
+  VkResult result = vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline);
+  vkDestroyShaderModule(device, shaderModule, nullptr);
+  if (result != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create compute pipeline!" << std::endl;
+    throw std::runtime_error("Failed to create compute pipeline!");
+  }
+
+  return pipeline;
+}
+
+void DepthPyramid::destroy()
+{
+  release();
+
+  vkDestroySampler(device, sampler, nullptr);
+  vkDestroyPipeline(device, levelReducePipeline, nullptr);
+  vkDestroyPipeline(device, depthReducePipeline, nullptr);
+  vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+  vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+}
+
+void DepthPyramid::create(VkImage depthImage, VkImageView depthView, VkFormat depthFormat, VkSampleCountFlagBits samples, VkExtent2D extent)
+{
+  release();
+
+  this->depthImage = depthImage;
+  depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT | (hasStencil(depthFormat) ? VK_IMAGE_ASPECT_STENCIL_BIT : 0);
+  depthExtent = extent;
+  depthSamples = samples;
+
+  width = previousPowerOfTwo(extent.width);
+  height = previousPowerOfTwo(extent.height);
+  uint32_t levelCount = 1;
+  while ((std::max(width, height) >> levelCount) != 0)
+  {
+    ++levelCount;
+  }
+
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.format = VK_FORMAT_R32_SFLOAT;
+  imageInfo.extent = {width, height, 1};
+  imageInfo.mipLevels = levelCount;
+  imageInfo.arrayLayers = 1;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create depth pyramid!" << std::endl;
+    throw std::runtime_error("Failed to create depth pyramid!");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(device, image, &memRequirements);
+  memory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ResourceLayout::Optimal);
+  vkBindImageMemory(device, image, memory.memory, memory.offset);
+
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = VK_FORMAT_R32_SFLOAT;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = levelCount;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create depth pyramid view!" << std::endl;
+    throw std::runtime_error("Failed to create depth pyramid view!");
+  }
+
+  levelViews.resize(levelCount);
+  for (uint32_t level = 0; level < levelCount; ++level)
+  {
+    viewInfo.subresourceRange.baseMipLevel = level;
+    viewInfo.subresourceRange.levelCount = 1;
+    if (vkCreateImageView(device, &viewInfo, nullptr, &levelViews[level]) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create depth pyramid view!" << std::endl;
+      throw std::runtime_error("Failed to create depth pyramid view!");
+    }
+  }
+
+  std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+  poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+  poolSizes[0].descriptorCount = levelCount;
+  poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+  poolSizes[1].descriptorCount = levelCount;
+
+  VkDescriptorPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+  poolInfo.pPoolSizes = poolSizes.data();
+  poolInfo.maxSets = levelCount;
+
+  if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create descriptor pool!" << std::endl;
+    throw std::runtime_error("Failed to create descriptor pool!");
+  }
+
+  std::vector<VkDescriptorSetLayout> layouts(levelCount, setLayout);
+  VkDescriptorSetAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  allocInfo.descriptorPool = descriptorPool;
+  allocInfo.descriptorSetCount = levelCount;
+  allocInfo.pSetLayouts = layouts.data();
+
+  levelSets.resize(levelCount);
+  if (vkAllocateDescriptorSets(device, &allocInfo, levelSets.data()) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to allocate descriptor sets!" << std::endl;
+    throw std::runtime_error("Failed to allocate descriptor sets!");
+  }
+
+  for (uint32_t level = 0; level < levelCount; ++level)
+  {
+    VkDescriptorImageInfo sourceInfo = {};
+    sourceInfo.sampler = sampler;
+    sourceInfo.imageView = level == 0 ? depthView : levelViews[level - 1];
+    sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+    VkDescriptorImageInfo targetInfo = {};
+    targetInfo.imageView = levelViews[level];
+    targetInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[0].dstSet = levelSets[level];
+    descriptorWrites[0].dstBinding = 0;
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[0].descriptorCount = 1;
+    descriptorWrites[0].pImageInfo = &sourceInfo;
+
+    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrites[1].dstSet = levelSets[level];
+    descriptorWrites[1].dstBinding = 1;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[1].descriptorCount = 1;
+    descriptorWrites[1].pImageInfo = &targetInfo;
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+  }
+}
+
+void DepthPyramid::release()
+{
+  if (image == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  // Destroying the pool frees the sets allocated from it
+  vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+  levelSets.clear();
+  for (auto levelView : levelViews)
+  {
+    vkDestroyImageView(device, levelView, nullptr);
+  }
+  levelViews.clear();
+  vkDestroyImageView(device, view, nullptr);
+  vkDestroyImage(device, image, nullptr);
+  allocator->free(memory);
+
+  image = VK_NULL_HANDLE;
+  view = VK_NULL_HANDLE;
+  descriptorPool = VK_NULL_HANDLE;
+}
+
+void DepthPyramid::recordClear(VkCommandBuffer commandBuffer)
+{
+  VkImageSubresourceRange range = {};
+  range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  range.baseMipLevel = 0;
+  range.levelCount = getLevelCount();
+  range.baseArrayLayer = 0;
+  range.layerCount = 1;
+
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange = range;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+    0, nullptr,
+    0, nullptr,
+    1, &barrier);
+
+  VkClearColorValue farPlane = {};
+  farPlane.float32[0] = 1.0f;
+  vkCmdClearColorImage(commandBuffer, image, VK_IMAGE_LAYOUT_GENERAL, &farPlane, 1, &range);
+
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+    0, nullptr,
+    0, nullptr,
+    1, &barrier);
+}
+
+void DepthPyramid::record(VkCommandBuffer commandBuffer)
+{
+  // The depth buffer becomes readable, and the pyramid's old contents are
+  // discarded once the culling that read them is done
+  std::array<VkImageMemoryBarrier, 2> barriers = {};
+  barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[0].image = depthImage;
+  barriers[0].subresourceRange = {depthAspect, 0, 1, 0, 1};
+  barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+  barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+  barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barriers[1].image = image;
+  barriers[1].subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, getLevelCount(), 0, 1};
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barriers[1].srcAccessMask = 0;
+  barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+    0, nullptr,
+    0, nullptr,
+    static_cast<uint32_t>(barriers.size()), barriers.data());
+
+  uint32_t sourceWidth = depthExtent.width;
+  uint32_t sourceHeight = depthExtent.height;
+  for (uint32_t level = 0; level < getLevelCount(); ++level)
+  {
+    const uint32_t levelWidth = std::max(1u, width >> level);
+    const uint32_t levelHeight = std::max(1u, height >> level);
+
+    ReducePushConstants constants = {};
+    constants.sourceWidth = static_cast<int32_t>(sourceWidth);
+    constants.sourceHeight = static_cast<int32_t>(sourceHeight);
+    constants.width = static_cast<int32_t>(levelWidth);
+    constants.height = static_cast<int32_t>(levelHeight);
+    constants.sampleCount = level == 0 ? static_cast<int32_t>(depthSamples) : 1;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, level == 0 ? depthReducePipeline : levelReducePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &levelSets[level], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    vkCmdDispatch(commandBuffer, (levelWidth + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, (levelHeight + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1);
+
+    // The next level reads this one, and the last one is read by culling
+    VkImageMemoryBarrier levelBarrier = {};
+    levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    levelBarrier.image = image;
+    levelBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1};
+    levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+      0, nullptr,
+      0, nullptr,
+      1, &levelBarrier);
+
+    sourceWidth = levelWidth;
+    sourceHeight = levelHeight;
+  }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "asset_archive.h"
+#include "memory_allocator.h"
+
+// Hierarchical depth buffer for occlusion culling. Level 0 is the largest
+// power of two that fits into the depth buffer, every texel holding the
+// farthest depth of the depth buffer texels and samples it covers, and each
+// further level halves the one before it the same way.
+//
+// An object whose nearest depth lies behind the farthest depth of the
+// pyramid texels its screen rectangle touches is hidden. The pyramid is
+// built from the depth buffer of the frame just drawn, so culling tests
+// against the previous frame.
+class DepthPyramid
+{
+public:
+  // Matches local_size_x and local_size_y in depth_reduce.comp
+  static const uint32_t WORKGROUP_SIZE = 8;
+
+  // depthReduceCode must be the multisampled variant of depth_reduce.comp
+  // if the depth buffer is multisampled; levelReduceCode is always the
+  // single sampled variant
+  void init(VkDevice device, MemoryAllocator& allocator, VkPipelineCache pipelineCache,
+    const Asset& depthReduceCode, const Asset& levelReduceCode);
+  void destroy();
+
+  // Creates the pyramid for a depth buffer, which must have been created
+  // with VK_IMAGE_USAGE_SAMPLED_BIT. Call release() and create() again
+  // whenever the depth buffer is recreated.
+  void create(VkImage depthImage, VkImageView depthView, VkFormat depthFormat, VkSampleCountFlagBits samples, VkExtent2D extent);
+  void release();
+
+  // Clears every level to the far plane, so that nothing is culled until
+  // the first build, and leaves the pyramid in VK_IMAGE_LAYOUT_GENERAL
+  void recordClear(VkCommandBuffer commandBuffer);
+
+  // Builds the pyramid after the render pass. The depth buffer must be in
+  // VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL and is left in
+  // VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL. The pyramid can be
+  // sampled by compute shaders recorded afterwards.
+  void record(VkCommandBuffer commandBuffer);
+
+  // All levels in VK_IMAGE_LAYOUT_GENERAL, to be sampled with getSampler()
+  VkImageView getView() const { return view; }
+  VkSampler getSampler() const { return sampler; }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  uint32_t getLevelCount() const { return static_cast<uint32_t>(levelViews.size()); }
+
+private:
+  struct ReducePushConstants
+  {
+    int32_t sourceWidth;
+    int32_t sourceHeight;
+    int32_t width;
+    int32_t height;
+    int32_t sampleCount;
+  };
+
+  VkPipeline createPipeline(VkPipelineCache pipelineCache, const Asset& code);
+
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+
+  VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+  VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+  VkPipeline depthReducePipeline = VK_NULL_HANDLE;
+  VkPipeline levelReducePipeline = VK_NULL_HANDLE;
+  VkSampler sampler = VK_NULL_HANDLE;
+
+  VkImage depthImage = VK_NULL_HANDLE;
+  VkImageAspectFlags depthAspect = 0;
+  VkExtent2D depthExtent = {};
+  VkSampleCountFlagBits depthSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkImage image = VK_NULL_HANDLE;
+  Allocation memory;
+  VkImageView view = VK_NULL_HANDLE;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<VkImageView> levelViews;
+  VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+  // Set i reduces into level i, reading the depth buffer or level i - 1
+  std::vector<VkDescriptorSet> levelSets;
+};
@@ -0,0 +1,231 @@
+#include "frame_scheduler.h"
+
+#include <iostream>
+#include <stdexcept>
+
+// Waits are split into slices this long, so that a GPU that stopped making
+// progress shows up in the log instead of hanging silently
+static const uint64_t FRAME_WAIT_TIMEOUT_NS = 5000000000ull;
+
+void FrameScheduler::init(VkDevice device, bool timelineSemaphores, uint32_t framesInFlight, FramePacing pacing)
+{
+  this->device = device;
+  this->framesInFlight = framesInFlight;
+  this->pacing = pacing;
+
+  if (framesInFlight == 0 || framesInFlight > MAX_FRAMES_IN_FLIGHT)
+  {
+    std::cerr << "ERROR: Unsupported number of frames in flight: " << framesInFlight << std::endl;
+    throw std::runtime_error("Unsupported number of frames in flight!");
+  }
+
+  if (timelineSemaphores)
+  {
+    waitSemaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR"));
+    getSemaphoreCounterValue = reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR"));
+  }
+
+  if (waitSemaphores != nullptr && getSemaphoreCounterValue != nullptr)
+  {
+    VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create frame timeline semaphore!" << std::endl;
+      throw std::runtime_error("Failed to create frame timeline semaphore!");
+    }
+  }
+  else
+  {
+    // Signaled, so the first frames using each slot do not wait
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    fences.resize(framesInFlight, VK_NULL_HANDLE);
+    for (VkFence& fence : fences)
+    {
+      if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+      {
+        std::cerr << "ERROR: Failed to create frame fence!" << std::endl;
+        throw std::runtime_error("Failed to create frame fence!");
+      }
+    }
+  }
+}
+
+void FrameScheduler::destroy()
+{
+  if (device == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  waitIdle();
+
+  if (timeline != VK_NULL_HANDLE)
+  {
+    vkDestroySemaphore(device, timeline, nullptr);
+    timeline = VK_NULL_HANDLE;
+  }
+  for (VkFence fence : fences)
+  {
+    vkDestroyFence(device, fence, nullptr);
+  }
+  fences.clear();
+  pendingFrames.clear();
+  device = VK_NULL_HANDLE;
+}
+
+void FrameScheduler::beginFrame()
+{
+  auto waitStart = BenchmarkClock::now();
+
+  retireFrames();
+  if (pacing == FramePacing::Latency)
+  {
+    waitForFrame(frameNumber - 1);
+  }
+  else if (frameNumber > framesInFlight)
+  {
+    waitForFrame(frameNumber - framesInFlight);
+  }
+  retireFrames();
+
+  inputTime = BenchmarkClock::now();
+  waitTimes.push_back(elapsedMilliseconds(waitStart, inputTime));
+}
+
+VkFence FrameScheduler::prepareSubmit(VkSubmitInfo& submitInfo)
+{
+  if (timeline == VK_NULL_HANDLE)
+  {
+    VkFence fence = fences[getFrameIndex()];
+    vkResetFences(device, 1, &fence);
+    return fence;
+  }
+
+  // Binary semaphores ignore their value
+  signalSemaphores.assign(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+  signalValues.assign(submitInfo.signalSemaphoreCount, 0);
+  signalSemaphores.push_back(timeline);
+  signalValues.push_back(frameNumber);
+
+  timelineSubmitInfo = {};
+  timelineSubmitInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timelineSubmitInfo.pNext = submitInfo.pNext;
+  timelineSubmitInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+  timelineSubmitInfo.pSignalSemaphoreValues = signalValues.data();
+
+  submitInfo.pNext = &timelineSubmitInfo;
+  submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+  submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+  return VK_NULL_HANDLE;
+}
+
+void FrameScheduler::endFrame()
+{
+  pendingFrames.push_back({frameNumber, inputTime});
+  ++frameNumber;
+}
+
+void FrameScheduler::waitIdle()
+{
+  waitForFrame(frameNumber - 1);
+  retireFrames();
+}
+
+void FrameScheduler::clearStatistics()
+{
+  waitTimes.clear();
+  latencies.clear();
+}
+
+uint64_t FrameScheduler::getCompletedFrame()
+{
+  if (timeline != VK_NULL_HANDLE)
+  {
+    uint64_t value = 0;
+    if (getSemaphoreCounterValue(device, timeline, &value) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to read frame timeline semaphore!" << std::endl;
+      throw std::runtime_error("Failed to read frame timeline semaphore!");
+    }
+    return value;
+  }
+
+  // A pending frame is always the last one submitted with its fence, because
+  // a slot is only reused once its previous frame has completed
+  uint64_t completed = frameNumber - 1 - pendingFrames.size();
+  for (const PendingFrame& pending : pendingFrames)
+  {
+    if (vkGetFenceStatus(device, fences[pending.frameNumber % framesInFlight]) != VK_SUCCESS)
+    {
+      break;
+    }
+    completed = pending.frameNumber;
+  }
+  return completed;
+}
+
+void FrameScheduler::waitForFrame(uint64_t frame)
+{
+  if (pendingFrames.empty() || frame < pendingFrames.front().frameNumber)
+  {
+    return;
+  }
+
+  for (;;)
+  {
+    VkResult result;
+    if (timeline != VK_NULL_HANDLE)
+    {
+      VkSemaphoreWaitInfoKHR waitInfo = {};
+      waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+      waitInfo.semaphoreCount = 1;
+      waitInfo.pSemaphores = &timeline;
+      waitInfo.pValues = &frame;
+      result = waitSemaphores(device, &waitInfo, FRAME_WAIT_TIMEOUT_NS);
+    }
+    else
+    {
+      result = vkWaitForFences(device, 1, &fences[frame % framesInFlight], VK_TRUE, FRAME_WAIT_TIMEOUT_NS);
+    }
+
+    if (result == VK_SUCCESS)
+    {
+      return;
+    }
+    if (result != VK_TIMEOUT)
+    {
+      std::cerr << "ERROR: Failed to wait for frame " << frame << "!" << std::endl;
+      throw std::runtime_error("Failed to wait for frame!");
+    }
+    std::cerr << "WARNING: Frame " << frame << " has not completed after "
+      << FRAME_WAIT_TIMEOUT_NS / 1000000 << " ms, still waiting" << std::endl;
+  }
+}
+
+void FrameScheduler::retireFrames()
+{
+  if (pendingFrames.empty())
+  {
+    return;
+  }
+
+  uint64_t completed = getCompletedFrame();
+  auto now = BenchmarkClock::now();
+  while (!pendingFrames.empty() && pendingFrames.front().frameNumber <= completed)
+  {
+    latencies.push_back(elapsedMilliseconds(pendingFrames.front().inputTime, now));
+    pendingFrames.pop_front();
+  }
+}
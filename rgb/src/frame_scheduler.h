@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "benchmark.h"
+
+enum class FramePacing
+{
+  // Keeps up to framesInFlight frames queued on the GPU, so the CPU only
+  // waits when it gets that far ahead
+  Throughput,
+  // Starts a frame only once the GPU has finished the previous one, so the
+  // input sampled for a frame is at most one frame old when it is drawn
+  Latency
+};
+
+// Paces the CPU against the graphics queue. Frames are numbered from 1 and
+// every submit signals a timeline semaphore with its frame number, so frame n
+// may reuse its per-frame resources once the semaphore reaches
+// n - framesInFlight. Without VK_KHR_timeline_semaphore it falls back to one
+// fence per frame in flight.
+//
+// beginFrame() marks the moment the frame samples its input. The time from
+// there until the CPU sees the frame complete is recorded as its latency, and
+// the time beginFrame() spends blocked as its CPU wait. The present itself is
+// not observable without VK_GOOGLE_display_timing, so latency ends where the
+// GPU finishes the frame, which is when the image is queued for presentation.
+class FrameScheduler
+{
+public:
+  static const uint32_t MAX_FRAMES_IN_FLIGHT = 4;
+
+  // timelineSemaphores must only be set if the device was created with the
+  // timelineSemaphore feature of VK_KHR_timeline_semaphore enabled
+  void init(VkDevice device, bool timelineSemaphores, uint32_t framesInFlight, FramePacing pacing);
+  // Waits for every submitted frame
+  void destroy();
+
+  uint32_t getFramesInFlight() const { return framesInFlight; }
+  bool usesTimelineSemaphore() const { return timeline != VK_NULL_HANDLE; }
+
+  FramePacing getPacing() const { return pacing; }
+  void setPacing(FramePacing pacing) { this->pacing = pacing; }
+
+  // Index of the per-frame resources the current frame uses
+  uint32_t getFrameIndex() const { return static_cast<uint32_t>(frameNumber % framesInFlight); }
+  // The current frame's number. Once frame n has begun, every frame before
+  // n - framesInFlight has completed.
+  uint64_t getFrameNumber() const { return frameNumber; }
+
+  // Blocks until the current frame's resources are free, or in Latency mode
+  // until every earlier frame is complete. May be called again for the same
+  // frame if it is abandoned before its submit.
+  void beginFrame();
+
+  // Adds what signals the end of the current frame to submitInfo and returns
+  // the fence to submit with, VK_NULL_HANDLE with a timeline semaphore. The
+  // arrays submitInfo points to stay valid until the next call.
+  VkFence prepareSubmit(VkSubmitInfo& submitInfo);
+
+  // Must follow the submit prepared by prepareSubmit()
+  void endFrame();
+
+  // Waits for every submitted frame
+  void waitIdle();
+
+  // In milliseconds, one sample per frame since the last clearStatistics()
+  const std::vector<double>& getWaitTimes() const { return waitTimes; }
+  const std::vector<double>& getLatencies() const { return latencies; }
+  void clearStatistics();
+
+private:
+  struct PendingFrame
+  {
+    uint64_t frameNumber;
+    BenchmarkClock::time_point inputTime;
+  };
+
+  uint64_t getCompletedFrame();
+  void waitForFrame(uint64_t frame);
+  // Records the latency of every pending frame that has completed by now
+  void retireFrames();
+
+  VkDevice device = VK_NULL_HANDLE;
+  uint32_t framesInFlight = 0;
+  FramePacing pacing = FramePacing::Throughput;
+
+  VkSemaphore timeline = VK_NULL_HANDLE;
+  PFN_vkWaitSemaphoresKHR waitSemaphores = nullptr;
+  PFN_vkGetSemaphoreCounterValueKHR getSemaphoreCounterValue = nullptr;
+  std::vector<VkFence> fences;
+
+  // The frame being recorded; the timeline semaphore starts at 0, meaning no
+  // frame has completed
+  uint64_t frameNumber = 1;
+  BenchmarkClock::time_point inputTime;
+  std::deque<PendingFrame> pendingFrames;
+
+  std::vector<VkSemaphore> signalSemaphores;
+  std::vector<uint64_t> signalValues;
+  VkTimelineSemaphoreSubmitInfoKHR timelineSubmitInfo = {};
+
+  std::vector<double> waitTimes;
+  std::vector<double> latencies;
+};
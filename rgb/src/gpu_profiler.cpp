@@ -0,0 +1,369 @@
+#include "gpu_profiler.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "benchmark.h"
+
+static const uint32_t PIPELINE_STATISTIC_COUNT = 6;
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice device, bool hostQueryReset, bool pipelineStatistics)
+{
+  this->physicalDevice = physicalDevice;
+  this->device = device;
+
+  if (hostQueryReset)
+  {
+    resetQueryPool = reinterpret_cast<PFN_vkResetQueryPoolEXT>(vkGetDeviceProcAddr(device, "vkResetQueryPoolEXT"));
+  }
+
+  // Results come back in bit order, which is the order of GpuPipelineStatistics
+  pipelineStatisticFlags = pipelineStatistics
+    ? VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+      | VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+      | VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+      | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT
+      | VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+      | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+    : 0;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  timestampPeriod = properties.limits.timestampPeriod;
+}
+
+void GpuProfiler::destroy()
+{
+  for (const Slot& slot : slots)
+  {
+    if (slot.timestampPool != VK_NULL_HANDLE)
+    {
+      vkDestroyQueryPool(device, slot.timestampPool, nullptr);
+    }
+    if (slot.statisticsPool != VK_NULL_HANDLE)
+    {
+      vkDestroyQueryPool(device, slot.statisticsPool, nullptr);
+    }
+  }
+  slots.clear();
+}
+
+uint32_t GpuProfiler::createSlot(uint32_t queueFamilyIndex, const std::string& trackName)
+{
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+  const VkQueueFamilyProperties& family = queueFamilies[queueFamilyIndex];
+
+  Slot slot = {};
+  slot.trackName = trackName;
+  slot.timestampMask = family.timestampValidBits >= 64 ? ~0ull : (1ull << family.timestampValidBits) - 1;
+  slot.timestampPool = VK_NULL_HANDLE;
+  slot.statisticsPool = VK_NULL_HANDLE;
+
+  // vkCmdResetQueryPool needs a graphics or compute queue
+  const bool queueCanReset = (family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) != 0;
+  if (family.timestampValidBits == 0 || (!queueCanReset && resetQueryPool == nullptr))
+  {
+    std::cerr << "WARNING: Queue family " << queueFamilyIndex << " cannot use timestamp queries, "
+      << trackName << " work is not profiled" << std::endl;
+    slots.push_back(slot);
+    return static_cast<uint32_t>(slots.size() - 1);
+  }
+
+  VkQueryPoolCreateInfo queryPoolInfo = {};
+  queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  queryPoolInfo.queryCount = 2 * MAX_SCOPES_PER_SLOT;
+
+  if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &slot.timestampPool) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create timestamp query pool!" << std::endl;
+    throw std::runtime_error("Failed to create timestamp query pool!");
+  }
+
+  // Pipeline statistics are graphics state, other queues cannot collect them
+  if (pipelineStatisticFlags != 0 && (family.queueFlags & VK_QUEUE_GRAPHICS_BIT))
+  {
+    queryPoolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    queryPoolInfo.queryCount = MAX_SCOPES_PER_SLOT;
+    queryPoolInfo.pipelineStatistics = pipelineStatisticFlags;
+
+    if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &slot.statisticsPool) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create pipeline statistics query pool!" << std::endl;
+      throw std::runtime_error("Failed to create pipeline statistics query pool!");
+    }
+  }
+
+  slots.push_back(slot);
+  return static_cast<uint32_t>(slots.size() - 1);
+}
+
+void GpuProfiler::beginSlot(uint32_t slotIndex, VkCommandBuffer commandBuffer)
+{
+  Slot& slot = slots[slotIndex];
+  slot.scopes.clear();
+  slot.statisticsCount = 0;
+  slot.pending = false;
+
+  if (slot.timestampPool == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  // The owner has waited for the slot's previous use, so resetting from the
+  // host is safe and works on every queue
+  if (resetQueryPool != nullptr)
+  {
+    resetQueryPool(device, slot.timestampPool, 0, 2 * MAX_SCOPES_PER_SLOT);
+    if (slot.statisticsPool != VK_NULL_HANDLE)
+    {
+      resetQueryPool(device, slot.statisticsPool, 0, MAX_SCOPES_PER_SLOT);
+    }
+  }
+  else
+  {
+    vkCmdResetQueryPool(commandBuffer, slot.timestampPool, 0, 2 * MAX_SCOPES_PER_SLOT);
+    if (slot.statisticsPool != VK_NULL_HANDLE)
+    {
+      vkCmdResetQueryPool(commandBuffer, slot.statisticsPool, 0, MAX_SCOPES_PER_SLOT);
+    }
+  }
+
+  slot.pending = true;
+}
+
+uint32_t GpuProfiler::beginScope(uint32_t slotIndex, VkCommandBuffer commandBuffer, const char* name, bool pipelineStatistics)
+{
+  Slot& slot = slots[slotIndex];
+  if (!slot.pending || slot.scopes.size() == MAX_SCOPES_PER_SLOT)
+  {
+    return INVALID_SCOPE;
+  }
+
+  Scope scope = {name, INVALID_SCOPE};
+  uint32_t index = static_cast<uint32_t>(slot.scopes.size());
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.timestampPool, 2 * index);
+
+  if (pipelineStatistics && slot.statisticsPool != VK_NULL_HANDLE)
+  {
+    scope.statisticsQuery = slot.statisticsCount++;
+    vkCmdBeginQuery(commandBuffer, slot.statisticsPool, scope.statisticsQuery, 0);
+  }
+
+  slot.scopes.push_back(scope);
+  return index;
+}
+
+void GpuProfiler::endScope(uint32_t slotIndex, VkCommandBuffer commandBuffer, uint32_t scope)
+{
+  if (scope == INVALID_SCOPE)
+  {
+    return;
+  }
+
+  Slot& slot = slots[slotIndex];
+  if (slot.scopes[scope].statisticsQuery != INVALID_SCOPE)
+  {
+    vkCmdEndQuery(commandBuffer, slot.statisticsPool, slot.scopes[scope].statisticsQuery);
+  }
+  vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, slot.timestampPool, 2 * scope + 1);
+}
+
+const std::vector<GpuScopeResult>& GpuProfiler::collectSlot(uint32_t slotIndex)
+{
+  Slot& slot = slots[slotIndex];
+  slot.results.clear();
+
+  if (!slot.pending || slot.scopes.empty())
+  {
+    slot.pending = false;
+    return slot.results;
+  }
+  slot.pending = false;
+
+  // The fence has signalled, so the results are available without waiting.
+  // Anything else means the command buffer was never submitted.
+  std::vector<uint64_t> timestamps(2 * slot.scopes.size());
+  VkResult result = vkGetQueryPoolResults(device, slot.timestampPool, 0, static_cast<uint32_t>(timestamps.size()),
+    timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS)
+  {
+    return slot.results;
+  }
+
+  std::vector<uint64_t> statistics(slot.statisticsCount * PIPELINE_STATISTIC_COUNT);
+  if (slot.statisticsCount != 0)
+  {
+    result = vkGetQueryPoolResults(device, slot.statisticsPool, 0, slot.statisticsCount,
+      statistics.size() * sizeof(uint64_t), statistics.data(), PIPELINE_STATISTIC_COUNT * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS)
+    {
+      return slot.results;
+    }
+  }
+
+  if (!haveBaseTimestamp)
+  {
+    baseTimestamp = timestamps[0] & slot.timestampMask;
+    haveBaseTimestamp = true;
+  }
+
+  for (size_t i = 0; i < slot.scopes.size(); ++i)
+  {
+    const Scope& scope = slot.scopes[i];
+    uint64_t begin = timestamps[2 * i] & slot.timestampMask;
+    uint64_t end = timestamps[2 * i + 1] & slot.timestampMask;
+
+    GpuScopeResult scopeResult = {};
+    scopeResult.name = scope.name;
+    scopeResult.startMilliseconds = static_cast<double>(static_cast<int64_t>(begin - baseTimestamp)) * timestampPeriod / 1e6;
+    scopeResult.durationMilliseconds = static_cast<double>((end - begin) & slot.timestampMask) * timestampPeriod / 1e6;
+    scopeResult.hasStatistics = scope.statisticsQuery != INVALID_SCOPE;
+    if (scopeResult.hasStatistics)
+    {
+      const uint64_t* values = &statistics[scope.statisticsQuery * PIPELINE_STATISTIC_COUNT];
+      scopeResult.statistics.inputAssemblyVertices = values[0];
+      scopeResult.statistics.inputAssemblyPrimitives = values[1];
+      scopeResult.statistics.vertexShaderInvocations = values[2];
+      scopeResult.statistics.clippingInvocations = values[3];
+      scopeResult.statistics.clippingPrimitives = values[4];
+      scopeResult.statistics.fragmentShaderInvocations = values[5];
+    }
+
+    slot.results.push_back(scopeResult);
+    record(slotIndex, scopeResult);
+  }
+
+  return slot.results;
+}
+
+void GpuProfiler::record(uint32_t slot, const GpuScopeResult& result)
+{
+  auto history = std::find_if(histories.begin(), histories.end(),
+    [&result](const ScopeHistory& entry) { return strcmp(entry.name, result.name) == 0; });
+  if (history == histories.end())
+  {
+    histories.push_back({result.name, {}, {}});
+    history = histories.end() - 1;
+  }
+
+  history->durations.push_back(result.durationMilliseconds);
+  if (history->durations.size() > ROLLING_WINDOW)
+  {
+    history->durations.pop_front();
+  }
+  if (result.hasStatistics)
+  {
+    history->statistics.push_back(result.statistics);
+    if (history->statistics.size() > ROLLING_WINDOW)
+    {
+      history->statistics.pop_front();
+    }
+  }
+
+  if (traceEnabled)
+  {
+    if (traceEvents.size() < MAX_TRACE_EVENTS)
+    {
+      traceEvents.push_back({result.name, slot, result.startMilliseconds, result.durationMilliseconds, result.hasStatistics, result.statistics});
+    }
+    else
+    {
+      traceTruncated = true;
+    }
+  }
+}
+
+void GpuProfiler::printReport() const
+{
+  for (const ScopeHistory& history : histories)
+  {
+    printTimingSummary(std::string("GPU ") + history.name, std::vector<double>(history.durations.begin(), history.durations.end()));
+
+    if (!history.statistics.empty())
+    {
+      GpuPipelineStatistics total;
+      for (const GpuPipelineStatistics& sample : history.statistics)
+      {
+        total.inputAssemblyVertices += sample.inputAssemblyVertices;
+        total.inputAssemblyPrimitives += sample.inputAssemblyPrimitives;
+        total.vertexShaderInvocations += sample.vertexShaderInvocations;
+        total.clippingInvocations += sample.clippingInvocations;
+        total.clippingPrimitives += sample.clippingPrimitives;
+        total.fragmentShaderInvocations += sample.fragmentShaderInvocations;
+      }
+
+      const uint64_t count = history.statistics.size();
+      std::cerr << "INFO:   average of " << count << " samples: "
+        << total.inputAssemblyVertices / count << " vertices, "
+        << total.inputAssemblyPrimitives / count << " primitives, "
+        << total.vertexShaderInvocations / count << " vertex shader invocations, "
+        << total.clippingInvocations / count << " primitives clipped into "
+        << total.clippingPrimitives / count << ", "
+        << total.fragmentShaderInvocations / count << " fragment shader invocations" << std::endl;
+    }
+  }
+}
+
+bool GpuProfiler::writeChromeTrace(const std::string& path) const
+{
+  std::ofstream out(path, std::ios::trunc);
+  if (!out.is_open())
+  {
+    std::cerr << "WARNING: Failed to create GPU trace " << path << std::endl;
+    return false;
+  }
+
+  // Complete events ("X") in microseconds, one thread per slot track
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"GPU\"}}";
+
+  std::vector<std::string> tracks;
+  std::vector<uint32_t> slotTracks(slots.size());
+  for (size_t i = 0; i < slots.size(); ++i)
+  {
+    auto track = std::find(tracks.begin(), tracks.end(), slots[i].trackName);
+    slotTracks[i] = static_cast<uint32_t>(track - tracks.begin());
+    if (track == tracks.end())
+    {
+      tracks.push_back(slots[i].trackName);
+      out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << slotTracks[i]
+        << ",\"args\":{\"name\":\"" << slots[i].trackName << "\"}}";
+    }
+  }
+
+  out.precision(3);
+  out << std::fixed;
+  for (const TraceEvent& event : traceEvents)
+  {
+    out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << slotTracks[event.track]
+      << ",\"ts\":" << event.startMilliseconds * 1000.0 << ",\"dur\":" << event.durationMilliseconds * 1000.0;
+    if (event.hasStatistics)
+    {
+      out << ",\"args\":{\"vertices\":" << event.statistics.inputAssemblyVertices
+        << ",\"primitives\":" << event.statistics.inputAssemblyPrimitives
+        << ",\"vertexShaderInvocations\":" << event.statistics.vertexShaderInvocations
+        << ",\"clippingInvocations\":" << event.statistics.clippingInvocations
+        << ",\"clippingPrimitives\":" << event.statistics.clippingPrimitives
+        << ",\"fragmentShaderInvocations\":" << event.statistics.fragmentShaderInvocations << "}";
+    }
+    out << "}";
+  }
+  out << "\n]}\n";
+
+  if (!out)
+  {
+    std::cerr << "WARNING: Failed to write GPU trace " << path << std::endl;
+    return false;
+  }
+
+  std::cerr << "INFO: Wrote " << traceEvents.size() << " GPU events to " << path
+    << (traceTruncated ? " (truncated)" : "") << std::endl;
+  return true;
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Measures named scopes of GPU work with timestamp queries, and optionally
+// pipeline statistics, without ever waiting for the results.
+//
+// Queries live in slots. A slot is owned by one command buffer that is
+// recorded, submitted and waited for over and over again, such as a frame in
+// flight or an upload batch, so the slots form a ring with the same depth as
+// the work in flight. The owner begins the slot when it starts recording,
+// brackets work with beginScope()/endScope(), and collects the slot once
+// its fence has signalled.
+//
+// Results feed a rolling per-scope report and, if enabled, a trace that
+// chrome://tracing and Perfetto can open.
+struct GpuPipelineStatistics
+{
+  uint64_t inputAssemblyVertices = 0;
+  uint64_t inputAssemblyPrimitives = 0;
+  uint64_t vertexShaderInvocations = 0;
+  uint64_t clippingInvocations = 0;
+  uint64_t clippingPrimitives = 0;
+  uint64_t fragmentShaderInvocations = 0;
+};
+
+struct GpuScopeResult
+{
+  const char* name;
+  // Relative to the first timestamp the profiler read back
+  double startMilliseconds;
+  double durationMilliseconds;
+  bool hasStatistics;
+  GpuPipelineStatistics statistics;
+};
+
+class GpuProfiler
+{
+public:
+  static const uint32_t INVALID_SLOT = ~0u;
+  static const uint32_t INVALID_SCOPE = ~0u;
+  static const uint32_t MAX_SCOPES_PER_SLOT = 16;
+  // Number of recent samples per scope the report covers
+  static const size_t ROLLING_WINDOW = 240;
+  static const size_t MAX_TRACE_EVENTS = 1000000;
+
+  // hostQueryReset is true when VK_EXT_host_query_reset is enabled, which is
+  // the only way to reset queries used on transfer-only queues.
+  // pipelineStatistics is true when the pipelineStatisticsQuery and
+  // inheritedQueries features are enabled.
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, bool hostQueryReset, bool pipelineStatistics);
+  void destroy();
+
+  // Queries on slots of queue families without timestamp support are skipped
+  uint32_t createSlot(uint32_t queueFamilyIndex, const std::string& trackName);
+
+  // Starts measuring into commandBuffer, which must be outside a render
+  // pass. Results of the slot's previous use that were not collected are lost.
+  void beginSlot(uint32_t slot, VkCommandBuffer commandBuffer);
+
+  // Scopes must be begun and ended outside render passes. Only one scope
+  // with pipeline statistics can be open at a time. name must outlive the profiler.
+  uint32_t beginScope(uint32_t slot, VkCommandBuffer commandBuffer, const char* name, bool pipelineStatistics = false);
+  void endScope(uint32_t slot, VkCommandBuffer commandBuffer, uint32_t scope);
+
+  // Reads back the slot's scopes once the GPU has finished its command
+  // buffer. Returns nothing if the slot has no results pending.
+  const std::vector<GpuScopeResult>& collectSlot(uint32_t slot);
+
+  // Pipeline statistics that secondary command buffers executed inside a
+  // measured scope must declare in VkCommandBufferInheritanceInfo
+  VkQueryPipelineStatisticFlags getPipelineStatisticFlags() const { return pipelineStatisticFlags; }
+
+  void setTraceEnabled(bool enabled) { traceEnabled = enabled; }
+
+  // Timing summary of the last ROLLING_WINDOW samples of every scope, and
+  // their average pipeline statistics
+  void printReport() const;
+  bool writeChromeTrace(const std::string& path) const;
+
+private:
+  struct Scope
+  {
+    const char* name;
+    uint32_t statisticsQuery; // INVALID_SCOPE without pipeline statistics
+  };
+
+  struct Slot
+  {
+    std::string trackName;
+    uint64_t timestampMask;
+    VkQueryPool timestampPool;
+    VkQueryPool statisticsPool;
+    std::vector<Scope> scopes;
+    uint32_t statisticsCount;
+    bool pending;
+    std::vector<GpuScopeResult> results;
+  };
+
+  struct ScopeHistory
+  {
+    const char* name;
+    std::deque<double> durations;
+    std::deque<GpuPipelineStatistics> statistics;
+  };
+
+  struct TraceEvent
+  {
+    const char* name;
+    uint32_t track;
+    double startMilliseconds;
+    double durationMilliseconds;
+    bool hasStatistics;
+    GpuPipelineStatistics statistics;
+  };
+
+  void record(uint32_t slot, const GpuScopeResult& result);
+
+  VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+  VkDevice device = VK_NULL_HANDLE;
+  PFN_vkResetQueryPoolEXT resetQueryPool = nullptr;
+  VkQueryPipelineStatisticFlags pipelineStatisticFlags = 0;
+  double timestampPeriod = 1.0;
+
+  std::vector<Slot> slots;
+  std::vector<ScopeHistory> histories;
+  bool haveBaseTimestamp = false;
+  uint64_t baseTimestamp = 0;
+
+  bool traceEnabled = false;
+  std::vector<TraceEvent> traceEvents;
+  bool traceTruncated = false;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// XXH64, used to fingerprint source assets so derived caches can be invalidated
+inline uint64_t xxhash64(const void* input, size_t length, uint64_t seed = 0)
+{
+  const uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+  const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+  const uint64_t PRIME3 = 0x165667B19E3779F9ull;
+  const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+  const uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+  auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+  auto read64 = [](const uint8_t* p) { uint64_t v; memcpy(&v, p, sizeof(v)); return v; };
+  auto read32 = [](const uint8_t* p) { uint32_t v; memcpy(&v, p, sizeof(v)); return v; };
+  auto round = [&](uint64_t acc, uint64_t lane)
+  {
+    acc += lane * PRIME2;
+    acc = rotl(acc, 31);
+    return acc * PRIME1;
+  };
+  auto mergeRound = [&](uint64_t acc, uint64_t lane)
+  {
+    acc ^= round(0, lane);
+    return acc * PRIME1 + PRIME4;
+  };
+
+  const uint8_t* p = static_cast<const uint8_t*>(input);
+  const uint8_t* end = p + length;
+  uint64_t hash;
+
+  if (length >= 32)
+  {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+
+    const uint8_t* limit = end - 32;
+    do
+    {
+      v1 = round(v1, read64(p));
+      v2 = round(v2, read64(p + 8));
+      v3 = round(v3, read64(p + 16));
+      v4 = round(v4, read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+
+    hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+    hash = mergeRound(hash, v1);
+    hash = mergeRound(hash, v2);
+    hash = mergeRound(hash, v3);
+    hash = mergeRound(hash, v4);
+  }
+  else
+  {
+    hash = seed + PRIME5;
+  }
+
+  hash += static_cast<uint64_t>(length);
+
+  while (p + 8 <= end)
+  {
+    hash ^= round(0, read64(p));
+    hash = rotl(hash, 27) * PRIME1 + PRIME4;
+    p += 8;
+  }
+
+  if (p + 4 <= end)
+  {
+    hash ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+    hash = rotl(hash, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+
+  while (p < end)
+  {
+    hash ^= static_cast<uint64_t>(*p) * PRIME5;
+    hash = rotl(hash, 11) * PRIME1;
+    ++p;
+  }
+
+  hash ^= hash >> 33;
+  hash *= PRIME2;
+  hash ^= hash >> 29;
+  hash *= PRIME3;
+  hash ^= hash >> 32;
+
+  return hash;
+}
@@ -0,0 +1,296 @@
+#include "ktx2.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "texture_codec.h"
+
+static_assert(sizeof(Ktx2Header) == 80, "Ktx2Header must match the file layout");
+static_assert(sizeof(Ktx2LevelIndex) == 24, "Ktx2LevelIndex must match the file layout");
+
+// Khronos data format descriptor values for the formats the writer supports
+static const uint32_t KHR_DF_DESCRIPTOR_BLOCK_SIZE = 24 + 16; // basic block with one sample
+static const uint8_t KHR_DF_MODEL_BC7 = 134;
+static const uint8_t KHR_DF_MODEL_ETC2 = 161;
+static const uint8_t KHR_DF_CHANNEL_BC7_COLOR = 0;
+static const uint8_t KHR_DF_CHANNEL_ETC2_COLOR = 2;
+static const uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+static const uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Level data must start at a multiple of both the block size and 4
+static uint64_t getLevelAlignment(VkFormat format)
+{
+  return std::max<uint64_t>(4, getBlockBytes(format));
+}
+
+static uint64_t getExpectedLevelSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level)
+{
+  uint32_t levelWidth = std::max(1u, width >> level);
+  uint32_t levelHeight = std::max(1u, height >> level);
+  return static_cast<uint64_t>((levelWidth + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE)
+    * ((levelHeight + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE) * getBlockBytes(format);
+}
+
+bool Ktx2Texture::open(const std::string& path)
+{
+  close();
+
+  if (!file.open(path, FileAccess::Sequential))
+  {
+    return false;
+  }
+
+  Ktx2Header header;
+  if (file.size() < sizeof(header))
+  {
+    std::cerr << "WARNING: Texture " << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+
+  if (memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+  {
+    std::cerr << "WARNING: Texture " << path << " is not a KTX 2.0 file" << std::endl;
+    close();
+    return false;
+  }
+
+  format = static_cast<VkFormat>(header.vkFormat);
+  bool supported = getBlockBytes(format) != 0
+    && header.pixelWidth != 0 && header.pixelHeight != 0 && header.pixelDepth == 0
+    && header.layerCount == 0 && header.faceCount == 1
+    && header.supercompressionScheme == 0
+    && header.levelCount != 0 && header.levelCount <= 32;
+  if (!supported)
+  {
+    std::cerr << "WARNING: Texture " << path << " uses KTX 2.0 features that are not supported" << std::endl;
+    close();
+    return false;
+  }
+
+  width = header.pixelWidth;
+  height = header.pixelHeight;
+
+  uint64_t indexEnd = sizeof(header) + static_cast<uint64_t>(header.levelCount) * sizeof(Ktx2LevelIndex);
+  if (indexEnd > file.size())
+  {
+    std::cerr << "WARNING: Texture " << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+
+  levels.resize(header.levelCount);
+  memcpy(levels.data(), file.data() + sizeof(header), levels.size() * sizeof(Ktx2LevelIndex));
+
+  for (uint32_t level = 0; level < header.levelCount; level++)
+  {
+    const Ktx2LevelIndex& index = levels[level];
+    bool inBounds = index.byteOffset >= indexEnd && index.byteOffset <= file.size() && index.byteLength <= file.size() - index.byteOffset;
+    if (!inBounds || index.byteLength != getExpectedLevelSize(format, width, height, level) || index.byteOffset % getLevelAlignment(format) != 0)
+    {
+      std::cerr << "WARNING: Texture " << path << " has a malformed level index" << std::endl;
+      close();
+      return false;
+    }
+  }
+
+  if (header.kvdByteOffset > file.size() || header.kvdByteLength > file.size() - header.kvdByteOffset)
+  {
+    std::cerr << "WARNING: Texture " << path << " has malformed key/value data" << std::endl;
+    close();
+    return false;
+  }
+
+  // Each entry is a 4 byte length followed by "key\0value", padded to 4 bytes
+  const uint8_t* kvd = file.data() + header.kvdByteOffset;
+  uint64_t position = 0;
+  while (position + sizeof(uint32_t) <= header.kvdByteLength)
+  {
+    uint32_t length;
+    memcpy(&length, kvd + position, sizeof(length));
+    position += sizeof(length);
+    if (length > header.kvdByteLength - position)
+    {
+      break;
+    }
+
+    const char* entry = reinterpret_cast<const char*>(kvd + position);
+    const char* keyEnd = static_cast<const char*>(memchr(entry, 0, length));
+    if (keyEnd != nullptr)
+    {
+      std::string value(keyEnd + 1, entry + length);
+      if (!value.empty() && value.back() == '\0')
+      {
+        value.pop_back();
+      }
+      values.emplace_back(std::string(entry, keyEnd), value);
+    }
+
+    position = alignUp(position + length, 4);
+  }
+
+  return true;
+}
+
+void Ktx2Texture::close()
+{
+  file.close();
+  format = VK_FORMAT_UNDEFINED;
+  width = 0;
+  height = 0;
+  levels.clear();
+  values.clear();
+}
+
+std::string Ktx2Texture::getValue(const std::string& key) const
+{
+  for (const auto& entry : values)
+  {
+    if (entry.first == key)
+    {
+      return entry.second;
+    }
+  }
+  return std::string();
+}
+
+Ktx2Writer::Ktx2Writer(VkFormat format, uint32_t width, uint32_t height)
+  : format(format), width(width), height(height)
+{
+}
+
+void Ktx2Writer::addLevel(const std::vector<uint8_t>& data)
+{
+  levels.push_back(&data);
+}
+
+void Ktx2Writer::addValue(const std::string& key, const std::string& value)
+{
+  values.emplace_back(key, value);
+}
+
+// Basic descriptor block with a single sample covering the whole texel block
+static std::vector<uint8_t> buildDataFormatDescriptor(VkFormat format)
+{
+  const uint32_t blockBytes = getBlockBytes(format);
+  const bool bc7 = format == VK_FORMAT_BC7_UNORM_BLOCK;
+
+  std::vector<uint8_t> dfd(sizeof(uint32_t) + KHR_DF_DESCRIPTOR_BLOCK_SIZE, 0);
+  auto put32 = [&dfd](size_t offset, uint32_t value) { memcpy(&dfd[offset], &value, sizeof(value)); };
+
+  put32(0, static_cast<uint32_t>(dfd.size()));
+  put32(4, 0); // vendor Khronos, descriptor type basic
+  put32(8, 2 | (KHR_DF_DESCRIPTOR_BLOCK_SIZE << 16)); // version 1.3
+  dfd[12] = bc7 ? KHR_DF_MODEL_BC7 : KHR_DF_MODEL_ETC2;
+  dfd[13] = KHR_DF_PRIMARIES_BT709;
+  dfd[14] = KHR_DF_TRANSFER_LINEAR;
+  dfd[15] = 0; // straight alpha
+  // Texel block dimensions minus one
+  dfd[16] = TEXTURE_BLOCK_SIZE - 1;
+  dfd[17] = TEXTURE_BLOCK_SIZE - 1;
+  dfd[20] = static_cast<uint8_t>(blockBytes);
+
+  // Sample: bit offset, bit length minus one, channel; then position, lower and upper
+  uint32_t channel = bc7 ? KHR_DF_CHANNEL_BC7_COLOR : KHR_DF_CHANNEL_ETC2_COLOR;
+  put32(28, 0 | ((blockBytes * 8 - 1) << 16) | (channel << 24));
+  put32(36, 0);
+  put32(40, 0xFFFFFFFFu);
+
+  return dfd;
+}
+
+bool Ktx2Writer::write(const std::string& path) const
+{
+  // Keys have to be sorted by their bytes
+  std::vector<std::pair<std::string, std::string>> sortedValues = values;
+  std::sort(sortedValues.begin(), sortedValues.end());
+
+  std::vector<uint8_t> kvd;
+  for (const auto& entry : sortedValues)
+  {
+    uint32_t length = static_cast<uint32_t>(entry.first.size() + 1 + entry.second.size() + 1);
+    size_t offset = kvd.size();
+    kvd.resize(alignUp(offset + sizeof(length) + length, 4), 0);
+    memcpy(&kvd[offset], &length, sizeof(length));
+    memcpy(&kvd[offset + sizeof(length)], entry.first.c_str(), entry.first.size() + 1);
+    memcpy(&kvd[offset + sizeof(length) + entry.first.size() + 1], entry.second.c_str(), entry.second.size() + 1);
+  }
+
+  const std::vector<uint8_t> dfd = buildDataFormatDescriptor(format);
+
+  Ktx2Header header = {};
+  memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+  header.vkFormat = static_cast<uint32_t>(format);
+  header.typeSize = 1;
+  header.pixelWidth = width;
+  header.pixelHeight = height;
+  header.faceCount = 1;
+  header.levelCount = static_cast<uint32_t>(levels.size());
+  header.dfdByteOffset = static_cast<uint32_t>(sizeof(header) + levels.size() * sizeof(Ktx2LevelIndex));
+  header.dfdByteLength = static_cast<uint32_t>(dfd.size());
+  header.kvdByteOffset = kvd.empty() ? 0 : header.dfdByteOffset + header.dfdByteLength;
+  header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+  // The smallest level comes first in the file so a streaming reader can
+  // show something before the large levels have arrived
+  std::vector<Ktx2LevelIndex> index(levels.size());
+  uint64_t offset = header.dfdByteOffset + header.dfdByteLength + header.kvdByteLength;
+  for (size_t level = levels.size(); level-- > 0;)
+  {
+    offset = alignUp(offset, getLevelAlignment(format));
+    index[level].byteOffset = offset;
+    index[level].byteLength = levels[level]->size();
+    index[level].uncompressedByteLength = levels[level]->size();
+    offset += levels[level]->size();
+  }
+
+  const std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+      std::cerr << "WARNING: Failed to create texture " << temporaryPath << std::endl;
+      return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(Ktx2LevelIndex)));
+    out.write(reinterpret_cast<const char*>(dfd.data()), static_cast<std::streamsize>(dfd.size()));
+    out.write(reinterpret_cast<const char*>(kvd.data()), static_cast<std::streamsize>(kvd.size()));
+
+    uint64_t written = header.dfdByteOffset + header.dfdByteLength + header.kvdByteLength;
+    for (size_t level = levels.size(); level-- > 0;)
+    {
+      static const char padding[16] = {};
+      out.write(padding, static_cast<std::streamsize>(index[level].byteOffset - written));
+      out.write(reinterpret_cast<const char*>(levels[level]->data()), static_cast<std::streamsize>(levels[level]->size()));
+      written = index[level].byteOffset + index[level].byteLength;
+    }
+
+    if (!out)
+    {
+      std::cerr << "WARNING: Failed to write texture " << temporaryPath << std::endl;
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error)
+  {
+    std::cerr << "WARNING: Failed to replace texture " << path << ": " << error.message() << std::endl;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "mapped_file.h"
+
+// Minimal KTX 2.0 support for single layer, single face 2D textures without
+// supercompression, which is all the texture cache needs:
+//
+//   identifier, header and index
+//   level index, level 0 first
+//   data format descriptor
+//   key/value data
+//   mip levels, smallest first, each aligned to the texel block size
+//
+// Files are memory mapped so level data can be copied straight into staging
+// memory. Other tools (ktx info, RenderDoc, texture viewers) can open the
+// files this writes.
+
+const uint8_t KTX2_IDENTIFIER[12] = {0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A};
+
+struct Ktx2Header
+{
+  uint8_t identifier[12];
+  uint32_t vkFormat;
+  uint32_t typeSize;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t layerCount;
+  uint32_t faceCount;
+  uint32_t levelCount;
+  uint32_t supercompressionScheme;
+  uint32_t dfdByteOffset;
+  uint32_t dfdByteLength;
+  uint32_t kvdByteOffset;
+  uint32_t kvdByteLength;
+  uint64_t sgdByteOffset;
+  uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex
+{
+  uint64_t byteOffset;
+  uint64_t byteLength;
+  uint64_t uncompressedByteLength;
+};
+
+class Ktx2Texture
+{
+public:
+  // Maps the file and checks that it is a texture this class can read.
+  // Returns false if the file is missing or malformed.
+  bool open(const std::string& path);
+  void close();
+
+  bool isOpen() const { return file.isOpen(); }
+
+  VkFormat getFormat() const { return format; }
+  uint32_t getWidth() const { return width; }
+  uint32_t getHeight() const { return height; }
+  uint32_t getLevelCount() const { return static_cast<uint32_t>(levels.size()); }
+
+  // Level data inside the mapping, valid until close()
+  const uint8_t* getLevelData(uint32_t level) const { return file.data() + levels[level].byteOffset; }
+  size_t getLevelSize(uint32_t level) const { return static_cast<size_t>(levels[level].byteLength); }
+
+  // Returns the value stored for key with its terminating zero removed, or
+  // an empty string if there is none
+  std::string getValue(const std::string& key) const;
+
+private:
+  MappedFile file;
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<Ktx2LevelIndex> levels;
+  std::vector<std::pair<std::string, std::string>> values;
+};
+
+class Ktx2Writer
+{
+public:
+  // Only the block compressed formats known to getBlockBytes() are supported
+  Ktx2Writer(VkFormat format, uint32_t width, uint32_t height);
+
+  // Levels are added level 0 first. The data is referenced, not copied, and
+  // must stay alive until write().
+  void addLevel(const std::vector<uint8_t>& data);
+
+  // Stored as a zero terminated string
+  void addValue(const std::string& key, const std::string& value);
+
+  // Writes to a temporary file first so a partially written texture is never picked up
+  bool write(const std::string& path) const;
+
+private:
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  std::vector<const std::vector<uint8_t>*> levels;
+  std::vector<std::pair<std::string, std::string>> values;
+};
@@ -0,0 +1,188 @@
+#include "lz4_block.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Limits of the format: matches are at least MIN_MATCH long and at most
+// MAX_OFFSET back, the last LAST_LITERALS bytes are always literals, and
+// no match starts in the last MATCH_FIND_LIMIT bytes
+static const size_t MIN_MATCH = 4;
+static const size_t MAX_OFFSET = 65535;
+static const size_t LAST_LITERALS = 5;
+static const size_t MATCH_FIND_LIMIT = 12;
+static const unsigned HASH_BITS = 16;
+
+static uint32_t read32(const uint8_t* data)
+{
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t hashSequence(uint32_t sequence)
+{
+  return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Lengths that do not fit in their 4 bits of the token continue in bytes of
+// 255 followed by the remainder
+static void writeLength(std::vector<uint8_t>& out, size_t length)
+{
+  for (; length >= 255; length -= 255)
+  {
+    out.push_back(255);
+  }
+  out.push_back(static_cast<uint8_t>(length));
+}
+
+static bool readLength(const uint8_t* in, size_t inSize, size_t& position, size_t& length)
+{
+  uint8_t byte;
+  do
+  {
+    if (position >= inSize)
+    {
+      return false;
+    }
+    byte = in[position++];
+    length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+static void writeSequence(std::vector<uint8_t>& out, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+{
+  const size_t matchCode = matchLength - MIN_MATCH;
+  const uint8_t token = static_cast<uint8_t>((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15));
+  out.push_back(token);
+  if (literalLength >= 15)
+  {
+    writeLength(out, literalLength - 15);
+  }
+  out.insert(out.end(), literals, literals + literalLength);
+
+  out.push_back(static_cast<uint8_t>(offset & 0xff));
+  out.push_back(static_cast<uint8_t>(offset >> 8));
+  if (matchCode >= 15)
+  {
+    writeLength(out, matchCode - 15);
+  }
+}
+
+void lz4Compress(const uint8_t* data, size_t size, std::vector<uint8_t>& compressed)
+{
+  compressed.clear();
+  compressed.reserve(size + size / 255 + 16);
+
+  // Positions + 1, so that 0 marks an empty entry
+  std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0);
+
+  size_t anchor = 0;
+  size_t position = 0;
+  if (size > MATCH_FIND_LIMIT)
+  {
+    const size_t matchLimit = size - LAST_LITERALS;
+    while (position + MATCH_FIND_LIMIT <= size)
+    {
+      const uint32_t sequence = read32(data + position);
+      uint32_t& entry = table[hashSequence(sequence)];
+      size_t candidate = entry;
+      entry = static_cast<uint32_t>(position + 1);
+
+      if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET || read32(data + candidate - 1) != sequence)
+      {
+        position++;
+        continue;
+      }
+      candidate--;
+
+      // Grow the match backwards into the pending literals, then forwards
+      while (position > anchor && candidate > 0 && data[position - 1] == data[candidate - 1])
+      {
+        position--;
+        candidate--;
+      }
+      size_t length = MIN_MATCH;
+      while (position + length < matchLimit && data[candidate + length] == data[position + length])
+      {
+        length++;
+      }
+
+      writeSequence(compressed, data + anchor, position - anchor, position - candidate, length);
+      position += length;
+      anchor = position;
+    }
+  }
+
+  // The last sequence only has literals
+  const size_t literalLength = size - anchor;
+  compressed.push_back(static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4));
+  if (literalLength >= 15)
+  {
+    writeLength(compressed, literalLength - 15);
+  }
+  compressed.insert(compressed.end(), data + anchor, data + size);
+}
+
+bool lz4Decompress(const uint8_t* compressed, size_t compressedSize, uint8_t* decompressed, size_t decompressedSize)
+{
+  size_t in = 0;
+  size_t out = 0;
+  while (in < compressedSize)
+  {
+    const uint8_t token = compressed[in++];
+
+    size_t literalLength = token >> 4;
+    if (literalLength == 15 && !readLength(compressed, compressedSize, in, literalLength))
+    {
+      return false;
+    }
+    if (literalLength > compressedSize - in || literalLength > decompressedSize - out)
+    {
+      return false;
+    }
+    if (literalLength != 0)
+    {
+      memcpy(decompressed + out, compressed + in, literalLength);
+    }
+    in += literalLength;
+    out += literalLength;
+
+    if (in == compressedSize)
+    {
+      break;
+    }
+
+    if (compressedSize - in < 2)
+    {
+      return false;
+    }
+    const size_t offset = compressed[in] | (static_cast<size_t>(compressed[in + 1]) << 8);
+    in += 2;
+    if (offset == 0 || offset > out)
+    {
+      return false;
+    }
+
+    size_t matchLength = token & 15;
+    if (matchLength == 15 && !readLength(compressed, compressedSize, in, matchLength))
+    {
+      return false;
+    }
+    matchLength += MIN_MATCH;
+    if (matchLength > decompressedSize - out)
+    {
+      return false;
+    }
+
+    // Matches may overlap the bytes they produce, so copy forwards one by one
+    const uint8_t* match = decompressed + out - offset;
+    for (size_t i = 0; i < matchLength; i++)
+    {
+      decompressed[out + i] = match[i];
+    }
+    out += matchLength;
+  }
+
+  return out == decompressedSize;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Compressor and decompressor for the LZ4 block format, without the frame
+// format around it. The sizes are stored by whoever stores the block.
+//
+// The compressor is the greedy single-probe variant: a match is found
+// through a hash table of the last position of every 4 byte sequence, which
+// is fast and compresses text such as SPIR-V and OBJ well, but leaves some
+// ratio on the table compared to LZ4 HC. The decompressor checks every
+// length and offset against both buffers, so corrupt input fails instead of
+// reading or writing out of bounds.
+
+// Replaces compressed with the compressed form of the size bytes at data
+void lz4Compress(const uint8_t* data, size_t size, std::vector<uint8_t>& compressed);
+
+// Decompresses a whole block into exactly decompressedSize bytes, returns
+// false if the block is malformed or does not decompress to that size
+bool lz4Decompress(const uint8_t* compressed, size_t compressedSize, uint8_t* decompressed, size_t decompressedSize);
@@ -14,98 +14,96 @@
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <fstream>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <optional>
 #include <set>
+#include <sstream>
 #include <stdexcept>
 #include <unordered_set>
 
+#include "asset_archive.h"
+#include "benchmark.h"
+#include "depth_pyramid.h"
+#include "frame_scheduler.h"
+#include "gpu_profiler.h"
+#include "hash.h"
+#include "ktx2.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "memory_allocator.h"
+#include "mesh_dedup.h"
+#include "mesh_lod.h"
+#include "mesh_meshlet.h"
+#include "mesh_optimize.h"
+#include "mesh_submesh.h"
+#include "mip_builder.h"
+#include "parallel.h"
+#include "pipeline_cache.h"
+#include "shader_reloader.h"
+#include "texture_codec.h"
+#include "texture_streamer.h"
+#include "uniform_ring.h"
+#include "upload_queue.h"
+#include "vertex.h"
+#include "vertex_packing.h"
+#include "virtual_texture.h"
+#include "worker_pool.h"
+
 struct UniformBufferObject
 {
-  alignas(16) glm::mat4 model;
   alignas(16) glm::mat4 view;
   alignas(16) glm::mat4 proj;
+  // Turn packed positions back into model space, unused with float vertices
+  alignas(16) glm::vec4 positionOffset;
+  alignas(16) glm::vec4 positionScale;
+  // Only read by virtual.frag: the share of the virtual texture the image
+  // covers in xy, pages per side of level 0 in z and level count in w
+  alignas(16) glm::vec4 virtualTexture;
 };
 
-struct Vertex
+// One per object in the uniform ring, bound at its own dynamic offset
+// before each of the object's draws
+struct ObjectUniforms
 {
-  glm::vec3 pos;
-  glm::vec3 color;
-  glm::vec2 texCoord;
-
-  bool operator==(const Vertex& other) const
-  {
-    return pos == other.pos && color == other.color && texCoord == other.texCoord;
-  }
-
-  static VkVertexInputBindingDescription getBindingDescription()
-  {
-    VkVertexInputBindingDescription bindingDescription = {};
-    bindingDescription.binding = 0;
-    bindingDescription.stride = sizeof(Vertex);
-    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-    return bindingDescription;
-  }
-
-  static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
-  {
-    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
-
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, pos);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-    attributeDescriptions[2].binding = 0;
-    attributeDescriptions[2].location = 2;
-    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-
-    return attributeDescriptions;
-  }
+  glm::mat4 model;
 };
 
-namespace std
+// Pushed before the compute pass that writes the instance transforms and the
+// indirect draw, matches instances.comp
+struct InstancePushConstants
 {
-  template<> struct hash<Vertex>
-  {
-    size_t operator()(Vertex const& vertex) const
-    {
-      return ((hash<glm::vec3>()(vertex.pos) ^
-        (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-        (hash<glm::vec2>()(vertex.texCoord) << 1);
-    }
-  };
-}
+  float time;
+  uint32_t instanceCount;
+  uint32_t lodCount;
+};
 
-std::vector<char> readFile(const std::string& filename)
+// Everything the compute pass culls against, matches instances.comp
+struct CullingUniforms
 {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-  if (!file.is_open())
-  {
-    std::cerr << "ERROR: Failed to load file! " << filename << std::endl;
-    throw std::runtime_error("Failed to load file!");
-  }
-
-  size_t fileSize = (size_t)file.tellg();
-  std::vector<char> buffer(fileSize);
-
-  file.seekg(0);
-  file.read(buffer.data(), fileSize);
-  file.close();
-
-  return buffer;
-}
+  alignas(16) glm::mat4 viewProj;
+  alignas(16) glm::vec4 frustumPlanes[6];
+  alignas(16) glm::vec4 boundingSphere;
+  alignas(8) glm::vec2 pyramidSize;
+  uint32_t pyramidLevels;
+  float lodScale;
+  alignas(16) glm::vec4 cameraPosition;
+  // Error of LOD i in component i % 4 of element i / 4
+  alignas(16) glm::vec4 lodErrors[MAX_MESH_LODS / 4];
+  // First indirect draw of LOD i, one per submesh, packed the same way.
+  // Entry MAX_MESH_LODS is the end of the last LOD's draws.
+  alignas(16) glm::uvec4 lodFirstDraws[MAX_MESH_LODS / 4 + 1];
+  // Only used by meshlets.comp
+  uint32_t meshletCount;
+};
 
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance,
   const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo,
@@ -138,6 +136,8 @@ struct QueueFamilyIndices
 {
   std::optional<uint32_t> graphicsFamily;
   std::optional<uint32_t> presentFamily;
+  // A transfer-only family if the device has one, the graphics family otherwise
+  std::optional<uint32_t> transferFamily;
 
   bool isComplete()
   {
@@ -152,6 +152,75 @@ struct SwapChainSupportDetails
   std::vector<VkPresentModeKHR> presentModes;
 };
 
+struct AppOptions
+{
+  // Render into offscreen images without a window, surface or swap chain
+  bool headless = false;
+  // Stop after this many frames and print frame timings; 0 runs until the window is closed
+  uint32_t benchmarkFrames = 0;
+  // Run a benchmark instead of the normal main loop: "dedup" is a standalone
+  // CPU benchmark, "resize" times swap chain recreation under a resize storm,
+  // "record" times command recording with an increasing number of threads,
+  // "instancing" compares per-object draws with a single indirect draw,
+  // "lod" compares LOD selection thresholds, "vertex-cache" compares the
+  // optimized mesh with the one in OBJ face order, "meshlets" compares
+  // culling whole objects with culling their meshlets, "pacing" compares
+  // the frame pacing modes, "mips" compares building the texture's mip
+  // chain on the CPU with blitting it on the GPU, "io" is a standalone
+  // benchmark of reading the startup assets through streams and mappings
+  std::string benchmark;
+  // Upload the source texture as RGBA8 even if a block compressed format is supported
+  bool uncompressedTextures = false;
+  // Build the mip chain of RGBA8 textures on the CPU with mipFilter instead
+  // of blitting it on the GPU. Block compressed textures always use the CPU.
+  bool cpuMips = false;
+  MipFilter mipFilter = MipFilter::Box;
+  // Decode the texture on background threads and draw with a placeholder
+  // until its coarse levels are uploaded, then stream in the finer levels.
+  // Streamed RGBA8 textures always build their mips on the CPU. Benchmarks
+  // load the texture before the first frame either way.
+  bool streamTextures = true;
+  // Number of copies of the model to draw; 0 draws one, or
+  // RECORD_BENCHMARK_OBJECTS for the "record" benchmark
+  uint32_t objectCount = 0;
+  // Threads recording draw commands every frame; 0 uses one per hardware thread
+  unsigned recordThreads = 0;
+  // Record one draw per object on the CPU instead of a single indirect draw
+  // of all objects written by a compute pass
+  bool directDraws = false;
+  // Also cull objects hidden behind the previous frame's depth buffer,
+  // besides the objects outside the view frustum
+  bool occlusionCulling = false;
+  // Cull the meshlets of every object, outside the view frustum or facing
+  // away from the camera, instead of whole objects. Always draws LOD 0.
+  bool meshletCulling = false;
+  // Vertex layout in the vertex buffer, falls back to Float if the device
+  // cannot fetch the packed formats
+  VertexFormat vertexFormat = VertexFormat::Packed;
+  // Every object is drawn with the coarsest LOD whose error projects to at
+  // most this many pixels on screen; 0 always draws the full mesh
+  float lodErrorPixels = 1.0f;
+  // Write every profiled GPU scope to this file as a Chrome trace on exit
+  std::string gpuTracePath;
+  // Frames the CPU may record ahead of the GPU, at most
+  // FrameScheduler::MAX_FRAMES_IN_FLIGHT
+  uint32_t framesInFlight = 2;
+  // Throughput keeps framesInFlight frames queued, Latency waits for the
+  // previous frame before sampling input for the next
+  FramePacing framePacing = FramePacing::Throughput;
+  // Draw the model with this image as a virtual texture, paged in from a
+  // page file as the view needs it, instead of the regular texture
+  std::string virtualTexturePath;
+  // Serve the assets from this archive instead of the loose files, falling
+  // back to a loose file for anything the archive does not hold
+  std::string assetArchivePath;
+  // Write the assets into an archive at this path and exit
+  std::string packPath;
+  // Recompile the graphics shaders when their sources change and swap the
+  // rebuilt pipelines in while running
+  bool watchShaders = false;
+};
+
 class HelloTriangleApplication
 {
 private:
@@ -159,15 +228,47 @@ private:
   const int HEIGHT = 600;
 
   const std::string MODEL_PATH = "models/chalet.obj";
+  const std::string MESH_CACHE_PATH = "models/chalet.rgbmesh";
   const std::string TEXTURE_PATH = "textures/chalet.jpg";
-
-  const int MAX_FRAMES_IN_FLIGHT = 2;
+  const std::string PIPELINE_CACHE_PATH = "pipeline.cache";
+
+  const uint32_t DEFAULT_HEADLESS_FRAMES = 500;
+  const uint32_t RESIZE_STORM_COUNT = 200;
+  const uint32_t RECORD_BENCHMARK_OBJECTS = 10000;
+  const uint32_t RECORD_BENCHMARK_FRAMES = 200;
+  const uint32_t INSTANCING_BENCHMARK_OBJECTS = 50000;
+  const uint32_t INSTANCING_BENCHMARK_FRAMES = 300;
+  const std::array<float, 5> LOD_BENCHMARK_ERRORS = {0.0f, 0.5f, 1.0f, 2.0f, 4.0f};
+  const uint32_t VERTEX_CACHE_BENCHMARK_OBJECTS = 64;
+  const uint32_t VERTEX_CACHE_BENCHMARK_FRAMES = 300;
+  const uint32_t MESHLET_BENCHMARK_OBJECTS = 16;
+  const uint32_t MESHLET_BENCHMARK_FRAMES = 300;
+  const uint32_t PACING_BENCHMARK_FRAMES = 300;
+  const uint32_t MIP_BENCHMARK_RUNS = 10;
+  const uint32_t IO_BENCHMARK_RUNS = 20;
+  const uint32_t IO_BENCHMARK_COLD_RUNS = 5;
+  // Streamed textures start out with every level at most this wide and
+  // high, the finer levels follow one per frame
+  const uint32_t STREAMING_FIRST_LEVEL_SIZE = 256;
+  const unsigned TEXTURE_DECODE_THREADS = 2;
+  // Matches local_size_x in instances.comp
+  const uint32_t INSTANCE_WORKGROUP_SIZE = 64;
+  // Room in each frame's indirect draw buffer. Meshes that would need more
+  // submeshes are drawn with 32-bit indices instead.
+  const uint32_t MAX_INDIRECT_DRAWS = 1024;
+  // Room for the draws of every meshlet of every object with meshlet
+  // culling, 5 MB per frame in flight
+  const uint32_t MAX_MESHLET_DRAWS = 262144;
+  const double PROFILER_REPORT_INTERVAL_MS = 5000.0;
+
+  const glm::vec3 CAMERA_POSITION = glm::vec3(2.0f, 2.0f, 2.0f);
+  const float FIELD_OF_VIEW = glm::radians(45.0f);
 
   const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
   };
 
-  const std::vector<const char*> deviceExtensions = {
+  const std::vector<const char*> swapChainExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
   };
 
@@ -177,75 +278,358 @@ private:
   const bool enableValidationLayers = true;
 #endif
 
-  GLFWwindow* window;
+  AppOptions options;
+
+  GLFWwindow* window = nullptr;
 
   VkInstance instance;
   VkDebugUtilsMessengerEXT debugMessenger;
-  VkSurfaceKHR surface;
+  VkSurfaceKHR surface = VK_NULL_HANDLE;
 
   VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
   VkDevice device;
 
+  // All buffer and image memory is sub-allocated from here
+  MemoryAllocator allocator;
+
   VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  VkQueue transferQueue;
+  uint32_t graphicsQueueFamily = 0;
+  uint32_t transferQueueFamily = 0;
+
+  // Startup uploads go through here, the graphics queue waits on them in
+  // finishUploads(), and so do streamed texture levels
+  UploadQueue uploadQueue;
 
-  VkSwapchainKHR swapChain;
+  // Setup command buffers submitted to the graphics queue that are freed once their fence signals
+  std::vector<std::pair<VkCommandBuffer, VkFence>> pendingSetupCommands;
+
+  VkSwapchainKHR swapChain = VK_NULL_HANDLE;
   std::vector<VkImage> swapChainImages;
   VkFormat swapChainImageFormat;
   VkExtent2D swapChainExtent;
   std::vector<VkImageView> swapChainImageViews;
 
+  // Headless mode renders into these instead of swap chain images
+  std::vector<Allocation> offscreenImagesMemory;
+  uint32_t offscreenImageIndex = 0;
+  VkExtent2D offscreenExtent = {static_cast<uint32_t>(WIDTH), static_cast<uint32_t>(HEIGHT)};
+
   VkRenderPass renderPass;
   VkDescriptorSetLayout descriptorSetLayout;
   VkPipelineLayout pipelineLayout;
   VkPipeline graphicsPipeline;
+  // Draws all objects at once, reading their transforms from the frame's instance set
+  VkPipeline instancedPipeline;
+  // Loaded from PIPELINE_CACHE_PATH at startup, used for every pipeline
+  // including the ones rebuilt on resize, and saved back at cleanup
+  VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+  bool pipelineCacheWarm = false;
 
   std::vector<VkFramebuffer> swapChainFramebuffers;
 
   VkCommandPool commandPool;
-  std::vector<VkCommandBuffer> commandBuffers;
 
+  // Draw commands are recorded again every frame. Each frame in flight has
+  // its own primary command buffer, and the draws are split into recording
+  // tasks that each fill a secondary command buffer from a pool of their own.
+  // A pool is then never used by two threads at once, and is only reset
+  // after the GPU has finished the frame that used it.
+  struct FrameCommands
+  {
+    VkCommandPool primaryPool;
+    VkCommandBuffer primaryBuffer;
+    std::vector<VkCommandPool> taskPools;
+    std::vector<VkCommandBuffer> taskBuffers;
+  };
+  std::vector<FrameCommands> frameCommands;
+  WorkerPool recordingPool;
+  size_t recordingTaskCount = 1;
+
+  // The scene is objectCount copies of the model on a square grid
+  uint32_t objectCount = 1;
+  uint32_t objectGridSize = 1;
+
+  // With indirect draws a compute pass writes every object's transform and
+  // the draw command into buffers of the frame in flight, so the CPU records
+  // the same handful of commands regardless of the number of objects.
+  // The placement of every object on the grid is uploaded once.
+  // Objects outside the view frustum, and with occlusion culling objects
+  // behind the depth pyramid, are left out of the draw.
+  struct FrameInstances
+  {
+    VkBuffer transformBuffer;
+    Allocation transformMemory;
+    VkBuffer drawCommandBuffer;
+    Allocation drawCommandMemory;
+    VkBuffer cullingBuffer;
+    Allocation cullingMemory;
+    // Number of meshlet draws written, read back once the frame is done
+    VkBuffer meshletCountBuffer = VK_NULL_HANDLE;
+    Allocation meshletCountMemory;
+    bool meshletCountPending = false;
+    VkDescriptorSet descriptorSet;
+  };
+  bool indirectDraws = true;
+  std::vector<FrameInstances> frameInstances;
+  VkBuffer instancePlacementBuffer;
+  Allocation instancePlacementMemory;
+  VkDescriptorSetLayout instanceSetLayout;
+  VkDescriptorPool instanceDescriptorPool;
+  VkPipelineLayout instancePipelineLayout;
+  VkPipeline instancePipeline;
+  bool occlusionCulling = false;
+  // Built from depthImage at the end of every frame when occlusion culling is on
+  DepthPyramid depthPyramid;
+  // LOD 0 split into meshlets, which meshlets.comp culls one by one for
+  // every object and writes one indirect draw per visible meshlet
+  bool meshletCulling = false;
+  std::vector<Meshlet> meshlets;
+  VkBuffer meshletBuffer = VK_NULL_HANDLE;
+  Allocation meshletMemory;
+  VkPipeline meshletPipeline = VK_NULL_HANDLE;
+  // Meshlets tested and drawn in the frames read back so far
+  uint64_t meshletsTested = 0;
+  uint64_t meshletsDrawn = 0;
+  // Seconds since the first frame, drives the animation
+  float animationTime = 0.0f;
+
+  // Per-frame resources exist once per frame in flight; the scheduler decides
+  // when the CPU may reuse them
+  uint32_t framesInFlight = 2;
+  FrameScheduler frameScheduler;
   std::vector<VkSemaphore> imageAvailableSemaphores;
   std::vector<VkSemaphore> renderFinishedSemaphores;
-  std::vector<VkFence> inFlightFences;
   size_t currentFrame = 0;
 
+  // Each frame in flight measures its command buffer in its own profiler
+  // slot, which is read back once the frame scheduler has seen it complete
+  GpuProfiler gpuProfiler;
+  std::vector<uint32_t> frameProfilerSlots;
+  // Optional device features the profiler uses when they are available
+  bool hostQueryResetEnabled = false;
+  bool pipelineStatisticsEnabled = false;
+  // Frames are paced with a timeline semaphore instead of fences
+  bool timelineSemaphoresEnabled = false;
+  // Indirect draws of the coarser LODs start at a non-zero instance, and
+  // all LODs are drawn with one call if the device can
+  bool drawIndirectFirstInstanceEnabled = false;
+  bool multiDrawIndirectEnabled = false;
+  // Meshlet draws stop at the count the culling pass wrote instead of
+  // walking every zeroed draw after the visible ones
+  bool drawIndirectCountEnabled = false;
+  PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+
+  std::vector<double> cpuFrameTimes;
+  std::vector<double> gpuFrameTimes;
+  std::vector<double> recordTimes;
+
   bool framebufferResized = false;
 
+  // Mesh data either points into the mapped mesh cache or into the vectors
+  // filled by parsing the OBJ, and is released once it has been uploaded
+  MeshCache meshCache;
   std::vector<Vertex> vertices;
   std::vector<uint32_t> indices;
+  const Vertex* vertexData = nullptr;
+  size_t vertexCount = 0;
+  const uint32_t* indexData = nullptr;
+  // Covers all LODs, which are ranges of the index buffer
+  size_t indexCount = 0;
+  std::vector<MeshLod> meshLods;
+  // With 16-bit indices every LOD is drawn in one or more submeshes, with
+  // 32-bit indices in exactly one that covers all of it. The submeshes of
+  // LOD i are [lodSubmeshes[i], lodSubmeshes[i + 1]).
+  VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+  std::vector<uint16_t> indices16;
+  std::vector<Submesh> submeshes;
+  std::vector<uint32_t> lodSubmeshes;
+  float lodErrorPixels = 1.0f;
+  // Model space center in xyz and radius in w, for culling
+  glm::vec4 meshBoundingSphere = glm::vec4(0.0f);
+  // With packed vertices the vertex buffer holds packedVertices, followed by
+  // packedColors at vertexColorOffset if the mesh is not all white
+  VertexFormat vertexFormat = VertexFormat::Float;
+  PackedVertexLayout packedLayout = {};
+  std::vector<PackedVertex> packedVertices;
+  std::vector<uint32_t> packedColors;
+  VkDeviceSize vertexColorOffset = 0;
   VkBuffer vertexBuffer;
-  VkDeviceMemory vertexBufferMemory;
+  Allocation vertexBufferMemory;
   VkBuffer indexBuffer;
-  VkDeviceMemory indexBufferMemory;
-  std::vector<VkBuffer> uniformBuffers;
-  std::vector<VkDeviceMemory> uniformBuffersMemory;
+  Allocation indexBufferMemory;
+  // Holds the frame's UniformBufferObject and the ObjectUniforms of every
+  // object, rewritten each frame at the offsets below
+  UniformRing uniformRing;
+  uint32_t frameUniformOffset = 0;
+  uint32_t objectUniformOffset = 0;
+  VkDeviceSize objectUniformStride = 0;
 
   uint32_t mipLevels;
+  VkFormat textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+  // Only uncompressed textures are uploaded without their mip chain
+  bool textureNeedsMipmaps = false;
+  int32_t textureWidth = 0;
+  int32_t textureHeight = 0;
   VkImage textureImage;
-  VkDeviceMemory textureImageMemory;
+  Allocation textureImageMemory;
   VkImageView textureImageView;
   VkSampler textureSampler;
 
+  // A streamed texture is drawn with a view of its resident levels, finest
+  // first, which is replaced every time a finer level arrives. Views and
+  // images that a descriptor set may still reference wait here until
+  // every frame that could use them has completed.
+  struct RetiredTexture
+  {
+    VkImageView view;
+    VkImage image;
+    Allocation memory;
+    uint64_t destroyFrame;
+  };
+
+  TextureStreamer textureStreamer;
+  bool textureStreaming = false;
+  // Levels of the decoded texture that are not resident yet
+  std::unique_ptr<DecodedTexture> streamedTexture;
+  uint32_t residentMipLevel = 0;
+  // In the order they were retired, which is also the order they can go
+  std::deque<RetiredTexture> retiredTextures;
+
+  // Pipelines replaced by a shader reload, destroyed once the frames that
+  // were recorded with them have completed
+  struct RetiredPipeline
+  {
+    VkPipeline pipeline;
+    uint64_t destroyFrame;
+  };
+
+  ShaderReloader shaderReloader;
+  std::deque<RetiredPipeline> retiredPipelines;
+  BenchmarkClock::time_point startTime = BenchmarkClock::now();
+  bool firstFramePresented = false;
+
   VkImage depthImage;
-  VkDeviceMemory depthImageMemory;
+  Allocation depthImageMemory;
   VkImageView depthImageView;
 
   VkImage colorImage;
-  VkDeviceMemory colorImageMemory;
+  Allocation colorImageMemory;
   VkImageView colorImageView;
 
   VkDescriptorPool descriptorPool;
+  // One per frame in flight, so that a frame can point its set at a new
+  // texture view while earlier frames still read theirs
   std::vector<VkDescriptorSet> descriptorSets;
+  // The texture view each set currently holds
+  std::vector<VkImageView> frameTextureViews;
+
+  // Open when --assets is given, loadAsset() serves from it
+  AssetArchive assetArchive;
+
+  // Needs stores and atomics in fragment shaders for the feedback
+  bool virtualTexturing = false;
+  VirtualTexture virtualTexture;
 
 public:
+  explicit HelloTriangleApplication(const AppOptions& options) : options(options)
+  {
+    if (options.objectCount != 0)
+    {
+      objectCount = options.objectCount;
+    }
+    else if (options.benchmark == "record")
+    {
+      objectCount = RECORD_BENCHMARK_OBJECTS;
+    }
+    else if (options.benchmark == "instancing" || options.benchmark == "lod")
+    {
+      objectCount = INSTANCING_BENCHMARK_OBJECTS;
+    }
+    else if (options.benchmark == "vertex-cache")
+    {
+      objectCount = VERTEX_CACHE_BENCHMARK_OBJECTS;
+    }
+    else if (options.benchmark == "meshlets")
+    {
+      objectCount = MESHLET_BENCHMARK_OBJECTS;
+    }
+    framesInFlight = options.framesInFlight;
+    indirectDraws = !options.directDraws;
+    // Cleared again by chooseMeshletCulling() if the device cannot do it
+    meshletCulling = options.meshletCulling || options.benchmark == "meshlets";
+    lodErrorPixels = options.lodErrorPixels;
+    objectGridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(objectCount))));
+  }
+
   void run()
   {
-    initWindow();
+    if (!options.packPath.empty())
+    {
+      packAssets();
+      return;
+    }
+    if (!options.assetArchivePath.empty())
+    {
+      openAssetArchive();
+    }
+
+    if (options.benchmark == "dedup")
+    {
+      runDedupBenchmark();
+      return;
+    }
+    if (options.benchmark == "io")
+    {
+      runIoBenchmark();
+      return;
+    }
+
+    if (!options.headless)
+    {
+      initWindow();
+    }
     initVulkan();
-    mainLoop();
+    if (options.benchmark == "resize")
+    {
+      runResizeBenchmark();
+    }
+    else if (options.benchmark == "record")
+    {
+      runRecordingBenchmark();
+    }
+    else if (options.benchmark == "instancing")
+    {
+      runInstancingBenchmark();
+    }
+    else if (options.benchmark == "lod")
+    {
+      runLodBenchmark();
+    }
+    else if (options.benchmark == "vertex-cache")
+    {
+      runVertexCacheBenchmark();
+    }
+    else if (options.benchmark == "meshlets")
+    {
+      runMeshletBenchmark();
+    }
+    else if (options.benchmark == "pacing")
+    {
+      runPacingBenchmark();
+    }
+    else if (options.benchmark == "mips")
+    {
+      runMipBenchmark();
+    }
+    else
+    {
+      mainLoop();
+      reportFrameTimes();
+    }
     cleanup();
   }
 
@@ -275,26 +659,62 @@ private:
     createSurface();
     choosePhysicalDevice();
     createLogicalDevice();
-    createSwapChain();
+    allocator.init(physicalDevice, device);
+    gpuProfiler.init(physicalDevice, device, hostQueryResetEnabled, pipelineStatisticsEnabled);
+    gpuProfiler.setTraceEnabled(!options.gpuTracePath.empty());
+    uploadQueue.init(physicalDevice, device, allocator, transferQueueFamily, transferQueue);
+    uploadQueue.setProfiler(&gpuProfiler);
+    createPipelineCache();
+    if (options.headless)
+    {
+      createOffscreenImages();
+    }
+    else
+    {
+      createSwapChain();
+    }
     createImageViews();
+    chooseOcclusionCulling();
     createRenderPass();
     createDescriptorSetLayout();
+    chooseVertexFormat();
+    loadModel();
+    chooseMeshletCulling();
     createGraphicsPipeline();
+    createInstancePipeline();
     createCommandPool();
+    createFrameProfilerSlots();
     createColorResources();
     createDepthResources();
     createFramebuffers();
     createTextureImage();
     createTextureImageView();
     createTextureSampler();
-    loadModel();
+    if (virtualTexturing)
+    {
+      virtualTexture.init(physicalDevice, device, allocator, options.virtualTexturePath, options.mipFilter,
+        framesInFlight, getDefaultThreadCount());
+    }
     createVertexBuffer();
     createIndexBuffer();
+    createInstanceBuffers();
+    createMeshletBuffer();
+    releaseModelData();
+    finishUploads();
     createUniformBuffers();
     createDescriptorPool();
     createDescriptorSets();
-    createCommandBuffers();
+    createInstanceDescriptorSets();
+    createDepthPyramid();
+    createFrameCommands();
     createSyncObjects();
+
+    if (options.watchShaders && options.benchmark.empty())
+    {
+      startShaderReload();
+    }
+
+    allocator.printStatistics();
   }
 
   void createColorResources()
@@ -314,1873 +734,4725 @@ private:
       VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 1);
   }
 
-  void loadModel()
+  // Serves an asset from the archive if one is open and holds it, otherwise
+  // maps the loose file. Decoders consume the bytes in place either way;
+  // SPIR-V needs 4 byte alignment, which both always have.
+  Asset loadAsset(const std::string& path) const
   {
-    tinyobj::attrib_t attrib;
-    std::vector<tinyobj::shape_t> shapes;
-    std::vector<tinyobj::material_t> materials;
-    std::string warn, err;
-
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str()))
-    {
-      throw std::runtime_error(warn + err);
-    }
-
-    std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
-
-    for (const auto& shape : shapes)
+    if (assetArchive.isOpen() && assetArchive.contains(path))
     {
-      for (const auto& index : shape.mesh.indices)
+      if (assetArchive.isStale(path))
       {
-        Vertex vertex = {};
-
-        vertex.pos = {
-          attrib.vertices[3 * index.vertex_index + 0],
-          attrib.vertices[3 * index.vertex_index + 1],
-          attrib.vertices[3 * index.vertex_index + 2]
-        };
-
-        vertex.texCoord = {
-          attrib.texcoords[2 * index.texcoord_index + 0],
-          1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
-        };
-
-        vertex.color = {1.0f, 1.0f, 1.0f};
-
-        if (uniqueVertices.count(vertex) == 0)
-        {
-          uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
-          vertices.push_back(vertex);
-        }
-
-        indices.push_back(uniqueVertices[vertex]);
+        std::cerr << "WARNING: " << path << " changed since " << options.assetArchivePath
+          << " was packed, serving the packed copy; repack it with --pack" << std::endl;
       }
+      return assetArchive.load(path);
     }
+    return loadLooseAsset(path);
   }
 
-  void createDepthResources()
-  {
-    VkFormat depthFormat = findDepthFormat();
-    createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat,
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      depthImage, depthImageMemory);
-    depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
-    transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
-  }
-
-  bool hasStencilComponent(VkFormat format)
-  {
-    return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
-  }
-
-  VkFormat findDepthFormat()
+  // Everything after loading indexes the vertices with the cached indices,
+  // which a damaged cache whose header still matches may not stay within
+  bool areCachedIndicesValid() const
   {
-    return findSupportedFormat(
-      {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
-    );
+    uint32_t maxIndex = 0;
+    for (size_t i = 0; i < indexCount; ++i)
+    {
+      maxIndex = std::max(maxIndex, indexData[i]);
+    }
+    if (indexCount != 0 && maxIndex >= vertexCount)
+    {
+      std::cerr << "WARNING: Mesh cache " << MESH_CACHE_PATH << " has index " << maxIndex
+        << " past its " << vertexCount << " vertices, rebuilding" << std::endl;
+      return false;
+    }
+    return true;
   }
 
-  VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
+  // The LODs of a mesh cache index into its index chunk, which a damaged
+  // or mismatched cache may not cover
+  bool areCachedLodsValid(const MeshLod* lods, size_t lodCount) const
   {
-    for (VkFormat format : candidates)
+    for (size_t lod = 0; lod < lodCount; ++lod)
     {
-      VkFormatProperties props;
-      vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
-      if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
-      {
-        return format;
-      }
-      else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features)
+      const uint64_t end = static_cast<uint64_t>(lods[lod].firstIndex) + lods[lod].indexCount;
+      if (lods[lod].indexCount == 0 || lods[lod].indexCount % 3 != 0 || end > indexCount)
       {
-        return format;
+        std::cerr << "WARNING: Mesh cache " << MESH_CACHE_PATH << " has LOD " << lod
+          << " outside its indices, rebuilding" << std::endl;
+        return false;
       }
     }
-
-    std::cerr << "ERROR: Failed to find supported format!" << std::endl;
-    throw std::runtime_error("Failed to find supported format!");
+    return true;
   }
 
-  void createTextureSampler()
+  void loadModel()
   {
-    VkSamplerCreateInfo samplerInfo = {};
-    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    samplerInfo.magFilter = VK_FILTER_LINEAR;
-    samplerInfo.minFilter = VK_FILTER_LINEAR;
-    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-    samplerInfo.anisotropyEnable = VK_TRUE;
-    samplerInfo.maxAnisotropy = 16;
-    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-    samplerInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerInfo.compareEnable = VK_FALSE;
-    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-    samplerInfo.minLod = 0.0f; // Optional
-    samplerInfo.maxLod = static_cast<float>(mipLevels);
-    samplerInfo.mipLodBias = 0.0f; // Optional
-
-    if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
+    auto loadStart = BenchmarkClock::now();
+
+    // Hashed to validate the mesh cache, and parsed from the same mapping
+    // if the cache has to be rebuilt
+    const Asset source = loadAsset(MODEL_PATH);
+    const uint64_t sourceSize = source.size();
+    const uint64_t sourceHash = xxhash64(source.data(), source.size());
+
+    const MeshLod* lodData = nullptr;
+    size_t lodCount = 0;
+    if (meshCache.open(MESH_CACHE_PATH, sourceSize, sourceHash)
+      && meshCache.getChunk(MESH_CHUNK_VERTICES, vertexData, vertexCount)
+      && meshCache.getChunk(MESH_CHUNK_INDICES, indexData, indexCount)
+      && meshCache.getChunk(MESH_CHUNK_LODS, lodData, lodCount)
+      && lodCount != 0 && lodCount <= MAX_MESH_LODS
+      && areCachedIndicesValid()
+      && areCachedLodsValid(lodData, lodCount))
     {
-      std::cerr << "ERROR: Failed to create texture sampler!" << std::endl;
-      throw std::runtime_error("Failed to create texture sampler!");
+      meshLods.assign(lodData, lodData + lodCount);
+      std::cerr << "INFO: Loaded " << vertexCount << " vertices and " << indexCount
+        << " indices from " << MESH_CACHE_PATH << " in "
+        << elapsedMilliseconds(loadStart, BenchmarkClock::now()) << " ms" << std::endl;
+      computeBoundingSphere();
+      printMeshLods();
+      packMesh();
+      splitMesh();
+      buildLodMeshlets();
+      return;
     }
-  }
+    meshCache.close();
 
-  void createTextureImageView()
-  {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
-  }
+    parseModel(source);
 
-  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
-  {
-    VkImageViewCreateInfo viewInfo = {};
-    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-    viewInfo.image = image;
-    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-    viewInfo.format = format;
-    viewInfo.subresourceRange.aspectMask = aspectFlags;
-    viewInfo.subresourceRange.baseMipLevel = 0;
-    viewInfo.subresourceRange.levelCount = mipLevels;
-    viewInfo.subresourceRange.baseArrayLayer = 0;
-    viewInfo.subresourceRange.layerCount = 1;
+    std::cerr << "INFO: Parsed " << vertices.size() << " vertices and " << indices.size()
+      << " indices from " << MODEL_PATH << " in "
+      << elapsedMilliseconds(loadStart, BenchmarkClock::now()) << " ms" << std::endl;
 
-    VkImageView imageView;
-    if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
+    auto lodStart = BenchmarkClock::now();
+    buildMeshLods(vertices.data(), vertices.size(), indices, MAX_MESH_LODS, meshLods);
+    std::cerr << "INFO: Simplified the mesh into " << meshLods.size() << " LODs in "
+      << elapsedMilliseconds(lodStart, BenchmarkClock::now()) << " ms" << std::endl;
+
+    optimizeMesh();
+
+    vertexData = vertices.data();
+    vertexCount = vertices.size();
+    indexData = indices.data();
+    indexCount = indices.size();
+    computeBoundingSphere();
+    printMeshLods();
+
+    MeshCacheWriter cacheWriter;
+    cacheWriter.addChunk(MESH_CHUNK_VERTICES, vertices);
+    cacheWriter.addChunk(MESH_CHUNK_INDICES, indices);
+    cacheWriter.addChunk(MESH_CHUNK_LODS, meshLods);
+    if (cacheWriter.write(MESH_CACHE_PATH, sourceSize, sourceHash))
     {
-      std::cerr << "ERROR: Failed to create texture image view!" << std::endl;
-      throw std::runtime_error("Failed to create texture image view!");
+      std::cerr << "INFO: Wrote mesh cache " << MESH_CACHE_PATH << std::endl;
     }
 
-    return imageView;
+    // Both may add vertices, which are not cached
+    packMesh();
+    splitMesh();
+    buildLodMeshlets();
   }
 
-  void createTextureImage()
+  // Centered on the bounding box, which is close enough to the smallest
+  // enclosing sphere for culling
+  void computeBoundingSphere()
   {
-    int texWidth, texHeight, texChannels;
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    glm::vec3 minimum(std::numeric_limits<float>::max());
+    glm::vec3 maximum(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+      minimum = glm::min(minimum, vertexData[i].pos);
+      maximum = glm::max(maximum, vertexData[i].pos);
+    }
 
-    if (!pixels)
+    const glm::vec3 center = (minimum + maximum) * 0.5f;
+    float radiusSquared = 0.0f;
+    for (size_t i = 0; i < vertexCount; ++i)
     {
-      std::cerr << "ERROR: Failed to load texture image!" << std::endl;
-      throw std::runtime_error("Failed to load texture image!");
+      const glm::vec3 offset = vertexData[i].pos - center;
+      radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
     }
 
-    VkDeviceSize imageSize = (uint64_t)texWidth * (uint64_t)texHeight * 4;
-    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+    meshBoundingSphere = glm::vec4(center, std::sqrt(radiusSquared));
+  }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+  // Reorders the triangles of every LOD for the post-transform vertex cache
+  // and then for overdraw, and finally the vertices in the order the index
+  // buffer uses them. The LODs keep their index ranges.
+  void optimizeMesh()
+  {
+    auto optimizeStart = BenchmarkClock::now();
 
-    createBuffer(imageSize,
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      stagingBuffer, stagingBufferMemory);
+    for (size_t lod = 0; lod < meshLods.size(); ++lod)
+    {
+      uint32_t* lodIndices = indices.data() + meshLods[lod].firstIndex;
+      const size_t lodIndexCount = meshLods[lod].indexCount;
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
+      const VertexCacheStatistics before = analyzeVertexCache(lodIndices, lodIndexCount, vertices.size());
+      std::cerr << "INFO:   LOD " << lod << " before optimization: ACMR " << before.acmr
+        << ", ATVR " << before.atvr << std::endl;
 
-    stbi_image_free(pixels);
+      optimizeVertexCache(lodIndices, lodIndexCount, vertices.size());
+      optimizeOverdraw(lodIndices, lodIndexCount, vertices.data(), vertices.size());
+    }
 
-    createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT,
-      VK_FORMAT_R8G8B8A8_UNORM,
-      VK_IMAGE_TILING_OPTIMAL,
-      VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-      VK_IMAGE_USAGE_SAMPLED_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      textureImage, textureImageMemory);
+    optimizeVertexFetch(vertices, indices);
 
-    transitionImageLayout(textureImage,
-      VK_FORMAT_R8G8B8A8_UNORM,
-      VK_IMAGE_LAYOUT_UNDEFINED,
-      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
-    generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+    std::cerr << "INFO: Optimized the mesh for the vertex cache in "
+      << elapsedMilliseconds(optimizeStart, BenchmarkClock::now()) << " ms" << std::endl;
+  }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+  void printMeshLods()
+  {
+    for (size_t lod = 0; lod < meshLods.size(); ++lod)
+    {
+      const VertexCacheStatistics statistics = analyzeVertexCache(indexData + meshLods[lod].firstIndex, meshLods[lod].indexCount, vertexCount);
+      std::cerr << "INFO:   LOD " << lod << ": " << meshLods[lod].indexCount / 3 << " triangles, error "
+        << meshLods[lod].error << ", ACMR " << statistics.acmr << ", ATVR " << statistics.atvr << std::endl;
+    }
   }
 
-  void generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+  // Decides the pipelines' vertex input, so it runs before they are created
+  void chooseVertexFormat()
   {
-    // Check if image format supports linear blitting
-    VkFormatProperties formatProperties;
-    vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
+    vertexFormat = options.vertexFormat;
+    if (vertexFormat != VertexFormat::Packed)
+    {
+      return;
+    }
 
-    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+    for (VkFormat format : {VK_FORMAT_R16G16B16A16_UNORM, VK_FORMAT_R16G16_UNORM, VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM})
     {
-      std::cerr << "ERROR: Texture image format does not support linear blitting!" << std::endl;
-      throw std::runtime_error("Texture image format does not support linear blitting!");
+      VkFormatProperties formatProperties;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+      if (!(formatProperties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT))
+      {
+        std::cerr << "WARNING: Packed vertex format " << format << " is not supported, using float vertices" << std::endl;
+        vertexFormat = VertexFormat::Float;
+        return;
+      }
     }
+  }
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+  void packMesh()
+  {
+    if (vertexFormat != VertexFormat::Packed)
+    {
+      return;
+    }
 
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++)
-    {
-      barrier.subresourceRange.baseMipLevel = i - 1;
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-      vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
-
-      VkImageBlit blit = {};
-      blit.srcOffsets[0] = {0, 0, 0};
-      blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      blit.srcSubresource.mipLevel = i - 1;
-      blit.srcSubresource.baseArrayLayer = 0;
-      blit.srcSubresource.layerCount = 1;
-      blit.dstOffsets[0] = {0, 0, 0};
-      blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
-      blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-      blit.dstSubresource.mipLevel = i;
-      blit.dstSubresource.baseArrayLayer = 0;
-      blit.dstSubresource.layerCount = 1;
+    packedLayout = packVertices(vertexData, vertexCount, packedVertices, packedColors);
 
-      vkCmdBlitImage(commandBuffer,
-        image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-        image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        1, &blit,
-        VK_FILTER_LINEAR);
+    const size_t packedSize = packedVertices.size() * sizeof(PackedVertex) + packedColors.size() * sizeof(uint32_t);
+    std::cerr << "INFO: Packed " << vertexCount << " vertices into " << packedSize << " bytes instead of "
+      << vertexCount * sizeof(Vertex) << " ("
+      << (packedLayout.texCoordFormat == VK_FORMAT_R16G16_UNORM ? "unorm" : "half float") << " texture coordinates, "
+      << (packedLayout.hasColors ? "with" : "without") << " colors)" << std::endl;
+  }
 
-      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  // Chooses 16-bit indices if they, together with the vertices that
+  // submeshes need copies of, take less memory than 32-bit indices, and the
+  // submeshes fit into the indirect draw buffer. The copies are appended to
+  // the vertex data.
+  void splitMesh()
+  {
+    std::vector<uint32_t> splitVertices;
+    buildSubmeshes(indexData, indexCount, vertexCount, meshLods, indices16, submeshes, lodSubmeshes, splitVertices);
 
-      vkCmdPipelineBarrier(commandBuffer,
-        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-        0, nullptr,
-        0, nullptr,
-        1, &barrier);
+    const size_t vertexSize = vertexFormat == VertexFormat::Packed
+      ? sizeof(PackedVertex) + (packedLayout.hasColors ? sizeof(uint32_t) : 0)
+      : sizeof(Vertex);
+    const size_t longIndexSize = indexCount * sizeof(uint32_t);
+    const size_t shortIndexSize = indexCount * sizeof(uint16_t) + splitVertices.size() * vertexSize;
 
-      if (mipWidth > 1) mipWidth /= 2;
-      if (mipHeight > 1) mipHeight /= 2;
+    if (shortIndexSize < longIndexSize && submeshes.size() <= MAX_INDIRECT_DRAWS)
+    {
+      indexType = VK_INDEX_TYPE_UINT16;
+      if (vertexFormat == VertexFormat::Packed)
+      {
+        packedVertices.reserve(packedVertices.size() + splitVertices.size());
+        for (uint32_t vertex : splitVertices)
+        {
+          packedVertices.push_back(packedVertices[vertex]);
+        }
+        if (packedLayout.hasColors)
+        {
+          packedColors.reserve(packedColors.size() + splitVertices.size());
+          for (uint32_t vertex : splitVertices)
+          {
+            packedColors.push_back(packedColors[vertex]);
+          }
+        }
+      }
+      else if (!splitVertices.empty())
+      {
+        // The vertices may still be in the mapped mesh cache
+        if (vertexData != vertices.data())
+        {
+          vertices.assign(vertexData, vertexData + vertexCount);
+        }
+        vertices.reserve(vertexCount + splitVertices.size());
+        for (uint32_t vertex : splitVertices)
+        {
+          vertices.push_back(vertices[vertex]);
+        }
+        vertexData = vertices.data();
+        vertexCount = vertices.size();
+      }
+    }
+    else
+    {
+      indexType = VK_INDEX_TYPE_UINT32;
+      indices16 = {};
+      submeshes.clear();
+      lodSubmeshes.clear();
+      for (const MeshLod& lod : meshLods)
+      {
+        lodSubmeshes.push_back(static_cast<uint32_t>(submeshes.size()));
+        submeshes.push_back({lod.firstIndex, lod.indexCount, 0});
+      }
+      lodSubmeshes.push_back(static_cast<uint32_t>(submeshes.size()));
     }
 
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-    vkCmdPipelineBarrier(commandBuffer,
-      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-      0, nullptr,
-      0, nullptr,
-      1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
+    const bool shortIndices = indexType == VK_INDEX_TYPE_UINT16;
+    std::cerr << "INFO: Index buffer holds " << indexCount << (shortIndices ? " 16-bit" : " 32-bit")
+      << " indices in " << submeshes.size() << " submeshes (" << lodSubmeshes[1] - lodSubmeshes[0]
+      << " in LOD 0), 16-bit indices take " << shortIndexSize << " bytes including "
+      << splitVertices.size() << " copied vertices, 32-bit indices " << longIndexSize << " bytes" << std::endl;
   }
 
-  void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+  // Meshlets of LOD 0, built within its submeshes so that each one is drawn
+  // with the vertexOffset of its submesh
+  void buildLodMeshlets()
   {
-    VkImageCreateInfo imageInfo = {};
-    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.extent.width = width;
-    imageInfo.extent.height = height;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = mipLevels;
-    imageInfo.arrayLayers = 1;
-    imageInfo.format = format;
-    imageInfo.tiling = tiling;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = usage;
-    imageInfo.samples = numSamples;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-    if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+    meshlets.clear();
+    if (!meshletCulling)
     {
-      std::cerr << "ERROR: Failed to create image!" << std::endl;
-      throw std::runtime_error("Failed to create image!");
+      return;
     }
 
-    VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
+    auto meshletStart = BenchmarkClock::now();
+    for (uint32_t i = lodSubmeshes[0]; i < lodSubmeshes[1]; ++i)
     {
-      std::cerr << "ERROR: Failed to allocate image memory!" << std::endl;
-      throw std::runtime_error("Failed to allocate image memory!");
+      buildMeshlets(vertexData, indexData, submeshes[i].firstIndex, submeshes[i].indexCount, submeshes[i].vertexOffset, meshlets);
     }
 
-    vkBindImageMemory(device, image, imageMemory, 0);
+    std::cerr << "INFO: Split LOD 0 into " << meshlets.size() << " meshlets of "
+      << (meshlets.empty() ? 0 : meshLods[0].indexCount / 3 / meshlets.size()) << " triangles on average in "
+      << elapsedMilliseconds(meshletStart, BenchmarkClock::now()) << " ms" << std::endl;
   }
 
-  VkCommandBuffer beginSingleTimeCommands()
+  // Meshlet culling writes a draw for every meshlet of every object, which
+  // need a draw count to start at different instances and share a buffer
+  void chooseMeshletCulling()
   {
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = commandPool;
-    allocInfo.commandBufferCount = 1;
-
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+    if (!meshletCulling)
+    {
+      return;
+    }
 
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    std::string missing;
+    if (!indirectDraws)
+    {
+      missing = "indirect draws";
+    }
+    else if (!drawIndirectFirstInstanceEnabled)
+    {
+      missing = "drawIndirectFirstInstance";
+    }
+    else if (!multiDrawIndirectEnabled)
+    {
+      missing = "multiDrawIndirect";
+    }
 
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (!missing.empty())
+    {
+      std::cerr << "WARNING: Meshlet culling needs " << missing << ", it is disabled" << std::endl;
+      meshletCulling = false;
+    }
+    else if (meshlets.empty() || objectCount * meshlets.size() > MAX_MESHLET_DRAWS)
+    {
+      std::cerr << "WARNING: " << objectCount << " objects of " << meshlets.size() << " meshlets need more than "
+        << MAX_MESHLET_DRAWS << " draws, meshlet culling is disabled" << std::endl;
+      meshletCulling = false;
+    }
 
-    return commandBuffer;
+    if (!meshletCulling)
+    {
+      meshlets.clear();
+    }
   }
 
-  void endSingleTimeCommands(VkCommandBuffer commandBuffer)
+  void releaseModelData()
   {
-    vkEndCommandBuffer(commandBuffer);
-
-    VkSubmitInfo submitInfo = {};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+    meshCache.close();
+    vertices = {};
+    indices = {};
+    indices16 = {};
+    packedVertices = {};
+    packedColors = {};
+    vertexData = nullptr;
+    indexData = nullptr;
+  }
 
-    vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(graphicsQueue);
+  void loadObj(const Asset& source, tinyobj::attrib_t& attrib, std::vector<tinyobj::shape_t>& shapes)
+  {
+    std::vector<tinyobj::material_t> materials;
+    std::string warn, err;
 
-    vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    // Parsed from the mapping, the materials are not used
+    MemoryStreamBuffer buffer(source.data(), source.size());
+    std::istream stream(&buffer);
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &stream))
+    {
+      throw std::runtime_error(warn + err);
+    }
   }
 
-  void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+  void parseModel(const Asset& source)
   {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkImageMemoryBarrier barrier = {};
-    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.oldLayout = oldLayout;
-    barrier.newLayout = newLayout;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.image = image;
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    barrier.subresourceRange.baseMipLevel = 0;
-    barrier.subresourceRange.levelCount = mipLevels;
-    barrier.subresourceRange.baseArrayLayer = 0;
-    barrier.subresourceRange.layerCount = 1;
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    loadObj(source, attrib, shapes);
 
-    VkPipelineStageFlags sourceStage;
-    VkPipelineStageFlags destinationStage;
+    buildIndexedMesh(attrib, shapes, vertices, indices, getDefaultThreadCount());
+  }
 
-    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+  void openAssetArchive()
+  {
+    if (!assetArchive.open(options.assetArchivePath))
     {
-      barrier.srcAccessMask = 0;
-      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-
-      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-      destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      std::cerr << "ERROR: Failed to open asset archive " << options.assetArchivePath << std::endl;
+      throw std::runtime_error("Failed to open asset archive!");
     }
-    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-    {
-      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    std::cerr << "INFO: Serving " << assetArchive.getNames().size() << " assets from " << options.assetArchivePath << std::endl;
+  }
 
-      sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-      destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
-    {
-      barrier.srcAccessMask = 0;
-      barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  // Packs the model, the texture source and every compiled shader. Caches
+  // derived from them stay loose, they depend on the device and are
+  // rebuilt next to the sources when missing.
+  void packAssets()
+  {
+    auto packStart = BenchmarkClock::now();
 
-      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-      destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    }
-    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
-    {
-      barrier.srcAccessMask = 0;
-      barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-      destinationStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    }
-    else
+    std::vector<std::string> paths = {MODEL_PATH, TEXTURE_PATH};
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator("shaders", error))
     {
-      std::cerr << "ERROR: Unsupported layout transition!" << std::endl;
-      throw std::invalid_argument("Unsupported layout transition!");
+      if (entry.path().extension() == ".spv")
+      {
+        paths.push_back(entry.path().generic_string());
+      }
     }
 
-    if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    AssetArchiveWriter writer;
+    for (const std::string& path : paths)
     {
-      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-
-      if (hasStencilComponent(format))
+      if (!writer.addFile(path))
       {
-        barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+        std::cerr << "ERROR: Failed to pack " << path << std::endl;
+        throw std::runtime_error("Failed to pack assets!");
       }
     }
-    else
+    if (!writer.write(options.packPath))
     {
-      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      std::cerr << "ERROR: Failed to write asset archive " << options.packPath << std::endl;
+      throw std::runtime_error("Failed to write asset archive!");
     }
 
-    vkCmdPipelineBarrier(
-      commandBuffer,
-      sourceStage, destinationStage,
-      0,
-      0, nullptr,
-      0, nullptr,
-      1, &barrier
-    );
-
-    endSingleTimeCommands(commandBuffer);
+    std::cerr << "INFO: Packed " << paths.size() << " assets into " << options.packPath << " ("
+      << std::filesystem::file_size(options.packPath, error) / 1024 << " KiB) in "
+      << elapsedMilliseconds(packStart, BenchmarkClock::now()) << " ms" << std::endl;
   }
 
-  void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+  void runDedupBenchmark()
   {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region = {};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {
-        width,
-        height,
-        1
-    };
-
-    vkCmdCopyBufferToImage(
-      commandBuffer,
-      buffer,
-      image,
-      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-      1,
-      &region
-    );
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    loadObj(loadAsset(MODEL_PATH), attrib, shapes);
 
-    endSingleTimeCommands(commandBuffer);
+    benchmarkIndexedMesh(attrib, shapes);
   }
 
-  void createDescriptorSets()
+  // Reads every non-empty asset startup touches that exists, copied into a
+  // vector through a stream the way shaders used to be read, and mapped
+  // with and without the sequential hint. Each file is hashed as a stand-in
+  // for the decoder that consumes it. After the first run the files come
+  // from the page cache, so this measures the copies and page faults, not
+  // the disk.
+  void runIoBenchmark()
   {
-    std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
-
-    VkDescriptorSetAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
-    allocInfo.pSetLayouts = layouts.data();
-
-    descriptorSets.resize(swapChainImages.size());
-    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+    std::vector<std::string> paths = {MODEL_PATH, MESH_CACHE_PATH, TEXTURE_PATH, PIPELINE_CACHE_PATH};
+    const std::filesystem::path textureDirectory = std::filesystem::path(TEXTURE_PATH).parent_path();
+    for (const auto& directory : {std::filesystem::path("shaders"), textureDirectory})
     {
-      std::cerr << "ERROR: Failed to allocate descriptor sets!" << std::endl;
-      throw std::runtime_error("Failed to allocate descriptor sets!");
+      std::error_code error;
+      for (const auto& entry : std::filesystem::directory_iterator(directory, error))
+      {
+        const std::filesystem::path extension = entry.path().extension();
+        if (extension == ".spv" || extension == ".ktx2")
+        {
+          paths.push_back(entry.path().string());
+        }
+      }
     }
 
-    for (size_t i = 0; i < swapChainImages.size(); i++)
+    uint64_t totalSize = 0;
+    std::vector<std::string> existing;
+    for (const std::string& path : paths)
     {
-      VkDescriptorBufferInfo bufferInfo = {};
-      bufferInfo.buffer = uniformBuffers[i];
-      bufferInfo.offset = 0;
-      bufferInfo.range = sizeof(UniformBufferObject);
+      std::error_code error;
+      const uint64_t size = std::filesystem::file_size(path, error);
+      // Empty files, such as a fresh pipeline cache, cannot be mapped
+      if (!error && size != 0)
+      {
+        existing.push_back(path);
+        totalSize += size;
+      }
+    }
+    std::cerr << "INFO: Reading " << existing.size() << " startup assets of " << totalSize / 1024 << " KiB" << std::endl;
 
-      VkDescriptorImageInfo imageInfo = {};
-      imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-      imageInfo.imageView = textureImageView;
-      imageInfo.sampler = textureSampler;
+    auto readStream = [](const std::string& path)
+    {
+      std::ifstream file(path, std::ios::ate | std::ios::binary);
+      std::vector<char> buffer(static_cast<size_t>(file.tellg()));
+      file.seekg(0);
+      file.read(buffer.data(), buffer.size());
+      return xxhash64(buffer.data(), buffer.size());
+    };
+    auto readMapped = [](const std::string& path, FileAccess access)
+    {
+      Asset file = loadLooseAsset(path, access);
+      return xxhash64(file.data(), file.size());
+    };
 
-      std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+    const std::array<std::pair<const char*, std::function<uint64_t(const std::string&)>>, 3> methods = {{
+      {"stream into vector", readStream},
+      {"mapped", [&readMapped](const std::string& path) { return readMapped(path, FileAccess::Normal); }},
+      {"mapped sequential", [&readMapped](const std::string& path) { return readMapped(path, FileAccess::Sequential); }}
+    }};
 
-      descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-      descriptorWrites[0].dstSet = descriptorSets[i];
-      descriptorWrites[0].dstBinding = 0;
-      descriptorWrites[0].dstArrayElement = 0;
-      descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-      descriptorWrites[0].descriptorCount = 1;
-      descriptorWrites[0].pBufferInfo = &bufferInfo;
+    uint64_t expectedChecksum = 0;
+    for (size_t method = 0; method < methods.size(); ++method)
+    {
+      std::vector<double> readTimes;
+      for (uint32_t run = 0; run < IO_BENCHMARK_RUNS; ++run)
+      {
+        uint64_t checksum = 0;
+        auto readStart = BenchmarkClock::now();
+        for (const std::string& path : existing)
+        {
+          checksum ^= methods[method].second(path);
+        }
+        readTimes.push_back(elapsedMilliseconds(readStart, BenchmarkClock::now()));
 
-      descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-      descriptorWrites[1].dstSet = descriptorSets[i];
-      descriptorWrites[1].dstBinding = 1;
-      descriptorWrites[1].dstArrayElement = 0;
-      descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-      descriptorWrites[1].descriptorCount = 1;
-      descriptorWrites[1].pImageInfo = &imageInfo;
+        if (method == 0 && run == 0)
+        {
+          expectedChecksum = checksum;
+        }
+        else if (checksum != expectedChecksum)
+        {
+          std::cerr << "WARNING: Startup assets read " << methods[method].first << " do not match the stream" << std::endl;
+        }
+      }
+      printTimingSummary(std::string("Startup assets ") + methods[method].first, readTimes);
+    }
 
-      vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    if (assetArchive.isOpen())
+    {
+      runArchiveBenchmark();
+    }
+    else
+    {
+      std::cerr << "INFO: No asset archive, pass --assets PATH to compare one with the loose files" << std::endl;
     }
   }
 
-  void createDescriptorPool()
+  // Loads everything in the archive from the loose files, against opening
+  // the archive and loading it from there. Cold runs drop the files from
+  // the OS file cache first, which is what a first start after boot sees.
+  void runArchiveBenchmark()
   {
-    std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
-
-    VkDescriptorPoolCreateInfo poolInfo = {};
-    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
-
-    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+    const std::vector<std::string> names = assetArchive.getNames();
+    for (const std::string& name : names)
     {
-      std::cerr << "ERROR: Failed to create descriptor pool!" << std::endl;
-      throw std::runtime_error("Failed to create descriptor pool!");
+      std::error_code error;
+      if (!std::filesystem::exists(name, error))
+      {
+        std::cerr << "INFO: " << name << " is only in the archive, skipping the comparison with loose files" << std::endl;
+        return;
+      }
     }
-  }
 
-  void createUniformBuffers()
-  {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+    auto readLoose = [&names]()
+    {
+      uint64_t checksum = 0;
+      for (const std::string& name : names)
+      {
+        Asset asset = loadLooseAsset(name);
+        checksum ^= xxhash64(asset.data(), asset.size());
+      }
+      return checksum;
+    };
+    auto readArchive = [this, &names]()
+    {
+      AssetArchive archive;
+      if (!archive.open(options.assetArchivePath))
+      {
+        throw std::runtime_error("Failed to reopen the asset archive!");
+      }
+      uint64_t checksum = 0;
+      for (const std::string& name : names)
+      {
+        Asset asset = archive.load(name);
+        checksum ^= xxhash64(asset.data(), asset.size());
+      }
+      return checksum;
+    };
+
+    bool canEvict = true;
+    uint64_t checksums[2] = {};
+    for (bool cold : {false, true})
+    {
+      for (bool archived : {false, true})
+      {
+        std::vector<double> readTimes;
+        for (uint32_t run = 0; run < (cold ? IO_BENCHMARK_COLD_RUNS : IO_BENCHMARK_RUNS) && canEvict; ++run)
+        {
+          if (cold)
+          {
+            for (const std::string& name : names)
+            {
+              canEvict = canEvict && evictFromFileCache(name);
+            }
+            canEvict = canEvict && evictFromFileCache(options.assetArchivePath);
+            if (!canEvict)
+            {
+              std::cerr << "INFO: The file cache cannot be dropped here, skipping the cold runs" << std::endl;
+              break;
+            }
+          }
+
+          auto readStart = BenchmarkClock::now();
+          checksums[archived ? 1 : 0] = archived ? readArchive() : readLoose();
+          readTimes.push_back(elapsedMilliseconds(readStart, BenchmarkClock::now()));
+        }
 
-    uniformBuffers.resize(swapChainImages.size());
-    uniformBuffersMemory.resize(swapChainImages.size());
+        if (!readTimes.empty())
+        {
+          printTimingSummary(std::string(cold ? "Cold " : "Warm ") + std::to_string(names.size())
+            + (archived ? " assets from the archive" : " loose assets"), readTimes);
+        }
+      }
+    }
 
-    for (size_t i = 0; i < swapChainImages.size(); i++)
+    if (checksums[0] != checksums[1])
     {
-      createBuffer(bufferSize,
-        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        uniformBuffers[i], uniformBuffersMemory[i]);
+      std::cerr << "WARNING: The archive does not match the loose files, repack it" << std::endl;
     }
   }
 
-  void createDescriptorSetLayout()
+  void createDepthResources()
   {
-    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-    uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
+    VkFormat depthFormat = findDepthFormat();
+    // The depth pyramid for occlusion culling is built from the depth buffer
+    createImage(swapChainExtent.width, swapChainExtent.height, 1, msaaSamples, depthFormat,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (occlusionCulling ? VK_IMAGE_USAGE_SAMPLED_BIT : 0),
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      depthImage, depthImageMemory);
+    depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1);
+    transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1);
+  }
 
-    VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-    samplerLayoutBinding.binding = 1;
-    samplerLayoutBinding.descriptorCount = 1;
-    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    samplerLayoutBinding.pImmutableSamplers = nullptr;
-    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+  bool hasStencilComponent(VkFormat format)
+  {
+    return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
+  }
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
-    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
+  VkFormat findDepthFormat()
+  {
+    return findSupportedFormat(
+      {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT},
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT
+    );
+  }
 
-    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+  VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features)
+  {
+    for (VkFormat format : candidates)
     {
-      std::cerr << "ERROR: Failed to create descriptor set layout!" << std::endl;
-      throw std::runtime_error("Failed to create descriptor set layout!");
+      VkFormatProperties props;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+      if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
+      {
+        return format;
+      }
+      else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features)
+      {
+        return format;
+      }
     }
+
+    std::cerr << "ERROR: Failed to find supported format!" << std::endl;
+    throw std::runtime_error("Failed to find supported format!");
   }
 
-  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+  void createTextureSampler()
   {
-    VkBufferCreateInfo bufferInfo = {};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = size;
-    bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_TRUE;
+    samplerInfo.maxAnisotropy = 16;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.minLod = 0.0f; // Optional
+    // Views of streamed textures start at their finest resident level, and
+    // the placeholder has a single level
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+    samplerInfo.mipLodBias = 0.0f; // Optional
 
-    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
     {
-      std::cerr << "ERROR: Failed to create buffer!" << std::endl;
-      throw std::runtime_error("Failed to create buffer!");
+      std::cerr << "ERROR: Failed to create texture sampler!" << std::endl;
+      throw std::runtime_error("Failed to create texture sampler!");
     }
+  }
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+  void createTextureImageView()
+  {
+    textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+  }
 
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+  VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels, uint32_t baseMipLevel = 0)
+  {
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = format;
+    viewInfo.subresourceRange.aspectMask = aspectFlags;
+    viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+    viewInfo.subresourceRange.levelCount = mipLevels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
 
-    if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
+    VkImageView imageView;
+    if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS)
     {
-      std::cerr << "ERROR: Failed to allocate vertex buffer memory!" << std::endl;
-      throw std::runtime_error("Failed to allocate vertex buffer memory!");
+      std::cerr << "ERROR: Failed to create texture image view!" << std::endl;
+      throw std::runtime_error("Failed to create texture image view!");
     }
 
-    vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    return imageView;
   }
 
-  void createIndexBuffer()
+  void createTextureImage()
   {
-    VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    VkFormat compressedFormat = options.uncompressedTextures ? VK_FORMAT_UNDEFINED : chooseCompressedTextureFormat();
+    if (options.streamTextures && options.benchmark.empty())
+    {
+      startTextureStreaming(compressedFormat != VK_FORMAT_UNDEFINED ? compressedFormat : VK_FORMAT_R8G8B8A8_UNORM);
+      return;
+    }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize,
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      stagingBuffer, stagingBufferMemory);
+    if (compressedFormat != VK_FORMAT_UNDEFINED)
+    {
+      loadCompressedTexture(compressedFormat);
+    }
+    else
+    {
+      loadUncompressedTexture();
+    }
+
+    printTextureStatistics();
+  }
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+  // Block compressed formats the device can sample with linear filtering,
+  // in order of preference. Returns VK_FORMAT_UNDEFINED if there is none.
+  VkFormat chooseCompressedTextureFormat()
+  {
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
 
-    createBuffer(bufferSize,
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-      VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      indexBuffer, indexBufferMemory);
+    const std::vector<std::pair<VkFormat, VkBool32>> candidates = {
+      {VK_FORMAT_BC7_UNORM_BLOCK, supportedFeatures.textureCompressionBC},
+      {VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK, supportedFeatures.textureCompressionETC2}
+    };
 
-    copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+    const VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    for (const auto& candidate : candidates)
+    {
+      VkFormatProperties properties;
+      vkGetPhysicalDeviceFormatProperties(physicalDevice, candidate.first, &properties);
+      if (candidate.second && (properties.optimalTilingFeatures & requiredFeatures) == requiredFeatures)
+      {
+        return candidate.first;
+      }
+    }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    std::cerr << "INFO: No block compressed texture format is supported, using RGBA8" << std::endl;
+    return VK_FORMAT_UNDEFINED;
   }
 
-  void createVertexBuffer()
+  // Uploads the texture with its whole mip chain from a KTX2 file next to the
+  // source image, see decodeTexture(). The levels are copied from the file
+  // mapping straight into the upload ring.
+  void loadCompressedTexture(VkFormat format)
   {
-    VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize,
-      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-      stagingBuffer, stagingBufferMemory);
+    Asset source = loadAsset(TEXTURE_PATH);
+    std::unique_ptr<DecodedTexture> texture = decodeTexture(TEXTURE_PATH, source, format, options.mipFilter, getDefaultThreadCount());
 
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t)bufferSize);
-    vkUnmapMemory(device, stagingBufferMemory);
+    textureFormat = format;
+    textureNeedsMipmaps = false;
+    textureWidth = static_cast<int32_t>(texture->width);
+    textureHeight = static_cast<int32_t>(texture->height);
+    mipLevels = static_cast<uint32_t>(texture->levels.size());
 
-    createBuffer(bufferSize,
-      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+    createImage(texture->width, texture->height, mipLevels, VK_SAMPLE_COUNT_1_BIT,
+      textureFormat,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+      VK_IMAGE_USAGE_SAMPLED_BIT,
       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-      vertexBuffer, vertexBufferMemory);
+      textureImage, textureImageMemory);
 
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+    uploadQueue.beginImageUpload(textureImage, mipLevels);
+    for (uint32_t level = 0; level < mipLevels; level++)
+    {
+      uploadTextureLevel(*texture, textureImage, level);
+    }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    if (texture->cache.isOpen())
+    {
+      std::cerr << "INFO: Loaded " << mipLevels << " " << getCompressedFormatName(format) << " levels from the texture cache in "
+        << texture->decodeMilliseconds << " ms" << std::endl;
+    }
   }
 
-  void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+  void uploadTextureLevel(const DecodedTexture& texture, VkImage image, uint32_t level)
   {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferCopy copyRegion = {};
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    endSingleTimeCommands(commandBuffer);
+    uint32_t levelWidth = std::max(1u, texture.width >> level);
+    uint32_t levelHeight = std::max(1u, texture.height >> level);
+    uploadQueue.uploadImageLevel(image, level, levelWidth, levelHeight, texture.blockSize, texture.bytesPerBlock, texture.levels[level]);
   }
 
-  uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+  // Draws with a 1x1 placeholder until the decode threads deliver the
+  // texture, see updateTextureStreaming()
+  void startTextureStreaming(VkFormat format)
   {
-    VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+    const uint32_t placeholder = 0xff808080;
+
+    mipLevels = 1;
+    textureWidth = 1;
+    textureHeight = 1;
+    textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    textureNeedsMipmaps = false;
 
-    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+    createImage(1, 1, 1, VK_SAMPLE_COUNT_1_BIT,
+      textureFormat,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+      VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      textureImage, textureImageMemory);
+    uploadQueue.uploadImage(textureImage, 1, 1, 1, 4, &placeholder);
+
+    // The decode itself leaves one hardware thread to the render loop
+    const MipFilter filter = options.mipFilter;
+    const unsigned threadCount = std::max(1u, getDefaultThreadCount() - 1);
+    const std::string path = TEXTURE_PATH;
+    textureStreamer.start(TEXTURE_DECODE_THREADS);
+    textureStreamer.enqueue([this, path, format, filter, threadCount]()
     {
-      if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
-      {
-        return i;
-      }
-    }
+      Asset source = loadAsset(path);
+      return decodeTexture(path, source, format, filter, threadCount);
+    });
+    textureStreaming = true;
 
-    std::cerr << "ERROR: Failed to find suitable memory type!" << std::endl;
-    throw std::runtime_error("Failed to find suitable memory type!");
+    std::cerr << "INFO: Streaming " << TEXTURE_PATH << " as "
+      << (isCompressedTextureFormat(format) ? getCompressedFormatName(format) : "rgba8") << " in the background" << std::endl;
   }
 
-  void recreateSwapChain()
+  // Called at the start of every frame, once the frame's resources are free.
+  // When the decoded texture arrives, its image is created with the levels
+  // up to STREAMING_FIRST_LEVEL_SIZE, then one finer level is uploaded per
+  // frame. Each upload makes a new view of the resident levels, which the
+  // frame's descriptor set picks up right away and the other sets when
+  // their frames come around.
+  void updateTextureStreaming()
   {
-    int width = 0;
-    int height = 0;
-    while (width == 0 || height == 0)
+    while (!retiredTextures.empty() && retiredTextures.front().destroyFrame <= frameScheduler.getFrameNumber())
     {
-      glfwGetFramebufferSize(window, &width, &height);
-      glfwWaitEvents();
+      destroyRetiredTexture(retiredTextures.front());
+      retiredTextures.pop_front();
     }
 
-    vkDeviceWaitIdle(device);
-
-    cleanupSwapChain();
+    if (textureStreaming && !streamedTexture)
+    {
+      streamedTexture = textureStreamer.poll();
+      if (streamedTexture)
+      {
+        beginStreamedTexture();
+      }
+    }
+    else if (streamedTexture)
+    {
+      uploadStreamedLevels(residentMipLevel - 1);
+    }
 
-    createSwapChain();
-    createImageViews();
-    createRenderPass();
-    createGraphicsPipeline();
-    createColorResources();
-    createDepthResources();
-    createFramebuffers();
-    createUniformBuffers();
-    createDescriptorPool();
-    createDescriptorSets();
-    createCommandBuffers();
+    if (frameTextureViews[currentFrame] != textureImageView)
+    {
+      writeTextureDescriptor(currentFrame);
+    }
   }
 
-  void createSyncObjects()
+  void beginStreamedTexture()
   {
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    const DecodedTexture& texture = *streamedTexture;
 
-    VkSemaphoreCreateInfo sempahoreInfo = {};
-    sempahoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    // The placeholder goes once no frame can still draw with it
+    retiredTextures.push_back({textureImageView, textureImage, textureImageMemory,
+      frameScheduler.getFrameNumber() + framesInFlight});
+    textureImageView = VK_NULL_HANDLE;
 
-    VkFenceCreateInfo fenceInfo = {};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    textureFormat = texture.format;
+    textureWidth = static_cast<int32_t>(texture.width);
+    textureHeight = static_cast<int32_t>(texture.height);
+    mipLevels = static_cast<uint32_t>(texture.levels.size());
+
+    createImage(texture.width, texture.height, mipLevels, VK_SAMPLE_COUNT_1_BIT,
+      textureFormat,
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+      VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      textureImage, textureImageMemory);
+    uploadQueue.beginImageUpload(textureImage, mipLevels);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    uint32_t firstLevel = mipLevels - 1;
+    while (firstLevel > 0 && std::max(texture.width, texture.height) >> (firstLevel - 1) <= STREAMING_FIRST_LEVEL_SIZE)
     {
-      if (vkCreateSemaphore(device, &sempahoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-        vkCreateSemaphore(device, &sempahoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-        vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS)
-      {
-        std::cerr << "ERROR: Failed to create semaphores!" << std::endl;
-        throw std::runtime_error("Failed to create semaphores!");
-      }
+      --firstLevel;
     }
+
+    residentMipLevel = mipLevels;
+    uploadStreamedLevels(firstLevel);
+
+    std::cerr << "INFO: Texture decoded in " << texture.decodeMilliseconds << " ms, first "
+      << mipLevels - firstLevel << " levels resident " << elapsedMilliseconds(startTime, BenchmarkClock::now())
+      << " ms after startup" << std::endl;
   }
 
-  void createCommandBuffers()
+  // Uploads the levels from firstLevel up to the finest resident one and
+  // makes them visible to the frames recorded from now on
+  void uploadStreamedLevels(uint32_t firstLevel)
   {
-    commandBuffers.resize(swapChainFramebuffers.size());
-
-    VkCommandBufferAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = commandPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = (size_t)commandBuffers.size();
-
-    if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+    for (uint32_t level = firstLevel; level < residentMipLevel; level++)
     {
-      std::cerr << "ERROR: Failed to allocate command buffers!" << std::endl;
-      throw std::runtime_error("Failed to allocate command buffers!");
+      uploadTextureLevel(*streamedTexture, textureImage, level);
     }
+    VkSemaphore uploadsDone = uploadQueue.flush();
 
-    for (size_t i = 0; i < commandBuffers.size(); ++i)
-    {
-      VkCommandBufferBeginInfo beginInfo = {};
-      beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-      beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-      beginInfo.pInheritanceInfo = nullptr; // Optional
-
-      if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
-      {
-        std::cerr << "ERROR: Failed to begin recording command buffer!" << std::endl;
-        throw std::runtime_error("Failed to begin recording command buffer!");
-      }
-
-      VkRenderPassBeginInfo renderPassInfo = {};
-      renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-      renderPassInfo.renderPass = renderPass;
-      renderPassInfo.framebuffer = swapChainFramebuffers[i];
-      renderPassInfo.renderArea.offset = {0, 0};
-      renderPassInfo.renderArea.extent = swapChainExtent;
-
-      std::array<VkClearValue, 2> clearValues = {};
-      clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
-      clearValues[1].depthStencil = {1.0f, 0};
-
-      renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-      renderPassInfo.pClearValues = clearValues.data();
-
-      vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // Submitted ahead of the frame on the same queue, so the frame's
+    // fragment shaders are in the barrier's second scope
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
-      vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+    VkImageMemoryBarrier imageBarrier = {};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = textureImage;
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = firstLevel;
+    imageBarrier.subresourceRange.levelCount = residentMipLevel - firstLevel;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-      VkBuffer vertexBuffers[] = {vertexBuffer};
-      VkDeviceSize offsets[] = {0};
-      vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-      vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
-      vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+    vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+      0, nullptr,
+      0, nullptr,
+      1, &imageBarrier);
 
-      vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    endSingleTimeCommands(commandBuffer, uploadsDone, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-      vkCmdEndRenderPass(commandBuffers[i]);
+    if (textureImageView != VK_NULL_HANDLE)
+    {
+      retiredTextures.push_back({textureImageView, VK_NULL_HANDLE, {}, frameScheduler.getFrameNumber() + framesInFlight});
+    }
+    textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels - firstLevel, firstLevel);
+    residentMipLevel = firstLevel;
 
-      if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-      {
-        std::cerr << "ERROR: Failed to record command buffer!" << std::endl;
-        throw std::runtime_error("Failed to record command buffer!");
-      }
+    if (residentMipLevel == 0)
+    {
+      std::cerr << "INFO: Texture at full quality " << elapsedMilliseconds(startTime, BenchmarkClock::now())
+        << " ms after startup" << std::endl;
+      printTextureStatistics();
+      streamedTexture.reset();
+      textureStreamer.stop();
+      textureStreaming = false;
     }
   }
 
-  void createCommandPool()
+  void destroyRetiredTexture(RetiredTexture& texture)
   {
-    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
-
-    VkCommandPoolCreateInfo poolInfo = {};
-    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-    poolInfo.flags = 0; // Optional
+    vkDestroyImageView(device, texture.view, nullptr);
+    if (texture.image != VK_NULL_HANDLE)
+    {
+      vkDestroyImage(device, texture.image, nullptr);
+      allocator.free(texture.memory);
+    }
+  }
 
-    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+  // Decodes the source texture to RGBA8 straight from its mapping
+  stbi_uc* loadTexturePixels(int& texWidth, int& texHeight)
+  {
+    Asset source = loadAsset(TEXTURE_PATH);
+    int texChannels;
+    stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    if (!pixels)
     {
-      std::cerr << "ERROR: Failed to create command pool!" << std::endl;
-      throw std::runtime_error("Failed to create command pool!");
+      std::cerr << "ERROR: Failed to load texture image!" << std::endl;
+      throw std::runtime_error("Failed to load texture image!");
     }
+    return pixels;
   }
 
-  void createFramebuffers()
+  void loadUncompressedTexture()
   {
-    swapChainFramebuffers.resize(swapChainImageViews.size());
+    int texWidth, texHeight;
+    stbi_uc* pixels = loadTexturePixels(texWidth, texHeight);
 
-    for (size_t i = 0; i < swapChainImageViews.size(); ++i)
+    mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+    textureWidth = texWidth;
+    textureHeight = texHeight;
+    textureFormat = VK_FORMAT_R8G8B8A8_UNORM;
+
+    // Blitting needs linear filtering of the format, the CPU does not
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, textureFormat, &formatProperties);
+    const bool canBlit = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) != 0;
+    if (!options.cpuMips && !canBlit)
     {
-      std::array<VkImageView, 3> attachments = {
-          colorImageView,
-          depthImageView,
-          swapChainImageViews[i]
-      };
+      std::cerr << "INFO: Texture format cannot be blitted with linear filtering, building mips on the CPU" << std::endl;
+    }
+    textureNeedsMipmaps = !options.cpuMips && canBlit;
 
-      VkFramebufferCreateInfo framebufferInfo = {};
-      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-      framebufferInfo.renderPass = renderPass;
-      framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-      framebufferInfo.pAttachments = attachments.data();
-      framebufferInfo.width = swapChainExtent.width;
-      framebufferInfo.height = swapChainExtent.height;
-      framebufferInfo.layers = 1;
+    createImage(texWidth, texHeight, mipLevels, VK_SAMPLE_COUNT_1_BIT,
+      textureFormat,
+      VK_IMAGE_TILING_OPTIMAL,
+      (textureNeedsMipmaps ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0) |
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+      VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      textureImage, textureImageMemory);
 
-      if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
-      {
-        std::cerr << "ERROR: Failed to create framebuffer!" << std::endl;
-        throw std::runtime_error("Failed to create framebuffer!");
-      }
+    if (textureNeedsMipmaps)
+    {
+      // The mip chain is blitted on the graphics queue in finishUploads()
+      uploadQueue.uploadImage(textureImage, mipLevels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 4, pixels);
+    }
+    else
+    {
+      auto buildStart = BenchmarkClock::now();
+      const uint32_t width = static_cast<uint32_t>(texWidth);
+      const uint32_t height = static_cast<uint32_t>(texHeight);
+      uploadQueue.uploadImageLevels(textureImage, mipLevels, width, height, 4, getMipChainOffsets(width, height).back(),
+        [&](uint8_t* chain)
+        {
+          buildMipChain(pixels, width, height, options.mipFilter, chain, getDefaultThreadCount());
+        });
+      std::cerr << "INFO: Built " << mipLevels << " " << getMipFilterName(options.mipFilter) << " filtered levels on the CPU in "
+        << elapsedMilliseconds(buildStart, BenchmarkClock::now()) << " ms" << std::endl;
     }
+
+    stbi_image_free(pixels);
   }
 
-  void createRenderPass()
+  // Compares the texture's footprint with what the same mip chain takes as
+  // RGBA8. Every sample fetches from one texel block per tap, so bits per
+  // texel is also the ratio of texture bandwidth at equal cache hit rates.
+  void printTextureStatistics()
   {
-    VkAttachmentDescription colorAttachment = {};
-    colorAttachment.format = swapChainImageFormat;
-    colorAttachment.samples = msaaSamples;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    VkDeviceSize rgbaBytes = 0;
+    for (uint32_t level = 0; level < mipLevels; level++)
+    {
+      rgbaBytes += static_cast<VkDeviceSize>(std::max(1, textureWidth >> level)) * std::max(1, textureHeight >> level) * 4;
+    }
 
-    VkAttachmentReference colorAttachmentRef = {};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    const bool compressed = isCompressedTextureFormat(textureFormat);
+    const double bitsPerTexel = compressed ? getBlockBytes(textureFormat) * 8.0 / (TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE) : 32.0;
 
-    VkAttachmentDescription depthAttachment = {};
-    depthAttachment.format = findDepthFormat();
-    depthAttachment.samples = msaaSamples;
-    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    StreamFormatGuard formatGuard(std::cerr);
+    std::cerr << "INFO: Texture " << textureWidth << "x" << textureHeight << ", " << mipLevels << " levels, "
+      << (compressed ? getCompressedFormatName(textureFormat) : "rgba8") << ": "
+      << textureImageMemory.size << " bytes of device memory (RGBA8 needs " << rgbaBytes << ", "
+      << std::fixed << std::setprecision(2) << static_cast<double>(rgbaBytes) / textureImageMemory.size << "x), "
+      << bitsPerTexel << " bits per sampled texel (RGBA8 32.00)" << std::endl;
+  }
 
-    VkAttachmentReference depthAttachmentRef = {};
-    depthAttachmentRef.attachment = 1;
-    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  // Waits for the upload queue on the graphics queue, without blocking the
+  // CPU, and finishes the uploaded resources there
+  void finishUploads()
+  {
+    VkSemaphore uploadsDone = uploadQueue.flush();
 
-    VkAttachmentDescription colorAttachmentResolve = {};
-    colorAttachmentResolve.format = swapChainImageFormat;
-    colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
 
-    VkAttachmentReference colorAttachmentResolveRef = {};
-    colorAttachmentResolveRef.attachment = 2;
-    colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    recordMeshUploadBarrier(commandBuffer);
 
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
-    subpass.pDepthStencilAttachment = &depthAttachmentRef;
-    subpass.pResolveAttachments = &colorAttachmentResolveRef;
+    if (textureNeedsMipmaps)
+    {
+      generateMipmaps(commandBuffer, textureImage, textureFormat, textureWidth, textureHeight, mipLevels);
+    }
+    else
+    {
+      VkImageMemoryBarrier imageBarrier = {};
+      imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      imageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      imageBarrier.image = textureImage;
+      imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      imageBarrier.subresourceRange.baseMipLevel = 0;
+      imageBarrier.subresourceRange.levelCount = mipLevels;
+      imageBarrier.subresourceRange.baseArrayLayer = 0;
+      imageBarrier.subresourceRange.layerCount = 1;
+      imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      imageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask =
-      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &imageBarrier);
+    }
 
-    std::array<VkAttachmentDescription, 3> attachments = {colorAttachment, depthAttachment, colorAttachmentResolve};
-    VkRenderPassCreateInfo renderPassInfo = {};
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-    renderPassInfo.pAttachments = attachments.data();
-    renderPassInfo.subpassCount = 1;
-    renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    endSingleTimeCommands(commandBuffer, uploadsDone, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
-    {
-      std::cerr << "ERROR: Failed to create render pass!" << std::endl;
-      throw std::runtime_error("Failed to create render pass!");
-    }
-    std::cerr << "INFO: Created render pass" << std::endl;
+    uploadQueue.printStatistics();
   }
 
-  void createGraphicsPipeline()
+  // The barrier's second scope covers every later submission, so the frames
+  // that read the vertex and index buffers are ordered after it too
+  void recordMeshUploadBarrier(VkCommandBuffer commandBuffer)
   {
-    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
-    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-    depthStencil.depthTestEnable = VK_TRUE;
-    depthStencil.depthWriteEnable = VK_TRUE;
-    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
-    depthStencil.depthBoundsTestEnable = VK_FALSE;
-    depthStencil.minDepthBounds = 0.0f; // Optional
-    depthStencil.maxDepthBounds = 1.0f; // Optional
-    depthStencil.stencilTestEnable = VK_FALSE;
-    depthStencil.front = {}; // Optional
-    depthStencil.back = {}; // Optional
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
 
-    auto vertShaderCode = readFile("shaders/vert.spv");
-    auto fragShaderCode = readFile("shaders/frag.spv");
+    // The compute pass reads the meshlets and object placements
+    vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+      1, &barrier,
+      0, nullptr,
+      0, nullptr);
+  }
 
-    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+  void generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+  {
+    // Check if image format supports linear blitting
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main";
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+    {
+      std::cerr << "ERROR: Texture image format does not support linear blitting!" << std::endl;
+      throw std::runtime_error("Texture image format does not support linear blitting!");
+    }
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.subresourceRange.levelCount = 1;
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    int32_t mipWidth = texWidth;
+    int32_t mipHeight = texHeight;
 
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    for (uint32_t i = 1; i < mipLevels; i++)
+    {
+      barrier.subresourceRange.baseMipLevel = i - 1;
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
 
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+      vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
 
-    VkViewport viewport = {};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)swapChainExtent.width;
-    viewport.height = (float)swapChainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+      VkImageBlit blit = {};
+      blit.srcOffsets[0] = {0, 0, 0};
+      blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
+      blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.srcSubresource.mipLevel = i - 1;
+      blit.srcSubresource.baseArrayLayer = 0;
+      blit.srcSubresource.layerCount = 1;
+      blit.dstOffsets[0] = {0, 0, 0};
+      blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
+      blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      blit.dstSubresource.mipLevel = i;
+      blit.dstSubresource.baseArrayLayer = 0;
+      blit.dstSubresource.layerCount = 1;
 
-    VkRect2D scissor = {};
-    scissor.offset = {0, 0};
-    scissor.extent = swapChainExtent;
+      vkCmdBlitImage(commandBuffer,
+        image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1, &blit,
+        VK_FILTER_LINEAR);
 
+      barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      vkCmdPipelineBarrier(commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+        0, nullptr,
+        0, nullptr,
+        1, &barrier);
+
+      if (mipWidth > 1) mipWidth /= 2;
+      if (mipHeight > 1) mipHeight /= 2;
+    }
+
+    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+      0, nullptr,
+      0, nullptr,
+      1, &barrier);
+  }
+
+  void createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory)
+  {
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = tiling;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = numSamples;
+
+    // Images filled by the upload queue are used on both queue families
+    uint32_t queueFamilyIndices[] = {graphicsQueueFamily, transferQueueFamily};
+    if ((usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT) && graphicsQueueFamily != transferQueueFamily)
+    {
+      imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      imageInfo.queueFamilyIndexCount = 2;
+      imageInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+    else
+    {
+      imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create image!" << std::endl;
+      throw std::runtime_error("Failed to create image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(device, image, &memRequirements);
+
+    ResourceLayout layout = tiling == VK_IMAGE_TILING_OPTIMAL ? ResourceLayout::Optimal : ResourceLayout::Linear;
+    imageMemory = allocator.allocate(memRequirements, properties, layout);
+
+    vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
+  }
+
+  VkCommandBuffer beginSingleTimeCommands()
+  {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    return commandBuffer;
+  }
+
+  // Submits without waiting; the command buffer is freed by collectSetupCommands()
+  // once it has executed. Later submissions to the graphics queue are ordered
+  // after it by the barriers it contains.
+  void endSingleTimeCommands(VkCommandBuffer commandBuffer, VkSemaphore waitSemaphore = VK_NULL_HANDLE,
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT)
+  {
+    vkEndCommandBuffer(commandBuffer);
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    if (waitSemaphore != VK_NULL_HANDLE)
+    {
+      submitInfo.waitSemaphoreCount = 1;
+      submitInfo.pWaitSemaphores = &waitSemaphore;
+      submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkFence fence;
+    if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create setup fence!" << std::endl;
+      throw std::runtime_error("Failed to create setup fence!");
+    }
+
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to submit setup command buffer!" << std::endl;
+      throw std::runtime_error("Failed to submit setup command buffer!");
+    }
+
+    pendingSetupCommands.emplace_back(commandBuffer, fence);
+  }
+
+  void collectSetupCommands(bool wait)
+  {
+    auto finished = std::remove_if(pendingSetupCommands.begin(), pendingSetupCommands.end(),
+      [this, wait](const std::pair<VkCommandBuffer, VkFence>& pending)
+      {
+        if (wait)
+        {
+          vkWaitForFences(device, 1, &pending.second, VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+        else if (vkGetFenceStatus(device, pending.second) != VK_SUCCESS)
+        {
+          return false;
+        }
+
+        vkDestroyFence(device, pending.second, nullptr);
+        vkFreeCommandBuffers(device, commandPool, 1, &pending.first);
+        return true;
+      });
+    pendingSetupCommands.erase(finished, pendingSetupCommands.end());
+  }
+
+  void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels)
+  {
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = oldLayout;
+    barrier.newLayout = newLayout;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkPipelineStageFlags sourceStage;
+    VkPipelineStageFlags destinationStage;
+
+    if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+      sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+      destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    {
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+    {
+      barrier.srcAccessMask = 0;
+      barrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+      sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      destinationStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    }
+    else
+    {
+      std::cerr << "ERROR: Unsupported layout transition!" << std::endl;
+      throw std::invalid_argument("Unsupported layout transition!");
+    }
+
+    if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+    {
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+      if (hasStencilComponent(format))
+      {
+        barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
+      }
+    }
+    else
+    {
+      barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+
+    vkCmdPipelineBarrier(
+      commandBuffer,
+      sourceStage, destinationStage,
+      0,
+      0, nullptr,
+      0, nullptr,
+      1, &barrier
+    );
+
+    endSingleTimeCommands(commandBuffer);
+  }
+
+  void createDescriptorSets()
+  {
+    std::vector<VkDescriptorSetLayout> layouts(framesInFlight, descriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = framesInFlight;
+    allocInfo.pSetLayouts = layouts.data();
+
+    descriptorSets.resize(framesInFlight);
+    if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to allocate descriptor sets!" << std::endl;
+      throw std::runtime_error("Failed to allocate descriptor sets!");
+    }
+
+    // Both uniform bindings cover one element of the ring, which one is
+    // picked by the dynamic offsets every time the set is bound
+    VkDescriptorBufferInfo bufferInfo = {};
+    bufferInfo.buffer = uniformRing.getBuffer();
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(UniformBufferObject);
+
+    VkDescriptorBufferInfo objectBufferInfo = {};
+    objectBufferInfo.buffer = uniformRing.getBuffer();
+    objectBufferInfo.offset = 0;
+    objectBufferInfo.range = sizeof(ObjectUniforms);
+
+    frameTextureViews.assign(framesInFlight, VK_NULL_HANDLE);
+    for (uint32_t i = 0; i < framesInFlight; i++)
+    {
+      std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+
+      descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[0].dstSet = descriptorSets[i];
+      descriptorWrites[0].dstBinding = 0;
+      descriptorWrites[0].dstArrayElement = 0;
+      descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      descriptorWrites[0].descriptorCount = 1;
+      descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+      descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[1].dstSet = descriptorSets[i];
+      descriptorWrites[1].dstBinding = 2;
+      descriptorWrites[1].dstArrayElement = 0;
+      descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+      descriptorWrites[1].descriptorCount = 1;
+      descriptorWrites[1].pBufferInfo = &objectBufferInfo;
+
+      vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+      writeTextureDescriptor(i);
+
+      if (virtualTexturing)
+      {
+        writeVirtualTextureDescriptors(i);
+      }
+    }
+  }
+
+  void writeVirtualTextureDescriptors(uint32_t frame)
+  {
+    std::array<VkDescriptorImageInfo, 2> imageInfos = {};
+    imageInfos[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos[0].imageView = virtualTexture.getAtlasView();
+    imageInfos[0].sampler = virtualTexture.getAtlasSampler();
+    imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfos[1].imageView = virtualTexture.getPageTableView();
+    imageInfos[1].sampler = virtualTexture.getPageTableSampler();
+
+    VkDescriptorBufferInfo feedbackInfo = {};
+    feedbackInfo.buffer = virtualTexture.getFeedbackBuffer(frame);
+    feedbackInfo.offset = 0;
+    feedbackInfo.range = virtualTexture.getFeedbackSize();
+
+    std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
+    for (uint32_t i = 0; i < descriptorWrites.size(); ++i)
+    {
+      descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrites[i].dstSet = descriptorSets[frame];
+      descriptorWrites[i].dstBinding = 3 + i;
+      descriptorWrites[i].dstArrayElement = 0;
+      descriptorWrites[i].descriptorCount = 1;
+    }
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[0].pImageInfo = &imageInfos[0];
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrites[1].pImageInfo = &imageInfos[1];
+    // Each frame in flight sets bits in its own feedback buffer
+    descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[2].pBufferInfo = &feedbackInfo;
+
+    vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+  }
+
+  // Points the frame's set at the current texture view. The set must not be
+  // in use, which holds for the current frame's set once beginFrame() returned.
+  void writeTextureDescriptor(uint32_t frame)
+  {
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = textureImageView;
+    imageInfo.sampler = textureSampler;
+
+    VkWriteDescriptorSet descriptorWrite = {};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = descriptorSets[frame];
+    descriptorWrite.dstBinding = 1;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    frameTextureViews[frame] = textureImageView;
+  }
+
+  void createDescriptorPool()
+  {
+    std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = 2 * framesInFlight;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[1].descriptorCount = 3 * framesInFlight;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = framesInFlight;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = framesInFlight;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create descriptor pool!" << std::endl;
+      throw std::runtime_error("Failed to create descriptor pool!");
+    }
+  }
+
+  // Every frame in flight gets a region with the frame's uniforms and room
+  // for the uniforms of every object
+  void createUniformBuffers()
+  {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    const VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+    auto alignedSize = [alignment](VkDeviceSize size) { return (size + alignment - 1) / alignment * alignment; };
+
+    objectUniformStride = alignedSize(sizeof(ObjectUniforms));
+    const VkDeviceSize frameSize = alignedSize(sizeof(UniformBufferObject)) + objectUniformStride * objectCount;
+    uniformRing.init(physicalDevice, device, allocator, framesInFlight, frameSize);
+    std::cerr << "INFO: Uniform ring of " << framesInFlight << " x " << frameSize / 1024 << " KiB for "
+      << objectCount << " objects" << std::endl;
+  }
+
+  void createDescriptorSetLayout()
+  {
+    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+    uboLayoutBinding.binding = 0;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+    VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
+    samplerLayoutBinding.binding = 1;
+    samplerLayoutBinding.descriptorCount = 1;
+    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    samplerLayoutBinding.pImmutableSamplers = nullptr;
+    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    // Only read by the pipeline that draws one object at a time
+    VkDescriptorSetLayoutBinding objectLayoutBinding = {};
+    objectLayoutBinding.binding = 2;
+    objectLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    objectLayoutBinding.descriptorCount = 1;
+    objectLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    // The atlas, page table and feedback buffer, only written and used with
+    // virtual texturing
+    std::array<VkDescriptorSetLayoutBinding, 3> virtualTextureBindings = {};
+    for (uint32_t i = 0; i < virtualTextureBindings.size(); ++i)
+    {
+      virtualTextureBindings[i].binding = 3 + i;
+      virtualTextureBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      virtualTextureBindings[i].descriptorCount = 1;
+      virtualTextureBindings[i].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    }
+    virtualTextureBindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+    std::array<VkDescriptorSetLayoutBinding, 6> bindings = {uboLayoutBinding, samplerLayoutBinding, objectLayoutBinding,
+      virtualTextureBindings[0], virtualTextureBindings[1], virtualTextureBindings[2]};
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create descriptor set layout!" << std::endl;
+      throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+
+    // Placements, transforms, draw commands, culling uniforms, the depth
+    // pyramid, meshlets and the meshlet count of a frame in flight. The
+    // compute pass writes the transforms that the instanced pipeline reads.
+    std::array<VkDescriptorSetLayoutBinding, 7> instanceBindings = {};
+    for (uint32_t i = 0; i < instanceBindings.size(); ++i)
+    {
+      instanceBindings[i].binding = i;
+      instanceBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      instanceBindings[i].descriptorCount = 1;
+      instanceBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    instanceBindings[1].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+    instanceBindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    // Only written and used with occlusion culling
+    instanceBindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    // 5 and 6 are only written and used with meshlet culling
+
+    layoutInfo.bindingCount = static_cast<uint32_t>(instanceBindings.size());
+    layoutInfo.pBindings = instanceBindings.data();
+
+    if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &instanceSetLayout) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create descriptor set layout!" << std::endl;
+      throw std::runtime_error("Failed to create descriptor set layout!");
+    }
+  }
+
+  void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory)
+  {
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+
+    // Buffers filled by the upload queue are used on both queue families
+    uint32_t queueFamilyIndices[] = {graphicsQueueFamily, transferQueueFamily};
+    if ((usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT) && graphicsQueueFamily != transferQueueFamily)
+    {
+      bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+      bufferInfo.queueFamilyIndexCount = 2;
+      bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+    else
+    {
+      bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    }
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create buffer!" << std::endl;
+      throw std::runtime_error("Failed to create buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+
+    bufferMemory = allocator.allocate(memRequirements, properties, ResourceLayout::Linear);
+
+    vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
+  }
+
+  void createIndexBuffer()
+  {
+    const bool shortIndices = indexType == VK_INDEX_TYPE_UINT16;
+    VkDeviceSize bufferSize = (shortIndices ? sizeof(uint16_t) : sizeof(uint32_t)) * indexCount;
+
+    createBuffer(bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      indexBuffer, indexBufferMemory);
+
+    if (shortIndices)
+    {
+      uploadQueue.uploadBuffer(indexBuffer, 0, indices16.data(), bufferSize);
+    }
+    else
+    {
+      uploadQueue.uploadBuffer(indexBuffer, 0, indexData, bufferSize);
+    }
+  }
+
+  void createVertexBuffer()
+  {
+    if (vertexFormat == VertexFormat::Packed)
+    {
+      VkDeviceSize packedSize = sizeof(PackedVertex) * packedVertices.size();
+      VkDeviceSize colorSize = sizeof(uint32_t) * packedColors.size();
+      vertexColorOffset = (packedSize + 15) / 16 * 16;
+
+      createBuffer(vertexColorOffset + colorSize,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+        VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        vertexBuffer, vertexBufferMemory);
+
+      uploadQueue.uploadBuffer(vertexBuffer, 0, packedVertices.data(), packedSize);
+      if (colorSize != 0)
+      {
+        uploadQueue.uploadBuffer(vertexBuffer, vertexColorOffset, packedColors.data(), colorSize);
+      }
+      return;
+    }
+
+    VkDeviceSize bufferSize = sizeof(vertexData[0]) * vertexCount;
+
+    createBuffer(bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      vertexBuffer, vertexBufferMemory);
+
+    uploadQueue.uploadBuffer(vertexBuffer, 0, vertexData, bufferSize);
+  }
+
+  // Binds the vertex stream, and the color stream of packed vertices that have one
+  void bindVertexBuffers(VkCommandBuffer commandBuffer)
+  {
+    const bool colorStream = vertexFormat == VertexFormat::Packed && packedLayout.hasColors;
+    VkBuffer vertexBuffers[] = {vertexBuffer, vertexBuffer};
+    VkDeviceSize offsets[] = {0, vertexColorOffset};
+    vkCmdBindVertexBuffers(commandBuffer, 0, colorStream ? 2 : 1, vertexBuffers, offsets);
+  }
+
+  // Only rebuilds what depends on the swap chain extent. The render pass and
+  // pipeline are kept unless the surface format changed. Uniforms live in
+  // the ring of frames in flight, which does not depend on the swap chain.
+  void recreateSwapChain()
+  {
+    if (!options.headless)
+    {
+      int width = 0;
+      int height = 0;
+      while (width == 0 || height == 0)
+      {
+        glfwGetFramebufferSize(window, &width, &height);
+        glfwWaitEvents();
+      }
+    }
+
+    vkDeviceWaitIdle(device);
+    collectAllGpuFrameTimes();
+    collectSetupCommands(true);
+
+    // Nothing is in flight after the wait above, so the whole pool can be reset
+    // before the attachment transitions below allocate from it again
+    vkResetCommandPool(device, commandPool, 0);
+
+    const VkFormat oldImageFormat = swapChainImageFormat;
+
+    cleanupSwapChain();
+
+    if (options.headless)
+    {
+      createOffscreenImages();
+    }
+    else
+    {
+      createSwapChain();
+    }
+    createImageViews();
+
+    if (swapChainImageFormat != oldImageFormat)
+    {
+      // A reload in progress would build against the old render pass and
+      // layout. While shaders are watched, the pipelines rebuilt below read
+      // the reloaded SPIR-V rather than what the archive holds.
+      const bool reloading = shaderReloader.isRunning();
+      shaderReloader.stop();
+      vkDestroyPipeline(device, graphicsPipeline, nullptr);
+      vkDestroyPipeline(device, instancedPipeline, nullptr);
+      vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+      vkDestroyRenderPass(device, renderPass, nullptr);
+      createRenderPass();
+      createGraphicsPipeline(reloading);
+      if (reloading)
+      {
+        startShaderReload();
+      }
+    }
+
+    createColorResources();
+    createDepthResources();
+    createDepthPyramid();
+    createFramebuffers();
+  }
+
+  void createSyncObjects()
+  {
+    imageAvailableSemaphores.resize(framesInFlight);
+    renderFinishedSemaphores.resize(framesInFlight);
+
+    VkSemaphoreCreateInfo sempahoreInfo = {};
+    sempahoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < framesInFlight; ++i)
+    {
+      if (vkCreateSemaphore(device, &sempahoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+        vkCreateSemaphore(device, &sempahoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS)
+      {
+        std::cerr << "ERROR: Failed to create semaphores!" << std::endl;
+        throw std::runtime_error("Failed to create semaphores!");
+      }
+    }
+
+    frameScheduler.init(device, timelineSemaphoresEnabled, framesInFlight, options.framePacing);
+    std::cerr << "INFO: " << framesInFlight << " frames in flight, paced with "
+      << (frameScheduler.usesTimelineSemaphore() ? "a timeline semaphore" : "fences") << " for "
+      << (options.framePacing == FramePacing::Latency ? "latency" : "throughput") << std::endl;
+  }
+
+  VkCommandPool createFrameCommandPool()
+  {
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = graphicsQueueFamily;
+    // Everything allocated from the pool is re-recorded every frame
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+    VkCommandPool pool;
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create command pool!" << std::endl;
+      throw std::runtime_error("Failed to create command pool!");
+    }
+
+    return pool;
+  }
+
+  VkCommandBuffer allocateCommandBuffer(VkCommandPool pool, VkCommandBufferLevel level)
+  {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = pool;
+    allocInfo.level = level;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to allocate command buffers!" << std::endl;
+      throw std::runtime_error("Failed to allocate command buffers!");
+    }
+
+    return commandBuffer;
+  }
+
+  // One recording task per recording thread, the command pools and buffers
+  // for all of them are created up front
+  void createFrameCommands()
+  {
+    recordingPool.start(options.recordThreads != 0 ? options.recordThreads : getDefaultThreadCount());
+    recordingTaskCount = recordingPool.getThreadCount();
+
+    frameCommands.resize(framesInFlight);
+    for (auto& frame : frameCommands)
+    {
+      frame.primaryPool = createFrameCommandPool();
+      frame.primaryBuffer = allocateCommandBuffer(frame.primaryPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+
+      frame.taskPools.resize(recordingPool.getThreadCount());
+      frame.taskBuffers.resize(recordingPool.getThreadCount());
+      for (size_t task = 0; task < frame.taskPools.size(); ++task)
+      {
+        frame.taskPools[task] = createFrameCommandPool();
+        frame.taskBuffers[task] = allocateCommandBuffer(frame.taskPools[task], VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+      }
+    }
+
+    std::cerr << "INFO: Recording " << objectCount << " objects per frame on up to "
+      << recordingPool.getThreadCount() << " threads" << std::endl;
+  }
+
+  void destroyFrameCommands()
+  {
+    recordingPool.stop();
+
+    // Destroying a pool frees the command buffers allocated from it
+    for (auto& frame : frameCommands)
+    {
+      vkDestroyCommandPool(device, frame.primaryPool, nullptr);
+      for (auto pool : frame.taskPools)
+      {
+        vkDestroyCommandPool(device, pool, nullptr);
+      }
+    }
+    frameCommands.clear();
+  }
+
+  // Records the current frame's command buffers for drawing into the given
+  // swap chain image. The frame's fence must have signalled.
+  void recordFrame(uint32_t imageIndex)
+  {
+    auto recordStart = BenchmarkClock::now();
+
+    FrameCommands& frame = frameCommands[currentFrame];
+    VkCommandBuffer commandBuffer = frame.primaryBuffer;
+    vkResetCommandPool(device, frame.primaryPool, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to begin recording command buffer!" << std::endl;
+      throw std::runtime_error("Failed to begin recording command buffer!");
+    }
+
+    const uint32_t profilerSlot = frameProfilerSlots[currentFrame];
+    gpuProfiler.beginSlot(profilerSlot, commandBuffer);
+    uint32_t frameScope = gpuProfiler.beginScope(profilerSlot, commandBuffer, "frame");
+
+    if (indirectDraws)
+    {
+      uint32_t instanceScope = gpuProfiler.beginScope(profilerSlot, commandBuffer, "instance update");
+      recordInstanceUpdate(commandBuffer);
+      gpuProfiler.endScope(profilerSlot, commandBuffer, instanceScope);
+    }
+
+    if (virtualTexturing)
+    {
+      uint32_t pageScope = gpuProfiler.beginScope(profilerSlot, commandBuffer, "virtual texture pages");
+      virtualTexture.update(commandBuffer, static_cast<uint32_t>(currentFrame), frameScheduler.getFrameNumber());
+      gpuProfiler.endScope(profilerSlot, commandBuffer, pageScope);
+    }
+
+    uint32_t renderPassScope = gpuProfiler.beginScope(profilerSlot, commandBuffer, "render pass", true);
+
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = renderPass;
+    renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    renderPassInfo.renderArea.offset = {0, 0};
+    renderPassInfo.renderArea.extent = swapChainExtent;
+
+    std::array<VkClearValue, 2> clearValues = {};
+    clearValues[0].color = {0.0f, 0.0f, 0.0f, 1.0f};
+    clearValues[1].depthStencil = {1.0f, 0};
+
+    renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+    renderPassInfo.pClearValues = clearValues.data();
+
+    if (indirectDraws)
+    {
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+      recordIndirectDraw(commandBuffer);
+    }
+    else
+    {
+      vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+      const size_t taskCount = std::min<size_t>(recordingTaskCount, objectCount);
+      recordingPool.run(taskCount, [this, &frame, taskCount, imageIndex](size_t task, unsigned)
+      {
+        recordDrawTask(frame, task, taskCount, imageIndex);
+      });
+
+      vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(taskCount), frame.taskBuffers.data());
+    }
+
+    vkCmdEndRenderPass(commandBuffer);
+
+    gpuProfiler.endScope(profilerSlot, commandBuffer, renderPassScope);
+
+    if (virtualTexturing)
+    {
+      virtualTexture.recordFeedbackBarrier(commandBuffer);
+    }
+
+    if (occlusionCulling)
+    {
+      uint32_t pyramidScope = gpuProfiler.beginScope(profilerSlot, commandBuffer, "depth pyramid");
+      depthPyramid.record(commandBuffer);
+      gpuProfiler.endScope(profilerSlot, commandBuffer, pyramidScope);
+    }
+    gpuProfiler.endScope(profilerSlot, commandBuffer, frameScope);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to record command buffer!" << std::endl;
+      throw std::runtime_error("Failed to record command buffer!");
+    }
+
+    if (isMeasuringFrames())
+    {
+      recordTimes.push_back(elapsedMilliseconds(recordStart, BenchmarkClock::now()));
+    }
+  }
+
+  // Records one contiguous range of objects into the task's secondary
+  // command buffer. Runs on a recording thread.
+  void recordDrawTask(const FrameCommands& frame, size_t task, size_t taskCount, uint32_t imageIndex)
+  {
+    VkCommandBuffer commandBuffer = frame.taskBuffers[task];
+    vkResetCommandPool(device, frame.taskPools[task], 0);
+
+    VkCommandBufferInheritanceInfo inheritanceInfo = {};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+    // The draws run inside the render pass scope's pipeline statistics query
+    inheritanceInfo.pipelineStatistics = gpuProfiler.getPipelineStatisticFlags();
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to begin recording command buffer!" << std::endl;
+      throw std::runtime_error("Failed to begin recording command buffer!");
+    }
+
+    // Secondary command buffers inherit no state, so each one binds everything itself
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)swapChainExtent.width;
+    viewport.height = (float)swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    bindVertexBuffers(commandBuffer);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+    const float lodScale = getLodScale();
+    const uint32_t lodCount = getSelectableLodCount(static_cast<uint32_t>(meshLods.size()));
+    const uint32_t firstObject = static_cast<uint32_t>(objectCount * task / taskCount);
+    const uint32_t endObject = static_cast<uint32_t>(objectCount * (task + 1) / taskCount);
+    for (uint32_t object = firstObject; object < endObject; ++object)
+    {
+      // Every object has its own slot in the ring, so the tasks never write
+      // to the same memory. The mapping may be write-combined, so it is
+      // only written, never read back.
+      ObjectUniforms uniforms = {};
+      uniforms.model = getObjectTransform(object);
+      std::array<uint32_t, 2> dynamicOffsets = {frameUniformOffset, static_cast<uint32_t>(objectUniformOffset + objectUniformStride * object)};
+      memcpy(uniformRing.getMapped(dynamicOffsets[1]), &uniforms, sizeof(uniforms));
+      vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[currentFrame],
+        static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+
+      const uint32_t lod = selectObjectLod(uniforms.model, getObjectPlacement(object).z, lodScale, lodCount);
+      for (uint32_t i = lodSubmeshes[lod]; i < lodSubmeshes[lod + 1]; ++i)
+      {
+        vkCmdDrawIndexed(commandBuffer, submeshes[i].indexCount, 1, submeshes[i].firstIndex, submeshes[i].vertexOffset, 0);
+      }
+    }
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to record command buffer!" << std::endl;
+      throw std::runtime_error("Failed to record command buffer!");
+    }
+  }
+
+  // The grid fills the space the single model takes up, so one object is
+  // drawn exactly as before. Every object spins with its own phase.
+  // Returns the position on the grid in xy, the scale in z and the phase in w.
+  glm::vec4 getObjectPlacement(uint32_t object) const
+  {
+    const float cellSize = 2.0f / objectGridSize;
+    const float x = ((object % objectGridSize) + 0.5f) * cellSize - 1.0f;
+    const float y = ((object / objectGridSize) + 0.5f) * cellSize - 1.0f;
+    return glm::vec4(x, y, cellSize / 2.0f, object * 0.5f);
+  }
+
+  // instances.comp computes the same transform on the GPU
+  glm::mat4 getObjectTransform(uint32_t object) const
+  {
+    const glm::vec4 placement = getObjectPlacement(object);
+    const float angle = animationTime * glm::radians(90.0f) + placement.w;
+
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(placement.x, placement.y, 0.0f));
+    model = glm::rotate(model, angle, glm::vec3(0.0f, 0.0f, 1.0f));
+    return glm::scale(model, glm::vec3(placement.z));
+  }
+
+  // A LOD is good enough for an object if its error, scaled with the object
+  // and projected to the object's distance, covers at most lodErrorPixels.
+  // That is the case when error * scale * getLodScale() <= distance.
+  float getLodScale() const
+  {
+    if (lodErrorPixels <= 0.0f)
+    {
+      return 0.0f;
+    }
+
+    const float pixelsPerUnit = swapChainExtent.height * 0.5f / std::tan(FIELD_OF_VIEW * 0.5f);
+    return pixelsPerUnit / lodErrorPixels;
+  }
+
+  // The coarsest of the first lodCount LODs that is good enough, which
+  // instances.comp selects the same way
+  uint32_t selectObjectLod(const glm::mat4& model, float scale, float lodScale, uint32_t lodCount) const
+  {
+    const glm::vec4 center = model * glm::vec4(meshBoundingSphere.x, meshBoundingSphere.y, meshBoundingSphere.z, 1.0f);
+    const glm::vec3 offset = glm::vec3(center.x, center.y, center.z) - CAMERA_POSITION;
+    const float distance = std::max(glm::length(offset) - meshBoundingSphere.w * scale, 0.0f);
+
+    uint32_t selected = 0;
+    for (uint32_t lod = 1; lod < lodCount; ++lod)
+    {
+      if (meshLods[lod].error * scale * lodScale <= distance)
+      {
+        selected = lod;
+      }
+    }
+    return selected;
+  }
+
+  // LOD selection is off when lodErrorPixels is 0, which leaves only LOD 0
+  uint32_t getSelectableLodCount(uint32_t lodCount) const
+  {
+    return lodErrorPixels > 0.0f ? lodCount : 1;
+  }
+
+  // Without drawIndirectFirstInstance every indirect draw starts at
+  // instance 0, so only one LOD gets a range of the transform buffer
+  uint32_t getIndirectLodCount() const
+  {
+    return drawIndirectFirstInstanceEnabled ? static_cast<uint32_t>(meshLods.size()) : 1;
+  }
+
+  void createInstanceBuffers()
+  {
+    std::vector<glm::vec4> placements(objectCount);
+    for (uint32_t object = 0; object < objectCount; ++object)
+    {
+      placements[object] = getObjectPlacement(object);
+    }
+
+    VkDeviceSize placementSize = sizeof(placements[0]) * placements.size();
+    createBuffer(placementSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      instancePlacementBuffer, instancePlacementMemory);
+
+    uploadQueue.uploadBuffer(instancePlacementBuffer, 0, placements.data(), placementSize);
+
+    if (getIndirectLodCount() < meshLods.size())
+    {
+      std::cerr << "WARNING: drawIndirectFirstInstance is not supported, indirect draws only use LOD 0" << std::endl;
+    }
+
+    // Every LOD has room for all objects in the transform buffer and a draw
+    // command per submesh
+    frameInstances.resize(framesInFlight);
+    for (auto& frame : frameInstances)
+    {
+      createBuffer(sizeof(glm::mat4) * objectCount * getIndirectLodCount(),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        frame.transformBuffer, frame.transformMemory);
+
+      createBuffer(sizeof(VkDrawIndexedIndirectCommand) * (meshletCulling ? MAX_MESHLET_DRAWS : MAX_INDIRECT_DRAWS),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+        VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        frame.drawCommandBuffer, frame.drawCommandMemory);
+
+      createBuffer(sizeof(CullingUniforms),
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        frame.cullingBuffer, frame.cullingMemory);
+
+      if (meshletCulling)
+      {
+        createBuffer(sizeof(uint32_t),
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+          frame.meshletCountBuffer, frame.meshletCountMemory);
+      }
+    }
+  }
+
+  void destroyMeshletBuffer()
+  {
+    if (meshletBuffer != VK_NULL_HANDLE)
+    {
+      vkDestroyBuffer(device, meshletBuffer, nullptr);
+      allocator.free(meshletMemory);
+      meshletBuffer = VK_NULL_HANDLE;
+    }
+  }
+
+  void createMeshletBuffer()
+  {
+    if (!meshletCulling)
+    {
+      return;
+    }
+
+    VkDeviceSize bufferSize = sizeof(meshlets[0]) * meshlets.size();
+    createBuffer(bufferSize,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+      meshletBuffer, meshletMemory);
+
+    uploadQueue.uploadBuffer(meshletBuffer, 0, meshlets.data(), bufferSize);
+  }
+
+  // Meshlets and the meshlet count of every frame in flight
+  void writeMeshletDescriptors()
+  {
+    for (auto& frame : frameInstances)
+    {
+      std::array<VkDescriptorBufferInfo, 2> bufferInfos = {};
+      bufferInfos[0].buffer = meshletBuffer;
+      bufferInfos[0].range = VK_WHOLE_SIZE;
+      bufferInfos[1].buffer = frame.meshletCountBuffer;
+      bufferInfos[1].range = VK_WHOLE_SIZE;
+
+      std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+      for (uint32_t i = 0; i < descriptorWrites.size(); ++i)
+      {
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = frame.descriptorSet;
+        descriptorWrites[i].dstBinding = 5 + i;
+        descriptorWrites[i].dstArrayElement = 0;
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+      }
+
+      vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+  }
+
+  void createInstanceDescriptorSets()
+  {
+    std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = 5 * framesInFlight;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    poolSizes[1].descriptorCount = framesInFlight;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSizes[2].descriptorCount = framesInFlight;
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = framesInFlight;
+
+    if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &instanceDescriptorPool) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create descriptor pool!" << std::endl;
+      throw std::runtime_error("Failed to create descriptor pool!");
+    }
+
+    for (auto& frame : frameInstances)
+    {
+      VkDescriptorSetAllocateInfo allocInfo = {};
+      allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+      allocInfo.descriptorPool = instanceDescriptorPool;
+      allocInfo.descriptorSetCount = 1;
+      allocInfo.pSetLayouts = &instanceSetLayout;
+
+      if (vkAllocateDescriptorSets(device, &allocInfo, &frame.descriptorSet) != VK_SUCCESS)
+      {
+        std::cerr << "ERROR: Failed to allocate descriptor sets!" << std::endl;
+        throw std::runtime_error("Failed to allocate descriptor sets!");
+      }
+
+      std::array<VkDescriptorBufferInfo, 4> bufferInfos = {};
+      bufferInfos[0].buffer = instancePlacementBuffer;
+      bufferInfos[0].range = VK_WHOLE_SIZE;
+      bufferInfos[1].buffer = frame.transformBuffer;
+      bufferInfos[1].range = VK_WHOLE_SIZE;
+      bufferInfos[2].buffer = frame.drawCommandBuffer;
+      bufferInfos[2].range = VK_WHOLE_SIZE;
+      bufferInfos[3].buffer = frame.cullingBuffer;
+      bufferInfos[3].range = sizeof(CullingUniforms);
+
+      std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+      for (uint32_t i = 0; i < descriptorWrites.size(); ++i)
+      {
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = frame.descriptorSet;
+        descriptorWrites[i].dstBinding = i;
+        descriptorWrites[i].dstArrayElement = 0;
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+      }
+      descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+
+      vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    if (meshletCulling)
+    {
+      writeMeshletDescriptors();
+    }
+  }
+
+  void destroyInstanceResources()
+  {
+    vkDestroyPipeline(device, instancePipeline, nullptr);
+    if (meshletPipeline != VK_NULL_HANDLE)
+    {
+      vkDestroyPipeline(device, meshletPipeline, nullptr);
+    }
+    vkDestroyPipelineLayout(device, instancePipelineLayout, nullptr);
+    vkDestroyDescriptorPool(device, instanceDescriptorPool, nullptr);
+
+    for (auto& frame : frameInstances)
+    {
+      vkDestroyBuffer(device, frame.transformBuffer, nullptr);
+      allocator.free(frame.transformMemory);
+      vkDestroyBuffer(device, frame.drawCommandBuffer, nullptr);
+      allocator.free(frame.drawCommandMemory);
+      vkDestroyBuffer(device, frame.cullingBuffer, nullptr);
+      allocator.free(frame.cullingMemory);
+      if (frame.meshletCountBuffer != VK_NULL_HANDLE)
+      {
+        vkDestroyBuffer(device, frame.meshletCountBuffer, nullptr);
+        allocator.free(frame.meshletCountMemory);
+      }
+    }
+    frameInstances.clear();
+
+    destroyMeshletBuffer();
+
+    if (occlusionCulling)
+    {
+      depthPyramid.destroy();
+    }
+
+    vkDestroyBuffer(device, instancePlacementBuffer, nullptr);
+    allocator.free(instancePlacementMemory);
+  }
+
+  // Writes this frame's transforms and indirect draw. Runs before the render
+  // pass, the draw waits for it with the barrier at the end.
+  void recordInstanceUpdate(VkCommandBuffer commandBuffer)
+  {
+    FrameInstances& frame = frameInstances[currentFrame];
+
+    // The frame's fence has signalled, so its uniforms are not in use
+    CullingUniforms culling = {};
+    culling.viewProj = getProjection() * getView();
+    getFrustumPlanes(culling.viewProj, culling.frustumPlanes);
+    culling.boundingSphere = meshBoundingSphere;
+    if (occlusionCulling)
+    {
+      culling.pyramidSize = glm::vec2(depthPyramid.getWidth(), depthPyramid.getHeight());
+      culling.pyramidLevels = depthPyramid.getLevelCount();
+    }
+    culling.lodScale = getLodScale();
+    culling.cameraPosition = glm::vec4(CAMERA_POSITION, 1.0f);
+    const uint32_t lodCount = getIndirectLodCount();
+    for (size_t lod = 0; lod < meshLods.size(); ++lod)
+    {
+      culling.lodErrors[lod / 4][lod % 4] = meshLods[lod].error;
+    }
+    for (uint32_t lod = 0; lod <= lodCount; ++lod)
+    {
+      culling.lodFirstDraws[lod / 4][lod % 4] = lodSubmeshes[lod];
+    }
+    culling.meshletCount = static_cast<uint32_t>(meshlets.size());
+    memcpy(frame.cullingMemory.mapped, &culling, sizeof(culling));
+
+    if (meshletCulling)
+    {
+      if (frame.meshletCountPending)
+      {
+        meshletsDrawn += *static_cast<const uint32_t*>(frame.meshletCountMemory.mapped);
+        meshletsTested += objectCount * meshlets.size();
+      }
+      frame.meshletCountPending = true;
+
+      // Visible meshlets are appended from the start. Without a draw count
+      // the draws after them are zeroed, so they draw nothing.
+      if (!drawIndirectCountEnabled)
+      {
+        vkCmdFillBuffer(commandBuffer, frame.drawCommandBuffer, 0, sizeof(VkDrawIndexedIndirectCommand) * objectCount * meshlets.size(), 0);
+      }
+      vkCmdFillBuffer(commandBuffer, frame.meshletCountBuffer, 0, sizeof(uint32_t), 0);
+    }
+    else
+    {
+      // Visible objects are counted into the instanceCount of every submesh
+      // of their LOD, whose transforms start at firstInstance
+      const uint32_t drawCount = lodSubmeshes[lodCount];
+      std::vector<VkDrawIndexedIndirectCommand> drawCommands(drawCount);
+      for (uint32_t lod = 0; lod < lodCount; ++lod)
+      {
+        for (uint32_t i = lodSubmeshes[lod]; i < lodSubmeshes[lod + 1]; ++i)
+        {
+          drawCommands[i].indexCount = submeshes[i].indexCount;
+          drawCommands[i].firstIndex = submeshes[i].firstIndex;
+          drawCommands[i].vertexOffset = submeshes[i].vertexOffset;
+          drawCommands[i].firstInstance = lod * objectCount;
+        }
+      }
+      vkCmdUpdateBuffer(commandBuffer, frame.drawCommandBuffer, 0, sizeof(drawCommands[0]) * drawCount, drawCommands.data());
+    }
+
+    VkMemoryBarrier resetBarrier = {};
+    resetBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      0,
+      1, &resetBarrier,
+      0, nullptr,
+      0, nullptr);
+
+    InstancePushConstants constants = {};
+    constants.time = animationTime;
+    constants.instanceCount = objectCount;
+    constants.lodCount = getSelectableLodCount(lodCount);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, meshletCulling ? meshletPipeline : instancePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, instancePipelineLayout, 0, 1, &frame.descriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, instancePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+    if (meshletCulling)
+    {
+      // One invocation per meshlet of every object
+      const uint32_t meshletCount = static_cast<uint32_t>(meshlets.size());
+      vkCmdDispatch(commandBuffer, (meshletCount + INSTANCE_WORKGROUP_SIZE - 1) / INSTANCE_WORKGROUP_SIZE, objectCount, 1);
+    }
+    else
+    {
+      vkCmdDispatch(commandBuffer, (objectCount + INSTANCE_WORKGROUP_SIZE - 1) / INSTANCE_WORKGROUP_SIZE, 1, 1);
+    }
+
+    // The depth tests also wait for the last frame's depth pyramid build to
+    // be done reading the depth buffer. The meshlet count is read back on
+    // the host.
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+      | (meshletCulling ? VK_ACCESS_HOST_READ_BIT : 0);
+
+    vkCmdPipelineBarrier(commandBuffer,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+        | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+        | (meshletCulling ? VK_PIPELINE_STAGE_HOST_BIT : 0),
+      0,
+      1, &barrier,
+      0, nullptr,
+      0, nullptr);
+  }
+
+  // Draws every object with one indirect draw per submesh of every LOD,
+  // straight into the primary command buffer
+  void recordIndirectDraw(VkCommandBuffer commandBuffer)
+  {
+    const FrameInstances& frame = frameInstances[currentFrame];
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, instancedPipeline);
+
+    VkViewport viewport = {};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)swapChainExtent.width;
+    viewport.height = (float)swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {};
+    scissor.offset = {0, 0};
+    scissor.extent = swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    bindVertexBuffers(commandBuffer);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+
+    // The instanced pipeline takes the transforms from set 1 and ignores
+    // the object uniforms
+    std::array<VkDescriptorSet, 2> sets = {descriptorSets[currentFrame], frame.descriptorSet};
+    std::array<uint32_t, 2> dynamicOffsets = {frameUniformOffset, objectUniformOffset};
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, static_cast<uint32_t>(sets.size()), sets.data(),
+      static_cast<uint32_t>(dynamicOffsets.size()), dynamicOffsets.data());
+
+    if (meshletCulling)
+    {
+      const uint32_t maxDrawCount = static_cast<uint32_t>(objectCount * meshlets.size());
+      if (drawIndirectCountEnabled)
+      {
+        cmdDrawIndexedIndirectCount(commandBuffer, frame.drawCommandBuffer, 0, frame.meshletCountBuffer, 0,
+          maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+      }
+      else
+      {
+        vkCmdDrawIndexedIndirect(commandBuffer, frame.drawCommandBuffer, 0, maxDrawCount, sizeof(VkDrawIndexedIndirectCommand));
+      }
+      return;
+    }
+
+    const uint32_t drawCount = lodSubmeshes[getIndirectLodCount()];
+    if (multiDrawIndirectEnabled)
+    {
+      vkCmdDrawIndexedIndirect(commandBuffer, frame.drawCommandBuffer, 0, drawCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+      for (uint32_t draw = 0; draw < drawCount; ++draw)
+      {
+        vkCmdDrawIndexedIndirect(commandBuffer, frame.drawCommandBuffer, draw * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+      }
+    }
+  }
+
+  void createCommandPool()
+  {
+    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+    poolInfo.flags = 0; // Optional
+
+    if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create command pool!" << std::endl;
+      throw std::runtime_error("Failed to create command pool!");
+    }
+  }
+
+  void createFrameProfilerSlots()
+  {
+    frameProfilerSlots.clear();
+    for (uint32_t i = 0; i < framesInFlight; ++i)
+    {
+      frameProfilerSlots.push_back(gpuProfiler.createSlot(graphicsQueueFamily, "graphics"));
+    }
+  }
+
+  void createFramebuffers()
+  {
+    swapChainFramebuffers.resize(swapChainImageViews.size());
+
+    for (size_t i = 0; i < swapChainImageViews.size(); ++i)
+    {
+      std::array<VkImageView, 3> attachments = {
+          colorImageView,
+          depthImageView,
+          swapChainImageViews[i]
+      };
+
+      VkFramebufferCreateInfo framebufferInfo = {};
+      framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+      framebufferInfo.renderPass = renderPass;
+      framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+      framebufferInfo.pAttachments = attachments.data();
+      framebufferInfo.width = swapChainExtent.width;
+      framebufferInfo.height = swapChainExtent.height;
+      framebufferInfo.layers = 1;
+
+      if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS)
+      {
+        std::cerr << "ERROR: Failed to create framebuffer!" << std::endl;
+        throw std::runtime_error("Failed to create framebuffer!");
+      }
+    }
+  }
+
+  void createRenderPass()
+  {
+    VkAttachmentDescription colorAttachment = {};
+    colorAttachment.format = swapChainImageFormat;
+    colorAttachment.samples = msaaSamples;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference colorAttachmentRef = {};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = findDepthFormat();
+    depthAttachment.samples = msaaSamples;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = occlusionCulling ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription colorAttachmentResolve = {};
+    colorAttachmentResolve.format = swapChainImageFormat;
+    colorAttachmentResolve.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachmentResolve.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentResolve.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    // Offscreen images are never presented, leave them ready to be read back
+    colorAttachmentResolve.finalLayout = options.headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    VkAttachmentReference colorAttachmentResolveRef = {};
+    colorAttachmentResolveRef.attachment = 2;
+    colorAttachmentResolveRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+    subpass.pResolveAttachments = &colorAttachmentResolveRef;
+
+    VkSubpassDependency dependency = {};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstAccessMask =
+      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    std::array<VkAttachmentDescription, 3> attachments = {colorAttachment, depthAttachment, colorAttachmentResolve};
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+    renderPassInfo.pAttachments = attachments.data();
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = 1;
+    renderPassInfo.pDependencies = &dependency;
+
+    if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create render pass!" << std::endl;
+      throw std::runtime_error("Failed to create render pass!");
+    }
+    std::cerr << "INFO: Created render pass" << std::endl;
+  }
+
+  // The SPIR-V the graphics pipelines are built from, with the sources and
+  // defines shaders/compile.bat compiles it from. Packed vertices have their
+  // own vertex shaders, which also need to know whether there is a color
+  // stream.
+  std::array<ShaderProgram, 3> getGraphicsShaderPrograms() const
+  {
+    std::string vertShaderName = "vert";
+    std::vector<std::string> defines;
+    if (vertexFormat == VertexFormat::Packed)
+    {
+      vertShaderName = packedLayout.hasColors ? "packed_colors_vert" : "packed_vert";
+      defines.push_back("PACKED_VERTICES");
+      if (packedLayout.hasColors)
+      {
+        defines.push_back("VERTEX_COLORS");
+      }
+    }
+
+    std::array<ShaderProgram, 3> programs = {};
+    programs[0] = {"shaders/shader.vert", "shaders/" + vertShaderName + ".spv", defines};
+    programs[1] = {"shaders/instanced.vert", "shaders/instanced_" + vertShaderName + ".spv", defines};
+    if (virtualTexturing)
+    {
+      programs[2] = {"shaders/virtual.frag", "shaders/virtual_frag.spv", {}};
+    }
+    else
+    {
+      programs[2] = {"shaders/shader.frag", "shaders/frag.spv", {}};
+    }
+    return programs;
+  }
+
+  // Loose shaders bypass the asset archive, for shaders a reload rewrote
+  void createGraphicsPipeline(bool looseShaders = false)
+  {
+    // Set 1 is only used by the instanced pipeline
+    std::array<VkDescriptorSetLayout, 2> setLayouts = {descriptorSetLayout, instanceSetLayout};
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create pipeline layout!" << std::endl;
+      throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    const std::array<ShaderProgram, 3> programs = getGraphicsShaderPrograms();
+    auto compileStart = BenchmarkClock::now();
+    auto load = [this, looseShaders](const std::string& path)
+    {
+      return looseShaders ? loadLooseAsset(path) : loadAsset(path);
+    };
+    std::array<VkPipeline, 2> pipelines = buildGraphicsPipelines(load(programs[0].output),
+      load(programs[1].output), load(programs[2].output));
+    graphicsPipeline = pipelines[0];
+    instancedPipeline = pipelines[1];
+    std::cerr << "INFO: Created graphics pipelines in "
+      << elapsedMilliseconds(compileStart, BenchmarkClock::now()) << " ms ("
+      << (pipelineCacheWarm ? "warm" : "cold") << " pipeline cache)" << std::endl;
+    // Whatever was compiled now is in the cache, so any later rebuild is warm
+    pipelineCacheWarm = true;
+  }
+
+  // Builds the regular and the instanced pipeline against the pipeline
+  // cache. Only reads state that is fixed while frames are drawn, so shader
+  // reloads call it from their own thread.
+  std::array<VkPipeline, 2> buildGraphicsPipelines(const Asset& vertShaderCode, const Asset& instancedVertShaderCode,
+    const Asset& fragShaderCode)
+  {
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.minDepthBounds = 0.0f; // Optional
+    depthStencil.maxDepthBounds = 1.0f; // Optional
+    depthStencil.stencilTestEnable = VK_FALSE;
+    depthStencil.front = {}; // Optional
+    depthStencil.back = {}; // Optional
+
+    VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+    VkShaderModule instancedVertShaderModule = createShaderModule(instancedVertShaderCode);
+    VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStageInfo.module = vertShaderModule;
+    vertShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStageInfo.module = fragShaderModule;
+    fragShaderStageInfo.pName = "main";
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+    VkPipelineShaderStageCreateInfo instancedShaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    instancedShaderStages[0].module = instancedVertShaderModule;
+
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions;
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+    if (vertexFormat == VertexFormat::Packed)
+    {
+      bindingDescriptions = PackedVertex::getBindingDescriptions(packedLayout.hasColors);
+      attributeDescriptions = PackedVertex::getAttributeDescriptions(packedLayout.hasColors, packedLayout.texCoordFormat);
+    }
+    else
+    {
+      auto vertexAttributes = Vertex::getAttributeDescriptions();
+      bindingDescriptions = {Vertex::getBindingDescription()};
+      attributeDescriptions.assign(vertexAttributes.begin(), vertexAttributes.end());
+    }
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    // Viewport and scissor are set while recording, so the pipeline does not
+    // depend on the swap chain extent and survives a resize
     VkPipelineViewportStateCreateInfo viewportState = {};
     viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
     viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
+    viewportState.pViewports = nullptr;
     viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    viewportState.pScissors = nullptr;
+
+    std::array<VkDynamicState, 2> dynamicStates = {
+      VK_DYNAMIC_STATE_VIEWPORT,
+      VK_DYNAMIC_STATE_SCISSOR
+    };
+
+    VkPipelineDynamicStateCreateInfo dynamicState = {};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+    dynamicState.pDynamicStates = dynamicStates.data();
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
+    rasterizer.depthBiasClamp = 0.0f; // Optional
+    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_TRUE; // enable sample shading in the pipeline
+    multisampling.rasterizationSamples = msaaSamples;
+    multisampling.minSampleShading = .2f; // min fraction for sample shading; closer to one is smoother
+    multisampling.pSampleMask = nullptr; // Optional
+    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
+    multisampling.alphaToOneEnable = VK_FALSE; // Optional
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+    colorBlendAttachment.colorWriteMask =
+      VK_COLOR_COMPONENT_R_BIT |
+      VK_COLOR_COMPONENT_G_BIT |
+      VK_COLOR_COMPONENT_B_BIT |
+      VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+
+    VkPipelineColorBlendStateCreateInfo colorBlending = {};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
+    colorBlending.attachmentCount = 1;
+    colorBlending.pAttachments = &colorBlendAttachment;
+    colorBlending.blendConstants[0] = 0.0f; // Optional
+    colorBlending.blendConstants[1] = 0.0f; // Optional
+    colorBlending.blendConstants[2] = 0.0f; // Optional
+    colorBlending.blendConstants[3] = 0.0f; // Optional
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.pVertexInputState = &vertexInputInfo;
+    pipelineInfo.pInputAssemblyState = &inputAssembly;
+    pipelineInfo.pViewportState = &viewportState;
+    pipelineInfo.pRasterizationState = &rasterizer;
+    pipelineInfo.pMultisampleState = &multisampling;
+    pipelineInfo.pDepthStencilState = &depthStencil;
+    pipelineInfo.pColorBlendState = &colorBlending;
+    pipelineInfo.pDynamicState = &dynamicState;
+    pipelineInfo.layout = pipelineLayout;
+    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.subpass = 0;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
+    pipelineInfo.basePipelineIndex = -1; // Optional
+
+    // The instanced pipeline only differs in where the transforms come from
+    std::array<VkGraphicsPipelineCreateInfo, 2> pipelineInfos = {pipelineInfo, pipelineInfo};
+    pipelineInfos[1].pStages = instancedShaderStages;
+
+    std::array<VkPipeline, 2> pipelines = {};
+    VkResult result = vkCreateGraphicsPipelines(device, pipelineCache, static_cast<uint32_t>(pipelineInfos.size()), pipelineInfos.data(), nullptr, pipelines.data());
+
+    vkDestroyShaderModule(device, fragShaderModule, nullptr);
+    vkDestroyShaderModule(device, instancedVertShaderModule, nullptr);
+    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+    if (result != VK_SUCCESS)
+    {
+      for (VkPipeline pipeline : pipelines)
+      {
+        vkDestroyPipeline(device, pipeline, nullptr);
+      }
+      std::cerr << "ERROR: Failed to create graphics pipeline!" << std::endl;
+      throw std::runtime_error("Failed to create graphics pipeline!");
+    }
+    return pipelines;
+  }
+
+  // Rebuilds the graphics pipelines in the background whenever one of their
+  // shaders is saved, see updateShaderReload()
+  void startShaderReload()
+  {
+    const std::array<ShaderProgram, 3> programs = getGraphicsShaderPrograms();
+    shaderReloader.start(device, std::vector<ShaderProgram>(programs.begin(), programs.end()), [this, programs]()
+    {
+      // Always the loose files the reloader just wrote, even with an archive
+      std::array<VkPipeline, 2> pipelines = buildGraphicsPipelines(loadLooseAsset(programs[0].output),
+        loadLooseAsset(programs[1].output), loadLooseAsset(programs[2].output));
+      return std::vector<VkPipeline>(pipelines.begin(), pipelines.end());
+    });
+  }
+
+  // Swaps in pipelines a shader reload finished, between frames. Frames
+  // still in flight keep the ones they were recorded with, which are
+  // destroyed once those frames have completed.
+  void updateShaderReload()
+  {
+    while (!retiredPipelines.empty() && retiredPipelines.front().destroyFrame <= frameScheduler.getFrameNumber())
+    {
+      vkDestroyPipeline(device, retiredPipelines.front().pipeline, nullptr);
+      retiredPipelines.pop_front();
+    }
+
+    std::vector<VkPipeline> pipelines = shaderReloader.poll();
+    if (pipelines.empty())
+    {
+      return;
+    }
+
+    const uint64_t destroyFrame = frameScheduler.getFrameNumber() + framesInFlight;
+    retiredPipelines.push_back({graphicsPipeline, destroyFrame});
+    retiredPipelines.push_back({instancedPipeline, destroyFrame});
+    graphicsPipeline = pipelines[0];
+    instancedPipeline = pipelines[1];
+  }
+
+  void createInstancePipeline()
+  {
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(InstancePushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &instanceSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &instancePipelineLayout) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create pipeline layout!" << std::endl;
+      throw std::runtime_error("Failed to create pipeline layout!");
+    }
+
+    instancePipeline = createInstanceComputePipeline(occlusionCulling ? "shaders/instances_occlusion_comp.spv" : "shaders/instances_comp.spv");
+    if (meshletCulling)
+    {
+      meshletPipeline = createInstanceComputePipeline(occlusionCulling ? "shaders/meshlets_occlusion_comp.spv" : "shaders/meshlets_comp.spv");
+    }
+
+    if (occlusionCulling)
+    {
+      auto depthReduceCode = loadAsset(msaaSamples != VK_SAMPLE_COUNT_1_BIT ? "shaders/depth_reduce_ms_comp.spv" : "shaders/depth_reduce_comp.spv");
+      auto levelReduceCode = loadAsset("shaders/depth_reduce_comp.spv");
+      depthPyramid.init(device, allocator, pipelineCache, depthReduceCode, levelReduceCode);
+    }
+  }
+
+  VkPipeline createInstanceComputePipeline(const std::string& path)
+  {
+    auto compShaderCode = loadAsset(path);
+    VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = instancePipelineLayout;
+
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create compute pipeline!" << std::endl;
+      throw std::runtime_error("Failed to create compute pipeline!");
+    }
+
+    vkDestroyShaderModule(device, compShaderModule, nullptr);
+    return pipeline;
+  }
+
+  // Occlusion culling samples the depth buffer, which its format and sample
+  // count have to support
+  void chooseOcclusionCulling()
+  {
+    if (!options.occlusionCulling)
+    {
+      return;
+    }
+
+    if (!indirectDraws)
+    {
+      std::cerr << "WARNING: Occlusion culling needs indirect draws, it is disabled" << std::endl;
+      return;
+    }
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, findDepthFormat(), &formatProperties);
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+      || !(deviceProperties.limits.sampledImageDepthSampleCounts & msaaSamples))
+    {
+      std::cerr << "WARNING: The depth buffer cannot be sampled, occlusion culling is disabled" << std::endl;
+      return;
+    }
+
+    occlusionCulling = true;
+  }
+
+  // Recreated with the depth buffer. Until the first frame builds it, the
+  // pyramid holds the far plane everywhere and hides nothing.
+  void createDepthPyramid()
+  {
+    if (!occlusionCulling)
+    {
+      return;
+    }
+
+    depthPyramid.create(depthImage, depthImageView, findDepthFormat(), msaaSamples, swapChainExtent);
+
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    depthPyramid.recordClear(commandBuffer);
+    endSingleTimeCommands(commandBuffer);
+
+    VkDescriptorImageInfo imageInfo = {};
+    imageInfo.sampler = depthPyramid.getSampler();
+    imageInfo.imageView = depthPyramid.getView();
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    for (auto& frame : frameInstances)
+    {
+      VkWriteDescriptorSet descriptorWrite = {};
+      descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      descriptorWrite.dstSet = frame.descriptorSet;
+      descriptorWrite.dstBinding = 4;
+      descriptorWrite.dstArrayElement = 0;
+      descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      descriptorWrite.descriptorCount = 1;
+      descriptorWrite.pImageInfo = &imageInfo;
+
+      vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    }
+  }
+
+  void createPipelineCache()
+  {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    pipelineCache = loadPipelineCache(device, deviceProperties, PIPELINE_CACHE_PATH, pipelineCacheWarm);
+  }
+
+  void destroyPipelineCache()
+  {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    savePipelineCache(device, pipelineCache, deviceProperties, PIPELINE_CACHE_PATH);
+
+    vkDestroyPipelineCache(device, pipelineCache, nullptr);
+    pipelineCache = VK_NULL_HANDLE;
+  }
+
+  VkShaderModule createShaderModule(const Asset& code)
+  {
+    VkShaderModuleCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    createInfo.codeSize = code.size();
+    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+    VkShaderModule shaderModule;
+    if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create shader module!" << std::endl;
+      throw std::runtime_error("Failed to create shader module!");
+    }
+
+    return shaderModule;
+  }
+
+  void createImageViews()
+  {
+    swapChainImageViews.resize(swapChainImages.size());
+
+    for (size_t i = 0; i < swapChainImages.size(); ++i)
+    {
+      swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+    }
+    std::cerr << "INFO: Image views created" << std::endl;
+  }
+
+  void createOffscreenImages()
+  {
+    swapChainImageFormat = findSupportedFormat(
+      {VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM},
+      VK_IMAGE_TILING_OPTIMAL,
+      VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT
+    );
+    swapChainExtent = offscreenExtent;
+
+    // One image more than frames in flight, like a triple buffered swap chain
+    size_t imageCount = framesInFlight + 1;
+    swapChainImages.resize(imageCount);
+    offscreenImagesMemory.resize(imageCount);
+
+    for (size_t i = 0; i < imageCount; ++i)
+    {
+      createImage(swapChainExtent.width, swapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+        VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        swapChainImages[i], offscreenImagesMemory[i]);
+    }
+    offscreenImageIndex = 0;
+
+    std::cerr << "INFO: Offscreen images created" << std::endl;
+  }
+
+  void createSwapChain()
+  {
+    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+
+    VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
+    VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+    VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+
+    uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+    {
+      imageCount = swapChainSupport.capabilities.maxImageCount;
+    }
+
+    VkSwapchainCreateInfoKHR createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    createInfo.surface = surface;
+    createInfo.minImageCount = imageCount;
+    createInfo.imageFormat = surfaceFormat.format;
+    createInfo.imageColorSpace = surfaceFormat.colorSpace;
+    createInfo.imageExtent = extent;
+    createInfo.imageArrayLayers = 1;
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+
+    if (indices.graphicsFamily == indices.presentFamily)
+    {
+      createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+      createInfo.queueFamilyIndexCount = 0; // Optional
+      createInfo.pQueueFamilyIndices = nullptr;
+    }
+    else
+    {
+      createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+      createInfo.queueFamilyIndexCount = 2;
+      createInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+
+    createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+    createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    createInfo.presentMode = presentMode;
+    createInfo.clipped = VK_TRUE;
+    // Handing over the old swap chain lets the driver reuse its resources
+    VkSwapchainKHR oldSwapChain = swapChain;
+    createInfo.oldSwapchain = oldSwapChain;
+
+    if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Could not create swap chain!" << std::endl;
+      throw std::runtime_error("Could not create swap chain!");
+    }
+    std::cerr << "INFO: Swap chain created" << std::endl;
+
+    if (oldSwapChain != VK_NULL_HANDLE)
+    {
+      vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+    }
+
+    vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+    swapChainImages.resize(imageCount);
+    vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+
+    swapChainImageFormat = surfaceFormat.format;
+    swapChainExtent = extent;
+  }
+
+  VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+  {
+    if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED)
+    {
+      return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+    }
+
+    for (const auto& availableFormat : availableFormats)
+    {
+      if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+      {
+        return availableFormat;
+      }
+    }
+
+    return availableFormats[0];
+  }
+
+  VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+  {
+    VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
+
+    for (const auto& availablePresentMode : availablePresentModes)
+    {
+      if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+      {
+        return availablePresentMode;
+      }
+      else if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+      {
+        bestMode = availablePresentMode;
+      }
+    }
+
+    return bestMode;
+  }
+
+  VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+  {
+    if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+    {
+      return capabilities.currentExtent;
+    }
+    else
+    {
+      int width, height;
+      glfwGetFramebufferSize(window, &width, &height);
+
+      VkExtent2D actualExtent = {
+          static_cast<uint32_t>(width),
+          static_cast<uint32_t>(height)
+      };
+
+      actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
+      actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
+
+      return actualExtent;
+    }
+  }
+
+  SwapChainSupportDetails querySwapChainSupport(const VkPhysicalDevice device)
+  {
+    SwapChainSupportDetails details;
+
+    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+
+    uint32_t formatCount = 0;
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+
+    if (formatCount != 0)
+    {
+      details.formats.resize(formatCount);
+      vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
+    }
+
+    uint32_t presentModeCount = 0;
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+
+    if (presentModeCount != 0)
+    {
+      details.presentModes.resize(presentModeCount);
+      vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+    }
+
+
+
+    return details;
+  }
+
+  void createSurface()
+  {
+    if (options.headless)
+    {
+      return;
+    }
+
+    if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Could not create window surface!" << std::endl;
+      throw std::runtime_error("Could not create window surface!");
+    }
+  }
+
+  std::vector<const char*> getDeviceExtensions()
+  {
+    if (options.headless)
+    {
+      return {};
+    }
+
+    return swapChainExtensions;
+  }
+
+  void createLogicalDevice()
+  {
+    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+    std::set<uint32_t> uniqueQueueFamilies = {
+      indices.graphicsFamily.value(),
+      indices.presentFamily.value(),
+      indices.transferFamily.value()
+    };
+
+    float queuePriority = 1.0f;
+    for (const uint32_t queueFamily : uniqueQueueFamilies)
+    {
+      VkDeviceQueueCreateInfo queueCreateInfo = {};
+      queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queueCreateInfo.queueFamilyIndex = queueFamily;
+      queueCreateInfo.queueCount = 1;
+      queueCreateInfo.pQueuePriorities = &queuePriority;
+      queueCreateInfos.push_back(queueCreateInfo);
+    }
+
+    VkPhysicalDeviceFeatures deviceFeatures = {};
+    deviceFeatures.samplerAnisotropy = VK_TRUE;
+    deviceFeatures.sampleRateShading = VK_TRUE; // enable sample shading feature for the device
+
+    // Block compressed textures are used when the device can sample them
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+
+    // Pipeline statistics of the render pass are only collected if the
+    // secondary command buffers drawing it can inherit the query
+    pipelineStatisticsEnabled = supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
+    deviceFeatures.pipelineStatisticsQuery = pipelineStatisticsEnabled ? VK_TRUE : VK_FALSE;
+    deviceFeatures.inheritedQueries = pipelineStatisticsEnabled ? VK_TRUE : VK_FALSE;
+
+    drawIndirectFirstInstanceEnabled = supportedFeatures.drawIndirectFirstInstance == VK_TRUE;
+    multiDrawIndirectEnabled = supportedFeatures.multiDrawIndirect == VK_TRUE;
+    deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+    deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+
+    if (!options.virtualTexturePath.empty())
+    {
+      virtualTexturing = supportedFeatures.fragmentStoresAndAtomics == VK_TRUE;
+      deviceFeatures.fragmentStoresAndAtomics = supportedFeatures.fragmentStoresAndAtomics;
+      if (!virtualTexturing)
+      {
+        std::cerr << "WARNING: Virtual texturing needs fragmentStoresAndAtomics, drawing the regular texture" << std::endl;
+      }
+    }
+
+    VkDeviceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+    createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
-    VkPipelineRasterizationStateCreateInfo rasterizer = {};
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-    rasterizer.depthBiasClamp = 0.0f; // Optional
-    rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
+    createInfo.pEnabledFeatures = &deviceFeatures;
 
-    VkPipelineMultisampleStateCreateInfo multisampling = {};
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_TRUE; // enable sample shading in the pipeline
-    multisampling.rasterizationSamples = msaaSamples;
-    multisampling.minSampleShading = .2f; // min fraction for sample shading; closer to one is smoother
-    multisampling.pSampleMask = nullptr; // Optional
-    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-    multisampling.alphaToOneEnable = VK_FALSE; // Optional
+    auto deviceExtensions = getDeviceExtensions();
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-    colorBlendAttachment.colorWriteMask =
-      VK_COLOR_COMPONENT_R_BIT |
-      VK_COLOR_COMPONENT_G_BIT |
-      VK_COLOR_COMPONENT_B_BIT |
-      VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
+    // Host query reset lets the profiler measure work on transfer-only queues,
+    // which cannot reset queries in a command buffer
+    VkPhysicalDeviceHostQueryResetFeaturesEXT hostQueryResetFeatures = {};
+    hostQueryResetFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
+    hostQueryResetFeatures.hostQueryReset = VK_TRUE;
+    hostQueryResetEnabled = isDeviceExtensionSupported(physicalDevice, VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+    if (hostQueryResetEnabled)
+    {
+      deviceExtensions.push_back(VK_EXT_HOST_QUERY_RESET_EXTENSION_NAME);
+      hostQueryResetFeatures.pNext = const_cast<void*>(createInfo.pNext);
+      createInfo.pNext = &hostQueryResetFeatures;
+    }
 
-    VkPipelineColorBlendStateCreateInfo colorBlending = {};
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f; // Optional
-    colorBlending.blendConstants[1] = 0.0f; // Optional
-    colorBlending.blendConstants[2] = 0.0f; // Optional
-    colorBlending.blendConstants[3] = 0.0f; // Optional
+    // Frames are paced on a timeline semaphore where there is one. The
+    // extension needs Vulkan 1.1 or VK_KHR_get_physical_device_properties2.
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+    timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+    timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+    timelineSemaphoresEnabled = deviceProperties.apiVersion >= VK_API_VERSION_1_1
+      && isDeviceExtensionSupported(physicalDevice, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    if (timelineSemaphoresEnabled)
+    {
+      deviceExtensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+      timelineSemaphoreFeatures.pNext = const_cast<void*>(createInfo.pNext);
+      createInfo.pNext = &timelineSemaphoreFeatures;
+    }
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+    // Vulkan 1.2 made the draw count core, but the instance asks for 1.1,
+    // so it is taken from the extension, which drivers keep exposing
+    drawIndirectCountEnabled = (options.meshletCulling || options.benchmark == "meshlets")
+      && isDeviceExtensionSupported(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawIndirectCountEnabled)
+    {
+      deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
 
-    if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+
+    if (enableValidationLayers)
     {
-      std::cerr << "ERROR: Failed to create pipeline layout!" << std::endl;
-      throw std::runtime_error("Failed to create pipeline layout!");
+      createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+      createInfo.ppEnabledLayerNames = validationLayers.data();
+    }
+    else
+    {
+      createInfo.enabledLayerCount = 0;
     }
 
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = shaderStages;
-    pipelineInfo.pVertexInputState = &vertexInputInfo;
-    pipelineInfo.pInputAssemblyState = &inputAssembly;
-    pipelineInfo.pViewportState = &viewportState;
-    pipelineInfo.pRasterizationState = &rasterizer;
-    pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = &depthStencil;
-    pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pDynamicState = nullptr; // Optional
-    pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
-    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-    pipelineInfo.basePipelineIndex = -1; // Optional
+    if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Could not create logical device!" << std::endl;
+      throw std::runtime_error("Could not create logical device!");
+    }
 
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
+    vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+    vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+    if (drawIndirectCountEnabled)
     {
-      std::cerr << "ERROR: Failed to create graphics pipeline!" << std::endl;
-      throw std::runtime_error("Failed to create graphics pipeline!");
+      cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+        vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+      drawIndirectCountEnabled = cmdDrawIndexedIndirectCount != nullptr;
     }
-    std::cerr << "INFO: Created graphics pipeline" << std::endl;
+    graphicsQueueFamily = indices.graphicsFamily.value();
+    transferQueueFamily = indices.transferFamily.value();
+  }
 
-    vkDestroyShaderModule(device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(device, vertShaderModule, nullptr);
+  QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
+  {
+    QueueFamilyIndices indices;
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+    int i = 0;
+    for (const auto& queueFamily : queueFamilies)
+    {
+      if (queueFamily.queueCount > 0)
+      {
+        // The instance update runs on the graphics queue. Vulkan guarantees
+        // a family with both if there is one with graphics.
+        if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))
+        {
+          indices.graphicsFamily = i;
+        }
+
+        if (options.headless)
+        {
+          // Nothing is presented, so the graphics queue stands in for the present queue
+          indices.presentFamily = indices.graphicsFamily;
+        }
+        else
+        {
+          VkBool32 presentSupport = false;
+          vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+          if (presentSupport)
+          {
+            indices.presentFamily = i;
+          }
+        }
+      }
+
+      if (indices.isComplete())
+      {
+        break;
+      }
+
+      ++i;
+    }
+
+    // Transfer-only families are usually backed by dedicated copy engines
+    // that run alongside graphics work
+    for (uint32_t family = 0; family < queueFamilyCount; ++family)
+    {
+      VkQueueFlags flags = queueFamilies[family].queueFlags;
+      if (queueFamilies[family].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT)
+        && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+      {
+        indices.transferFamily = family;
+        break;
+      }
+    }
+    if (!indices.transferFamily.has_value())
+    {
+      indices.transferFamily = indices.graphicsFamily;
+    }
+
+    return indices;
   }
 
-  VkShaderModule createShaderModule(const std::vector<char>& code)
+  void choosePhysicalDevice()
   {
-    VkShaderModuleCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    createInfo.codeSize = code.size();
-    createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+    if (deviceCount == 0)
+    {
+      std::cerr << "ERROR: No Vulkan physical devices found!" << std::endl;
+      throw std::runtime_error("No Vulkan physical devices found!");
+    }
+
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+    for (const auto& device : devices)
+    {
+      if (isDeviceSuitable(device))
+      {
+        physicalDevice = device;
+        msaaSamples = getMaxUsableSampleCount();
+        break;
+      }
+    }
+
+    if (physicalDevice == VK_NULL_HANDLE)
+    {
+      std::cerr << "ERROR: No suitable Vulkan physical device found!" << std::endl;
+      throw std::runtime_error("No suitable Vulkan physical device found!");
+    }
+    std::cerr << "INFO: Physical device chosen" << std::endl;
+  }
+
+  VkSampleCountFlagBits getMaxUsableSampleCount()
+  {
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+
+    VkSampleCountFlags counts = std::min(physicalDeviceProperties.limits.framebufferColorSampleCounts, physicalDeviceProperties.limits.framebufferDepthSampleCounts);
+    if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
+    if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
+    if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
+    if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
+    if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
+    if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+
+    return VK_SAMPLE_COUNT_1_BIT;
+  }
+
+  bool isDeviceSuitable(const VkPhysicalDevice device)
+  {
+    VkPhysicalDeviceProperties deviceProperties;
+    VkPhysicalDeviceFeatures deviceFeatures;
+
+    vkGetPhysicalDeviceProperties(device, &deviceProperties);
+    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+
+    QueueFamilyIndices indices = findQueueFamilies(device);
+
+    auto extensionsSupported = checkDeviceExtensionsSupported(device);
+    bool swapChainAdequate = false;
+    if (extensionsSupported && options.headless)
+    {
+      swapChainAdequate = true;
+    }
+    else if (extensionsSupported)
+    {
+      SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
+      swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+    }
+
+    // Headless runs must also work on software implementations such as lavapipe
+    bool deviceTypeSupported = options.headless || deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU;
+
+    return deviceTypeSupported
+      && indices.isComplete()
+      && extensionsSupported
+      && swapChainAdequate
+      && deviceFeatures.samplerAnisotropy;
+  }
+
+  bool checkDeviceExtensionsSupported(const VkPhysicalDevice device)
+  {
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    auto deviceExtensions = getDeviceExtensions();
+    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+
+    for (const auto& extension : availableExtensions)
+    {
+      requiredExtensions.erase(extension.extensionName);
+    }
+
+    return requiredExtensions.empty();
+  }
+
+  bool isDeviceExtensionSupported(const VkPhysicalDevice device, const char* name)
+  {
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+    for (const auto& extension : availableExtensions)
+    {
+      if (strcmp(extension.extensionName, name) == 0)
+      {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void setupDebugCallback()
+  {
+    if (!enableValidationLayers)
+    {
+      return;
+    }
+
+    VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+    createInfo.messageSeverity =
+      VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+      VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+      VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+    createInfo.messageType =
+      VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+      VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+      VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+    createInfo.pfnUserCallback = debugCallback;
+    createInfo.pUserData = nullptr; // Optional
 
-    VkShaderModule shaderModule;
-    if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+    if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS)
     {
-      std::cerr << "ERROR: Failed to create shader module!" << std::endl;
-      throw std::runtime_error("Failed to create shader module!");
+      std::cerr << "ERROR: Failed to set up the debug messenger!" << std::endl;
+      throw std::runtime_error("Failed to set up the debug messenger!");
     }
-
-    return shaderModule;
   }
 
-  void createImageViews()
+  void createInstance()
   {
-    swapChainImageViews.resize(swapChainImages.size());
-
-    for (size_t i = 0; i < swapChainImages.size(); ++i)
+    if (enableValidationLayers && !checkValidationLayerSupport())
     {
-      swapChainImageViews[i] = createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, 1);
+      std::cerr << "ERROR: Missing validation layers!" << std::endl;
+      throw std::runtime_error("Missing validation layers!");
     }
-    std::cerr << "INFO: Image views created" << std::endl;
-  }
 
-  void createSwapChain()
-  {
-    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+    // This is technically optional but provides useful information for the
+    // driver to optimize for our specific application
+    VkApplicationInfo appInfo = {};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Hello Triangle";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_API_VERSION_1_1;
 
-    VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-    VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-    VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+    // Required
+    VkInstanceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
 
-    uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-    if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
+    auto requiredExtensions = getRequiredExtensions();
+
+    auto availableExtensions = getVkExtensions();
+    printVkExtensions(availableExtensions);
+    if (!checkVkExtensions(availableExtensions, requiredExtensions))
     {
-      imageCount = swapChainSupport.capabilities.maxImageCount;
+      std::cerr << "ERROR: Missing extension" << std::endl;
+      throw std::runtime_error("Missing extension");
     }
+    std::cerr << "INFO: All " << requiredExtensions.size() << " required extensions present" << std::endl;
 
-    VkSwapchainCreateInfoKHR createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    createInfo.surface = surface;
-    createInfo.minImageCount = imageCount;
-    createInfo.imageFormat = surfaceFormat.format;
-    createInfo.imageColorSpace = surfaceFormat.colorSpace;
-    createInfo.imageExtent = extent;
-    createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-    uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
+    createInfo.ppEnabledExtensionNames = requiredExtensions.data();
 
-    if (indices.graphicsFamily == indices.presentFamily)
+    // Enable validation layers
+    if (enableValidationLayers)
     {
-      createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-      createInfo.queueFamilyIndexCount = 0; // Optional
-      createInfo.pQueueFamilyIndices = nullptr;
+      std::cerr << "INFO: Enabling " << validationLayers.size()
+        << " validation layer" << (validationLayers.size() <= 1 ? "" : "s")
+        << std::endl;
+      createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+      createInfo.ppEnabledLayerNames = validationLayers.data();
     }
     else
     {
-      createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-      createInfo.queueFamilyIndexCount = 2;
-      createInfo.pQueueFamilyIndices = queueFamilyIndices;
+      createInfo.enabledLayerCount = 0;
     }
 
-    createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-    createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    createInfo.presentMode = presentMode;
-    createInfo.clipped = VK_TRUE;
-    createInfo.oldSwapchain = nullptr;
-
-    if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS)
+    VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
+    if (result != VK_SUCCESS)
     {
-      std::cerr << "ERROR: Could not create swap chain!" << std::endl;
-      throw std::runtime_error("Could not create swap chain!");
+      std::cerr << "ERROR: Failed to create a Vulkan instance: " << result << std::endl;
+      throw std::runtime_error("Failed to create Vulkan instance!");
     }
-    std::cerr << "INFO: Swap chain created" << std::endl;
-
-    vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-    swapChainImages.resize(imageCount);
-    vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
-
-    swapChainImageFormat = surfaceFormat.format;
-    swapChainExtent = extent;
   }
 
-  VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
+  bool checkValidationLayerSupport()
   {
-    if (availableFormats.size() == 1 && availableFormats[0].format == VK_FORMAT_UNDEFINED)
+    uint32_t layerCount = 0;
+    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+    std::vector<VkLayerProperties> layers(layerCount);
+    vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+
+    std::unordered_set<std::string> availableLayers;
+    for (const auto& layer : layers)
     {
-      return {VK_FORMAT_B8G8R8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+      availableLayers.insert(layer.layerName);
     }
 
-    for (const auto& availableFormat : availableFormats)
+    bool layersPresent = true;
+    for (const auto validationLayer : validationLayers)
     {
-      if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+      if (availableLayers.find(validationLayer) == availableLayers.end())
       {
-        return availableFormat;
+        std::cerr << "WARNING: " << validationLayer << " is missing" << std::endl;
+        layersPresent = false;
       }
     }
 
-    return availableFormats[0];
+    return layersPresent;
   }
 
-  VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
+  static std::string getSeverityFromFlag(const VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity)
   {
-    VkPresentModeKHR bestMode = VK_PRESENT_MODE_FIFO_KHR;
+    static const std::unordered_map<VkDebugUtilsMessageSeverityFlagBitsEXT, std::string> severityToString = {
+      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,   "ERROR"},
+      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "WARNING"},
+      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,    "INFO"},
+      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "VERBOSE"},
+    };
 
-    for (const auto& availablePresentMode : availablePresentModes)
+    const auto value = severityToString.find(messageSeverity);
+    if (value == severityToString.end())
     {
-      if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-      {
-        return availablePresentMode;
-      }
-      else if (availablePresentMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
-      {
-        bestMode = availablePresentMode;
-      }
+      return "UNKNOWN";
+    }
+    else
+    {
+      return value->second;
     }
-
-    return bestMode;
   }
 
-  VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilities)
+  static std::string getTypeFromFlag(const VkDebugUtilsMessageTypeFlagsEXT messageType)
   {
-    if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
+    static const std::unordered_map<VkDebugUtilsMessageTypeFlagsEXT, std::string> typeToString = {
+      {VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT,     "GENERAL"},
+      {VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT,  "VALIDATION"},
+      {VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT, "PERFORMANCE"},
+    };
+
+    const auto value = typeToString.find(messageType);
+    if (value == typeToString.end())
     {
-      return capabilities.currentExtent;
+      return "UNKNOWN";
     }
     else
     {
-      int width, height;
-      glfwGetFramebufferSize(window, &width, &height);
-
-      VkExtent2D actualExtent = {
-          static_cast<uint32_t>(width),
-          static_cast<uint32_t>(height)
-      };
-
-      actualExtent.width = std::max(capabilities.minImageExtent.width, std::min(capabilities.maxImageExtent.width, actualExtent.width));
-      actualExtent.height = std::max(capabilities.minImageExtent.height, std::min(capabilities.maxImageExtent.height, actualExtent.height));
-
-      return actualExtent;
+      return value->second;
     }
   }
 
-  SwapChainSupportDetails querySwapChainSupport(const VkPhysicalDevice device)
+  static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+    VkDebugUtilsMessageTypeFlagsEXT messageType,
+    const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
+    void* pUserData)
   {
-    SwapChainSupportDetails details;
+    std::cerr << "Validation layer: " << getSeverityFromFlag(messageSeverity)
+      << " : " << getTypeFromFlag(messageType) << " : "
+      << pCallbackData->pMessage << std::endl;
 
-    vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &details.capabilities);
+    return VK_FALSE;
+  }
 
-    uint32_t formatCount = 0;
-    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+  std::vector<const char*> getRequiredExtensions()
+  {
+    std::vector<const char*> extensions;
 
-    if (formatCount != 0)
+    // Get the extensions required by the window system
+    if (!options.headless)
     {
-      details.formats.resize(formatCount);
-      vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, details.formats.data());
-    }
+      uint32_t glfwExtensionCount = 0;
+      const char** glfwExtensions;
 
-    uint32_t presentModeCount = 0;
-    vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, nullptr);
+      glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
-    if (presentModeCount != 0)
-    {
-      details.presentModes.resize(presentModeCount);
-      vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, details.presentModes.data());
+      extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
     }
 
-
-
-    return details;
-  }
-
-  void createSurface()
-  {
-    if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS)
+    if (enableValidationLayers)
     {
-      std::cerr << "ERROR: Could not create window surface!" << std::endl;
-      throw std::runtime_error("Could not create window surface!");
+      extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
     }
+
+    return extensions;
   }
 
-  void createLogicalDevice()
+  std::vector<VkExtensionProperties> getVkExtensions()
   {
-    QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-
-    std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-    std::set<uint32_t> uniqueQueueFamilies = {
-      indices.graphicsFamily.value(),
-      indices.presentFamily.value()
-    };
-
-    float queuePriority = 1.0f;
-    for (const uint32_t queueFamily : uniqueQueueFamilies)
-    {
-      VkDeviceQueueCreateInfo queueCreateInfo = {};
-      queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-      queueCreateInfo.queueFamilyIndex = queueFamily;
-      queueCreateInfo.queueCount = 1;
-      queueCreateInfo.pQueuePriorities = &queuePriority;
-      queueCreateInfos.push_back(queueCreateInfo);
-    }
-
-    VkPhysicalDeviceFeatures deviceFeatures = {};
-    deviceFeatures.samplerAnisotropy = VK_TRUE;
-    deviceFeatures.sampleRateShading = VK_TRUE; // enable sample shading feature for the device
+    uint32_t extensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
 
-    VkDeviceCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-    createInfo.pQueueCreateInfos = queueCreateInfos.data();
+    std::vector<VkExtensionProperties> extensions(extensionCount);
 
-    createInfo.pEnabledFeatures = &deviceFeatures;
+    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
 
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    return extensions;
+  }
 
-    if (enableValidationLayers)
+  void printVkExtensions(const std::vector<VkExtensionProperties>& extensions)
+  {
+    std::cerr << "INFO: " << extensions.size() << " available extensions:" << std::endl;
+
+    for (const auto& extension : extensions)
     {
-      createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-      createInfo.ppEnabledLayerNames = validationLayers.data();
+      std::cerr << "\t" << extension.extensionName << std::endl;
     }
-    else
+  }
+
+  bool checkVkExtensions(const std::vector<VkExtensionProperties>& extensions,
+    const std::vector<const char *>& requiredExtensions)
+  {
+    std::unordered_set<std::string> available;
+
+    for (const auto& extension : extensions)
     {
-      createInfo.enabledLayerCount = 0;
+      available.insert(&extension.extensionName[0
+    ]);
     }
 
-    if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS)
+    bool extensionsPresent = true;
+    for (const auto requiredExtension : requiredExtensions)
     {
-      std::cerr << "ERROR: Could not create logical device!" << std::endl;
-      throw std::runtime_error("Could not create logical device!");
+      if (available.find(requiredExtension) == available.end())
+      {
+        std::cerr << "WARNING: Missing required extension: "
+          << requiredExtension << std::endl;
+        extensionsPresent = false;
+      }
     }
 
-    vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-    vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    return extensionsPresent;
   }
 
-  QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device)
+  uint32_t getFrameLimit()
   {
-    QueueFamilyIndices indices;
+    if (options.headless && options.benchmarkFrames == 0)
+    {
+      return DEFAULT_HEADLESS_FRAMES;
+    }
 
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+    return options.benchmarkFrames;
+  }
 
-    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+  // Frame and recording times are only kept when they are reported
+  bool isMeasuringFrames()
+  {
+    return getFrameLimit() != 0 || !options.benchmark.empty();
+  }
 
-    int i = 0;
-    for (const auto& queueFamily : queueFamilies)
+  void mainLoop()
+  {
+    const uint32_t frameLimit = getFrameLimit();
+    auto lastReport = BenchmarkClock::now();
+
+    for (uint32_t frame = 0; frameLimit == 0 || frame < frameLimit; ++frame)
     {
-      if (queueFamily.queueCount > 0)
+      if (!options.headless)
       {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-        {
-          indices.graphicsFamily = i;
-        }
-
-        VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-        if (presentSupport)
+        if (glfwWindowShouldClose(window))
         {
-          indices.presentFamily = i;
+          break;
         }
+        glfwPollEvents();
       }
 
-      if (indices.isComplete())
+      auto frameStart = BenchmarkClock::now();
+      drawFrame();
+      if (frameLimit != 0)
       {
-        break;
+        cpuFrameTimes.push_back(elapsedMilliseconds(frameStart, BenchmarkClock::now()));
+      }
+      else if (elapsedMilliseconds(lastReport, BenchmarkClock::now()) >= PROFILER_REPORT_INTERVAL_MS)
+      {
+        // Without a frame limit there is no final report, so the profiler's
+        // rolling window is printed every now and then instead
+        gpuProfiler.printReport();
+        printFramePacing();
+        frameScheduler.clearStatistics();
+        lastReport = BenchmarkClock::now();
       }
-
-      ++i;
     }
-    return indices;
+
+    frameScheduler.waitIdle();
+    vkDeviceWaitIdle(device);
+    collectAllGpuFrameTimes();
   }
 
-  void choosePhysicalDevice()
+  // Resizes the window (or the offscreen images) every frame, the way dragging
+  // a window edge does, and measures the stall of each swap chain recreation
+  void runResizeBenchmark()
   {
-    uint32_t deviceCount = 0;
-    vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    std::vector<double> stallTimes;
 
-    if (deviceCount == 0)
+    for (uint32_t i = 0; i < RESIZE_STORM_COUNT; ++i)
     {
-      std::cerr << "ERROR: No Vulkan physical devices found!" << std::endl;
-      throw std::runtime_error("No Vulkan physical devices found!");
-    }
+      if (!options.headless && glfwWindowShouldClose(window))
+      {
+        break;
+      }
 
-    std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+      // Sweep between full and half size in 32 steps
+      uint32_t step = i % 64 < 32 ? i % 32 : 31 - i % 32;
+      uint32_t width = static_cast<uint32_t>(WIDTH) - step * static_cast<uint32_t>(WIDTH) / 64;
+      uint32_t height = static_cast<uint32_t>(HEIGHT) - step * static_cast<uint32_t>(HEIGHT) / 64;
 
-    for (const auto& device : devices)
-    {
-      if (isDeviceSuitable(device))
+      if (options.headless)
       {
-        physicalDevice = device;
-        msaaSamples = getMaxUsableSampleCount();
-        break;
+        offscreenExtent = {width, height};
+      }
+      else
+      {
+        glfwSetWindowSize(window, static_cast<int>(width), static_cast<int>(height));
+        glfwPollEvents();
+        // The timed recreation below handles the resize
+        framebufferResized = false;
       }
-    }
 
-    if (physicalDevice == VK_NULL_HANDLE)
-    {
-      std::cerr << "ERROR: No suitable Vulkan physical device found!" << std::endl;
-      throw std::runtime_error("No suitable Vulkan physical device found!");
+      // Keep frames in flight so the wait inside the recreation is realistic
+      drawFrame();
+
+      auto recreateStart = BenchmarkClock::now();
+      recreateSwapChain();
+      stallTimes.push_back(elapsedMilliseconds(recreateStart, BenchmarkClock::now()));
     }
-    std::cerr << "INFO: Physical device chosen" << std::endl;
-  }
 
-  VkSampleCountFlagBits getMaxUsableSampleCount()
-  {
-    VkPhysicalDeviceProperties physicalDeviceProperties;
-    vkGetPhysicalDeviceProperties(physicalDevice, &physicalDeviceProperties);
+    vkDeviceWaitIdle(device);
+    collectAllGpuFrameTimes();
 
-    VkSampleCountFlags counts = std::min(physicalDeviceProperties.limits.framebufferColorSampleCounts, physicalDeviceProperties.limits.framebufferDepthSampleCounts);
-    if (counts & VK_SAMPLE_COUNT_64_BIT) { return VK_SAMPLE_COUNT_64_BIT; }
-    if (counts & VK_SAMPLE_COUNT_32_BIT) { return VK_SAMPLE_COUNT_32_BIT; }
-    if (counts & VK_SAMPLE_COUNT_16_BIT) { return VK_SAMPLE_COUNT_16_BIT; }
-    if (counts & VK_SAMPLE_COUNT_8_BIT) { return VK_SAMPLE_COUNT_8_BIT; }
-    if (counts & VK_SAMPLE_COUNT_4_BIT) { return VK_SAMPLE_COUNT_4_BIT; }
-    if (counts & VK_SAMPLE_COUNT_2_BIT) { return VK_SAMPLE_COUNT_2_BIT; }
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
 
-    return VK_SAMPLE_COUNT_1_BIT;
+    std::cerr << "INFO: Resize storm on " << deviceProperties.deviceName
+      << (options.headless ? " (headless)" : "") << std::endl;
+    printTimingSummary("Swap chain recreation stall", stallTimes);
+    allocator.printStatistics();
   }
 
-  bool isDeviceSuitable(const VkPhysicalDevice device)
+  // Records the same frame over and over with 1, 2, 4, ... recording tasks,
+  // without submitting it, to show how recording throughput scales with
+  // the number of threads. Recording for an image does not need it to be
+  // acquired, so the swap chain is left alone.
+  void runRecordingBenchmark()
   {
+    // Indirect draws record the same few commands for any number of objects
+    indirectDraws = false;
+    const uint32_t imageIndex = 0;
+    updateUniformBuffer();
+
     VkPhysicalDeviceProperties deviceProperties;
-    VkPhysicalDeviceFeatures deviceFeatures;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cerr << "INFO: Recording " << objectCount << " draws per frame on " << deviceProperties.deviceName << std::endl;
 
-    vkGetPhysicalDeviceProperties(device, &deviceProperties);
-    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+    const size_t maxTasks = recordingPool.getThreadCount();
+    double singleThreadMedian = 0.0;
+    for (size_t tasks = 1; ; tasks = std::min(tasks * 2, maxTasks))
+    {
+      recordingTaskCount = tasks;
+      recordTimes.clear();
+      for (uint32_t i = 0; i < RECORD_BENCHMARK_FRAMES; ++i)
+      {
+        recordFrame(imageIndex);
+      }
 
-    QueueFamilyIndices indices = findQueueFamilies(device);
+      TimingSummary summary = summarizeTimings(recordTimes);
+      if (tasks == 1)
+      {
+        singleThreadMedian = summary.median;
+      }
 
-    auto extensionsSupported = checkDeviceExtensionsSupported(device);
-    bool swapChainAdequate = false;
-    if (extensionsSupported)
-    {
-      SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
-      swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+      printTimingSummary("Command recording on " + std::to_string(tasks) + " threads", recordTimes);
+      if (summary.median > 0.0)
+      {
+        StreamFormatGuard formatGuard(std::cerr);
+        std::cerr << "INFO:   " << std::fixed << std::setprecision(0) << objectCount / summary.median << " draws per ms, "
+          << std::setprecision(2) << singleThreadMedian / summary.median << "x single threaded" << std::endl;
+      }
+
+      if (tasks == maxTasks)
+      {
+        break;
+      }
     }
 
-    return deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU
-      && indices.isComplete()
-      && extensionsSupported
-      && swapChainAdequate
-      && deviceFeatures.samplerAnisotropy;
+    vkDeviceWaitIdle(device);
   }
 
-  bool checkDeviceExtensionsSupported(const VkPhysicalDevice device)
+  // Draws frameCount frames, or fewer if the window is closed, measuring each
+  // one from scratch, and waits for the GPU to finish them
+  void drawBenchmarkFrames(uint32_t frameCount)
   {
-    uint32_t extensionCount = 0;
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-
-    std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-    vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
-
-    std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+    cpuFrameTimes.clear();
+    recordTimes.clear();
+    gpuFrameTimes.clear();
+    frameScheduler.clearStatistics();
 
-    for (const auto& extension : availableExtensions)
+    for (uint32_t i = 0; i < frameCount; ++i)
     {
-      requiredExtensions.erase(extension.extensionName);
+      if (!options.headless)
+      {
+        if (glfwWindowShouldClose(window))
+        {
+          break;
+        }
+        glfwPollEvents();
+      }
+
+      auto frameStart = BenchmarkClock::now();
+      drawFrame();
+      cpuFrameTimes.push_back(elapsedMilliseconds(frameStart, BenchmarkClock::now()));
     }
 
-    return requiredExtensions.empty();
+    // Through the scheduler, so the latency of the last frames is measured too
+    frameScheduler.waitIdle();
+    vkDeviceWaitIdle(device);
+    collectAllGpuFrameTimes();
   }
 
-  void setupDebugCallback()
+  // Draws the same frames with one draw per object recorded on the CPU, then
+  // with the single indirect draw written by the compute pass, and compares
+  // how many objects each gets through per millisecond of CPU and GPU time
+  void runInstancingBenchmark()
   {
-    if (!enableValidationLayers)
-    {
-      return;
-    }
-
-    VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-    createInfo.messageSeverity =
-      VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-      VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-      VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-    createInfo.messageType =
-      VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-      VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-      VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-    createInfo.pfnUserCallback = debugCallback;
-    createInfo.pUserData = nullptr; // Optional
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cerr << "INFO: Drawing " << objectCount << " instances on " << deviceProperties.deviceName
+      << (options.headless ? " (headless)" : "") << std::endl;
 
-    if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &debugMessenger) != VK_SUCCESS)
+    for (bool indirect : {false, true})
     {
-      std::cerr << "ERROR: Failed to set up the debug messenger!" << std::endl;
-      throw std::runtime_error("Failed to set up the debug messenger!");
+      indirectDraws = indirect;
+      drawBenchmarkFrames(INSTANCING_BENCHMARK_FRAMES);
+
+      const std::string label = indirect ? "Indirect draw" : "Per-object draws";
+      printTimingSummary(label + " CPU frame time", cpuFrameTimes);
+      printTimingSummary(label + " CPU command recording", recordTimes);
+      printTimingSummary(label + " GPU frame time", gpuFrameTimes);
+
+      TimingSummary recording = summarizeTimings(recordTimes);
+      TimingSummary gpu = summarizeTimings(gpuFrameTimes);
+      StreamFormatGuard formatGuard(std::cerr);
+      std::cerr << "INFO:   " << std::fixed << std::setprecision(0);
+      if (recording.median > 0.0)
+      {
+        std::cerr << objectCount / recording.median << " instances per ms of recording";
+      }
+      if (gpu.median > 0.0)
+      {
+        std::cerr << (recording.median > 0.0 ? ", " : "") << objectCount / gpu.median << " instances per ms of GPU time";
+      }
+      std::cerr << std::endl;
     }
   }
 
-  void createInstance()
+  // Draws the same frames with every threshold in LOD_BENCHMARK_ERRORS,
+  // starting with the full mesh for every object, and reports how many
+  // triangles each threshold selects and what it costs in frame time
+  void runLodBenchmark()
   {
-    if (enableValidationLayers && !checkValidationLayerSupport())
-    {
-      std::cerr << "ERROR: Missing validation layers!" << std::endl;
-      throw std::runtime_error("Missing validation layers!");
-    }
-
-    // This is technically optional but provides useful information for the
-    // driver to optimize for our specific application
-    VkApplicationInfo appInfo = {};
-    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-    appInfo.pApplicationName = "Hello Triangle";
-    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.pEngineName = "No Engine";
-    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
-
-    // Required
-    VkInstanceCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-    createInfo.pApplicationInfo = &appInfo;
-
-    auto requiredExtensions = getRequiredExtensions();
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cerr << "INFO: Drawing " << objectCount << " objects with " << meshLods.size() << " LODs on "
+      << deviceProperties.deviceName << (options.headless ? " (headless)" : "")
+      << (indirectDraws ? "" : " with direct draws") << std::endl;
 
-    auto availableExtensions = getVkExtensions();
-    printVkExtensions(availableExtensions);
-    if (!checkVkExtensions(availableExtensions, requiredExtensions))
+    for (float errorPixels : LOD_BENCHMARK_ERRORS)
     {
-      std::cerr << "ERROR: Missing extension" << std::endl;
-      throw std::runtime_error("Missing extension");
-    }
-    std::cerr << "INFO: All " << requiredExtensions.size() << " required extensions present" << std::endl;
-
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredExtensions.size());
-    createInfo.ppEnabledExtensionNames = requiredExtensions.data();
+      lodErrorPixels = errorPixels;
+      drawBenchmarkFrames(INSTANCING_BENCHMARK_FRAMES);
+
+      // Counted on the CPU for the last frame's animation, before culling
+      const uint32_t lodCount = getSelectableLodCount(indirectDraws ? getIndirectLodCount() : static_cast<uint32_t>(meshLods.size()));
+      const float lodScale = getLodScale();
+      std::vector<uint32_t> objectsPerLod(meshLods.size(), 0);
+      uint64_t triangleCount = 0;
+      for (uint32_t object = 0; object < objectCount; ++object)
+      {
+        const uint32_t lod = selectObjectLod(getObjectTransform(object), getObjectPlacement(object).z, lodScale, lodCount);
+        ++objectsPerLod[lod];
+        triangleCount += meshLods[lod].indexCount / 3;
+      }
 
-    // Enable validation layers
-    if (enableValidationLayers)
-    {
-      std::cerr << "INFO: Enabling " << validationLayers.size()
-        << " validation layer" << (validationLayers.size() <= 1 ? "" : "s")
-        << std::endl;
-      createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-      createInfo.ppEnabledLayerNames = validationLayers.data();
-    }
-    else
-    {
-      createInfo.enabledLayerCount = 0;
-    }
+      std::ostringstream label;
+      if (errorPixels > 0.0f)
+      {
+        label << "LOD error " << errorPixels << " px";
+      }
+      else
+      {
+        label << "Full mesh";
+      }
+      printTimingSummary(label.str() + " CPU frame time", cpuFrameTimes);
+      printTimingSummary(label.str() + " GPU frame time", gpuFrameTimes);
 
-    VkResult result = vkCreateInstance(&createInfo, nullptr, &instance);
-    if (result != VK_SUCCESS)
-    {
-      std::cerr << "ERROR: Failed to create a Vulkan instance: " << result << std::endl;
-      throw std::runtime_error("Failed to create Vulkan instance!");
+      std::cerr << "INFO:   " << triangleCount << " triangles, objects per LOD:";
+      for (uint32_t count : objectsPerLod)
+      {
+        std::cerr << " " << count;
+      }
+      std::cerr << std::endl;
     }
   }
 
-  bool checkValidationLayerSupport()
+  // Draws the full mesh as loaded, which is optimized for the vertex cache,
+  // then replaces it with the mesh in OBJ face order and draws that. Besides
+  // the frame times, the profiler report shows how many vertex shader
+  // invocations the render pass took with each.
+  void runVertexCacheBenchmark()
   {
-    uint32_t layerCount = 0;
-    vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cerr << "INFO: Drawing " << objectCount << " objects at full detail on " << deviceProperties.deviceName
+      << (options.headless ? " (headless)" : "") << std::endl;
+
+    lodErrorPixels = 0.0f;
+    for (bool optimized : {true, false})
+    {
+      if (!optimized)
+      {
+        loadUnoptimizedMesh();
+      }
+
+      drawBenchmarkFrames(VERTEX_CACHE_BENCHMARK_FRAMES);
 
-    std::vector<VkLayerProperties> layers(layerCount);
-    vkEnumerateInstanceLayerProperties(&layerCount, layers.data());
+      const std::string label = optimized ? "Optimized mesh" : "Unoptimized mesh";
+      printTimingSummary(label + " CPU frame time", cpuFrameTimes);
+      printTimingSummary(label + " GPU frame time", gpuFrameTimes);
+      gpuProfiler.printReport();
+    }
+  }
 
-    std::unordered_set<std::string> availableLayers;
-    for (const auto& layer : layers)
+  // Draws LOD 0 of every object with the compute pass culling whole objects,
+  // then culling their meshlets, and reports how many meshlets were culled
+  void runMeshletBenchmark()
+  {
+    if (!meshletCulling)
     {
-      availableLayers.insert(layer.layerName);
+      std::cerr << "ERROR: Meshlet culling is not available!" << std::endl;
+      throw std::runtime_error("Meshlet culling is not available!");
     }
 
-    bool layersPresent = true;
-    for (const auto validationLayer : validationLayers)
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cerr << "INFO: Drawing " << objectCount << " objects of " << meshlets.size() << " meshlets on "
+      << deviceProperties.deviceName << (options.headless ? " (headless)" : "") << std::endl;
+    std::cerr << "INFO: Meshlet draws " << (drawIndirectCountEnabled
+      ? "stop at the visible count (VK_KHR_draw_indirect_count)"
+      : "walk all " + std::to_string(objectCount * meshlets.size()) + " slots, zeroed after the visible ones") << std::endl;
+
+    lodErrorPixels = 0.0f;
+    for (bool culling : {false, true})
     {
-      if (availableLayers.find(validationLayer) == availableLayers.end())
+      meshletCulling = culling;
+      meshletsTested = 0;
+      meshletsDrawn = 0;
+      for (auto& frame : frameInstances)
       {
-        std::cerr << "WARNING: " << validationLayer << " is missing" << std::endl;
-        layersPresent = false;
+        frame.meshletCountPending = false;
       }
-    }
+      drawBenchmarkFrames(MESHLET_BENCHMARK_FRAMES);
 
-    return layersPresent;
+      const std::string label = culling ? "Meshlet culling" : "Object culling";
+      printTimingSummary(label + " CPU frame time", cpuFrameTimes);
+      printTimingSummary(label + " GPU frame time", gpuFrameTimes);
+      printMeshletStatistics();
+      gpuProfiler.printReport();
+    }
   }
 
-  static std::string getSeverityFromFlag(const VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity)
+  // Draws the same frames keeping as many frames queued as allowed, then
+  // starting each frame only once the previous one is done, and compares
+  // what each costs in frame time against what it saves in latency
+  void runPacingBenchmark()
   {
-    static const std::unordered_map<VkDebugUtilsMessageSeverityFlagBitsEXT, std::string> severityToString = {
-      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,   "ERROR"},
-      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT, "WARNING"},
-      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT,    "INFO"},
-      {VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT, "VERBOSE"},
-    };
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    std::cerr << "INFO: Pacing " << framesInFlight << " frames in flight on " << deviceProperties.deviceName
+      << (options.headless ? " (headless)" : "") << std::endl;
 
-    const auto value = severityToString.find(messageSeverity);
-    if (value == severityToString.end())
-    {
-      return "UNKNOWN";
-    }
-    else
+    for (FramePacing pacing : {FramePacing::Throughput, FramePacing::Latency})
     {
-      return value->second;
+      frameScheduler.setPacing(pacing);
+      drawBenchmarkFrames(PACING_BENCHMARK_FRAMES);
+
+      const std::string label = pacing == FramePacing::Latency ? "Latency pacing" : "Throughput pacing";
+      printTimingSummary(label + " CPU frame time", cpuFrameTimes);
+      printTimingSummary(label + " CPU wait for GPU", frameScheduler.getWaitTimes());
+      printTimingSummary(label + " input to GPU completion", frameScheduler.getLatencies());
+      printTimingSummary(label + " GPU frame time", gpuFrameTimes);
     }
   }
 
-  static std::string getTypeFromFlag(const VkDebugUtilsMessageTypeFlagsEXT messageType)
+  // Builds the texture's RGBA8 mip chain on the CPU with every filter, on
+  // one thread and on all of them, then blits the same chain on the GPU.
+  // The CPU chain is ready to upload with one copy, the blit needs level 0
+  // uploaded first and costs queue time instead.
+  void runMipBenchmark()
   {
-    static const std::unordered_map<VkDebugUtilsMessageTypeFlagsEXT, std::string> typeToString = {
-      {VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT,     "GENERAL"},
-      {VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT,  "VALIDATION"},
-      {VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT, "PERFORMANCE"},
-    };
+    int texWidth, texHeight;
+    stbi_uc* pixels = loadTexturePixels(texWidth, texHeight);
 
-    const auto value = typeToString.find(messageType);
-    if (value == typeToString.end())
+    const uint32_t width = static_cast<uint32_t>(texWidth);
+    const uint32_t height = static_cast<uint32_t>(texHeight);
+    const std::vector<size_t> offsets = getMipChainOffsets(width, height);
+    const uint32_t levels = static_cast<uint32_t>(offsets.size() - 1);
+    std::cerr << "INFO: Building " << levels << " levels of a " << width << "x" << height << " texture" << std::endl;
+
+    std::vector<uint8_t> chain(offsets.back());
+    for (MipFilter filter : {MipFilter::Box, MipFilter::Kaiser})
     {
-      return "UNKNOWN";
+      for (unsigned threads : {1u, getDefaultThreadCount()})
+      {
+        std::vector<double> buildTimes;
+        for (uint32_t run = 0; run < MIP_BENCHMARK_RUNS; ++run)
+        {
+          auto buildStart = BenchmarkClock::now();
+          buildMipChain(pixels, width, height, filter, chain.data(), threads);
+          buildTimes.push_back(elapsedMilliseconds(buildStart, BenchmarkClock::now()));
+        }
+        printTimingSummary(std::string("CPU ") + getMipFilterName(filter) + " mips on " + std::to_string(threads) + " threads", buildTimes);
+      }
     }
-    else
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+    if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
     {
-      return value->second;
+      std::cerr << "INFO: RGBA8 cannot be blitted with linear filtering, skipping the GPU blit" << std::endl;
+      stbi_image_free(pixels);
+      return;
     }
-  }
-
-  static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-    VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
-    VkDebugUtilsMessageTypeFlagsEXT messageType,
-    const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
-    void* pUserData)
-  {
-    std::cerr << "Validation layer: " << getSeverityFromFlag(messageSeverity)
-      << " : " << getTypeFromFlag(messageType) << " : "
-      << pCallbackData->pMessage << std::endl;
 
-    return VK_FALSE;
-  }
+    VkImage image;
+    Allocation imageMemory;
+    createImage(width, height, levels, VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_TILING_OPTIMAL,
+      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, imageMemory);
+    uploadQueue.uploadImage(image, levels, width, height, 4, pixels);
+    VkSemaphore uploadsDone = uploadQueue.flush();
+    stbi_image_free(pixels);
 
-  std::vector<const char*> getRequiredExtensions()
-  {
-    // Get the extensions required by the window system
-    uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions;
+    const uint32_t profilerSlot = gpuProfiler.createSlot(graphicsQueueFamily, "graphics");
+    std::vector<double> blitTimes;
+    std::vector<double> blitGpuTimes;
+    for (uint32_t run = 0; run < MIP_BENCHMARK_RUNS; ++run)
+    {
+      auto blitStart = BenchmarkClock::now();
+      VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+      gpuProfiler.beginSlot(profilerSlot, commandBuffer);
+      uint32_t scope = gpuProfiler.beginScope(profilerSlot, commandBuffer, "mip blit");
 
-    glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+      if (run > 0)
+      {
+        // The previous run left every level ready for sampling
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = levels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+          VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+          0, nullptr,
+          0, nullptr,
+          1, &barrier);
+      }
+      generateMipmaps(commandBuffer, image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, levels);
 
-    std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+      gpuProfiler.endScope(profilerSlot, commandBuffer, scope);
+      endSingleTimeCommands(commandBuffer, run == 0 ? uploadsDone : VK_NULL_HANDLE, VK_PIPELINE_STAGE_TRANSFER_BIT);
+      vkQueueWaitIdle(graphicsQueue);
+      blitTimes.push_back(elapsedMilliseconds(blitStart, BenchmarkClock::now()));
 
-    if (enableValidationLayers)
-    {
-      extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+      for (const GpuScopeResult& result : gpuProfiler.collectSlot(profilerSlot))
+      {
+        if (strcmp(result.name, "mip blit") == 0)
+        {
+          blitGpuTimes.push_back(result.durationMilliseconds);
+        }
+      }
     }
+    printTimingSummary("GPU blit mips, submit to completion", blitTimes);
+    printTimingSummary("GPU blit mips, GPU time", blitGpuTimes);
 
-    return extensions;
+    collectSetupCommands(true);
+    vkDestroyImage(device, image, nullptr);
+    allocator.free(imageMemory);
   }
 
-  std::vector<VkExtensionProperties> getVkExtensions()
+  // Replaces the vertex and index buffers with the mesh parsed from the OBJ,
+  // without LODs or any reordering. The GPU must be idle.
+  void loadUnoptimizedMesh()
   {
-    uint32_t extensionCount = 0;
-    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+    vkDestroyBuffer(device, indexBuffer, nullptr);
+    allocator.free(indexBufferMemory);
+    vkDestroyBuffer(device, vertexBuffer, nullptr);
+    allocator.free(vertexBufferMemory);
+
+    parseModel(loadAsset(MODEL_PATH));
+    vertexData = vertices.data();
+    vertexCount = vertices.size();
+    indexData = indices.data();
+    indexCount = indices.size();
+    meshLods = {{0, static_cast<uint32_t>(indexCount), 0.0f, 0}};
+    printMeshLods();
+    packMesh();
+    splitMesh();
+    buildLodMeshlets();
 
-    std::vector<VkExtensionProperties> extensions(extensionCount);
+    createVertexBuffer();
+    createIndexBuffer();
+    if (meshletCulling)
+    {
+      destroyMeshletBuffer();
+      if (objectCount * meshlets.size() > MAX_MESHLET_DRAWS)
+      {
+        std::cerr << "WARNING: Too many meshlets to draw, meshlet culling is disabled" << std::endl;
+        meshletCulling = false;
+      }
+      else
+      {
+        createMeshletBuffer();
+        writeMeshletDescriptors();
+      }
+    }
 
-    vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+    VkSemaphore uploadsDone = uploadQueue.flush();
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    recordMeshUploadBarrier(commandBuffer);
+    endSingleTimeCommands(commandBuffer, uploadsDone, VK_PIPELINE_STAGE_TRANSFER_BIT);
 
-    return extensions;
+    releaseModelData();
   }
 
-  void printVkExtensions(const std::vector<VkExtensionProperties>& extensions)
+  void collectGpuFrameTime(size_t frame)
   {
-    std::cerr << "INFO: " << extensions.size() << " available extensions:" << std::endl;
-
-    for (const auto& extension : extensions)
+    for (const GpuScopeResult& scope : gpuProfiler.collectSlot(frameProfilerSlots[frame]))
     {
-      std::cerr << "\t" << extension.extensionName << std::endl;
+      if (strcmp(scope.name, "frame") == 0 && isMeasuringFrames())
+      {
+        gpuFrameTimes.push_back(scope.durationMilliseconds);
+      }
     }
   }
 
-  bool checkVkExtensions(const std::vector<VkExtensionProperties>& extensions,
-    const std::vector<const char *>& requiredExtensions)
+  void collectAllGpuFrameTimes()
   {
-    std::unordered_set<std::string> available;
+    for (size_t i = 0; i < frameProfilerSlots.size(); ++i)
+    {
+      collectGpuFrameTime(i);
+    }
+  }
 
-    for (const auto& extension : extensions)
+  void reportFrameTimes()
+  {
+    if (cpuFrameTimes.empty())
     {
-      available.insert(&extension.extensionName[0
-    ]);
+      return;
     }
 
-    bool extensionsPresent = true;
-    for (const auto requiredExtension : requiredExtensions)
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    std::cerr << "INFO: Frame times on " << deviceProperties.deviceName
+      << " at " << swapChainExtent.width << "x" << swapChainExtent.height
+      << (options.headless ? " (headless)" : "") << std::endl;
+    printTimingSummary("CPU frame time", cpuFrameTimes);
+    printTimingSummary("CPU command recording", recordTimes);
+    printTimingSummary("GPU frame time", gpuFrameTimes);
+    printFramePacing();
+    printMeshletStatistics();
+    if (virtualTexturing)
     {
-      if (available.find(requiredExtension) == available.end())
-      {
-        std::cerr << "WARNING: Missing required extension: "
-          << requiredExtension << std::endl;
-        extensionsPresent = false;
-      }
+      virtualTexture.printStatistics();
     }
+    gpuProfiler.printReport();
+  }
 
-    return extensionsPresent;
+  // Time the CPU spent blocked on the GPU before each frame, and from the
+  // input each frame was drawn with to the GPU finishing it
+  void printFramePacing()
+  {
+    printTimingSummary("CPU wait for GPU", frameScheduler.getWaitTimes());
+    printTimingSummary("Input to GPU completion", frameScheduler.getLatencies());
   }
 
-  void mainLoop()
+  void printMeshletStatistics()
   {
-    while (!glfwWindowShouldClose(window))
+    if (!meshletCulling || meshletsTested == 0)
     {
-      glfwPollEvents();
-      drawFrame();
+      return;
     }
 
-    vkDeviceWaitIdle(device);
+    StreamFormatGuard formatGuard(std::cerr);
+    std::cerr << "INFO:   " << std::fixed << std::setprecision(1)
+      << 100.0 * static_cast<double>(meshletsTested - meshletsDrawn) / static_cast<double>(meshletsTested)
+      << "% of " << meshletsTested << " meshlets culled" << std::endl;
   }
 
   void drawFrame()
   {
-    vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+    frameScheduler.beginFrame();
+    currentFrame = frameScheduler.getFrameIndex();
+    collectGpuFrameTime(currentFrame);
+    collectSetupCommands(false);
+    uploadQueue.collect();
+    updateTextureStreaming();
+    updateShaderReload();
 
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
-
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+    if (options.headless)
     {
-      framebufferResized = false;
-      recreateSwapChain();
+      imageIndex = offscreenImageIndex;
+      offscreenImageIndex = (offscreenImageIndex + 1) % static_cast<uint32_t>(swapChainImages.size());
     }
-    else if (result != VK_SUCCESS)
+    else
     {
-      std::cerr << "ERROR: Failed to acquire swap chain image!" << std::endl;
-      throw std::runtime_error("Failed to acquire swap chain image!");
+      VkResult result = vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+      if (result == VK_ERROR_OUT_OF_DATE_KHR)
+      {
+        recreateSwapChain();
+        return;
+      }
+      else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+      {
+        std::cerr << "ERROR: Failed to acquire swap chain image!" << std::endl;
+        throw std::runtime_error("Failed to acquire swap chain image!");
+      }
     }
 
-    updateUniformBuffer(imageIndex);
+    updateUniformBuffer();
+    recordFrame(imageIndex);
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     VkSemaphore waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
     VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
     VkSemaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
-
-    vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    if (!options.headless)
+    {
+      submitInfo.waitSemaphoreCount = 1;
+      submitInfo.pWaitSemaphores = waitSemaphores;
+      submitInfo.pWaitDstStageMask = waitStages;
+      submitInfo.signalSemaphoreCount = 1;
+      submitInfo.pSignalSemaphores = signalSemaphores;
+    }
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frameCommands[currentFrame].primaryBuffer;
 
-    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
+    VkFence frameFence = frameScheduler.prepareSubmit(submitInfo);
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, frameFence) != VK_SUCCESS)
     {
       std::cerr << "ERROR: Failed to submit draw command buffer!" << std::endl;
       throw std::runtime_error("Failed to submit draw command buffer!");
     }
+    frameScheduler.endFrame();
 
-    VkPresentInfoKHR presentInfo = {};
-    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presentInfo.waitSemaphoreCount = 1;
-    presentInfo.pWaitSemaphores = signalSemaphores;
-    VkSwapchainKHR swapChains[] = {swapChain};
-    presentInfo.swapchainCount = 1;
-    presentInfo.pSwapchains = swapChains;
-    presentInfo.pImageIndices = &imageIndex;
-    presentInfo.pResults = nullptr; // Optional
-
-    result = vkQueuePresentKHR(presentQueue, &presentInfo);
-
-    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+    if (!options.headless)
     {
-      recreateSwapChain();
+      VkPresentInfoKHR presentInfo = {};
+      presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+      presentInfo.waitSemaphoreCount = 1;
+      presentInfo.pWaitSemaphores = signalSemaphores;
+      VkSwapchainKHR swapChains[] = {swapChain};
+      presentInfo.swapchainCount = 1;
+      presentInfo.pSwapchains = swapChains;
+      presentInfo.pImageIndices = &imageIndex;
+      presentInfo.pResults = nullptr; // Optional
+
+      VkResult result = vkQueuePresentKHR(presentQueue, &presentInfo);
+
+      if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized)
+      {
+        framebufferResized = false;
+        recreateSwapChain();
+      }
+      else if (result != VK_SUCCESS)
+      {
+        throw std::runtime_error("failed to present swap chain image!");
+      }
     }
-    else if (result != VK_SUCCESS)
+
+    if (!firstFramePresented)
     {
-      throw std::runtime_error("failed to present swap chain image!");
+      firstFramePresented = true;
+      std::cerr << "INFO: First frame queued " << elapsedMilliseconds(startTime, BenchmarkClock::now())
+        << " ms after startup" << std::endl;
     }
-
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
   }
 
-  void updateUniformBuffer(uint32_t currentImage)
+  // Fills the current frame's region of the uniform ring. The object
+  // uniforms are only reserved here, the recording tasks write them.
+  void updateUniformBuffer()
   {
     static auto startTime = std::chrono::high_resolution_clock::now();
 
     auto currentTime = std::chrono::high_resolution_clock::now();
-    float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+    animationTime = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
     UniformBufferObject ubo = {};
-    ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-    ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
-    ubo.proj[1][1] *= -1;
+    ubo.view = getView();
+    ubo.proj = getProjection();
+    ubo.positionOffset = glm::vec4(packedLayout.positionOffset, 0.0f);
+    ubo.positionScale = glm::vec4(packedLayout.positionScale, 0.0f);
+    if (virtualTexturing)
+    {
+      ubo.virtualTexture = glm::vec4(virtualTexture.getScaleX(), virtualTexture.getScaleY(),
+        static_cast<float>(virtualTexture.getPagesPerSide()), static_cast<float>(virtualTexture.getLevelCount()));
+    }
+
+    uniformRing.beginFrame(static_cast<uint32_t>(currentFrame));
+    frameUniformOffset = uniformRing.push(ubo);
+    objectUniformOffset = uniformRing.allocate(objectUniformStride * objectCount);
+  }
+
+  glm::mat4 getView() const
+  {
+    return glm::lookAt(CAMERA_POSITION, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+  }
 
-    void* data;
-    vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-    memcpy(data, &ubo, sizeof(ubo));
-    vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+  glm::mat4 getProjection() const
+  {
+    glm::mat4 proj = glm::perspective(FIELD_OF_VIEW, swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
+    proj[1][1] *= -1;
+    return proj;
+  }
+
+  // Left, right, top, bottom, near and far planes of a view projection with
+  // a depth range of 0 to 1, normalized and pointing inwards
+  static void getFrustumPlanes(const glm::mat4& viewProj, glm::vec4 planes[6])
+  {
+    const glm::vec4 row0(viewProj[0][0], viewProj[1][0], viewProj[2][0], viewProj[3][0]);
+    const glm::vec4 row1(viewProj[0][1], viewProj[1][1], viewProj[2][1], viewProj[3][1]);
+    const glm::vec4 row2(viewProj[0][2], viewProj[1][2], viewProj[2][2], viewProj[3][2]);
+    const glm::vec4 row3(viewProj[0][3], viewProj[1][3], viewProj[2][3], viewProj[3][3]);
+
+    planes[0] = row3 + row0;
+    planes[1] = row3 - row0;
+    planes[2] = row3 + row1;
+    planes[3] = row3 - row1;
+    planes[4] = row2;
+    planes[5] = row3 - row2;
+
+    for (int i = 0; i < 6; ++i)
+    {
+      planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
   }
 
+  // Destroys everything sized to the swap chain extent. The swap chain itself
+  // is kept so that createSwapChain() can pass it on as the old swap chain.
   void cleanupSwapChain()
   {
     vkDestroyImageView(device, colorImageView, nullptr);
     vkDestroyImage(device, colorImage, nullptr);
-    vkFreeMemory(device, colorImageMemory, nullptr);
+    allocator.free(colorImageMemory);
 
     vkDestroyImageView(device, depthImageView, nullptr);
     vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+    allocator.free(depthImageMemory);
 
-    for (size_t i = 0; i < swapChainImages.size(); i++)
+    for (auto framebuffer : swapChainFramebuffers)
     {
-      vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-      vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+      vkDestroyFramebuffer(device, framebuffer, nullptr);
     }
 
-    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+    for (auto imageView : swapChainImageViews)
+    {
+      vkDestroyImageView(device, imageView, nullptr);
+    }
 
-    for (auto framebuffer : swapChainFramebuffers)
+    if (options.headless)
     {
-      vkDestroyFramebuffer(device, framebuffer, nullptr);
+      for (size_t i = 0; i < swapChainImages.size(); ++i)
+      {
+        vkDestroyImage(device, swapChainImages[i], nullptr);
+        allocator.free(offscreenImagesMemory[i]);
+      }
     }
+  }
 
-    vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+  void cleanup()
+  {
+    cleanupSwapChain();
+    if (swapChain != VK_NULL_HANDLE)
+    {
+      vkDestroySwapchainKHR(device, swapChain, nullptr);
+    }
+    uniformRing.destroy();
+    vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 
+    shaderReloader.stop();
+    for (RetiredPipeline& retired : retiredPipelines)
+    {
+      vkDestroyPipeline(device, retired.pipeline, nullptr);
+    }
+    retiredPipelines.clear();
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
+    vkDestroyPipeline(device, instancedPipeline, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyRenderPass(device, renderPass, nullptr);
 
-    for (auto imageView : swapChainImageViews)
+    destroyInstanceResources();
+
+    textureStreamer.stop();
+    streamedTexture.reset();
+    for (RetiredTexture& texture : retiredTextures)
     {
-      vkDestroyImageView(device, imageView, nullptr);
+      destroyRetiredTexture(texture);
     }
-    vkDestroySwapchainKHR(device, swapChain, nullptr);
-  }
+    retiredTextures.clear();
 
-  void cleanup()
-  {
-    cleanupSwapChain();
+    virtualTexture.destroy();
 
     vkDestroySampler(device, textureSampler, nullptr);
     vkDestroyImageView(device, textureImageView, nullptr);
     vkDestroyImage(device, textureImage, nullptr);
-    vkFreeMemory(device, textureImageMemory, nullptr);
+    allocator.free(textureImageMemory);
 
     vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, instanceSetLayout, nullptr);
 
     vkDestroyBuffer(device, indexBuffer, nullptr);
-    vkFreeMemory(device, indexBufferMemory, nullptr);
+    allocator.free(indexBufferMemory);
 
     vkDestroyBuffer(device, vertexBuffer, nullptr);
-    vkFreeMemory(device, vertexBufferMemory, nullptr);
+    allocator.free(vertexBufferMemory);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    for (uint32_t i = 0; i < framesInFlight; ++i)
     {
       vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
       vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-      vkDestroyFence(device, inFlightFences[i], nullptr);
     }
+    frameScheduler.destroy();
 
+    destroyFrameCommands();
+    collectSetupCommands(true);
     vkDestroyCommandPool(device, commandPool, nullptr);
 
+    destroyPipelineCache();
+
+    uploadQueue.destroy();
+
+    if (!options.gpuTracePath.empty())
+    {
+      gpuProfiler.writeChromeTrace(options.gpuTracePath);
+    }
+    gpuProfiler.destroy();
+    allocator.destroy();
+
     vkDestroyDevice(device, nullptr);
 
     if (enableValidationLayers)
@@ -2188,21 +5460,137 @@ private:
       DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
     }
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (surface != VK_NULL_HANDLE)
+    {
+      vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 
-    glfwDestroyWindow(window);
+    if (!options.headless)
+    {
+      glfwDestroyWindow(window);
 
-    glfwTerminate();
+      glfwTerminate();
+    }
   }
 };
 
-int main()
+AppOptions parseOptions(int argc, char* argv[])
 {
-  HelloTriangleApplication app;
+  AppOptions options;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    const std::string arg = argv[i];
+
+    if (arg == "--headless")
+    {
+      options.headless = true;
+    }
+    else if (arg == "--frames" && i + 1 < argc)
+    {
+      options.benchmarkFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+    }
+    else if (arg == "--objects" && i + 1 < argc)
+    {
+      options.objectCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+    }
+    else if (arg == "--record-threads" && i + 1 < argc)
+    {
+      options.recordThreads = static_cast<unsigned>(std::stoul(argv[++i]));
+    }
+    else if (arg == "--uncompressed-textures")
+    {
+      options.uncompressedTextures = true;
+    }
+    else if (arg == "--sync-textures")
+    {
+      options.streamTextures = false;
+    }
+    else if (arg == "--virtual-texture" && i + 1 < argc)
+    {
+      options.virtualTexturePath = argv[++i];
+    }
+    else if (arg == "--assets" && i + 1 < argc)
+    {
+      options.assetArchivePath = argv[++i];
+    }
+    else if (arg == "--pack" && i + 1 < argc)
+    {
+      options.packPath = argv[++i];
+    }
+    else if (arg == "--watch-shaders")
+    {
+      options.watchShaders = true;
+    }
+    else if (arg == "--direct-draws")
+    {
+      options.directDraws = true;
+    }
+    else if (arg == "--occlusion-culling")
+    {
+      options.occlusionCulling = true;
+    }
+    else if (arg == "--meshlets")
+    {
+      options.meshletCulling = true;
+    }
+    else if (arg == "--vertex-format" && i + 1 < argc && (std::string(argv[i + 1]) == "float" || std::string(argv[i + 1]) == "packed"))
+    {
+      options.vertexFormat = std::string(argv[++i]) == "packed" ? VertexFormat::Packed : VertexFormat::Float;
+    }
+    else if (arg == "--lod-error" && i + 1 < argc)
+    {
+      options.lodErrorPixels = std::stof(argv[++i]);
+      if (!(options.lodErrorPixels >= 0.0f) || !std::isfinite(options.lodErrorPixels))
+      {
+        std::cerr << "ERROR: --lod-error must be a number of pixels, at least 0" << std::endl;
+        throw std::invalid_argument("Invalid LOD error: " + std::string(argv[i]));
+      }
+    }
+    else if (arg == "--mips" && i + 1 < argc && (std::string(argv[i + 1]) == "blit" || std::string(argv[i + 1]) == "box" || std::string(argv[i + 1]) == "kaiser"))
+    {
+      const std::string mips = argv[++i];
+      options.cpuMips = mips != "blit";
+      options.mipFilter = mips == "kaiser" ? MipFilter::Kaiser : MipFilter::Box;
+    }
+    else if (arg == "--frames-in-flight" && i + 1 < argc)
+    {
+      options.framesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+      if (options.framesInFlight == 0 || options.framesInFlight > FrameScheduler::MAX_FRAMES_IN_FLIGHT)
+      {
+        std::cerr << "ERROR: --frames-in-flight must be between 1 and " << FrameScheduler::MAX_FRAMES_IN_FLIGHT << std::endl;
+        throw std::invalid_argument("Invalid number of frames in flight: " + std::string(argv[i]));
+      }
+    }
+    else if (arg == "--pacing" && i + 1 < argc && (std::string(argv[i + 1]) == "throughput" || std::string(argv[i + 1]) == "latency"))
+    {
+      options.framePacing = std::string(argv[++i]) == "latency" ? FramePacing::Latency : FramePacing::Throughput;
+    }
+    else if (arg == "--gpu-trace" && i + 1 < argc)
+    {
+      options.gpuTracePath = argv[++i];
+    }
+    else if (arg == "--bench" && i + 1 < argc && (std::string(argv[i + 1]) == "dedup" || std::string(argv[i + 1]) == "resize" || std::string(argv[i + 1]) == "record" || std::string(argv[i + 1]) == "instancing" || std::string(argv[i + 1]) == "lod" || std::string(argv[i + 1]) == "vertex-cache" || std::string(argv[i + 1]) == "meshlets" || std::string(argv[i + 1]) == "pacing" || std::string(argv[i + 1]) == "mips" || std::string(argv[i + 1]) == "io"))
+    {
+      options.benchmark = argv[++i];
+    }
+    else
+    {
+      std::cerr << "ERROR: Unknown argument: " << arg << std::endl;
+      std::cerr << "Usage: rgb [--headless] [--frames N] [--bench dedup|resize|record|instancing|lod|vertex-cache|meshlets|pacing|mips|io] [--objects N] [--record-threads N] [--direct-draws] [--occlusion-culling] [--meshlets] [--lod-error PIXELS] [--vertex-format float|packed] [--uncompressed-textures] [--sync-textures] [--virtual-texture PATH] [--assets PATH] [--pack PATH] [--watch-shaders] [--mips blit|box|kaiser] [--frames-in-flight N] [--pacing throughput|latency] [--gpu-trace PATH]" << std::endl;
+      throw std::invalid_argument("Unknown argument: " + arg);
+    }
+  }
+
+  return options;
+}
 
+int main(int argc, char* argv[])
+{
   try
   {
+    HelloTriangleApplication app(parseOptions(argc, argv));
     app.run();
   }
   catch (const std::exception & e)
@@ -0,0 +1,227 @@
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+  : mappedData(std::exchange(other.mappedData, nullptr)),
+  mappedSize(std::exchange(other.mappedSize, 0)),
+  opened(std::exchange(other.opened, false))
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if (this != &other)
+  {
+    close();
+    mappedData = std::exchange(other.mappedData, nullptr);
+    mappedSize = std::exchange(other.mappedSize, 0);
+    opened = std::exchange(other.opened, false);
+  }
+  return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path, FileAccess access)
+{
+  close();
+
+  DWORD flags = FILE_ATTRIBUTE_NORMAL;
+  if (access == FileAccess::Sequential)
+  {
+    flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+  }
+  else if (access == FileAccess::Random)
+  {
+    flags |= FILE_FLAG_RANDOM_ACCESS;
+  }
+
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize))
+  {
+    CloseHandle(file);
+    return false;
+  }
+
+  // Empty files cannot be mapped but are still valid files
+  if (fileSize.QuadPart == 0)
+  {
+    CloseHandle(file);
+    opened = true;
+    return true;
+  }
+
+  HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  CloseHandle(file);
+  if (mapping == nullptr)
+  {
+    return false;
+  }
+
+  // The view keeps the mapping alive after its handle is closed
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (view == nullptr)
+  {
+    return false;
+  }
+
+  mappedData = static_cast<const uint8_t*>(view);
+  mappedSize = static_cast<size_t>(fileSize.QuadPart);
+  opened = true;
+
+  // Views are not read ahead on their own, a sequential reader would
+  // otherwise fault in one small run of pages after the other
+  if (access == FileAccess::Sequential)
+  {
+    prefetch(0, mappedSize);
+  }
+  return true;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+  if (offset >= mappedSize)
+  {
+    return;
+  }
+
+  WIN32_MEMORY_RANGE_ENTRY range;
+  range.VirtualAddress = const_cast<uint8_t*>(mappedData + offset);
+  range.NumberOfBytes = std::min(size, mappedSize - offset);
+  PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::close()
+{
+  if (mappedData != nullptr)
+  {
+    UnmapViewOfFile(mappedData);
+  }
+  mappedData = nullptr;
+  mappedSize = 0;
+  opened = false;
+}
+
+bool evictFromFileCache(const std::string&)
+{
+  return false;
+}
+
+#else
+
+bool MappedFile::open(const std::string& path, FileAccess access)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  // Empty files cannot be mapped but are still valid files
+  if (fileStat.st_size == 0)
+  {
+    ::close(fd);
+    opened = true;
+    return true;
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (view == MAP_FAILED)
+  {
+    return false;
+  }
+
+  mappedData = static_cast<const uint8_t*>(view);
+  mappedSize = static_cast<size_t>(fileStat.st_size);
+  opened = true;
+
+  // Only hints, a failure leaves the default read ahead in place
+  if (access == FileAccess::Sequential)
+  {
+    madvise(view, mappedSize, MADV_SEQUENTIAL);
+    madvise(view, mappedSize, MADV_WILLNEED);
+  }
+  else if (access == FileAccess::Random)
+  {
+    madvise(view, mappedSize, MADV_RANDOM);
+  }
+  return true;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const
+{
+  if (offset >= mappedSize)
+  {
+    return;
+  }
+
+  // madvise() takes whole pages
+  const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = offset / pageSize * pageSize;
+  const size_t end = offset + std::min(size, mappedSize - offset);
+  madvise(const_cast<uint8_t*>(mappedData) + begin, end - begin, MADV_WILLNEED);
+}
+
+void MappedFile::close()
+{
+  if (mappedData != nullptr)
+  {
+    munmap(const_cast<uint8_t*>(mappedData), mappedSize);
+  }
+  mappedData = nullptr;
+  mappedSize = 0;
+  opened = false;
+}
+
+bool evictFromFileCache(const std::string& path)
+{
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    return false;
+  }
+
+  // Only clean pages that no mapping holds are dropped, which covers files
+  // that were read and closed
+  bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  ::close(fd);
+  return evicted;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+// How a mapped file is going to be read, passed on to the OS as a paging hint
+enum class FileAccess
+{
+  Normal,
+  // Read front to back soon after opening, like a source that is decoded
+  // as a whole: read ahead aggressively, starting right away
+  Sequential,
+  // Read in scattered pieces, like the pages of a virtual texture: do not
+  // read ahead of the pieces that are touched
+  Random
+};
+
+// Read-only memory mapping of a whole file. Decoders and staging copies read
+// straight from data(), without copying the file into a buffer first. The
+// mapping starts on a page boundary, so it is aligned for any type.
+class MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+
+  // Returns false if the file does not exist or cannot be mapped
+  bool open(const std::string& path, FileAccess access = FileAccess::Normal);
+  void close();
+
+  // Asks the OS to start reading [offset, offset + size) in the background,
+  // so that touching it later does not wait for the disk
+  void prefetch(size_t offset, size_t size) const;
+
+  bool isOpen() const { return opened; }
+  const uint8_t* data() const { return mappedData; }
+  size_t size() const { return mappedSize; }
+
+private:
+  const uint8_t* mappedData = nullptr;
+  size_t mappedSize = 0;
+  bool opened = false;
+};
+
+// Drops the file's pages from the OS file cache, so that the next read comes
+// from the disk, for measuring cold starts. Returns false where that is not
+// supported.
+bool evictFromFileCache(const std::string& path);
+
+// Lets parsers that only read std::istream read a mapping without a copy
+class MemoryStreamBuffer : public std::streambuf
+{
+public:
+  MemoryStreamBuffer(const uint8_t* data, size_t size)
+  {
+    char* begin = const_cast<char*>(reinterpret_cast<const char*>(data));
+    setg(begin, begin, begin + size);
+  }
+};
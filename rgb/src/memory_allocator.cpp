@@ -0,0 +1,370 @@
+#include "memory_allocator.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include "benchmark.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+{
+  this->device = device;
+  preferredBlockSize = blockSize;
+
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  bufferImageGranularity = std::max<VkDeviceSize>(1, properties.limits.bufferImageGranularity);
+  maxMemoryAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+
+void MemoryAllocator::destroy()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (uint32_t i = 0; i < blocks.size(); ++i)
+  {
+    if (blocks[i] == nullptr)
+    {
+      continue;
+    }
+    if (blocks[i]->allocationCount != 0)
+    {
+      std::cerr << "WARNING: Memory block " << i << " still has " << blocks[i]->allocationCount << " allocations" << std::endl;
+    }
+    destroyBlock(i);
+  }
+  blocks.clear();
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+  for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+  {
+    if ((typeFilter & (1 << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+    {
+      return i;
+    }
+  }
+
+  std::cerr << "ERROR: Failed to find suitable memory type!" << std::endl;
+  throw std::runtime_error("Failed to find suitable memory type!");
+}
+
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceLayout layout)
+{
+  const uint32_t memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Allocation allocation;
+
+  // Blocks of a small heap, like the host visible part of VRAM, are capped at an eighth of it
+  const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+  const VkDeviceSize blockSize = std::min(preferredBlockSize, std::max<VkDeviceSize>(heapSize / 8, 1));
+
+  if (requirements.size > blockSize / 2)
+  {
+    uint32_t blockIndex = createBlock(memoryTypeIndex, requirements.size, true);
+    allocateFromBlock(blockIndex, requirements, layout, allocation);
+    return allocation;
+  }
+
+  // Best fit is chosen within each block, blocks are tried oldest first
+  for (uint32_t i = 0; i < blocks.size(); ++i)
+  {
+    const Block* block = blocks[i].get();
+    if (block != nullptr && !block->dedicated && block->memoryTypeIndex == memoryTypeIndex
+      && allocateFromBlock(i, requirements, layout, allocation))
+    {
+      return allocation;
+    }
+  }
+
+  uint32_t blockIndex = createBlock(memoryTypeIndex, blockSize, false);
+  if (!allocateFromBlock(blockIndex, requirements, layout, allocation))
+  {
+    std::cerr << "ERROR: Failed to place allocation in a new memory block!" << std::endl;
+    throw std::runtime_error("Failed to place allocation in a new memory block!");
+  }
+  return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation)
+{
+  if (allocation.memory == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Block& block = *blocks[allocation.blockIndex];
+  auto range = std::prev(block.ranges.upper_bound(allocation.offset));
+  range->second.free = true;
+  range->second.padding = 0;
+  --block.allocationCount;
+
+  auto next = std::next(range);
+  if (next != block.ranges.end() && next->second.free)
+  {
+    range->second.size += next->second.size;
+    block.ranges.erase(next);
+  }
+  if (range != block.ranges.begin())
+  {
+    auto previous = std::prev(range);
+    if (previous->second.free)
+    {
+      previous->second.size += range->second.size;
+      block.ranges.erase(range);
+    }
+  }
+
+  if (block.allocationCount == 0)
+  {
+    // One empty block per memory type is kept around so that freeing and
+    // reallocating, like on every resize, does not hit the driver each time
+    bool otherEmptyBlock = false;
+    for (uint32_t i = 0; i < blocks.size(); ++i)
+    {
+      const Block* other = blocks[i].get();
+      if (i != allocation.blockIndex && other != nullptr && !other->dedicated
+        && other->memoryTypeIndex == block.memoryTypeIndex && other->allocationCount == 0)
+      {
+        otherEmptyBlock = true;
+      }
+    }
+
+    if (block.dedicated || otherEmptyBlock)
+    {
+      destroyBlock(allocation.blockIndex);
+    }
+  }
+
+  allocation = Allocation();
+}
+
+// Resources of different layouts conflict when the end of the first and the
+// start of the second fall into the same bufferImageGranularity page
+bool MemoryAllocator::conflicts(ResourceLayout a, ResourceLayout b, VkDeviceSize endOfFirst, VkDeviceSize startOfSecond) const
+{
+  if (a == b || bufferImageGranularity == 1)
+  {
+    return false;
+  }
+  return (endOfFirst - 1) / bufferImageGranularity == startOfSecond / bufferImageGranularity;
+}
+
+bool MemoryAllocator::allocateFromBlock(uint32_t blockIndex, const VkMemoryRequirements& requirements, ResourceLayout layout, Allocation& allocation)
+{
+  Block& block = *blocks[blockIndex];
+  const VkDeviceSize alignment = std::max<VkDeviceSize>(1, requirements.alignment);
+
+  auto best = block.ranges.end();
+  VkDeviceSize bestOffset = 0;
+
+  for (auto it = block.ranges.begin(); it != block.ranges.end(); ++it)
+  {
+    const VkDeviceSize rangeStart = it->first;
+    const Range& range = it->second;
+    if (!range.free || range.size < requirements.size)
+    {
+      continue;
+    }
+    if (best != block.ranges.end() && range.size >= best->second.size)
+    {
+      continue;
+    }
+
+    VkDeviceSize offset = alignUp(rangeStart, alignment);
+
+    // Free ranges are always merged, so the neighbours are used ranges
+    if (it != block.ranges.begin())
+    {
+      auto previous = std::prev(it);
+      if (conflicts(previous->second.layout, layout, rangeStart, offset))
+      {
+        offset = alignUp(offset, bufferImageGranularity);
+      }
+    }
+
+    const VkDeviceSize rangeEnd = rangeStart + range.size;
+    if (offset + requirements.size > rangeEnd)
+    {
+      continue;
+    }
+
+    auto next = std::next(it);
+    if (next != block.ranges.end() && conflicts(layout, next->second.layout, offset + requirements.size, next->first))
+    {
+      continue;
+    }
+
+    best = it;
+    bestOffset = offset;
+  }
+
+  if (best == block.ranges.end())
+  {
+    return false;
+  }
+
+  // The padding in front of the allocation stays part of the used range and
+  // is returned along with it
+  const VkDeviceSize rangeStart = best->first;
+  const VkDeviceSize rangeEnd = rangeStart + best->second.size;
+  const VkDeviceSize usedEnd = bestOffset + requirements.size;
+
+  best->second.size = usedEnd - rangeStart;
+  best->second.padding = bestOffset - rangeStart;
+  best->second.free = false;
+  best->second.layout = layout;
+  if (usedEnd < rangeEnd)
+  {
+    block.ranges[usedEnd] = {rangeEnd - usedEnd, 0, true, ResourceLayout::Linear};
+  }
+  ++block.allocationCount;
+
+  allocation.memory = block.memory;
+  allocation.offset = bestOffset;
+  allocation.size = requirements.size;
+  allocation.mapped = block.mapped != nullptr ? block.mapped + bestOffset : nullptr;
+  allocation.blockIndex = blockIndex;
+  return true;
+}
+
+uint32_t MemoryAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated)
+{
+  uint32_t blockCount = 0;
+  for (const auto& block : blocks)
+  {
+    blockCount += block != nullptr ? 1 : 0;
+  }
+  if (blockCount >= maxMemoryAllocationCount)
+  {
+    std::cerr << "ERROR: Exceeded maxMemoryAllocationCount of " << maxMemoryAllocationCount << "!" << std::endl;
+    throw std::runtime_error("Exceeded maxMemoryAllocationCount!");
+  }
+
+  auto block = std::make_unique<Block>();
+  block->size = size;
+  block->memoryTypeIndex = memoryTypeIndex;
+  block->dedicated = dedicated;
+  block->mapped = nullptr;
+  block->allocationCount = 0;
+  block->ranges[0] = {size, 0, true, ResourceLayout::Linear};
+
+  VkMemoryAllocateInfo allocInfo = {};
+  allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  allocInfo.allocationSize = size;
+  allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+  if (vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to allocate " << size << " bytes of device memory!" << std::endl;
+    throw std::runtime_error("Failed to allocate device memory!");
+  }
+
+  if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+  {
+    void* data;
+    if (vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+    {
+      vkFreeMemory(device, block->memory, nullptr);
+      std::cerr << "ERROR: Failed to map device memory!" << std::endl;
+      throw std::runtime_error("Failed to map device memory!");
+    }
+    block->mapped = static_cast<uint8_t*>(data);
+  }
+
+  for (uint32_t i = 0; i < blocks.size(); ++i)
+  {
+    if (blocks[i] == nullptr)
+    {
+      blocks[i] = std::move(block);
+      return i;
+    }
+  }
+  blocks.push_back(std::move(block));
+  return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+void MemoryAllocator::destroyBlock(uint32_t blockIndex)
+{
+  Block& block = *blocks[blockIndex];
+  if (block.mapped != nullptr)
+  {
+    vkUnmapMemory(device, block.memory);
+  }
+  vkFreeMemory(device, block.memory, nullptr);
+  blocks[blockIndex].reset();
+}
+
+MemoryStatistics MemoryAllocator::getStatistics() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  MemoryStatistics statistics;
+  VkDeviceSize largestFreeRanges = 0;
+  for (const auto& block : blocks)
+  {
+    if (block == nullptr)
+    {
+      continue;
+    }
+
+    ++statistics.blockCount;
+    statistics.dedicatedBlockCount += block->dedicated ? 1 : 0;
+    statistics.allocationCount += block->allocationCount;
+    statistics.blockBytes += block->size;
+
+    VkDeviceSize blockLargestFreeRange = 0;
+    for (const auto& entry : block->ranges)
+    {
+      const Range& range = entry.second;
+      if (range.free)
+      {
+        statistics.freeBytes += range.size;
+        blockLargestFreeRange = std::max(blockLargestFreeRange, range.size);
+      }
+      else
+      {
+        statistics.usedBytes += range.size - range.padding;
+        statistics.paddingBytes += range.padding;
+      }
+    }
+    statistics.largestFreeRange = std::max(statistics.largestFreeRange, blockLargestFreeRange);
+    largestFreeRanges += blockLargestFreeRange;
+  }
+
+  if (statistics.freeBytes != 0)
+  {
+    statistics.fragmentation = 1.0 - static_cast<double>(largestFreeRanges) / static_cast<double>(statistics.freeBytes);
+  }
+  return statistics;
+}
+
+void MemoryAllocator::printStatistics() const
+{
+  const MemoryStatistics statistics = getStatistics();
+  const double MIB = 1024.0 * 1024.0;
+  StreamFormatGuard formatGuard(std::cerr);
+
+  std::cerr << "INFO: GPU memory: " << statistics.allocationCount << " allocations in "
+    << statistics.blockCount << " blocks (" << statistics.dedicatedBlockCount << " dedicated, limit "
+    << maxMemoryAllocationCount << ")" << std::endl;
+  std::cerr << "INFO:   " << std::fixed << std::setprecision(2)
+    << statistics.usedBytes / MIB << " MiB used of " << statistics.blockBytes / MIB << " MiB, "
+    << statistics.paddingBytes / 1024.0 << " KiB lost to alignment, "
+    << statistics.freeBytes / MIB << " MiB free, "
+    << statistics.fragmentation * 100.0 << "% fragmented" << std::endl;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Sub-allocates buffers and images out of large VkDeviceMemory blocks. Every
+// memory type has its own list of blocks, and each block keeps a map of free
+// and used ranges ordered by offset. Placement is best fit, honours the
+// resource's alignment, and keeps linear and optimal resources
+// bufferImageGranularity apart. Resources larger than half a block get a
+// dedicated block of their own.
+//
+// Host visible blocks are mapped once when they are created, since a
+// VkDeviceMemory can only be mapped once at a time. Use Allocation::mapped
+// instead of vkMapMemory.
+
+// Buffers and linear images must not share a bufferImageGranularity page with optimal images
+enum class ResourceLayout
+{
+  Linear,
+  Optimal
+};
+
+struct Allocation
+{
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  // Points at offset inside the persistently mapped block, nullptr if the memory is not host visible
+  void* mapped = nullptr;
+  uint32_t blockIndex = 0;
+};
+
+struct MemoryStatistics
+{
+  uint32_t blockCount = 0;
+  uint32_t dedicatedBlockCount = 0;
+  uint32_t allocationCount = 0;
+  VkDeviceSize blockBytes = 0;
+  VkDeviceSize usedBytes = 0;
+  // Lost to alignment and granularity padding in front of allocations
+  VkDeviceSize paddingBytes = 0;
+  VkDeviceSize freeBytes = 0;
+  VkDeviceSize largestFreeRange = 0;
+  // Share of the free memory that lies outside the largest free range of its block
+  double fragmentation = 0.0;
+};
+
+class MemoryAllocator
+{
+public:
+  static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+  // Frees all blocks; every allocation must have been freed before
+  void destroy();
+
+  // Throws if no memory type matches or the device is out of memory
+  Allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, ResourceLayout layout);
+  void free(Allocation& allocation);
+
+  uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+  MemoryStatistics getStatistics() const;
+  void printStatistics() const;
+
+private:
+  struct Range
+  {
+    VkDeviceSize size;
+    VkDeviceSize padding;
+    bool free;
+    ResourceLayout layout;
+  };
+
+  struct Block
+  {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memoryTypeIndex;
+    bool dedicated;
+    uint8_t* mapped;
+    uint32_t allocationCount;
+    // Keyed by offset, covers the whole block, adjacent free ranges are always merged
+    std::map<VkDeviceSize, Range> ranges;
+  };
+
+  bool allocateFromBlock(uint32_t blockIndex, const VkMemoryRequirements& requirements, ResourceLayout layout, Allocation& allocation);
+  uint32_t createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated);
+  void destroyBlock(uint32_t blockIndex);
+  bool conflicts(ResourceLayout a, ResourceLayout b, VkDeviceSize endOfFirst, VkDeviceSize startOfSecond) const;
+
+  VkDevice device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties = {};
+  VkDeviceSize bufferImageGranularity = 1;
+  uint32_t maxMemoryAllocationCount = 0;
+  VkDeviceSize preferredBlockSize = DEFAULT_BLOCK_SIZE;
+
+  // Destroyed blocks leave a null slot so that block indices stay stable
+  std::vector<std::unique_ptr<Block>> blocks;
+  mutable std::mutex mutex;
+};
@@ -0,0 +1,151 @@
+#include "mesh_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool MeshCache::open(const std::string& path, uint64_t sourceSize, uint64_t sourceHash)
+{
+  close();
+
+  if (!file.open(path, FileAccess::Sequential))
+  {
+    return false;
+  }
+
+  MeshCacheHeader header;
+  if (file.size() < sizeof(header))
+  {
+    std::cerr << "WARNING: Mesh cache " << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+  memcpy(&header, file.data(), sizeof(header));
+
+  if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION)
+  {
+    std::cerr << "INFO: Mesh cache " << path << " has an old format, rebuilding" << std::endl;
+    close();
+    return false;
+  }
+
+  if (header.sourceSize != sourceSize || header.sourceHash != sourceHash)
+  {
+    std::cerr << "INFO: Mesh cache " << path << " is out of date, rebuilding" << std::endl;
+    close();
+    return false;
+  }
+
+  uint64_t tableEnd = sizeof(header) + static_cast<uint64_t>(header.chunkCount) * sizeof(MeshCacheChunk);
+  if (tableEnd > file.size())
+  {
+    std::cerr << "WARNING: Mesh cache " << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+
+  chunks.resize(header.chunkCount);
+  memcpy(chunks.data(), file.data() + sizeof(header), chunks.size() * sizeof(MeshCacheChunk));
+
+  for (const auto& chunk : chunks)
+  {
+    bool inBounds = chunk.offset >= tableEnd && chunk.offset <= file.size() && chunk.size <= file.size() - chunk.offset;
+    bool wholeElements = chunk.elementSize != 0 && chunk.size % chunk.elementSize == 0;
+    if (!inBounds || !wholeElements || chunk.offset % MESH_CACHE_ALIGNMENT != 0)
+    {
+      std::cerr << "WARNING: Mesh cache " << path << " has a malformed chunk table" << std::endl;
+      close();
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void MeshCache::close()
+{
+  file.close();
+  chunks.clear();
+}
+
+const MeshCacheChunk* MeshCache::findChunk(uint32_t id) const
+{
+  for (const auto& chunk : chunks)
+  {
+    if (chunk.id == id)
+    {
+      return &chunk;
+    }
+  }
+  return nullptr;
+}
+
+void MeshCacheWriter::addChunk(uint32_t id, uint32_t elementSize, const void* data, size_t size)
+{
+  chunks.push_back({id, elementSize, data, size});
+}
+
+bool MeshCacheWriter::write(const std::string& path, uint64_t sourceSize, uint64_t sourceHash) const
+{
+  MeshCacheHeader header = {};
+  header.magic = MESH_CACHE_MAGIC;
+  header.version = MESH_CACHE_VERSION;
+  header.sourceSize = sourceSize;
+  header.sourceHash = sourceHash;
+  header.chunkCount = static_cast<uint32_t>(chunks.size());
+
+  std::vector<MeshCacheChunk> table(chunks.size());
+  uint64_t offset = alignUp(sizeof(header) + table.size() * sizeof(MeshCacheChunk), MESH_CACHE_ALIGNMENT);
+  for (size_t i = 0; i < chunks.size(); ++i)
+  {
+    table[i].id = chunks[i].id;
+    table[i].elementSize = chunks[i].elementSize;
+    table[i].offset = offset;
+    table[i].size = chunks[i].size;
+    offset = alignUp(offset + chunks[i].size, MESH_CACHE_ALIGNMENT);
+  }
+
+  const std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+      std::cerr << "WARNING: Failed to create mesh cache " << temporaryPath << std::endl;
+      return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(MeshCacheChunk));
+
+    const char padding[MESH_CACHE_ALIGNMENT] = {};
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+      uint64_t position = static_cast<uint64_t>(out.tellp());
+      out.write(padding, static_cast<std::streamsize>(table[i].offset - position));
+      out.write(static_cast<const char*>(chunks[i].data), static_cast<std::streamsize>(chunks[i].size));
+    }
+
+    if (!out)
+    {
+      std::cerr << "WARNING: Failed to write mesh cache " << temporaryPath << std::endl;
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error)
+  {
+    std::cerr << "WARNING: Failed to replace mesh cache " << path << ": " << error.message() << std::endl;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Binary cache of processed mesh data, laid out so that it can be memory
+// mapped and copied straight into staging buffers:
+//
+//   MeshCacheHeader
+//   MeshCacheChunk[chunkCount]
+//   chunk payloads, each aligned to MESH_CACHE_ALIGNMENT
+//
+// All values are little endian. The cache records the size and hash of the
+// source file it was built from and is ignored when either no longer matches.
+// Bump MESH_CACHE_VERSION whenever the layout or the processing that produced
+// a chunk changes.
+
+constexpr uint32_t makeChunkId(const char (&id)[5])
+{
+  return static_cast<uint32_t>(id[0]) |
+    (static_cast<uint32_t>(id[1]) << 8) |
+    (static_cast<uint32_t>(id[2]) << 16) |
+    (static_cast<uint32_t>(id[3]) << 24);
+}
+
+const uint32_t MESH_CACHE_MAGIC = makeChunkId("RGBM");
+const uint32_t MESH_CACHE_VERSION = 3;
+const uint64_t MESH_CACHE_ALIGNMENT = 64;
+
+const uint32_t MESH_CHUNK_VERTICES = makeChunkId("VERT");
+const uint32_t MESH_CHUNK_INDICES = makeChunkId("INDX");
+const uint32_t MESH_CHUNK_LODS = makeChunkId("LODS");
+
+struct MeshCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceSize;
+  uint64_t sourceHash;
+  uint32_t chunkCount;
+  uint32_t reserved;
+};
+
+struct MeshCacheChunk
+{
+  uint32_t id;
+  uint32_t elementSize;
+  uint64_t offset;
+  uint64_t size;
+};
+
+class MeshCache
+{
+public:
+  // Maps the cache and validates it against the source it should describe.
+  // Returns false if the cache is missing, stale or malformed.
+  bool open(const std::string& path, uint64_t sourceSize, uint64_t sourceHash);
+  void close();
+
+  bool isOpen() const { return file.isOpen(); }
+
+  // Finds a chunk whose elements are of type T, returns false if it is
+  // missing or was written with a different element size
+  template<typename T>
+  bool getChunk(uint32_t id, const T*& data, size_t& count) const
+  {
+    const MeshCacheChunk* chunk = findChunk(id);
+    if (chunk == nullptr || chunk->elementSize != sizeof(T))
+    {
+      return false;
+    }
+
+    data = reinterpret_cast<const T*>(file.data() + chunk->offset);
+    count = static_cast<size_t>(chunk->size / sizeof(T));
+    return true;
+  }
+
+private:
+  const MeshCacheChunk* findChunk(uint32_t id) const;
+
+  MappedFile file;
+  std::vector<MeshCacheChunk> chunks;
+};
+
+class MeshCacheWriter
+{
+public:
+  // The data is referenced, not copied, and must stay alive until write()
+  template<typename T>
+  void addChunk(uint32_t id, const std::vector<T>& data)
+  {
+    addChunk(id, sizeof(T), data.data(), data.size() * sizeof(T));
+  }
+
+  void addChunk(uint32_t id, uint32_t elementSize, const void* data, size_t size);
+
+  // Writes to a temporary file first so a partially written cache is never picked up
+  bool write(const std::string& path, uint64_t sourceSize, uint64_t sourceHash) const;
+
+private:
+  struct PendingChunk
+  {
+    uint32_t id;
+    uint32_t elementSize;
+    const void* data;
+    size_t size;
+  };
+
+  std::vector<PendingChunk> chunks;
+};
@@ -0,0 +1,442 @@
+#include "mesh_dedup.h"
+
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "benchmark.h"
+#include "parallel.h"
+
+static const uint32_t EMPTY_SLOT = std::numeric_limits<uint32_t>::max();
+
+static Vertex makeVertex(const tinyobj::attrib_t& attrib, int vertexIndex, int texcoordIndex)
+{
+  Vertex vertex = {};
+
+  vertex.pos = {
+    attrib.vertices[3 * vertexIndex + 0],
+    attrib.vertices[3 * vertexIndex + 1],
+    attrib.vertices[3 * vertexIndex + 2]
+  };
+
+  if (texcoordIndex >= 0)
+  {
+    vertex.texCoord = {
+      attrib.texcoords[2 * texcoordIndex + 0],
+      1.0f - attrib.texcoords[2 * texcoordIndex + 1]
+    };
+  }
+  else
+  {
+    vertex.texCoord = {0.0f, 1.0f};
+  }
+
+  vertex.color = {1.0f, 1.0f, 1.0f};
+
+  return vertex;
+}
+
+// A corner is identified by its position and texcoord indices; normals are
+// not part of Vertex so they do not split vertices
+static uint64_t makeCornerKey(const tinyobj::index_t& index)
+{
+  return static_cast<uint64_t>(static_cast<uint32_t>(index.vertex_index)) |
+    (static_cast<uint64_t>(static_cast<uint32_t>(index.texcoord_index)) << 32);
+}
+
+static Vertex makeVertex(const tinyobj::attrib_t& attrib, uint64_t cornerKey)
+{
+  return makeVertex(attrib, static_cast<int32_t>(cornerKey & 0xFFFFFFFFu), static_cast<int32_t>(cornerKey >> 32));
+}
+
+// MurmurHash3 finalizer, spreads the key bits over the whole word
+static uint64_t mixBits(uint64_t key)
+{
+  key ^= key >> 33;
+  key *= 0xFF51AFD7ED558CCDull;
+  key ^= key >> 33;
+  key *= 0xC4CEB9FE1A85EC53ull;
+  key ^= key >> 33;
+  return key;
+}
+
+static uint64_t hashVertex(const Vertex& vertex)
+{
+  const float values[] = {
+    vertex.pos.x, vertex.pos.y, vertex.pos.z,
+    vertex.color.x, vertex.color.y, vertex.color.z,
+    vertex.texCoord.x, vertex.texCoord.y
+  };
+
+  uint64_t hash = 0;
+  for (float value : values)
+  {
+    // Adding zero folds -0.0 into 0.0, which compare equal
+    float normalized = value + 0.0f;
+    uint32_t bits;
+    memcpy(&bits, &normalized, sizeof(bits));
+    hash = mixBits(hash ^ bits);
+  }
+  return hash;
+}
+
+static size_t nextPowerOfTwo(size_t value)
+{
+  size_t power = 1;
+  while (power < value)
+  {
+    power <<= 1;
+  }
+  return power;
+}
+
+void buildIndexedMeshReference(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+  vertices.clear();
+  indices.clear();
+
+  std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+
+  for (const auto& shape : shapes)
+  {
+    for (const auto& index : shape.mesh.indices)
+    {
+      Vertex vertex = makeVertex(attrib, index.vertex_index, index.texcoord_index);
+
+      if (uniqueVertices.count(vertex) == 0)
+      {
+        uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(vertex);
+      }
+
+      indices.push_back(uniqueVertices[vertex]);
+    }
+  }
+}
+
+void buildIndexedMesh(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, unsigned threadCount)
+{
+  size_t cornerCount = 0;
+  for (const auto& shape : shapes)
+  {
+    cornerCount += shape.mesh.indices.size();
+  }
+
+  if (cornerCount >= EMPTY_SLOT)
+  {
+    std::cerr << "ERROR: Mesh has too many corners for 32-bit indices!" << std::endl;
+    throw std::runtime_error("Mesh has too many corners for 32-bit indices!");
+  }
+
+  threadCount = std::max(1u, threadCount);
+
+  // Flatten every shape's corners into one key array
+  std::vector<uint64_t> keys(cornerCount);
+  size_t shapeOffset = 0;
+  for (const auto& shape : shapes)
+  {
+    const auto& shapeIndices = shape.mesh.indices;
+    parallelFor(shapeIndices.size(), threadCount, [&](size_t begin, size_t end, unsigned)
+    {
+      for (size_t i = begin; i < end; ++i)
+      {
+        keys[shapeOffset + i] = makeCornerKey(shapeIndices[i]);
+      }
+    });
+    shapeOffset += shapeIndices.size();
+  }
+
+  // Several shards per thread keeps the per-shard work balanced
+  const size_t shardCount = std::max<size_t>(64, nextPowerOfTwo(static_cast<size_t>(threadCount) * 16));
+  int shardShift = 64;
+  for (size_t shards = shardCount; shards > 1; shards >>= 1)
+  {
+    --shardShift;
+  }
+  auto shardOf = [shardShift](uint64_t hash)
+  {
+    return static_cast<size_t>(hash >> shardShift);
+  };
+
+  // Bucket corner numbers by shard. Each thread scatters its own contiguous
+  // range after the ranges of lower threads, so every shard lists its
+  // corners in ascending order.
+  std::vector<uint32_t> shardOffsets(static_cast<size_t>(threadCount) * shardCount, 0);
+  parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end, unsigned thread)
+  {
+    uint32_t* counts = &shardOffsets[thread * shardCount];
+    for (size_t c = begin; c < end; ++c)
+    {
+      ++counts[shardOf(mixBits(keys[c]))];
+    }
+  });
+
+  std::vector<uint32_t> shardStart(shardCount + 1, 0);
+  uint32_t running = 0;
+  for (size_t s = 0; s < shardCount; ++s)
+  {
+    shardStart[s] = running;
+    for (unsigned t = 0; t < threadCount; ++t)
+    {
+      uint32_t count = shardOffsets[t * shardCount + s];
+      shardOffsets[t * shardCount + s] = running;
+      running += count;
+    }
+  }
+  shardStart[shardCount] = running;
+
+  std::vector<uint32_t> shardCorners(cornerCount);
+  parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end, unsigned thread)
+  {
+    uint32_t* offsets = &shardOffsets[thread * shardCount];
+    for (size_t c = begin; c < end; ++c)
+    {
+      shardCorners[offsets[shardOf(mixBits(keys[c]))]++] = static_cast<uint32_t>(c);
+    }
+  });
+
+  // Deduplicate every shard independently in an open addressing table,
+  // remembering the first corner of each distinct key
+  std::vector<uint32_t> cornerEntry(cornerCount);
+  std::vector<uint8_t> isFirst(cornerCount, 0);
+  std::vector<std::vector<uint32_t>> shardFirstCorners(shardCount);
+
+  parallelFor(shardCount, threadCount, [&](size_t begin, size_t end, unsigned)
+  {
+    std::vector<uint64_t> tableKeys;
+    std::vector<uint32_t> tableEntries;
+
+    for (size_t s = begin; s < end; ++s)
+    {
+      const uint32_t* corners = shardCorners.data() + shardStart[s];
+      const size_t count = shardStart[s + 1] - shardStart[s];
+      auto& firstCorners = shardFirstCorners[s];
+
+      // Most vertices are shared by several triangles, start small and grow
+      size_t capacity = nextPowerOfTwo(std::max<size_t>(16, count / 2));
+      tableKeys.assign(capacity, 0);
+      tableEntries.assign(capacity, EMPTY_SLOT);
+
+      auto insert = [&](uint64_t key, uint32_t entry)
+      {
+        size_t mask = tableEntries.size() - 1;
+        size_t slot = static_cast<size_t>(mixBits(key)) & mask;
+        while (tableEntries[slot] != EMPTY_SLOT)
+        {
+          slot = (slot + 1) & mask;
+        }
+        tableKeys[slot] = key;
+        tableEntries[slot] = entry;
+      };
+
+      for (size_t i = 0; i < count; ++i)
+      {
+        const uint32_t corner = corners[i];
+        const uint64_t key = keys[corner];
+        size_t mask = tableEntries.size() - 1;
+        size_t slot = static_cast<size_t>(mixBits(key)) & mask;
+
+        while (tableEntries[slot] != EMPTY_SLOT && tableKeys[slot] != key)
+        {
+          slot = (slot + 1) & mask;
+        }
+
+        if (tableEntries[slot] != EMPTY_SLOT)
+        {
+          cornerEntry[corner] = tableEntries[slot];
+          continue;
+        }
+
+        const uint32_t entry = static_cast<uint32_t>(firstCorners.size());
+        firstCorners.push_back(corner);
+        isFirst[corner] = 1;
+        cornerEntry[corner] = entry;
+        tableKeys[slot] = key;
+        tableEntries[slot] = entry;
+
+        // Keep the load factor at or below one half
+        if (firstCorners.size() * 2 > tableEntries.size())
+        {
+          std::vector<uint64_t> oldKeys(tableEntries.size() * 2, 0);
+          std::vector<uint32_t> oldEntries(tableEntries.size() * 2, EMPTY_SLOT);
+          oldKeys.swap(tableKeys);
+          oldEntries.swap(tableEntries);
+          for (size_t j = 0; j < oldEntries.size(); ++j)
+          {
+            if (oldEntries[j] != EMPTY_SLOT)
+            {
+              insert(oldKeys[j], oldEntries[j]);
+            }
+          }
+        }
+      }
+    }
+  });
+
+  std::vector<uint32_t> shardBase(shardCount + 1, 0);
+  for (size_t s = 0; s < shardCount; ++s)
+  {
+    shardBase[s + 1] = shardBase[s] + static_cast<uint32_t>(shardFirstCorners[s].size());
+  }
+  const uint32_t uniqueCount = shardBase[shardCount];
+
+  // Number the distinct keys in order of their first corner with a parallel
+  // prefix sum over the first-corner flags; shardCorners is reused for the ranks
+  std::vector<uint32_t>& firstRank = shardCorners;
+  std::vector<uint32_t> chunkFirsts(threadCount + 1, 0);
+  parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end, unsigned thread)
+  {
+    uint32_t firsts = 0;
+    for (size_t c = begin; c < end; ++c)
+    {
+      firsts += isFirst[c];
+    }
+    chunkFirsts[thread + 1] = firsts;
+  });
+  for (unsigned t = 0; t < threadCount; ++t)
+  {
+    chunkFirsts[t + 1] += chunkFirsts[t];
+  }
+  parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end, unsigned thread)
+  {
+    uint32_t rank = chunkFirsts[thread];
+    for (size_t c = begin; c < end; ++c)
+    {
+      if (isFirst[c])
+      {
+        firstRank[c] = rank++;
+      }
+    }
+  });
+
+  std::vector<uint32_t> entryIds(uniqueCount);
+  parallelFor(shardCount, threadCount, [&](size_t begin, size_t end, unsigned)
+  {
+    for (size_t s = begin; s < end; ++s)
+    {
+      const auto& firstCorners = shardFirstCorners[s];
+      for (size_t e = 0; e < firstCorners.size(); ++e)
+      {
+        entryIds[shardBase[s] + e] = firstRank[firstCorners[e]];
+      }
+    }
+  });
+
+  vertices.resize(uniqueCount);
+  indices.resize(cornerCount);
+  parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end, unsigned)
+  {
+    for (size_t c = begin; c < end; ++c)
+    {
+      const uint32_t id = entryIds[shardBase[shardOf(mixBits(keys[c]))] + cornerEntry[c]];
+      indices[c] = id;
+      if (isFirst[c])
+      {
+        vertices[id] = makeVertex(attrib, keys[c]);
+      }
+    }
+  });
+
+  // Different index pairs can still describe the same vertex when the OBJ
+  // repeats positions or texcoords. Merging them in id order keeps the
+  // first-referenced numbering of the reference path.
+  std::vector<uint32_t> remap(uniqueCount);
+  std::vector<uint32_t> table(nextPowerOfTwo(std::max<size_t>(16, static_cast<size_t>(uniqueCount) * 2)), EMPTY_SLOT);
+  const size_t tableMask = table.size() - 1;
+  uint32_t mergedCount = 0;
+
+  for (uint32_t v = 0; v < uniqueCount; ++v)
+  {
+    size_t slot = static_cast<size_t>(hashVertex(vertices[v])) & tableMask;
+    while (table[slot] != EMPTY_SLOT && !(vertices[table[slot]] == vertices[v]))
+    {
+      slot = (slot + 1) & tableMask;
+    }
+
+    if (table[slot] != EMPTY_SLOT)
+    {
+      remap[v] = table[slot];
+    }
+    else
+    {
+      // Compacting in place is safe because mergedCount never exceeds v
+      vertices[mergedCount] = vertices[v];
+      table[slot] = mergedCount;
+      remap[v] = mergedCount++;
+    }
+  }
+
+  if (mergedCount != uniqueCount)
+  {
+    vertices.resize(mergedCount);
+    parallelFor(cornerCount, threadCount, [&](size_t begin, size_t end, unsigned)
+    {
+      for (size_t c = begin; c < end; ++c)
+      {
+        indices[c] = remap[indices[c]];
+      }
+    });
+  }
+}
+
+void benchmarkIndexedMesh(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes)
+{
+  const int REPETITIONS = 5;
+
+  size_t cornerCount = 0;
+  for (const auto& shape : shapes)
+  {
+    cornerCount += shape.mesh.indices.size();
+  }
+  std::cerr << "INFO: Deduplicating " << cornerCount << " corners, " << REPETITIONS << " runs per configuration" << std::endl;
+
+  std::vector<Vertex> referenceVertices;
+  std::vector<uint32_t> referenceIndices;
+  std::vector<double> referenceTimes;
+  for (int run = 0; run < REPETITIONS; ++run)
+  {
+    auto start = BenchmarkClock::now();
+    buildIndexedMeshReference(attrib, shapes, referenceVertices, referenceIndices);
+    referenceTimes.push_back(elapsedMilliseconds(start, BenchmarkClock::now()));
+  }
+  printTimingSummary("std::unordered_map dedup", referenceTimes);
+  const double referenceMedian = summarizeTimings(referenceTimes).median;
+
+  std::vector<unsigned> threadCounts;
+  for (unsigned threads = 1; threads < getDefaultThreadCount(); threads *= 2)
+  {
+    threadCounts.push_back(threads);
+  }
+  threadCounts.push_back(getDefaultThreadCount());
+
+  for (unsigned threads : threadCounts)
+  {
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<double> times;
+    for (int run = 0; run < REPETITIONS; ++run)
+    {
+      auto start = BenchmarkClock::now();
+      buildIndexedMesh(attrib, shapes, vertices, indices, threads);
+      times.push_back(elapsedMilliseconds(start, BenchmarkClock::now()));
+    }
+
+    bool identical = vertices.size() == referenceVertices.size()
+      && indices == referenceIndices
+      && memcmp(vertices.data(), referenceVertices.data(), vertices.size() * sizeof(Vertex)) == 0;
+    if (!identical)
+    {
+      std::cerr << "ERROR: Sharded dedup with " << threads << " threads differs from the reference!" << std::endl;
+      throw std::runtime_error("Sharded dedup differs from the reference!");
+    }
+
+    printTimingSummary("sharded dedup, " + std::to_string(threads) + " thread" + (threads == 1 ? "" : "s"), times);
+    std::cerr << "INFO:   " << referenceMedian / summarizeTimings(times).median << "x faster than std::unordered_map, "
+      << vertices.size() << " vertices" << std::endl;
+  }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <tiny_obj_loader.h>
+
+#include "vertex.h"
+
+// Turns the corners of all tinyobj shapes into a deduplicated vertex buffer
+// and an index buffer. Vertices are numbered in the order they are first
+// referenced, so both functions produce identical output.
+
+// The original single threaded path, hashing every Vertex into a std::unordered_map
+void buildIndexedMeshReference(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Multi-threaded path: deduplicates the (position, texcoord) index pairs in
+// sharded open addressing tables, then merges any pairs that still map to
+// equal vertices
+void buildIndexedMesh(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes,
+  std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, unsigned threadCount);
+
+// Times both paths for an increasing number of threads and checks that they agree
+void benchmarkIndexedMesh(const tinyobj::attrib_t& attrib, const std::vector<tinyobj::shape_t>& shapes);
@@ -0,0 +1,400 @@
+#include "mesh_lod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+// Each LOD aims for this fraction of the triangles of the one before
+static const double LOD_TRIANGLE_RATIO = 0.5;
+// The chain ends when a LOD keeps more than this fraction of the triangles
+// of the one before, since locked borders and seams stop most collapses
+static const double LOD_STALL_RATIO = 0.75;
+// or when the LOD would have fewer triangles than this
+static const size_t LOD_MIN_TRIANGLES = 64;
+// A collapse is rejected if it turns the normal of any remaining triangle by
+// more than about 78 degrees, which also rules out folding triangles over
+static const double MIN_NORMAL_COSINE = 0.2;
+
+struct Point
+{
+  double x, y, z;
+};
+
+static Point getPosition(const Vertex& vertex)
+{
+  return {vertex.pos.x, vertex.pos.y, vertex.pos.z};
+}
+
+static Point subtract(const Point& a, const Point& b)
+{
+  return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static Point cross(const Point& a, const Point& b)
+{
+  return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+static double dot(const Point& a, const Point& b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// Sum of the squared distances to a set of planes, each weighted by the area
+// of the triangle it came from
+struct Quadric
+{
+  double a2, b2, c2, d2;
+  double ab, ac, ad, bc, bd, cd;
+  double weight;
+};
+
+static Quadric makeTriangleQuadric(const Point& p0, const Point& p1, const Point& p2)
+{
+  Quadric quadric = {};
+
+  const Point normal = cross(subtract(p1, p0), subtract(p2, p0));
+  const double length = std::sqrt(dot(normal, normal));
+  if (length == 0.0)
+  {
+    return quadric;
+  }
+
+  const double a = normal.x / length;
+  const double b = normal.y / length;
+  const double c = normal.z / length;
+  const double d = -(a * p0.x + b * p0.y + c * p0.z);
+  const double area = length * 0.5;
+
+  quadric.a2 = area * a * a;
+  quadric.b2 = area * b * b;
+  quadric.c2 = area * c * c;
+  quadric.d2 = area * d * d;
+  quadric.ab = area * a * b;
+  quadric.ac = area * a * c;
+  quadric.ad = area * a * d;
+  quadric.bc = area * b * c;
+  quadric.bd = area * b * d;
+  quadric.cd = area * c * d;
+  quadric.weight = area;
+
+  return quadric;
+}
+
+static void addQuadric(Quadric& quadric, const Quadric& other)
+{
+  quadric.a2 += other.a2;
+  quadric.b2 += other.b2;
+  quadric.c2 += other.c2;
+  quadric.d2 += other.d2;
+  quadric.ab += other.ab;
+  quadric.ac += other.ac;
+  quadric.ad += other.ad;
+  quadric.bc += other.bc;
+  quadric.bd += other.bd;
+  quadric.cd += other.cd;
+  quadric.weight += other.weight;
+}
+
+// Mean squared distance of the point to the planes
+static double evaluateQuadric(const Quadric& quadric, const Point& p)
+{
+  if (quadric.weight == 0.0)
+  {
+    return 0.0;
+  }
+
+  const double error =
+    quadric.a2 * p.x * p.x + quadric.b2 * p.y * p.y + quadric.c2 * p.z * p.z + quadric.d2 +
+    2.0 * (quadric.ab * p.x * p.y + quadric.ac * p.x * p.z + quadric.bc * p.y * p.z) +
+    2.0 * (quadric.ad * p.x + quadric.bd * p.y + quadric.cd * p.z);
+
+  return std::max(error, 0.0) / quadric.weight;
+}
+
+// Moves vertex from onto vertex to, which are the ends of an edge
+struct Collapse
+{
+  double error;
+  uint32_t from;
+  uint32_t to;
+};
+
+// Drops triangles with two corners at the same position, such as the two
+// triangles on either side of a collapsed edge
+static void removeDegenerateTriangles(std::vector<uint32_t>& indices, const std::vector<uint32_t>& positionOf)
+{
+  size_t kept = 0;
+  for (size_t i = 0; i + 2 < indices.size(); i += 3)
+  {
+    const uint32_t p0 = positionOf[indices[i + 0]];
+    const uint32_t p1 = positionOf[indices[i + 1]];
+    const uint32_t p2 = positionOf[indices[i + 2]];
+    if (p0 == p1 || p1 == p2 || p2 == p0)
+    {
+      continue;
+    }
+
+    indices[kept + 0] = indices[i + 0];
+    indices[kept + 1] = indices[i + 1];
+    indices[kept + 2] = indices[i + 2];
+    kept += 3;
+  }
+  indices.resize(kept);
+}
+
+float simplifyMesh(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+  size_t targetIndexCount, std::vector<uint32_t>& result)
+{
+  result.assign(indices, indices + indexCount - indexCount % 3);
+
+  // Vertices that only differ in their texture coordinates share a position,
+  // and all topology is tracked per position. A position with several
+  // vertices lies on a texture seam.
+  std::vector<uint32_t> positionOf(vertexCount);
+  std::vector<uint32_t> vertexCounts(vertexCount, 0);
+  {
+    std::unordered_map<glm::vec3, uint32_t> firstVertex;
+    firstVertex.reserve(vertexCount);
+    for (uint32_t i = 0; i < vertexCount; ++i)
+    {
+      positionOf[i] = firstVertex.emplace(vertices[i].pos, i).first->second;
+      ++vertexCounts[positionOf[i]];
+    }
+  }
+
+  removeDegenerateTriangles(result, positionOf);
+
+  // Every position starts with the planes of the triangles around it, and
+  // collapsing an edge adds the planes of the position that went away to the
+  // one that stayed, so the error is always measured against the input
+  std::vector<Quadric> quadrics(vertexCount, Quadric{});
+  for (size_t i = 0; i < result.size(); i += 3)
+  {
+    const Quadric quadric = makeTriangleQuadric(
+      getPosition(vertices[result[i + 0]]),
+      getPosition(vertices[result[i + 1]]),
+      getPosition(vertices[result[i + 2]]));
+
+    for (size_t corner = 0; corner < 3; ++corner)
+    {
+      addQuadric(quadrics[positionOf[result[i + corner]]], quadric);
+    }
+  }
+
+  std::vector<uint32_t> fanOffsets(vertexCount + 1);
+  std::vector<uint32_t> fanCursors(vertexCount);
+  std::vector<uint32_t> fanTriangles;
+  std::vector<uint32_t> neighbors;
+  std::vector<Collapse> collapses;
+  std::vector<uint8_t> touched(vertexCount);
+  std::vector<uint32_t> remap(vertexCount);
+  double maxError = 0.0;
+
+  // Every pass collapses the cheapest edges that do not share a triangle
+  // with an edge collapsed earlier in the same pass
+  while (result.size() > targetIndexCount)
+  {
+    // Triangles around every position
+    std::fill(fanOffsets.begin(), fanOffsets.end(), 0);
+    for (uint32_t index : result)
+    {
+      ++fanOffsets[positionOf[index] + 1];
+    }
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+      fanOffsets[i + 1] += fanOffsets[i];
+    }
+    std::copy(fanOffsets.begin(), fanOffsets.end() - 1, fanCursors.begin());
+    fanTriangles.resize(result.size());
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+      const uint32_t position = positionOf[result[i]];
+      fanTriangles[fanCursors[position]++] = static_cast<uint32_t>(i / 3);
+    }
+
+    // Only vertices inside a closed, manifold patch of a single texture
+    // chart move: every edge around them has exactly two triangles. Such a
+    // vertex is the only one at its position. Each one picks its cheapest edge.
+    collapses.clear();
+    for (uint32_t vertex = 0; vertex < vertexCount; ++vertex)
+    {
+      const uint32_t fanBegin = fanOffsets[vertex];
+      const uint32_t fanEnd = fanOffsets[vertex + 1];
+      if (positionOf[vertex] != vertex || vertexCounts[vertex] != 1 || fanBegin == fanEnd)
+      {
+        continue;
+      }
+
+      neighbors.clear();
+      for (uint32_t i = fanBegin; i < fanEnd; ++i)
+      {
+        const uint32_t* corners = &result[3 * fanTriangles[i]];
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+          if (corners[corner] != vertex)
+          {
+            neighbors.push_back(positionOf[corners[corner]]);
+          }
+        }
+      }
+      std::sort(neighbors.begin(), neighbors.end());
+
+      bool manifold = true;
+      for (size_t i = 0; i < neighbors.size() && manifold; i += 2)
+      {
+        manifold = i + 1 < neighbors.size() && neighbors[i] == neighbors[i + 1]
+          && (i + 2 == neighbors.size() || neighbors[i + 2] != neighbors[i]);
+      }
+      if (!manifold)
+      {
+        continue;
+      }
+
+      Collapse best = {std::numeric_limits<double>::max(), vertex, vertex};
+      for (uint32_t i = fanBegin; i < fanEnd; ++i)
+      {
+        const uint32_t* corners = &result[3 * fanTriangles[i]];
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+          const uint32_t target = corners[corner];
+          if (target == vertex)
+          {
+            continue;
+          }
+
+          Quadric merged = quadrics[vertex];
+          addQuadric(merged, quadrics[positionOf[target]]);
+          const double error = evaluateQuadric(merged, getPosition(vertices[target]));
+          if (error < best.error)
+          {
+            best = {error, vertex, target};
+          }
+        }
+      }
+      collapses.push_back(best);
+    }
+
+    std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b)
+    {
+      return a.error < b.error;
+    });
+
+    std::fill(touched.begin(), touched.end(), 0);
+    for (uint32_t i = 0; i < vertexCount; ++i)
+    {
+      remap[i] = i;
+    }
+
+    const size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+    size_t trianglesRemoved = 0;
+    size_t collapseCount = 0;
+    for (const Collapse& collapse : collapses)
+    {
+      if (trianglesRemoved >= trianglesToRemove)
+      {
+        break;
+      }
+
+      const uint32_t from = collapse.from;
+      const uint32_t toPosition = positionOf[collapse.to];
+      if (touched[from] || touched[toPosition])
+      {
+        continue;
+      }
+
+      const Point target = getPosition(vertices[collapse.to]);
+      bool flips = false;
+      size_t collapsedTriangles = 0;
+      for (uint32_t i = fanOffsets[from]; i < fanOffsets[from + 1] && !flips; ++i)
+      {
+        const uint32_t* corners = &result[3 * fanTriangles[i]];
+        if (positionOf[corners[0]] == toPosition || positionOf[corners[1]] == toPosition || positionOf[corners[2]] == toPosition)
+        {
+          ++collapsedTriangles;
+          continue;
+        }
+
+        Point before[3];
+        Point after[3];
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+          before[corner] = getPosition(vertices[corners[corner]]);
+          after[corner] = corners[corner] == from ? target : before[corner];
+        }
+
+        const Point normalBefore = cross(subtract(before[1], before[0]), subtract(before[2], before[0]));
+        const Point normalAfter = cross(subtract(after[1], after[0]), subtract(after[2], after[0]));
+        const double lengths = std::sqrt(dot(normalBefore, normalBefore) * dot(normalAfter, normalAfter));
+        flips = dot(normalBefore, normalAfter) <= MIN_NORMAL_COSINE * lengths;
+      }
+      if (flips)
+      {
+        continue;
+      }
+
+      remap[from] = collapse.to;
+      addQuadric(quadrics[toPosition], quadrics[from]);
+      maxError = std::max(maxError, collapse.error);
+      trianglesRemoved += collapsedTriangles;
+      ++collapseCount;
+
+      // Nothing around the collapse moves again in this pass, which keeps
+      // the fans and the flip test of later collapses accurate
+      for (uint32_t i = fanOffsets[from]; i < fanOffsets[from + 1]; ++i)
+      {
+        const uint32_t* corners = &result[3 * fanTriangles[i]];
+        for (size_t corner = 0; corner < 3; ++corner)
+        {
+          touched[positionOf[corners[corner]]] = 1;
+        }
+      }
+    }
+
+    if (collapseCount == 0)
+    {
+      break;
+    }
+
+    for (uint32_t& index : result)
+    {
+      index = remap[index];
+    }
+    removeDegenerateTriangles(result, positionOf);
+  }
+
+  return static_cast<float>(std::sqrt(maxError));
+}
+
+void buildMeshLods(const Vertex* vertices, size_t vertexCount, std::vector<uint32_t>& indices,
+  uint32_t maxLods, std::vector<MeshLod>& lods)
+{
+  lods.clear();
+  lods.push_back({0, static_cast<uint32_t>(indices.size()), 0.0f, 0});
+
+  std::vector<uint32_t> source(indices);
+  std::vector<uint32_t> simplified;
+  float error = 0.0f;
+  while (lods.size() < maxLods)
+  {
+    const size_t targetTriangles = static_cast<size_t>(source.size() / 3 * LOD_TRIANGLE_RATIO);
+    if (targetTriangles < LOD_MIN_TRIANGLES)
+    {
+      break;
+    }
+
+    const float lodError = simplifyMesh(vertices, vertexCount, source.data(), source.size(), targetTriangles * 3, simplified);
+    if (simplified.size() > source.size() * LOD_STALL_RATIO)
+    {
+      break;
+    }
+
+    // Each LOD is simplified from the one before, so its distance from the
+    // original mesh is at most the sum of the errors along the way
+    error += lodError;
+    lods.push_back({static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(simplified.size()), error, 0});
+    indices.insert(indices.end(), simplified.begin(), simplified.end());
+    source.swap(simplified);
+  }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vertex.h"
+
+// Levels of detail of a mesh share its vertex buffer and differ only in
+// their triangles, which are stored one after the other in a single index
+// buffer. LOD 0 is the original mesh.
+
+const uint32_t MAX_MESH_LODS = 8;
+
+// Stored verbatim in the mesh cache
+struct MeshLod
+{
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  // Bound on how far, in model space units, the surface of this LOD is
+  // from the original mesh
+  float error;
+  uint32_t reserved;
+};
+
+// Collapses edges onto one of their existing vertices in order of increasing
+// quadric error, until at most targetIndexCount indices are left or no edge
+// can be collapsed without folding a triangle over. Vertices on open borders
+// and texture seams never move. Returns the error of the simplified mesh
+// relative to the input.
+float simplifyMesh(const Vertex* vertices, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+  size_t targetIndexCount, std::vector<uint32_t>& result);
+
+// Appends up to maxLods - 1 simplified copies of the mesh in indices to
+// indices, each with about half the triangles of the one before, and
+// describes all of them in lods. The chain stops early once simplification
+// no longer gets anywhere.
+void buildMeshLods(const Vertex* vertices, size_t vertexCount, std::vector<uint32_t>& indices,
+  uint32_t maxLods, std::vector<MeshLod>& lods);
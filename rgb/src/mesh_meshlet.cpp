@@ -0,0 +1,150 @@
+#include "mesh_meshlet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static void computeMeshletBounds(const Vertex* vertices, const uint32_t* indices, Meshlet& meshlet)
+{
+  const uint32_t* meshletIndices = indices + meshlet.firstIndex;
+
+  double minimum[3] = {std::numeric_limits<double>::max(), std::numeric_limits<double>::max(), std::numeric_limits<double>::max()};
+  double maximum[3] = {-std::numeric_limits<double>::max(), -std::numeric_limits<double>::max(), -std::numeric_limits<double>::max()};
+  for (uint32_t i = 0; i < meshlet.indexCount; ++i)
+  {
+    const glm::vec3& position = vertices[meshletIndices[i]].pos;
+    const double components[3] = {position.x, position.y, position.z};
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+      minimum[axis] = std::min(minimum[axis], components[axis]);
+      maximum[axis] = std::max(maximum[axis], components[axis]);
+    }
+  }
+
+  double center[3];
+  for (size_t axis = 0; axis < 3; ++axis)
+  {
+    center[axis] = (minimum[axis] + maximum[axis]) * 0.5;
+  }
+
+  double radiusSquared = 0.0;
+  for (uint32_t i = 0; i < meshlet.indexCount; ++i)
+  {
+    const glm::vec3& position = vertices[meshletIndices[i]].pos;
+    const double offset[3] = {position.x - center[0], position.y - center[1], position.z - center[2]};
+    radiusSquared = std::max(radiusSquared, offset[0] * offset[0] + offset[1] * offset[1] + offset[2] * offset[2]);
+  }
+
+  // The axis is the average of the unit triangle normals, the cone's half
+  // angle is the largest angle between it and any of them
+  std::vector<double> normals;
+  normals.reserve(meshlet.indexCount);
+  double axis[3] = {};
+  for (uint32_t i = 0; i + 3 <= meshlet.indexCount; i += 3)
+  {
+    const glm::vec3& p0 = vertices[meshletIndices[i + 0]].pos;
+    const glm::vec3& p1 = vertices[meshletIndices[i + 1]].pos;
+    const glm::vec3& p2 = vertices[meshletIndices[i + 2]].pos;
+
+    const double e1[3] = {p1.x - p0.x, p1.y - p0.y, p1.z - p0.z};
+    const double e2[3] = {p2.x - p0.x, p2.y - p0.y, p2.z - p0.z};
+    double normal[3] = {
+      e1[1] * e2[2] - e1[2] * e2[1],
+      e1[2] * e2[0] - e1[0] * e2[2],
+      e1[0] * e2[1] - e1[1] * e2[0]
+    };
+    const double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    if (length == 0.0)
+    {
+      // Degenerate triangles are never drawn, whichever way they face
+      continue;
+    }
+
+    for (size_t component = 0; component < 3; ++component)
+    {
+      normal[component] /= length;
+      axis[component] += normal[component];
+      normals.push_back(normal[component]);
+    }
+  }
+
+  double cutoff = 2.0;
+  const double axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  if (axisLength > 0.0)
+  {
+    for (double& component : axis)
+    {
+      component /= axisLength;
+    }
+
+    double minimumDot = 1.0;
+    for (size_t i = 0; i < normals.size(); i += 3)
+    {
+      minimumDot = std::min(minimumDot, normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2]);
+    }
+
+    // A view direction within 90 degrees minus the half angle of the axis
+    // sees the back of every triangle, and the sine of the half angle is
+    // the cosine of that
+    if (minimumDot > 0.0)
+    {
+      cutoff = std::sqrt(std::max(1.0 - minimumDot * minimumDot, 0.0));
+    }
+  }
+
+  meshlet.boundingSphere = glm::vec4(static_cast<float>(center[0]), static_cast<float>(center[1]),
+    static_cast<float>(center[2]), static_cast<float>(std::sqrt(radiusSquared)));
+  meshlet.cone = glm::vec4(static_cast<float>(axis[0]), static_cast<float>(axis[1]),
+    static_cast<float>(axis[2]), static_cast<float>(cutoff));
+}
+
+void buildMeshlets(const Vertex* vertices, const uint32_t* indices, uint32_t firstIndex, uint32_t indexCount,
+  int32_t vertexOffset, std::vector<Meshlet>& meshlets)
+{
+  // Vertices of the current meshlet, few enough to search linearly
+  std::vector<uint32_t> meshletVertices;
+  meshletVertices.reserve(MAX_MESHLET_VERTICES);
+
+  Meshlet meshlet = {};
+  meshlet.firstIndex = firstIndex;
+  meshlet.vertexOffset = vertexOffset;
+
+  const uint32_t endIndex = firstIndex + indexCount;
+  for (uint32_t triangle = firstIndex; triangle + 3 <= endIndex; triangle += 3)
+  {
+    uint32_t newVertices = 0;
+    for (uint32_t i = triangle; i < triangle + 3; ++i)
+    {
+      const bool repeated = std::find(&indices[triangle], &indices[i], indices[i]) != &indices[i];
+      if (!repeated && std::find(meshletVertices.begin(), meshletVertices.end(), indices[i]) == meshletVertices.end())
+      {
+        ++newVertices;
+      }
+    }
+
+    if (meshletVertices.size() + newVertices > MAX_MESHLET_VERTICES || meshlet.indexCount == 3 * MAX_MESHLET_TRIANGLES)
+    {
+      computeMeshletBounds(vertices, indices, meshlet);
+      meshlets.push_back(meshlet);
+
+      meshlet.firstIndex = triangle;
+      meshlet.indexCount = 0;
+      meshletVertices.clear();
+    }
+
+    for (uint32_t i = triangle; i < triangle + 3; ++i)
+    {
+      if (std::find(meshletVertices.begin(), meshletVertices.end(), indices[i]) == meshletVertices.end())
+      {
+        meshletVertices.push_back(indices[i]);
+      }
+    }
+    meshlet.indexCount += 3;
+  }
+
+  if (meshlet.indexCount != 0)
+  {
+    computeMeshletBounds(vertices, indices, meshlet);
+    meshlets.push_back(meshlet);
+  }
+}
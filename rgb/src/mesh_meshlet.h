@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vertex.h"
+
+// Meshlets are small clusters of consecutive triangles in the index buffer,
+// culled one by one on the GPU against the frustum and by the directions
+// their triangles face. They are drawn with the regular vertex pipeline,
+// each as a range of the index buffer.
+
+const uint32_t MAX_MESHLET_VERTICES = 64;
+const uint32_t MAX_MESHLET_TRIANGLES = 124;
+
+// Matches the Meshlet struct in meshlets.comp
+struct Meshlet
+{
+  // Model space center in xyz and radius in w
+  glm::vec4 boundingSphere;
+  // Every triangle's normal is within the cone around the axis in xyz. The
+  // meshlet faces away from every point from which the center is further
+  // than w times the distance along the axis, plus the radius. w is above 1
+  // if the triangles face too many directions for that to ever happen.
+  glm::vec4 cone;
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  int32_t vertexOffset;
+  uint32_t reserved;
+};
+
+// Splits the triangles in [firstIndex, firstIndex + indexCount) of indices
+// into meshlets, in order, and appends them to meshlets. Each one keeps
+// vertexOffset for drawing, the bounds come from indices into vertices.
+void buildMeshlets(const Vertex* vertices, const uint32_t* indices, uint32_t firstIndex, uint32_t indexCount,
+  int32_t vertexOffset, std::vector<Meshlet>& meshlets);
@@ -0,0 +1,352 @@
+#include "mesh_optimize.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const uint32_t INVALID_VERTEX = std::numeric_limits<uint32_t>::max();
+
+// FIFO cache simulated with the time each vertex entered it. Time advances
+// with every miss, so a vertex stays cached until cacheSize more vertices
+// have entered after it.
+class FifoCache
+{
+public:
+  FifoCache(size_t vertexCount, uint32_t cacheSize)
+    : enterTimes(vertexCount, 0), time(cacheSize + 1), cacheSize(cacheSize)
+  {
+  }
+
+  bool contains(uint32_t vertex) const
+  {
+    return time - enterTimes[vertex] <= cacheSize;
+  }
+
+  // Returns the number of misses, 0 or 1
+  uint32_t access(uint32_t vertex)
+  {
+    if (contains(vertex))
+    {
+      return 0;
+    }
+    enterTimes[vertex] = time++;
+    return 1;
+  }
+
+  uint32_t accessTriangle(const uint32_t* corners)
+  {
+    return access(corners[0]) + access(corners[1]) + access(corners[2]);
+  }
+
+  // How long ago the vertex entered the cache, in misses
+  uint32_t getAge(uint32_t vertex) const
+  {
+    return time - enterTimes[vertex];
+  }
+
+  void flush()
+  {
+    time += cacheSize;
+  }
+
+private:
+  std::vector<uint32_t> enterTimes;
+  uint32_t time;
+  uint32_t cacheSize;
+};
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+  uint32_t cacheSize)
+{
+  FifoCache cache(vertexCount, cacheSize);
+  std::vector<uint8_t> referenced(vertexCount, 0);
+  size_t misses = 0;
+  size_t referencedCount = 0;
+
+  for (size_t i = 0; i < indexCount; ++i)
+  {
+    misses += cache.access(indices[i]);
+    if (!referenced[indices[i]])
+    {
+      referenced[indices[i]] = 1;
+      ++referencedCount;
+    }
+  }
+
+  VertexCacheStatistics statistics = {};
+  if (indexCount >= 3)
+  {
+    statistics.acmr = static_cast<double>(misses) / static_cast<double>(indexCount / 3);
+    statistics.atvr = static_cast<double>(misses) / static_cast<double>(referencedCount);
+  }
+  return statistics;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0)
+  {
+    return;
+  }
+
+  // Triangles around every vertex
+  std::vector<uint32_t> fanOffsets(vertexCount + 1, 0);
+  for (size_t i = 0; i < triangleCount * 3; ++i)
+  {
+    ++fanOffsets[indices[i] + 1];
+  }
+  for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+  {
+    fanOffsets[vertex + 1] += fanOffsets[vertex];
+  }
+
+  std::vector<uint32_t> fanTriangles(triangleCount * 3);
+  std::vector<uint32_t> fanCursors(fanOffsets.begin(), fanOffsets.end() - 1);
+  for (size_t i = 0; i < triangleCount * 3; ++i)
+  {
+    fanTriangles[fanCursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+
+  // Triangles around every vertex that have not been emitted yet
+  std::vector<uint32_t> liveCounts(vertexCount);
+  for (size_t vertex = 0; vertex < vertexCount; ++vertex)
+  {
+    liveCounts[vertex] = fanOffsets[vertex + 1] - fanOffsets[vertex];
+  }
+
+  FifoCache cache(vertexCount, cacheSize);
+  std::vector<uint8_t> emitted(triangleCount, 0);
+  std::vector<uint32_t> result;
+  result.reserve(triangleCount * 3);
+  // Vertices of emitted triangles, most recent last, to pick up from when
+  // the fan runs into a dead end
+  std::vector<uint32_t> deadEndStack;
+  std::vector<uint32_t> candidates;
+  uint32_t nextUnvisited = 0;
+
+  uint32_t fanVertex = indices[0];
+  while (fanVertex != INVALID_VERTEX)
+  {
+    candidates.clear();
+    for (uint32_t i = fanOffsets[fanVertex]; i < fanOffsets[fanVertex + 1]; ++i)
+    {
+      const uint32_t triangle = fanTriangles[i];
+      if (emitted[triangle])
+      {
+        continue;
+      }
+      emitted[triangle] = 1;
+
+      for (size_t corner = 0; corner < 3; ++corner)
+      {
+        const uint32_t vertex = indices[3 * triangle + corner];
+        result.push_back(vertex);
+        deadEndStack.push_back(vertex);
+        candidates.push_back(vertex);
+        --liveCounts[vertex];
+        cache.access(vertex);
+      }
+    }
+
+    // Fan next around the candidate that entered the cache the longest ago
+    // but will still be cached once its own fan is emitted, which adds at
+    // most two new vertices per triangle
+    fanVertex = INVALID_VERTEX;
+    uint32_t bestPriority = 0;
+    for (uint32_t vertex : candidates)
+    {
+      if (liveCounts[vertex] == 0)
+      {
+        continue;
+      }
+
+      const uint32_t age = cache.getAge(vertex);
+      const uint32_t priority = age + 2 * liveCounts[vertex] <= cacheSize ? age : 0;
+      if (fanVertex == INVALID_VERTEX || priority > bestPriority)
+      {
+        fanVertex = vertex;
+        bestPriority = priority;
+      }
+    }
+
+    while (fanVertex == INVALID_VERTEX && !deadEndStack.empty())
+    {
+      const uint32_t vertex = deadEndStack.back();
+      deadEndStack.pop_back();
+      if (liveCounts[vertex] != 0)
+      {
+        fanVertex = vertex;
+      }
+    }
+
+    while (fanVertex == INVALID_VERTEX && nextUnvisited < vertexCount)
+    {
+      if (liveCounts[nextUnvisited] != 0)
+      {
+        fanVertex = nextUnvisited;
+      }
+      ++nextUnvisited;
+    }
+  }
+
+  std::copy(result.begin(), result.end(), indices);
+}
+
+struct OverdrawCluster
+{
+  uint32_t firstTriangle;
+  uint32_t triangleCount;
+  float sortKey;
+};
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+  float threshold, uint32_t cacheSize)
+{
+  const size_t triangleCount = indexCount / 3;
+  if (triangleCount == 0)
+  {
+    return;
+  }
+
+  // A triangle that misses with all three vertices starts over with a cold
+  // cache, so splitting the order there costs nothing
+  FifoCache cache(vertexCount, cacheSize);
+  std::vector<uint32_t> hardBoundaries;
+  for (size_t triangle = 0; triangle < triangleCount; ++triangle)
+  {
+    if (cache.accessTriangle(&indices[3 * triangle]) == 3 || triangle == 0)
+    {
+      hardBoundaries.push_back(static_cast<uint32_t>(triangle));
+    }
+  }
+  hardBoundaries.push_back(static_cast<uint32_t>(triangleCount));
+
+  // Within those, a new cluster starts whenever the current one has reached
+  // an ACMR within threshold of the whole hard cluster
+  std::vector<uint32_t> boundaries;
+  for (size_t cluster = 0; cluster + 1 < hardBoundaries.size(); ++cluster)
+  {
+    const uint32_t begin = hardBoundaries[cluster];
+    const uint32_t end = hardBoundaries[cluster + 1];
+
+    cache.flush();
+    uint32_t clusterMisses = 0;
+    for (uint32_t triangle = begin; triangle < end; ++triangle)
+    {
+      clusterMisses += cache.accessTriangle(&indices[3 * triangle]);
+    }
+    const float targetAcmr = threshold * clusterMisses / (end - begin);
+
+    boundaries.push_back(begin);
+    cache.flush();
+    uint32_t runningMisses = 0;
+    uint32_t runningTriangles = 0;
+    for (uint32_t triangle = begin; triangle + 1 < end; ++triangle)
+    {
+      runningMisses += cache.accessTriangle(&indices[3 * triangle]);
+      ++runningTriangles;
+      if (runningMisses <= targetAcmr * runningTriangles)
+      {
+        boundaries.push_back(triangle + 1);
+        cache.flush();
+        runningMisses = 0;
+        runningTriangles = 0;
+      }
+    }
+  }
+  boundaries.push_back(static_cast<uint32_t>(triangleCount));
+
+  double meshCenter[3] = {};
+  for (size_t i = 0; i < triangleCount * 3; ++i)
+  {
+    const glm::vec3& position = vertices[indices[i]].pos;
+    meshCenter[0] += position.x;
+    meshCenter[1] += position.y;
+    meshCenter[2] += position.z;
+  }
+  for (double& component : meshCenter)
+  {
+    component /= static_cast<double>(triangleCount * 3);
+  }
+
+  // Clusters whose area weighted normal points away from the mesh centre are
+  // on the outside and drawn first
+  std::vector<OverdrawCluster> clusters(boundaries.size() - 1);
+  for (size_t cluster = 0; cluster < clusters.size(); ++cluster)
+  {
+    double center[3] = {};
+    double normal[3] = {};
+    double area = 0.0;
+    for (uint32_t triangle = boundaries[cluster]; triangle < boundaries[cluster + 1]; ++triangle)
+    {
+      const glm::vec3& p0 = vertices[indices[3 * triangle + 0]].pos;
+      const glm::vec3& p1 = vertices[indices[3 * triangle + 1]].pos;
+      const glm::vec3& p2 = vertices[indices[3 * triangle + 2]].pos;
+
+      const double e1[3] = {p1.x - p0.x, p1.y - p0.y, p1.z - p0.z};
+      const double e2[3] = {p2.x - p0.x, p2.y - p0.y, p2.z - p0.z};
+      const double cross[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0]
+      };
+      const double triangleArea = std::sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+
+      center[0] += (p0.x + p1.x + p2.x) / 3.0 * triangleArea;
+      center[1] += (p0.y + p1.y + p2.y) / 3.0 * triangleArea;
+      center[2] += (p0.z + p1.z + p2.z) / 3.0 * triangleArea;
+      normal[0] += cross[0];
+      normal[1] += cross[1];
+      normal[2] += cross[2];
+      area += triangleArea;
+    }
+
+    const double normalLength = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    double sortKey = 0.0;
+    if (area > 0.0 && normalLength > 0.0)
+    {
+      for (size_t axis = 0; axis < 3; ++axis)
+      {
+        sortKey += (center[axis] / area - meshCenter[axis]) * normal[axis] / normalLength;
+      }
+    }
+
+    clusters[cluster].firstTriangle = boundaries[cluster];
+    clusters[cluster].triangleCount = boundaries[cluster + 1] - boundaries[cluster];
+    clusters[cluster].sortKey = static_cast<float>(sortKey);
+  }
+
+  std::stable_sort(clusters.begin(), clusters.end(), [](const OverdrawCluster& a, const OverdrawCluster& b)
+  {
+    return a.sortKey > b.sortKey;
+  });
+
+  std::vector<uint32_t> result;
+  result.reserve(triangleCount * 3);
+  for (const OverdrawCluster& cluster : clusters)
+  {
+    const uint32_t* first = &indices[3 * cluster.firstTriangle];
+    result.insert(result.end(), first, first + 3 * cluster.triangleCount);
+  }
+  std::copy(result.begin(), result.end(), indices);
+}
+
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+  std::vector<uint32_t> remap(vertices.size(), INVALID_VERTEX);
+  std::vector<Vertex> reordered;
+  reordered.reserve(vertices.size());
+
+  for (uint32_t& index : indices)
+  {
+    if (remap[index] == INVALID_VERTEX)
+    {
+      remap[index] = static_cast<uint32_t>(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  vertices.swap(reordered);
+}
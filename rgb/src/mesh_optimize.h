@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "vertex.h"
+
+// Reorders triangles and vertices so that the GPU transforms and fetches
+// each vertex as few times as possible. None of the passes change what is
+// drawn, only the order it is drawn in.
+
+// Size of the FIFO post-transform cache the passes optimize for and the
+// statistics simulate. Real hardware differs, but orders that are good for
+// one cache size are good for others.
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Stop splitting the cache optimized triangles into smaller clusters for
+// overdraw sorting once a cluster's ACMR is within this factor of its
+// neighbourhood
+const float OVERDRAW_THRESHOLD = 1.05f;
+
+struct VertexCacheStatistics
+{
+  // Average cache miss ratio, vertices transformed per triangle: 3 without
+  // any reuse, 0.5 at best for large regular meshes
+  double acmr;
+  // Average transform to vertex ratio, vertices transformed per vertex
+  // referenced: 1 is ideal
+  double atvr;
+};
+
+VertexCacheStatistics analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount,
+  uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw", 2007): fans around the vertex that stays
+// in the cache the longest. Reorders the triangles in place.
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount,
+  uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Splits cache optimized triangles into clusters wherever the cache is
+// flushed anyway, or where splitting costs less than threshold in ACMR, and
+// sorts the clusters so that those facing away from the mesh centre, which
+// tend to occlude the others, are drawn first
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const Vertex* vertices, size_t vertexCount,
+  float threshold = OVERDRAW_THRESHOLD, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Renumbers the vertices in the order the index buffer first uses them and
+// drops unused ones, so that vertex fetches walk the vertex buffer forwards
+void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
@@ -0,0 +1,123 @@
+#include "mesh_submesh.h"
+
+#include <algorithm>
+#include <limits>
+
+static const uint32_t INVALID_VERTEX = std::numeric_limits<uint32_t>::max();
+
+// Submeshes that address the mesh's vertices directly are only worth a draw
+// of their own if they have at least this many triangles, shorter runs go
+// into the neighbouring submesh with copied vertices
+static const uint32_t MIN_SHARED_TRIANGLES = 256;
+
+// End of the run of triangles from first whose vertex range fits, but not
+// past limit. Sets minimum to the start of the range.
+static uint32_t growSharedRun(const uint32_t* indices, uint32_t first, uint32_t limit, uint32_t maxVertices,
+  uint32_t& minimum)
+{
+  minimum = indices[first];
+  uint32_t maximum = indices[first];
+  uint32_t end = first;
+  while (end < limit)
+  {
+    const uint32_t newMinimum = std::min({minimum, indices[end], indices[end + 1], indices[end + 2]});
+    const uint32_t newMaximum = std::max({maximum, indices[end], indices[end + 1], indices[end + 2]});
+    if (newMaximum - newMinimum >= maxVertices)
+    {
+      break;
+    }
+    minimum = newMinimum;
+    maximum = newMaximum;
+    end += 3;
+  }
+  return end;
+}
+
+void buildSubmeshes(const uint32_t* indices, size_t indexCount, size_t vertexCount, const std::vector<MeshLod>& lods,
+  std::vector<uint16_t>& indices16, std::vector<Submesh>& submeshes, std::vector<uint32_t>& lodSubmeshes,
+  std::vector<uint32_t>& splitVertices, uint32_t maxVertices)
+{
+  indices16.assign(indexCount, 0);
+  submeshes.clear();
+  lodSubmeshes.clear();
+  splitVertices.clear();
+
+  // Index of each vertex's copy within the current split submesh
+  std::vector<uint32_t> copies(vertexCount, INVALID_VERTEX);
+
+  for (const MeshLod& lod : lods)
+  {
+    lodSubmeshes.push_back(static_cast<uint32_t>(submeshes.size()));
+
+    // Every LOD gets at least one submesh, so that instances.comp can count
+    // into its first draw
+    if (lod.indexCount == 0)
+    {
+      Submesh submesh = {};
+      submesh.firstIndex = lod.firstIndex;
+      submeshes.push_back(submesh);
+      continue;
+    }
+
+    const uint32_t endIndex = lod.firstIndex + lod.indexCount;
+    uint32_t first = lod.firstIndex;
+    while (first < endIndex)
+    {
+      Submesh submesh = {};
+      submesh.firstIndex = first;
+      uint32_t minimum = 0;
+      uint32_t end = growSharedRun(indices, first, endIndex, maxVertices, minimum);
+      if (end == endIndex || end - first >= 3 * MIN_SHARED_TRIANGLES)
+      {
+        for (uint32_t i = first; i < end; ++i)
+        {
+          indices16[i] = static_cast<uint16_t>(indices[i] - minimum);
+        }
+        submesh.vertexOffset = static_cast<int32_t>(minimum);
+      }
+      else
+      {
+        // Copy the vertices of triangles until the copies are full or a long
+        // enough shared run starts
+        const size_t firstCopy = splitVertices.size();
+        end = first;
+        while (end < endIndex && splitVertices.size() - firstCopy + 3 <= maxVertices)
+        {
+          if (end != first)
+          {
+            uint32_t runMinimum = 0;
+            const uint32_t limit = std::min(endIndex, end + 3 * MIN_SHARED_TRIANGLES);
+            if (growSharedRun(indices, end, limit, maxVertices, runMinimum) == limit)
+            {
+              break;
+            }
+          }
+
+          for (uint32_t i = end; i < end + 3; ++i)
+          {
+            uint32_t& copy = copies[indices[i]];
+            if (copy == INVALID_VERTEX)
+            {
+              copy = static_cast<uint32_t>(splitVertices.size() - firstCopy);
+              splitVertices.push_back(indices[i]);
+            }
+            indices16[i] = static_cast<uint16_t>(copy);
+          }
+          end += 3;
+        }
+
+        for (size_t i = firstCopy; i < splitVertices.size(); ++i)
+        {
+          copies[splitVertices[i]] = INVALID_VERTEX;
+        }
+        submesh.vertexOffset = static_cast<int32_t>(vertexCount + firstCopy);
+      }
+
+      submesh.indexCount = end - first;
+      submeshes.push_back(submesh);
+      first = end;
+    }
+  }
+
+  lodSubmeshes.push_back(static_cast<uint32_t>(submeshes.size()));
+}
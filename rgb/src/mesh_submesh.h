@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "mesh_lod.h"
+
+// 16-bit indices reach 65536 vertices. Larger meshes are drawn in
+// submeshes, runs of triangles whose vertices all lie within that many of
+// the submesh's vertexOffset, which the draw adds to every index.
+const uint32_t MAX_SUBMESH_VERTICES = 65536;
+
+struct Submesh
+{
+  uint32_t firstIndex;
+  uint32_t indexCount;
+  int32_t vertexOffset;
+};
+
+// Splits the index range of every LOD into submeshes and writes indices
+// relative to their submesh into indices16, at the same positions as in
+// indices. The submeshes of LOD i are [lodSubmeshes[i], lodSubmeshes[i + 1]),
+// at least one.
+//
+// Most submeshes address the mesh's own vertices, which optimizeVertexFetch()
+// numbered in the order the triangles use them. Triangles whose corners are
+// further apart than that, where the vertex cache optimization jumped to
+// another part of the mesh or in coarse LODs, go into submeshes with their
+// own copies of their vertices. Copy i is of vertex splitVertices[i] and
+// goes after the mesh's vertices, at vertexCount + i.
+void buildSubmeshes(const uint32_t* indices, size_t indexCount, size_t vertexCount, const std::vector<MeshLod>& lods,
+  std::vector<uint16_t>& indices16, std::vector<Submesh>& submeshes, std::vector<uint32_t>& lodSubmeshes,
+  std::vector<uint32_t>& splitVertices, uint32_t maxVertices = MAX_SUBMESH_VERTICES);
@@ -0,0 +1,294 @@
+#include "mip_builder.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#include "parallel.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_BUILDER_SSE2 1
+#endif
+
+// Linear values are encoded through a table of this many steps, fine enough
+// that every sRGB code near black still has a step of its own
+static const int LINEAR_STEPS = 8192;
+
+// Levels with fewer rows than this per thread are built on one thread
+static const uint32_t MIN_ROWS_PER_THREAD = 16;
+
+static const int KAISER_TAPS = 8;
+static const float KAISER_BETA = 4.0f;
+
+namespace
+{
+  struct Tables
+  {
+    // Indexed by the 8 bit value, RGB decode sRGB, A is linear
+    std::array<float, 256> srgbToLinear;
+    std::array<float, 256> unormToFloat;
+    std::array<uint8_t, LINEAR_STEPS + 1> linearToSrgb;
+
+    Tables()
+    {
+      for (int i = 0; i < 256; i++)
+      {
+        float value = i / 255.0f;
+        srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+        unormToFloat[i] = value;
+      }
+      for (int i = 0; i <= LINEAR_STEPS; i++)
+      {
+        float value = static_cast<float>(i) / LINEAR_STEPS;
+        float srgb = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+        linearToSrgb[i] = static_cast<uint8_t>(std::lround(std::clamp(srgb, 0.0f, 1.0f) * 255.0f));
+      }
+    }
+  };
+
+  const Tables& getTables()
+  {
+    static const Tables tables;
+    return tables;
+  }
+
+  // Weights of one separable filter, applied at source offsets first + i from
+  // twice the destination coordinate
+  struct Filter
+  {
+    int first;
+    int taps;
+    float weights[KAISER_TAPS];
+  };
+
+  float besselI0(float x)
+  {
+    // Power series, converges quickly for the small arguments used here
+    float sum = 1.0f;
+    float term = 1.0f;
+    for (int k = 1; k < 20; k++)
+    {
+      term *= (x / (2.0f * k)) * (x / (2.0f * k));
+      sum += term;
+    }
+    return sum;
+  }
+
+  Filter makeFilter(MipFilter type)
+  {
+    Filter filter = {};
+    if (type == MipFilter::Box)
+    {
+      filter.first = 0;
+      filter.taps = 2;
+      filter.weights[0] = 0.5f;
+      filter.weights[1] = 0.5f;
+      return filter;
+    }
+
+    // Taps sit at half texel distances from the center of the destination
+    // texel, which lies between source texels 2x and 2x + 1
+    const float pi = 3.14159265358979f;
+    const float radius = KAISER_TAPS / 2.0f;
+    filter.first = 1 - KAISER_TAPS / 2;
+    filter.taps = KAISER_TAPS;
+    float total = 0.0f;
+    for (int i = 0; i < KAISER_TAPS; i++)
+    {
+      float distance = std::abs(filter.first + i - 0.5f);
+      float x = distance / 2.0f;
+      float sinc = x == 0.0f ? 1.0f : std::sin(pi * x) / (pi * x);
+      float ratio = distance / radius;
+      float window = besselI0(KAISER_BETA * std::sqrt(std::max(0.0f, 1.0f - ratio * ratio))) / besselI0(KAISER_BETA);
+      filter.weights[i] = sinc * window;
+      total += filter.weights[i];
+    }
+    for (int i = 0; i < KAISER_TAPS; i++)
+    {
+      filter.weights[i] /= total;
+    }
+    return filter;
+  }
+
+#ifdef MIP_BUILDER_SSE2
+  struct Float4
+  {
+    __m128 v;
+  };
+
+  inline Float4 load4(const float* p) { return {_mm_loadu_ps(p)}; }
+  inline void store4(float* p, Float4 a) { _mm_storeu_ps(p, a.v); }
+  inline Float4 zero4() { return {_mm_setzero_ps()}; }
+  inline Float4 multiplyAdd(Float4 sum, Float4 a, float weight) { return {_mm_add_ps(sum.v, _mm_mul_ps(a.v, _mm_set1_ps(weight)))}; }
+
+  // Scales to table steps, clamps and rounds all four channels at once
+  inline void quantize(Float4 a, int32_t* steps)
+  {
+    __m128 scaled = _mm_mul_ps(a.v, _mm_set_ps(255.0f, LINEAR_STEPS, LINEAR_STEPS, LINEAR_STEPS));
+    scaled = _mm_min_ps(_mm_max_ps(scaled, _mm_setzero_ps()), _mm_set_ps(255.0f, LINEAR_STEPS, LINEAR_STEPS, LINEAR_STEPS));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(steps), _mm_cvttps_epi32(_mm_add_ps(scaled, _mm_set1_ps(0.5f))));
+  }
+#else
+  struct Float4
+  {
+    float v[4];
+  };
+
+  inline Float4 load4(const float* p) { return {{p[0], p[1], p[2], p[3]}}; }
+  inline void store4(float* p, Float4 a) { memcpy(p, a.v, sizeof(a.v)); }
+  inline Float4 zero4() { return {{0.0f, 0.0f, 0.0f, 0.0f}}; }
+  inline Float4 multiplyAdd(Float4 sum, Float4 a, float weight)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      sum.v[c] += a.v[c] * weight;
+    }
+    return sum;
+  }
+
+  inline void quantize(Float4 a, int32_t* steps)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      float scale = c == 3 ? 255.0f : static_cast<float>(LINEAR_STEPS);
+      steps[c] = static_cast<int32_t>(std::clamp(a.v[c] * scale, 0.0f, scale) + 0.5f);
+    }
+  }
+#endif
+
+  // Source rows decoded to linear RGBA floats, kept while a thread walks down
+  // its range of destination rows, which share most of their source rows
+  class RowCache
+  {
+  public:
+    RowCache(const uint8_t* pixels, uint32_t width, uint32_t height)
+      : pixels(pixels), width(width), height(height), rows(KAISER_TAPS, std::vector<float>(static_cast<size_t>(width) * 4)), tags(KAISER_TAPS, -1)
+    {
+    }
+
+    const float* get(int row)
+    {
+      row = std::clamp(row, 0, static_cast<int>(height) - 1);
+      size_t slot = static_cast<size_t>(row) % rows.size();
+      if (tags[slot] != row)
+      {
+        const Tables& tables = getTables();
+        const uint8_t* source = pixels + static_cast<size_t>(row) * width * 4;
+        float* decoded = rows[slot].data();
+        for (size_t i = 0; i < static_cast<size_t>(width) * 4; i += 4)
+        {
+          decoded[i] = tables.srgbToLinear[source[i]];
+          decoded[i + 1] = tables.srgbToLinear[source[i + 1]];
+          decoded[i + 2] = tables.srgbToLinear[source[i + 2]];
+          decoded[i + 3] = tables.unormToFloat[source[i + 3]];
+        }
+        tags[slot] = row;
+      }
+      return rows[slot].data();
+    }
+
+  private:
+    const uint8_t* pixels;
+    uint32_t width;
+    uint32_t height;
+    std::vector<std::vector<float>> rows;
+    std::vector<int> tags;
+  };
+
+  void buildLevel(const uint8_t* source, uint32_t sourceWidth, uint32_t sourceHeight,
+    uint8_t* level, uint32_t width, uint32_t height, const Filter& filter, unsigned threadCount)
+  {
+    const Tables& tables = getTables();
+    threadCount = std::max(1u, std::min(threadCount, height / MIN_ROWS_PER_THREAD));
+
+    parallelFor(height, threadCount, [&](size_t begin, size_t end, unsigned)
+    {
+      RowCache cache(source, sourceWidth, sourceHeight);
+      std::vector<float> column(static_cast<size_t>(sourceWidth) * 4);
+
+      for (size_t y = begin; y < end; y++)
+      {
+        // Vertical pass over whole source rows
+        const float* rows[KAISER_TAPS];
+        for (int i = 0; i < filter.taps; i++)
+        {
+          rows[i] = cache.get(static_cast<int>(y) * 2 + filter.first + i);
+        }
+        for (size_t i = 0; i < column.size(); i += 4)
+        {
+          Float4 sum = zero4();
+          for (int t = 0; t < filter.taps; t++)
+          {
+            sum = multiplyAdd(sum, load4(rows[t] + i), filter.weights[t]);
+          }
+          store4(column.data() + i, sum);
+        }
+
+        // Horizontal pass, one RGBA texel at a time
+        uint8_t* out = level + y * width * 4;
+        for (uint32_t x = 0; x < width; x++)
+        {
+          Float4 sum = zero4();
+          for (int t = 0; t < filter.taps; t++)
+          {
+            int sourceX = std::clamp(static_cast<int>(x) * 2 + filter.first + t, 0, static_cast<int>(sourceWidth) - 1);
+            sum = multiplyAdd(sum, load4(column.data() + static_cast<size_t>(sourceX) * 4), filter.weights[t]);
+          }
+
+          int32_t steps[4];
+          quantize(sum, steps);
+          out[x * 4] = tables.linearToSrgb[steps[0]];
+          out[x * 4 + 1] = tables.linearToSrgb[steps[1]];
+          out[x * 4 + 2] = tables.linearToSrgb[steps[2]];
+          out[x * 4 + 3] = static_cast<uint8_t>(steps[3]);
+        }
+      }
+    });
+  }
+}
+
+const char* getMipFilterName(MipFilter filter)
+{
+  return filter == MipFilter::Kaiser ? "kaiser" : "box";
+}
+
+std::vector<size_t> getMipChainOffsets(uint32_t width, uint32_t height)
+{
+  std::vector<size_t> offsets = {0};
+  for (;;)
+  {
+    offsets.push_back(offsets.back() + static_cast<size_t>(width) * height * 4);
+    if (width == 1 && height == 1)
+    {
+      break;
+    }
+    width = std::max(1u, width / 2);
+    height = std::max(1u, height / 2);
+  }
+  return offsets;
+}
+
+void buildMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, MipFilter filter,
+  uint8_t* chain, unsigned threadCount)
+{
+  const Filter weights = makeFilter(filter);
+  const std::vector<size_t> offsets = getMipChainOffsets(width, height);
+
+  memcpy(chain, pixels, offsets[1]);
+  for (size_t level = 1; level + 1 < offsets.size(); level++)
+  {
+    uint32_t levelWidth = std::max(1u, width / 2);
+    uint32_t levelHeight = std::max(1u, height / 2);
+    buildLevel(chain + offsets[level - 1], width, height, chain + offsets[level], levelWidth, levelHeight, weights, threadCount);
+    width = levelWidth;
+    height = levelHeight;
+  }
+}
+
+void buildMipLevel(const uint8_t* source, uint32_t width, uint32_t height, MipFilter filter,
+  uint8_t* level, unsigned threadCount)
+{
+  buildLevel(source, width, height, level, std::max(1u, width / 2), std::max(1u, height / 2), makeFilter(filter), threadCount);
+}
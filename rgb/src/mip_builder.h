@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Builds RGBA8 mip chains on the CPU, as an alternative to blitting them on
+// the GPU that works for every format, filters color in linear light and
+// feeds the block compressors.
+//
+// Every level is filtered from the previous one with a separable filter.
+// Color channels are decoded from sRGB to linear floats through a table,
+// filtered four channels at a time with SSE2 where available, and encoded
+// back through a table; alpha is filtered as it is. The rows of each level
+// are split between threads; levels depend on each other, so they are built
+// one after the other.
+
+enum class MipFilter
+{
+  // 2x2 average, the same footprint vkCmdBlitImage uses
+  Box,
+  // 8 tap Kaiser windowed sinc, sharper than the box and with less aliasing
+  Kaiser
+};
+
+const char* getMipFilterName(MipFilter filter);
+
+// Byte offset of every level in a chain packed level after level, followed
+// by the size of the whole chain
+std::vector<size_t> getMipChainOffsets(uint32_t width, uint32_t height);
+
+// Writes level 0, copied from pixels, followed by every smaller level down to
+// 1x1 into chain, at the offsets getMipChainOffsets() returns
+void buildMipChain(const uint8_t* pixels, uint32_t width, uint32_t height, MipFilter filter,
+  uint8_t* chain, unsigned threadCount);
+
+// Writes the level below source, which is width x height, into level. For
+// chains too large to hold at once, built one level after the other.
+void buildMipLevel(const uint8_t* source, uint32_t width, uint32_t height, MipFilter filter,
+  uint8_t* level, unsigned threadCount);
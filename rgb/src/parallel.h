@@ -0,0 +1,48 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+inline unsigned getDefaultThreadCount()
+{
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Splits [0, count) into one contiguous range per thread and calls
+// function(begin, end, threadIndex) for each range. The calling thread runs
+// the first range itself; ranges are handed out in order, so range t always
+// precedes range t + 1.
+template<typename Function>
+void parallelFor(size_t count, unsigned threadCount, Function&& function)
+{
+  threadCount = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threadCount, count)));
+  if (threadCount == 1)
+  {
+    function(size_t(0), count, 0u);
+    return;
+  }
+
+  auto rangeBegin = [count, threadCount](unsigned t)
+  {
+    return count * t / threadCount;
+  };
+
+  std::vector<std::thread> workers;
+  workers.reserve(threadCount - 1);
+  for (unsigned t = 1; t < threadCount; ++t)
+  {
+    workers.emplace_back([&function, &rangeBegin, t]()
+    {
+      function(rangeBegin(t), rangeBegin(t + 1), t);
+    });
+  }
+
+  function(size_t(0), rangeBegin(1), 0u);
+
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+}
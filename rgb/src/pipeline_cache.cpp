@@ -0,0 +1,141 @@
+#include "pipeline_cache.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "hash.h"
+#include "mapped_file.h"
+
+static bool matchesDevice(const PipelineCacheHeader& header, const VkPhysicalDeviceProperties& properties)
+{
+  return header.vendorID == properties.vendorID
+    && header.deviceID == properties.deviceID
+    && header.driverVersion == properties.driverVersion
+    && memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties,
+  const std::string& path, bool& warm)
+{
+  warm = false;
+
+  MappedFile file;
+  const void* initialData = nullptr;
+  size_t initialDataSize = 0;
+
+  if (file.open(path, FileAccess::Sequential))
+  {
+    PipelineCacheHeader header = {};
+    if (file.size() >= sizeof(header))
+    {
+      memcpy(&header, file.data(), sizeof(header));
+    }
+
+    if (file.size() < sizeof(header) || header.dataSize != file.size() - sizeof(header))
+    {
+      std::cerr << "WARNING: Pipeline cache " << path << " is truncated" << std::endl;
+    }
+    else if (header.magic != PIPELINE_CACHE_MAGIC || header.version != PIPELINE_CACHE_VERSION)
+    {
+      std::cerr << "INFO: Pipeline cache " << path << " has an old format, rebuilding" << std::endl;
+    }
+    else if (!matchesDevice(header, properties))
+    {
+      std::cerr << "INFO: Pipeline cache " << path << " was written by another device or driver, rebuilding" << std::endl;
+    }
+    else if (xxhash64(file.data() + sizeof(header), static_cast<size_t>(header.dataSize)) != header.dataHash)
+    {
+      std::cerr << "WARNING: Pipeline cache " << path << " is corrupt, rebuilding" << std::endl;
+    }
+    else
+    {
+      initialData = file.data() + sizeof(header);
+      initialDataSize = static_cast<size_t>(header.dataSize);
+    }
+  }
+
+  VkPipelineCacheCreateInfo createInfo = {};
+  createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  createInfo.initialDataSize = initialDataSize;
+  createInfo.pInitialData = initialData;
+
+  VkPipelineCache pipelineCache;
+  if (vkCreatePipelineCache(device, &createInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create pipeline cache!" << std::endl;
+    throw std::runtime_error("Failed to create pipeline cache!");
+  }
+
+  warm = initialData != nullptr;
+  if (warm)
+  {
+    std::cerr << "INFO: Loaded " << initialDataSize << " bytes of pipeline cache from " << path << std::endl;
+  }
+
+  return pipelineCache;
+}
+
+bool savePipelineCache(VkDevice device, VkPipelineCache pipelineCache,
+  const VkPhysicalDeviceProperties& properties, const std::string& path)
+{
+  size_t dataSize = 0;
+  if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr) != VK_SUCCESS)
+  {
+    std::cerr << "WARNING: Failed to query pipeline cache size" << std::endl;
+    return false;
+  }
+
+  std::vector<uint8_t> data(dataSize);
+  if (vkGetPipelineCacheData(device, pipelineCache, &dataSize, data.data()) != VK_SUCCESS)
+  {
+    std::cerr << "WARNING: Failed to read pipeline cache data" << std::endl;
+    return false;
+  }
+  data.resize(dataSize);
+
+  PipelineCacheHeader header = {};
+  header.magic = PIPELINE_CACHE_MAGIC;
+  header.version = PIPELINE_CACHE_VERSION;
+  header.vendorID = properties.vendorID;
+  header.deviceID = properties.deviceID;
+  header.driverVersion = properties.driverVersion;
+  header.dataSize = data.size();
+  header.dataHash = xxhash64(data.data(), data.size());
+  memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+
+  // Written to a temporary file first so a partially written cache is never picked up
+  const std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+      std::cerr << "WARNING: Failed to create pipeline cache " << temporaryPath << std::endl;
+      return false;
+    }
+
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+    if (!out)
+    {
+      std::cerr << "WARNING: Failed to write pipeline cache " << temporaryPath << std::endl;
+      return false;
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error)
+  {
+    std::cerr << "WARNING: Failed to replace pipeline cache " << path << ": " << error.message() << std::endl;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+
+  std::cerr << "INFO: Wrote " << data.size() << " bytes of pipeline cache to " << path << std::endl;
+  return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <vulkan/vulkan.h>
+
+// VkPipelineCache data stored on disk behind a small header:
+//
+//   PipelineCacheHeader
+//   cache data as returned by vkGetPipelineCacheData
+//
+// The header records the device and driver the data came from. Drivers are
+// supposed to reject foreign data themselves, but some crash or silently
+// produce bad pipelines, so mismatching files are never handed to them.
+
+const uint32_t PIPELINE_CACHE_MAGIC = 0x50424752; // "RGBP"
+const uint32_t PIPELINE_CACHE_VERSION = 1;
+
+struct PipelineCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint32_t reserved;
+  uint64_t dataSize;
+  uint64_t dataHash;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+// Creates a pipeline cache, seeded from path when the file was written by
+// the same device and driver. warm is set when the file was used.
+VkPipelineCache loadPipelineCache(VkDevice device, const VkPhysicalDeviceProperties& properties,
+  const std::string& path, bool& warm);
+
+// Writes the current contents of the cache to path, returns false on failure
+bool savePipelineCache(VkDevice device, VkPipelineCache pipelineCache,
+  const VkPhysicalDeviceProperties& properties, const std::string& path);
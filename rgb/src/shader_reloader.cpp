@@ -0,0 +1,274 @@
+#include "shader_reloader.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <set>
+
+#ifdef __linux__
+#include <map>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include "benchmark.h"
+
+// Editors save in several steps, so a change is only acted on once the
+// sources have been quiet for this long
+static const int SETTLE_MILLISECONDS = 100;
+
+static std::string getEnvironment(const char* name)
+{
+#ifdef _WIN32
+  char* value = nullptr;
+  size_t length = 0;
+  if (_dupenv_s(&value, &length, name) != 0 || value == nullptr)
+  {
+    return std::string();
+  }
+  std::string result = value;
+  free(value);
+  return result;
+#else
+  const char* value = std::getenv(name);
+  return value != nullptr ? value : std::string();
+#endif
+}
+
+ShaderReloader::~ShaderReloader()
+{
+  stop();
+}
+
+void ShaderReloader::start(VkDevice device, std::vector<ShaderProgram> programs, BuildPipelines build)
+{
+  stop();
+
+  this->device = device;
+  this->programs = std::move(programs);
+  this->build = std::move(build);
+
+  compiler = getEnvironment("GLSLANG_VALIDATOR");
+  if (compiler.empty())
+  {
+    const std::string sdk = getEnvironment("VULKAN_SDK");
+    compiler = sdk.empty() ? "glslangValidator" : (std::filesystem::path(sdk) / "bin" / "glslangValidator").string();
+  }
+
+  stopping = false;
+  thread = std::thread(&ShaderReloader::watch, this);
+
+  std::cerr << "INFO: Watching " << this->programs.size() << " shaders, compiling with " << compiler << std::endl;
+}
+
+void ShaderReloader::stop()
+{
+  if (!thread.joinable())
+  {
+    return;
+  }
+
+  stopping = true;
+  thread.join();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  destroyPipelines(finished);
+}
+
+std::vector<VkPipeline> ShaderReloader::poll()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<VkPipeline> pipelines;
+  pipelines.swap(finished);
+  return pipelines;
+}
+
+#ifdef __linux__
+
+void ShaderReloader::watch()
+{
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+  {
+    std::cerr << "WARNING: Failed to initialize inotify, shaders are not reloaded" << std::endl;
+    return;
+  }
+
+  // Directories are watched rather than the files, since editors often
+  // replace a file instead of writing to it
+  std::map<int, std::filesystem::path> directories;
+  for (const ShaderProgram& program : programs)
+  {
+    std::filesystem::path directory = std::filesystem::path(program.source).parent_path();
+    if (directory.empty())
+    {
+      directory = ".";
+    }
+    int watch = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch < 0)
+    {
+      std::cerr << "WARNING: Failed to watch " << directory.string() << " for shader changes" << std::endl;
+      continue;
+    }
+    directories[watch] = directory;
+  }
+
+  alignas(inotify_event) char buffer[4096];
+  pollfd descriptor = {fd, POLLIN, 0};
+  while (!stopping)
+  {
+    if (::poll(&descriptor, 1, SETTLE_MILLISECONDS) <= 0)
+    {
+      continue;
+    }
+
+    std::set<size_t> changed;
+    do
+    {
+      ssize_t length;
+      while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+      {
+        for (char* event = buffer; event < buffer + length; )
+        {
+          const inotify_event* notification = reinterpret_cast<const inotify_event*>(event);
+          event += sizeof(inotify_event) + notification->len;
+          if (notification->len == 0 || directories.count(notification->wd) == 0)
+          {
+            continue;
+          }
+
+          const std::filesystem::path path = directories[notification->wd] / notification->name;
+          for (size_t i = 0; i < programs.size(); ++i)
+          {
+            if (std::filesystem::path(programs[i].source).lexically_normal() == path.lexically_normal())
+            {
+              changed.insert(i);
+            }
+          }
+        }
+      }
+    } while (!stopping && ::poll(&descriptor, 1, SETTLE_MILLISECONDS) > 0);
+
+    if (!changed.empty() && !stopping)
+    {
+      reload(std::vector<size_t>(changed.begin(), changed.end()));
+    }
+  }
+
+  close(fd);
+}
+
+#else
+
+void ShaderReloader::watch()
+{
+  std::vector<std::filesystem::file_time_type> writeTimes(programs.size());
+  for (size_t i = 0; i < programs.size(); ++i)
+  {
+    std::error_code error;
+    writeTimes[i] = std::filesystem::last_write_time(programs[i].source, error);
+  }
+
+  while (!stopping)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(SETTLE_MILLISECONDS));
+
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < programs.size(); ++i)
+    {
+      std::error_code error;
+      std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(programs[i].source, error);
+      if (!error && writeTime != writeTimes[i])
+      {
+        writeTimes[i] = writeTime;
+        changed.push_back(i);
+      }
+    }
+
+    if (!changed.empty())
+    {
+      reload(changed);
+    }
+  }
+}
+
+#endif
+
+bool ShaderReloader::compile(const ShaderProgram& program) const
+{
+  // Written next to the output and moved over it, so that a failed compile
+  // leaves the last good SPIR-V in place
+  const std::string temporaryPath = program.output + ".tmp";
+  std::string command = "\"" + compiler + "\" -V";
+  for (const std::string& define : program.defines)
+  {
+    command += " -D" + define;
+  }
+  command += " \"" + program.source + "\" -o \"" + temporaryPath + "\"";
+#ifdef _WIN32
+  // cmd.exe strips the outer quotes of a command that starts with one
+  command = "\"" + command + "\"";
+#endif
+
+  std::error_code error;
+  if (std::system(command.c_str()) != 0)
+  {
+    std::cerr << "WARNING: Failed to compile " << program.source << ", keeping the running pipelines" << std::endl;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+
+  std::filesystem::rename(temporaryPath, program.output, error);
+  if (error)
+  {
+    std::cerr << "WARNING: Failed to replace " << program.output << ": " << error.message() << std::endl;
+    std::filesystem::remove(temporaryPath, error);
+    return false;
+  }
+  return true;
+}
+
+void ShaderReloader::reload(const std::vector<size_t>& changed)
+{
+  auto reloadStart = BenchmarkClock::now();
+
+  for (size_t program : changed)
+  {
+    if (!compile(programs[program]))
+    {
+      return;
+    }
+  }
+
+  std::vector<VkPipeline> pipelines;
+  try
+  {
+    pipelines = build();
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "WARNING: Failed to rebuild the pipelines, keeping the running ones: " << e.what() << std::endl;
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    // Built again before the render loop picked up the previous ones
+    destroyPipelines(finished);
+    finished = std::move(pipelines);
+  }
+
+  std::cerr << "INFO: Reloaded " << changed.size() << " shaders in "
+    << elapsedMilliseconds(reloadStart, BenchmarkClock::now()) << " ms" << std::endl;
+}
+
+void ShaderReloader::destroyPipelines(std::vector<VkPipeline>& pipelines)
+{
+  for (VkPipeline pipeline : pipelines)
+  {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  pipelines.clear();
+}
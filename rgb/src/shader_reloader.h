@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+// Watches shader sources while the application runs, recompiles the ones
+// that change to SPIR-V with glslangValidator and builds new pipelines from
+// them, all on a background thread, so that the render loop only has to
+// swap the finished pipelines in.
+//
+// Changes are picked up with inotify on Linux and by polling modification
+// times elsewhere. The compiler is taken from GLSLANG_VALIDATOR, then from
+// the Vulkan SDK at VULKAN_SDK, then from PATH. A shader that fails to
+// compile, or pipelines that fail to build, leave the running pipelines in
+// place; the compiler's errors are on the console.
+
+// One SPIR-V file and the source and defines it is compiled from, as in
+// shaders/compile.bat
+struct ShaderProgram
+{
+  std::string source;
+  std::string output;
+  std::vector<std::string> defines;
+};
+
+class ShaderReloader
+{
+public:
+  // Runs on the watch thread once the changed programs compiled. Creates
+  // pipelines from the freshly written SPIR-V or throws.
+  using BuildPipelines = std::function<std::vector<VkPipeline>()>;
+
+  ShaderReloader() = default;
+  ~ShaderReloader();
+
+  ShaderReloader(const ShaderReloader&) = delete;
+  ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+  // Pipelines that were built but never polled are destroyed with device
+  void start(VkDevice device, std::vector<ShaderProgram> programs, BuildPipelines build);
+  // Finishes a running compile or build and joins
+  void stop();
+
+  bool isRunning() const { return thread.joinable(); }
+
+  // Returns the pipelines of the latest reload that finished since the last
+  // call, or nothing. The caller owns them and retires the ones they replace.
+  std::vector<VkPipeline> poll();
+
+private:
+  void watch();
+  bool compile(const ShaderProgram& program) const;
+  void reload(const std::vector<size_t>& changed);
+  void destroyPipelines(std::vector<VkPipeline>& pipelines);
+
+  VkDevice device = VK_NULL_HANDLE;
+  std::vector<ShaderProgram> programs;
+  BuildPipelines build;
+  std::string compiler;
+
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+  std::mutex mutex;
+  std::vector<VkPipeline> finished;
+};
@@ -0,0 +1,585 @@
+#include "texture_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "parallel.h"
+
+static const uint32_t TEXELS_PER_BLOCK = TEXTURE_BLOCK_SIZE * TEXTURE_BLOCK_SIZE;
+
+struct TexelBlock
+{
+  uint8_t texels[TEXELS_PER_BLOCK][4]; // row-major, texels[y * 4 + x]
+};
+
+std::vector<RgbaImage> buildMipImages(const uint8_t* pixels, uint32_t width, uint32_t height, MipFilter filter, unsigned threadCount)
+{
+  const std::vector<size_t> offsets = getMipChainOffsets(width, height);
+  std::vector<uint8_t> chain(offsets.back());
+  buildMipChain(pixels, width, height, filter, chain.data(), threadCount);
+
+  std::vector<RgbaImage> levels(offsets.size() - 1);
+  for (size_t level = 0; level < levels.size(); level++)
+  {
+    levels[level].width = std::max(1u, width >> level);
+    levels[level].height = std::max(1u, height >> level);
+    levels[level].pixels.assign(chain.begin() + offsets[level], chain.begin() + offsets[level + 1]);
+  }
+  return levels;
+}
+
+bool isCompressedTextureFormat(VkFormat format)
+{
+  return getBlockBytes(format) != 0;
+}
+
+uint32_t getBlockBytes(VkFormat format)
+{
+  switch (format)
+  {
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+    return 16;
+  case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+const char* getCompressedFormatName(VkFormat format)
+{
+  switch (format)
+  {
+  case VK_FORMAT_BC7_UNORM_BLOCK:
+    return "bc7";
+  case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+    return "etc2";
+  default:
+    return "unknown";
+  }
+}
+
+static int squaredError(const uint8_t* a, const int* b, uint32_t channels)
+{
+  int error = 0;
+  for (uint32_t c = 0; c < channels; c++)
+  {
+    int d = static_cast<int>(a[c]) - b[c];
+    error += d * d;
+  }
+  return error;
+}
+
+// BC7 mode 6: 7 bit RGBA endpoints plus a shared low bit per endpoint, and a
+// 4 bit index per texel into a 16 step ramp between them
+namespace bc7
+{
+  static const int WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+  struct Endpoints
+  {
+    int color[2][4]; // 8 bit values, the low bit is the endpoint's p-bit
+  };
+
+  static void interpolate(const Endpoints& endpoints, int index, int* out)
+  {
+    for (int c = 0; c < 4; c++)
+    {
+      out[c] = ((64 - WEIGHTS[index]) * endpoints.color[0][c] + WEIGHTS[index] * endpoints.color[1][c] + 32) >> 6;
+    }
+  }
+
+  // Picks the nearest ramp entry for every texel, returns the total error
+  static int assignIndices(const TexelBlock& block, const Endpoints& endpoints, uint8_t* indices)
+  {
+    int ramp[16][4];
+    for (int i = 0; i < 16; i++)
+    {
+      interpolate(endpoints, i, ramp[i]);
+    }
+
+    int total = 0;
+    for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+    {
+      int best = std::numeric_limits<int>::max();
+      for (int i = 0; i < 16; i++)
+      {
+        int error = squaredError(block.texels[t], ramp[i], 4);
+        if (error < best)
+        {
+          best = error;
+          indices[t] = static_cast<uint8_t>(i);
+        }
+      }
+      total += best;
+    }
+    return total;
+  }
+
+  // Tries all four p-bit combinations for a pair of unquantized endpoints
+  static int quantize(const TexelBlock& block, const float (&ends)[2][4], Endpoints& endpoints, uint8_t* indices)
+  {
+    int bestError = std::numeric_limits<int>::max();
+    for (int pbits = 0; pbits < 4; pbits++)
+    {
+      Endpoints candidate;
+      for (int e = 0; e < 2; e++)
+      {
+        int p = (pbits >> e) & 1;
+        for (int c = 0; c < 4; c++)
+        {
+          int q = static_cast<int>(std::lround((ends[e][c] - p) / 2.0f));
+          candidate.color[e][c] = std::clamp(q, 0, 127) * 2 + p;
+        }
+      }
+
+      uint8_t candidateIndices[TEXELS_PER_BLOCK];
+      int error = assignIndices(block, candidate, candidateIndices);
+      if (error < bestError)
+      {
+        bestError = error;
+        endpoints = candidate;
+        memcpy(indices, candidateIndices, sizeof(candidateIndices));
+      }
+    }
+    return bestError;
+  }
+
+  // Endpoints at the extremes of the block's principal axis
+  static void fitPrincipalAxis(const TexelBlock& block, float (&ends)[2][4])
+  {
+    float mean[4] = {};
+    for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+    {
+      for (int c = 0; c < 4; c++)
+      {
+        mean[c] += block.texels[t][c];
+      }
+    }
+    for (int c = 0; c < 4; c++)
+    {
+      mean[c] /= TEXELS_PER_BLOCK;
+    }
+
+    float covariance[4][4] = {};
+    for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+    {
+      for (int i = 0; i < 4; i++)
+      {
+        for (int j = 0; j < 4; j++)
+        {
+          covariance[i][j] += (block.texels[t][i] - mean[i]) * (block.texels[t][j] - mean[j]);
+        }
+      }
+    }
+
+    // Power iteration converges quickly enough for a 4x4 matrix
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; iteration++)
+    {
+      float next[4] = {};
+      for (int i = 0; i < 4; i++)
+      {
+        for (int j = 0; j < 4; j++)
+        {
+          next[i] += covariance[i][j] * axis[j];
+        }
+      }
+      float length = std::sqrt(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+      if (length < 1e-6f)
+      {
+        break;
+      }
+      for (int i = 0; i < 4; i++)
+      {
+        axis[i] = next[i] / length;
+      }
+    }
+
+    float minProjection = std::numeric_limits<float>::max();
+    float maxProjection = -std::numeric_limits<float>::max();
+    for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+    {
+      float projection = 0.0f;
+      for (int c = 0; c < 4; c++)
+      {
+        projection += (block.texels[t][c] - mean[c]) * axis[c];
+      }
+      minProjection = std::min(minProjection, projection);
+      maxProjection = std::max(maxProjection, projection);
+    }
+
+    for (int c = 0; c < 4; c++)
+    {
+      ends[0][c] = std::clamp(mean[c] + axis[c] * minProjection, 0.0f, 255.0f);
+      ends[1][c] = std::clamp(mean[c] + axis[c] * maxProjection, 0.0f, 255.0f);
+    }
+  }
+
+  // Least squares endpoints for a fixed set of indices; returns false if the
+  // indices do not span a ramp
+  static bool refitEndpoints(const TexelBlock& block, const uint8_t* indices, float (&ends)[2][4])
+  {
+    float aa = 0.0f;
+    float ab = 0.0f;
+    float bb = 0.0f;
+    float ax[4] = {};
+    float bx[4] = {};
+    for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+    {
+      float b = WEIGHTS[indices[t]] / 64.0f;
+      float a = 1.0f - b;
+      aa += a * a;
+      ab += a * b;
+      bb += b * b;
+      for (int c = 0; c < 4; c++)
+      {
+        ax[c] += a * block.texels[t][c];
+        bx[c] += b * block.texels[t][c];
+      }
+    }
+
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+    {
+      return false;
+    }
+
+    for (int c = 0; c < 4; c++)
+    {
+      ends[0][c] = std::clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+      ends[1][c] = std::clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+  }
+
+  struct BitWriter
+  {
+    uint8_t* out;
+    uint32_t position = 0;
+
+    void write(uint32_t value, uint32_t bits)
+    {
+      for (uint32_t i = 0; i < bits; i++, position++)
+      {
+        out[position / 8] |= static_cast<uint8_t>(((value >> i) & 1) << (position % 8));
+      }
+    }
+  };
+
+  static int encodeBlock(const TexelBlock& block, uint8_t* out)
+  {
+    float ends[2][4];
+    fitPrincipalAxis(block, ends);
+
+    Endpoints endpoints;
+    uint8_t indices[TEXELS_PER_BLOCK];
+    int error = quantize(block, ends, endpoints, indices);
+
+    for (int pass = 0; pass < 2 && error > 0; pass++)
+    {
+      Endpoints refined;
+      uint8_t refinedIndices[TEXELS_PER_BLOCK];
+      if (!refitEndpoints(block, indices, ends))
+      {
+        break;
+      }
+      int refinedError = quantize(block, ends, refined, refinedIndices);
+      if (refinedError >= error)
+      {
+        break;
+      }
+      error = refinedError;
+      endpoints = refined;
+      memcpy(indices, refinedIndices, sizeof(indices));
+    }
+
+    // The first texel's index is stored with its top bit implied zero
+    if (indices[0] & 8)
+    {
+      std::swap(endpoints.color[0], endpoints.color[1]);
+      for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+      {
+        indices[t] = static_cast<uint8_t>(15 - indices[t]);
+      }
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer = {out};
+    writer.write(1u << 6, 7);
+    for (int c = 0; c < 4; c++)
+    {
+      writer.write(static_cast<uint32_t>(endpoints.color[0][c] >> 1), 7);
+      writer.write(static_cast<uint32_t>(endpoints.color[1][c] >> 1), 7);
+    }
+    writer.write(static_cast<uint32_t>(endpoints.color[0][0] & 1), 1);
+    writer.write(static_cast<uint32_t>(endpoints.color[1][0] & 1), 1);
+    writer.write(indices[0], 3);
+    for (uint32_t t = 1; t < TEXELS_PER_BLOCK; t++)
+    {
+      writer.write(indices[t], 4);
+    }
+
+    return error;
+  }
+}
+
+// ETC2 RGB8 blocks in the two modes shared with ETC1: the block is split
+// into two 2x4 or 4x2 halves, each with a base color and one of eight
+// modifier tables
+namespace etc2
+{
+  static const int MODIFIERS[8][2] = {
+    {2, 8}, {5, 17}, {9, 29}, {13, 42}, {18, 60}, {24, 80}, {33, 106}, {47, 183}
+  };
+
+  // Modifier for each 2 bit texel index, the high bit selects the sign
+  static int modifier(int table, int index)
+  {
+    int value = MODIFIERS[table][index & 1];
+    return (index & 2) ? -value : value;
+  }
+
+  struct HalfBlock
+  {
+    int table = 0;
+    int error = 0;
+    uint8_t indices[8];
+  };
+
+  // texels lists the half's 8 block texel numbers
+  static HalfBlock fitHalf(const TexelBlock& block, const uint32_t* texels, const int* base)
+  {
+    HalfBlock best;
+    best.error = std::numeric_limits<int>::max();
+    for (int table = 0; table < 8; table++)
+    {
+      HalfBlock candidate;
+      candidate.table = table;
+      for (int i = 0; i < 8; i++)
+      {
+        int bestTexelError = std::numeric_limits<int>::max();
+        for (int index = 0; index < 4; index++)
+        {
+          int m = modifier(table, index);
+          int color[3] = {
+            std::clamp(base[0] + m, 0, 255),
+            std::clamp(base[1] + m, 0, 255),
+            std::clamp(base[2] + m, 0, 255)
+          };
+          int error = squaredError(block.texels[texels[i]], color, 3);
+          if (error < bestTexelError)
+          {
+            bestTexelError = error;
+            candidate.indices[i] = static_cast<uint8_t>(index);
+          }
+        }
+        candidate.error += bestTexelError;
+      }
+      if (candidate.error < best.error)
+      {
+        best = candidate;
+      }
+    }
+    return best;
+  }
+
+  static void averageHalf(const TexelBlock& block, const uint32_t* texels, float* average)
+  {
+    for (int c = 0; c < 3; c++)
+    {
+      int sum = 0;
+      for (int i = 0; i < 8; i++)
+      {
+        sum += block.texels[texels[i]][c];
+      }
+      average[c] = sum / 8.0f;
+    }
+  }
+
+  static int expand4(int value) { return (value << 4) | value; }
+  static int expand5(int value) { return (value << 3) | (value >> 2); }
+
+  struct Candidate
+  {
+    uint64_t bits = 0;
+    int error = std::numeric_limits<int>::max();
+  };
+
+  static uint64_t packIndices(const uint32_t (&halves)[2][8], const HalfBlock (&fits)[2])
+  {
+    uint64_t bits = 0;
+    for (int h = 0; h < 2; h++)
+    {
+      for (int i = 0; i < 8; i++)
+      {
+        // Texel (x, y) uses bit x * 4 + y of each index plane
+        uint32_t texel = halves[h][i];
+        uint32_t bit = (texel % 4) * 4 + texel / 4;
+        bits |= static_cast<uint64_t>(fits[h].indices[i] >> 1) << (16 + bit);
+        bits |= static_cast<uint64_t>(fits[h].indices[i] & 1) << bit;
+      }
+    }
+    return bits;
+  }
+
+  static Candidate encodeIndividual(const TexelBlock& block, const uint32_t (&halves)[2][8], bool flip)
+  {
+    int quantized[2][3];
+    int base[2][3];
+    HalfBlock fits[2];
+    for (int h = 0; h < 2; h++)
+    {
+      float average[3];
+      averageHalf(block, halves[h], average);
+      for (int c = 0; c < 3; c++)
+      {
+        quantized[h][c] = std::clamp(static_cast<int>(std::lround(average[c] * 15.0f / 255.0f)), 0, 15);
+        base[h][c] = expand4(quantized[h][c]);
+      }
+      fits[h] = fitHalf(block, halves[h], base[h]);
+    }
+
+    Candidate candidate;
+    candidate.error = fits[0].error + fits[1].error;
+    for (int c = 0; c < 3; c++)
+    {
+      candidate.bits |= static_cast<uint64_t>(quantized[0][c]) << (60 - c * 8);
+      candidate.bits |= static_cast<uint64_t>(quantized[1][c]) << (56 - c * 8);
+    }
+    candidate.bits |= static_cast<uint64_t>(fits[0].table) << 37;
+    candidate.bits |= static_cast<uint64_t>(fits[1].table) << 34;
+    candidate.bits |= static_cast<uint64_t>(flip ? 1 : 0) << 32;
+    candidate.bits |= packIndices(halves, fits);
+    return candidate;
+  }
+
+  static Candidate encodeDifferential(const TexelBlock& block, const uint32_t (&halves)[2][8], bool flip)
+  {
+    int quantized[2][3];
+    int base[2][3];
+    float average[2][3];
+    averageHalf(block, halves[0], average[0]);
+    averageHalf(block, halves[1], average[1]);
+
+    // The second color is stored as a 3 bit signed delta from the first, so
+    // it is clamped to what the delta can reach without leaving 0..31
+    for (int c = 0; c < 3; c++)
+    {
+      quantized[0][c] = std::clamp(static_cast<int>(std::lround(average[0][c] * 31.0f / 255.0f)), 0, 31);
+      int second = static_cast<int>(std::lround(average[1][c] * 31.0f / 255.0f));
+      int delta = std::clamp(second - quantized[0][c], -4, 3);
+      quantized[1][c] = std::clamp(quantized[0][c] + delta, 0, 31);
+      base[0][c] = expand5(quantized[0][c]);
+      base[1][c] = expand5(quantized[1][c]);
+    }
+
+    HalfBlock fits[2] = {fitHalf(block, halves[0], base[0]), fitHalf(block, halves[1], base[1])};
+
+    Candidate candidate;
+    candidate.error = fits[0].error + fits[1].error;
+    for (int c = 0; c < 3; c++)
+    {
+      uint32_t delta = static_cast<uint32_t>(quantized[1][c] - quantized[0][c]) & 7;
+      candidate.bits |= static_cast<uint64_t>(quantized[0][c]) << (59 - c * 8);
+      candidate.bits |= static_cast<uint64_t>(delta) << (56 - c * 8);
+    }
+    candidate.bits |= static_cast<uint64_t>(fits[0].table) << 37;
+    candidate.bits |= static_cast<uint64_t>(fits[1].table) << 34;
+    candidate.bits |= static_cast<uint64_t>(1) << 33;
+    candidate.bits |= static_cast<uint64_t>(flip ? 1 : 0) << 32;
+    candidate.bits |= packIndices(halves, fits);
+    return candidate;
+  }
+
+  static int encodeBlock(const TexelBlock& block, uint8_t* out)
+  {
+    Candidate best;
+    for (int flip = 0; flip < 2; flip++)
+    {
+      // Without flip the halves are the left and right 2x4 columns, with flip
+      // the top and bottom 4x2 rows
+      uint32_t halves[2][8];
+      int counts[2] = {0, 0};
+      for (uint32_t t = 0; t < TEXELS_PER_BLOCK; t++)
+      {
+        uint32_t x = t % 4;
+        uint32_t y = t / 4;
+        int half = flip ? (y >= 2) : (x >= 2);
+        halves[half][counts[half]++] = t;
+      }
+
+      Candidate individual = encodeIndividual(block, halves, flip != 0);
+      Candidate differential = encodeDifferential(block, halves, flip != 0);
+      if (individual.error < best.error)
+      {
+        best = individual;
+      }
+      if (differential.error < best.error)
+      {
+        best = differential;
+      }
+    }
+
+    // Blocks are stored big endian
+    for (int i = 0; i < 8; i++)
+    {
+      out[i] = static_cast<uint8_t>(best.bits >> (56 - i * 8));
+    }
+    return best.error;
+  }
+}
+
+static TexelBlock fetchBlock(const RgbaImage& image, uint32_t blockX, uint32_t blockY)
+{
+  TexelBlock block;
+  for (uint32_t y = 0; y < TEXTURE_BLOCK_SIZE; y++)
+  {
+    uint32_t sourceY = std::min(blockY * TEXTURE_BLOCK_SIZE + y, image.height - 1);
+    for (uint32_t x = 0; x < TEXTURE_BLOCK_SIZE; x++)
+    {
+      uint32_t sourceX = std::min(blockX * TEXTURE_BLOCK_SIZE + x, image.width - 1);
+      memcpy(block.texels[y * TEXTURE_BLOCK_SIZE + x], &image.pixels[(static_cast<size_t>(sourceY) * image.width + sourceX) * 4], 4);
+    }
+  }
+  return block;
+}
+
+double compressImage(VkFormat format, const RgbaImage& image, std::vector<uint8_t>& blocks, unsigned threadCount)
+{
+  const uint32_t blockBytes = getBlockBytes(format);
+  const uint32_t blocksX = (image.width + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE;
+  const uint32_t blocksY = (image.height + TEXTURE_BLOCK_SIZE - 1) / TEXTURE_BLOCK_SIZE;
+  blocks.assign(static_cast<size_t>(blocksX) * blocksY * blockBytes, 0);
+
+  std::vector<double> threadErrors(threadCount, 0.0);
+  parallelFor(blocksY, threadCount, [&](size_t begin, size_t end, unsigned threadIndex)
+  {
+    double error = 0.0;
+    for (size_t blockY = begin; blockY < end; blockY++)
+    {
+      for (uint32_t blockX = 0; blockX < blocksX; blockX++)
+      {
+        TexelBlock block = fetchBlock(image, blockX, static_cast<uint32_t>(blockY));
+        uint8_t* out = &blocks[(blockY * blocksX + blockX) * blockBytes];
+
+        // The padding texels repeat the edge, so they are counted again here
+        // and the error is scaled down to the texels that really exist
+        int blockError = format == VK_FORMAT_BC7_UNORM_BLOCK ? bc7::encodeBlock(block, out) : etc2::encodeBlock(block, out);
+        uint32_t coveredX = std::min(TEXTURE_BLOCK_SIZE, image.width - blockX * TEXTURE_BLOCK_SIZE);
+        uint32_t coveredY = std::min(TEXTURE_BLOCK_SIZE, image.height - static_cast<uint32_t>(blockY) * TEXTURE_BLOCK_SIZE);
+        error += static_cast<double>(blockError) * coveredX * coveredY / TEXELS_PER_BLOCK;
+      }
+    }
+    threadErrors[threadIndex] = error;
+  });
+
+  double total = 0.0;
+  for (double error : threadErrors)
+  {
+    total += error;
+  }
+  return total;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "mip_builder.h"
+
+// CPU encoders for the block compressed texture formats the renderer can
+// sample from. They run once when a texture cache is built, so they favour
+// simple, predictable code over encoder quality:
+//
+//   VK_FORMAT_BC7_UNORM_BLOCK        mode 6 only (one RGBA endpoint pair, 4 bit indices)
+//   VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK individual and differential modes only
+//
+// Both produce 4x4 texel blocks; levels that are not a multiple of 4 are
+// padded by repeating the edge texels.
+
+const uint32_t TEXTURE_BLOCK_SIZE = 4;
+
+struct RgbaImage
+{
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<uint8_t> pixels; // tightly packed RGBA8
+};
+
+// Level 0 followed by every level down to 1x1 built by buildMipChain(), one
+// image per level for the block compressors
+std::vector<RgbaImage> buildMipImages(const uint8_t* pixels, uint32_t width, uint32_t height, MipFilter filter, unsigned threadCount);
+
+// True for the formats compressImage() can produce
+bool isCompressedTextureFormat(VkFormat format);
+
+// Size of one 4x4 block in bytes, 0 for unsupported formats
+uint32_t getBlockBytes(VkFormat format);
+
+// Short name used in file names and log output, e.g. "bc7"
+const char* getCompressedFormatName(VkFormat format);
+
+// Encodes the image into tightly packed blocks, row of blocks by row of
+// blocks, using up to threadCount threads. Returns the sum of squared errors
+// over all texels and every channel the format stores, for reporting.
+double compressImage(VkFormat format, const RgbaImage& image, std::vector<uint8_t>& blocks, unsigned threadCount);
@@ -0,0 +1,235 @@
+#include "texture_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+#include <stb_image.h>
+
+#include "benchmark.h"
+#include "hash.h"
+#include "texture_codec.h"
+
+namespace
+{
+  void decodeCompressedTexture(const Asset& source, const std::string& path, MipFilter filter, unsigned threadCount,
+    DecodedTexture& texture)
+  {
+    const std::string cachePath = path.substr(0, path.rfind('.')) + "." + getCompressedFormatName(texture.format) + ".ktx2";
+
+    // The mip filter is part of the key, so changing it rebuilds the levels
+    std::ostringstream sourceKey;
+    sourceKey << source.size() << ":" << std::hex << xxhash64(source.data(), source.size()) << ":" << getMipFilterName(filter);
+
+    texture.blockSize = TEXTURE_BLOCK_SIZE;
+    texture.bytesPerBlock = getBlockBytes(texture.format);
+
+    Ktx2Texture& cache = texture.cache;
+    if (cache.open(cachePath) && cache.getFormat() == texture.format && cache.getValue(TEXTURE_SOURCE_KEY) == sourceKey.str())
+    {
+      texture.width = cache.getWidth();
+      texture.height = cache.getHeight();
+      for (uint32_t level = 0; level < cache.getLevelCount(); level++)
+      {
+        texture.levels.push_back(cache.getLevelData(level));
+      }
+      return;
+    }
+
+    if (cache.isOpen())
+    {
+      std::cerr << "INFO: Texture " << cachePath << " is out of date, rebuilding" << std::endl;
+    }
+    cache.close();
+
+    auto transcodeStart = BenchmarkClock::now();
+
+    int texWidth, texHeight, texChannels;
+    stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+      std::cerr << "ERROR: Failed to load texture image!" << std::endl;
+      throw std::runtime_error("Failed to load texture image!");
+    }
+
+    std::vector<RgbaImage> chain = buildMipImages(pixels, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight),
+      filter, threadCount);
+    stbi_image_free(pixels);
+
+    double squaredError = 0.0;
+    double samples = 0.0;
+    texture.storage.resize(chain.size());
+    for (size_t level = 0; level < chain.size(); level++)
+    {
+      squaredError += compressImage(texture.format, chain[level], texture.storage[level], threadCount);
+      samples += static_cast<double>(chain[level].width) * chain[level].height * (texture.format == VK_FORMAT_BC7_UNORM_BLOCK ? 4 : 3);
+      texture.levels.push_back(texture.storage[level].data());
+    }
+
+    texture.width = static_cast<uint32_t>(texWidth);
+    texture.height = static_cast<uint32_t>(texHeight);
+
+    std::cerr << "INFO: Transcoded " << path << " to " << getCompressedFormatName(texture.format) << " in "
+      << elapsedMilliseconds(transcodeStart, BenchmarkClock::now()) << " ms, RMSE "
+      << std::sqrt(squaredError / samples) << std::endl;
+
+    Ktx2Writer writer(texture.format, texture.width, texture.height);
+    for (const auto& level : texture.storage)
+    {
+      writer.addLevel(level);
+    }
+    writer.addValue("KTXwriter", "rgb");
+    writer.addValue(TEXTURE_SOURCE_KEY, sourceKey.str());
+    if (writer.write(cachePath))
+    {
+      std::cerr << "INFO: Wrote texture cache " << cachePath << std::endl;
+    }
+  }
+
+  void decodeUncompressedTexture(const Asset& source, MipFilter filter, unsigned threadCount, DecodedTexture& texture)
+  {
+    int texWidth, texHeight, texChannels;
+    stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+    if (!pixels)
+    {
+      std::cerr << "ERROR: Failed to load texture image!" << std::endl;
+      throw std::runtime_error("Failed to load texture image!");
+    }
+
+    texture.width = static_cast<uint32_t>(texWidth);
+    texture.height = static_cast<uint32_t>(texHeight);
+    texture.blockSize = 1;
+    texture.bytesPerBlock = 4;
+
+    const std::vector<size_t> offsets = getMipChainOffsets(texture.width, texture.height);
+    texture.storage.resize(1);
+    texture.storage[0].resize(offsets.back());
+    buildMipChain(pixels, texture.width, texture.height, filter, texture.storage[0].data(), threadCount);
+    stbi_image_free(pixels);
+
+    for (size_t level = 0; level + 1 < offsets.size(); level++)
+    {
+      texture.levels.push_back(texture.storage[0].data() + offsets[level]);
+    }
+  }
+}
+
+std::unique_ptr<DecodedTexture> decodeTexture(const std::string& path, const Asset& source, VkFormat format, MipFilter filter,
+  unsigned threadCount)
+{
+  auto decodeStart = BenchmarkClock::now();
+
+  auto texture = std::make_unique<DecodedTexture>();
+  texture->format = format;
+  if (isCompressedTextureFormat(format))
+  {
+    decodeCompressedTexture(source, path, filter, threadCount, *texture);
+  }
+  else if (format == VK_FORMAT_R8G8B8A8_UNORM)
+  {
+    decodeUncompressedTexture(source, filter, threadCount, *texture);
+  }
+  else
+  {
+    std::cerr << "ERROR: Unsupported texture format: " << format << std::endl;
+    throw std::runtime_error("Unsupported texture format!");
+  }
+
+  texture->decodeMilliseconds = elapsedMilliseconds(decodeStart, BenchmarkClock::now());
+  return texture;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+  stop();
+}
+
+void TextureStreamer::start(unsigned threadCount)
+{
+  stop();
+
+  stopping = false;
+  for (unsigned t = 0; t < std::max(1u, threadCount); ++t)
+  {
+    threads.emplace_back(&TextureStreamer::work, this);
+  }
+}
+
+void TextureStreamer::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    jobs.clear();
+  }
+  wake.notify_all();
+
+  for (auto& thread : threads)
+  {
+    thread.join();
+  }
+  threads.clear();
+}
+
+void TextureStreamer::enqueue(DecodeJob job)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  wake.notify_one();
+}
+
+std::unique_ptr<DecodedTexture> TextureStreamer::poll()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (firstError)
+  {
+    std::exception_ptr error = firstError;
+    firstError = nullptr;
+    std::rethrow_exception(error);
+  }
+  if (finished.empty())
+  {
+    return nullptr;
+  }
+
+  std::unique_ptr<DecodedTexture> texture = std::move(finished.front());
+  finished.pop_front();
+  return texture;
+}
+
+void TextureStreamer::work()
+{
+  for (;;)
+  {
+    DecodeJob job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+      if (stopping)
+      {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    try
+    {
+      std::unique_ptr<DecodedTexture> texture = job();
+      std::lock_guard<std::mutex> lock(mutex);
+      finished.push_back(std::move(texture));
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!firstError)
+      {
+        firstError = std::current_exception();
+      }
+    }
+  }
+}
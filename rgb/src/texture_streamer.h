@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "asset_archive.h"
+#include "ktx2.h"
+#include "mip_builder.h"
+
+// A texture with its whole mip chain in CPU memory, ready to be uploaded
+// level by level
+struct DecodedTexture
+{
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  // 4 and the block's size in bytes for block compressed formats, 1 and the
+  // texel's size otherwise
+  uint32_t blockSize = 1;
+  uint32_t bytesPerBlock = 4;
+  // Level 0 first, pointing into cache or storage
+  std::vector<const uint8_t*> levels;
+  Ktx2Texture cache;
+  std::vector<std::vector<uint8_t>> storage;
+  double decodeMilliseconds = 0.0;
+};
+
+// Key/value entry recording which source image a texture cache was
+// transcoded from, and with which mip filter
+const char* const TEXTURE_SOURCE_KEY = "rgb.source";
+
+// Decodes the image loaded from path into a full mip chain of format. Block
+// compressed formats are read from a KTX2 cache next to path, which is
+// transcoded from source first if it is missing, stale or in another format.
+// VK_FORMAT_R8G8B8A8_UNORM is decoded from the source with mips built on the
+// CPU. Touches no Vulkan objects, so it may run on any thread.
+std::unique_ptr<DecodedTexture> decodeTexture(const std::string& path, const Asset& source, VkFormat format, MipFilter filter,
+  unsigned threadCount);
+
+// Runs decode jobs on a few background threads, so that frames are drawn
+// while textures load. Finished textures are collected with poll() on the
+// thread that uploads them. Unlike WorkerPool::run(), enqueue() returns at
+// once and the jobs run in the order they were queued.
+class TextureStreamer
+{
+public:
+  using DecodeJob = std::function<std::unique_ptr<DecodedTexture>()>;
+
+  TextureStreamer() = default;
+  ~TextureStreamer();
+
+  TextureStreamer(const TextureStreamer&) = delete;
+  TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+  void start(unsigned threadCount);
+  // Finishes the job each thread is running, drops the queued ones and joins
+  void stop();
+
+  void enqueue(DecodeJob job);
+
+  // Returns a finished texture without blocking, or nullptr if none is
+  // ready. If a job threw, its exception is rethrown here instead.
+  std::unique_ptr<DecodedTexture> poll();
+
+private:
+  void work();
+
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<DecodeJob> jobs;
+  std::deque<std::unique_ptr<DecodedTexture>> finished;
+  bool stopping = false;
+  std::exception_ptr firstError;
+};
@@ -0,0 +1,67 @@
+#include "uniform_ring.h"
+
+#include <iostream>
+#include <stdexcept>
+
+void UniformRing::init(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+  uint32_t frameCount, VkDeviceSize frameSize)
+{
+  this->device = device;
+  this->allocator = &allocator;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  alignment = properties.limits.minUniformBufferOffsetAlignment;
+  // Every region starts aligned, so that allocations aligned within a
+  // region are aligned in the buffer as well
+  this->frameSize = getAlignedSize(frameSize);
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = this->frameSize * frameCount;
+  bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create uniform ring buffer!" << std::endl;
+    throw std::runtime_error("Failed to create uniform ring buffer!");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+  memory = allocator.allocate(memRequirements,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    ResourceLayout::Linear);
+  vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+  frameStart = 0;
+  head = 0;
+}
+
+void UniformRing::destroy()
+{
+  vkDestroyBuffer(device, buffer, nullptr);
+  buffer = VK_NULL_HANDLE;
+  allocator->free(memory);
+}
+
+void UniformRing::beginFrame(uint32_t frame)
+{
+  frameStart = frameSize * frame;
+  head = frameStart;
+}
+
+uint32_t UniformRing::allocate(VkDeviceSize size)
+{
+  VkDeviceSize alignedSize = getAlignedSize(size);
+  if (head + alignedSize > frameStart + frameSize)
+  {
+    std::cerr << "ERROR: Uniform ring region of " << frameSize << " bytes is full!" << std::endl;
+    throw std::runtime_error("Uniform ring region is full!");
+  }
+
+  VkDeviceSize offset = head;
+  head += alignedSize;
+  return static_cast<uint32_t>(offset);
+}
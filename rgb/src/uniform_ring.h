@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+
+// One persistently mapped uniform buffer with a region per frame in flight.
+// A frame's uniforms are suballocated linearly from its region, at offsets
+// aligned to minUniformBufferOffsetAlignment, and bound through descriptors
+// of type VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, so a single descriptor
+// set serves every frame and every object without mapping memory.
+//
+// A region is rewritten from its start by beginFrame(), so the frame that
+// last used it must have completed on the GPU by then.
+class UniformRing
+{
+public:
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+    uint32_t frameCount, VkDeviceSize frameSize);
+  void destroy();
+
+  // Starts filling the region of a frame in flight from the beginning
+  void beginFrame(uint32_t frame);
+
+  // Reserves size bytes in the current frame's region and returns their
+  // offset in the buffer, which is also the dynamic offset to bind them with
+  uint32_t allocate(VkDeviceSize size);
+
+  template<typename T>
+  uint32_t push(const T& data)
+  {
+    uint32_t offset = allocate(sizeof(T));
+    memcpy(getMapped(offset), &data, sizeof(T));
+    return offset;
+  }
+
+  void* getMapped(uint32_t offset) const { return static_cast<uint8_t*>(memory.mapped) + offset; }
+
+  // Size of an allocation of size bytes once it is padded to the alignment,
+  // which is the stride of an array of them bound one element at a time
+  VkDeviceSize getAlignedSize(VkDeviceSize size) const { return (size + alignment - 1) / alignment * alignment; }
+
+  VkBuffer getBuffer() const { return buffer; }
+
+private:
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+  VkDeviceSize alignment = 1;
+  VkDeviceSize frameSize = 0;
+
+  VkBuffer buffer = VK_NULL_HANDLE;
+  Allocation memory;
+
+  VkDeviceSize frameStart = 0;
+  VkDeviceSize head = 0;
+};
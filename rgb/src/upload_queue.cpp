@@ -0,0 +1,402 @@
+#include "upload_queue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include "benchmark.h"
+#include "gpu_profiler.h"
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void UploadQueue::init(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+  uint32_t queueFamilyIndex, VkQueue queue, VkDeviceSize ringSize)
+{
+  this->device = device;
+  this->allocator = &allocator;
+  this->queueFamilyIndex = queueFamilyIndex;
+  this->queue = queue;
+  this->ringSize = ringSize;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  // A multiple of 16 also satisfies the texel block size rule of vkCmdCopyBufferToImage for every format used here
+  copyAlignment = std::max<VkDeviceSize>(16, properties.limits.optimalBufferCopyOffsetAlignment);
+
+  VkCommandPoolCreateInfo poolInfo = {};
+  poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  poolInfo.queueFamilyIndex = queueFamilyIndex;
+  poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+  if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create upload command pool!" << std::endl;
+    throw std::runtime_error("Failed to create upload command pool!");
+  }
+
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = ringSize;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, &ringBuffer) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create staging ring buffer!" << std::endl;
+    throw std::runtime_error("Failed to create staging ring buffer!");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, ringBuffer, &memRequirements);
+  ringMemory = allocator.allocate(memRequirements,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    ResourceLayout::Linear);
+  vkBindBufferMemory(device, ringBuffer, ringMemory.memory, ringMemory.offset);
+
+  head = 0;
+  tail = 0;
+}
+
+void UploadQueue::destroy()
+{
+  if (recording)
+  {
+    submit(false);
+  }
+  while (!inFlight.empty())
+  {
+    retireOldest();
+  }
+
+  for (const Batch& batch : freeBatches)
+  {
+    vkDestroyFence(device, batch.fence, nullptr);
+    vkDestroySemaphore(device, batch.semaphore, nullptr);
+  }
+  freeBatches.clear();
+
+  vkDestroyCommandPool(device, commandPool, nullptr);
+  vkDestroyBuffer(device, ringBuffer, nullptr);
+  allocator->free(ringMemory);
+}
+
+VkCommandBuffer UploadQueue::getCommandBuffer()
+{
+  if (recording)
+  {
+    return current.commandBuffer;
+  }
+
+  if (!freeBatches.empty())
+  {
+    current = freeBatches.back();
+    freeBatches.pop_back();
+  }
+  else
+  {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (vkAllocateCommandBuffers(device, &allocInfo, &current.commandBuffer) != VK_SUCCESS
+      || vkCreateFence(device, &fenceInfo, nullptr, &current.fence) != VK_SUCCESS
+      || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &current.semaphore) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create upload batch!" << std::endl;
+      throw std::runtime_error("Failed to create upload batch!");
+    }
+
+    current.profilerSlot = profiler != nullptr ? profiler->createSlot(queueFamilyIndex, "transfer") : GpuProfiler::INVALID_SLOT;
+  }
+
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  vkBeginCommandBuffer(current.commandBuffer, &beginInfo);
+
+  current.profilerScope = GpuProfiler::INVALID_SCOPE;
+  if (current.profilerSlot != GpuProfiler::INVALID_SLOT)
+  {
+    profiler->beginSlot(current.profilerSlot, current.commandBuffer);
+    current.profilerScope = profiler->beginScope(current.profilerSlot, current.commandBuffer, "upload");
+  }
+
+  recording = true;
+  return current.commandBuffer;
+}
+
+VkDeviceSize UploadQueue::reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+  VkDeviceSize position = alignUp(head, alignment);
+  if (position % ringSize + size > ringSize)
+  {
+    // Skip the rest of the ring rather than splitting the copy
+    position = alignUp(position, ringSize);
+  }
+
+  if (position + size > tail + ringSize)
+  {
+    auto stallStart = BenchmarkClock::now();
+    while (position + size > tail + ringSize)
+    {
+      if (inFlight.empty())
+      {
+        // Only the batch being recorded holds on to the space
+        submit(false);
+      }
+      retireOldest();
+    }
+    ++stallCount;
+    stallMilliseconds += elapsedMilliseconds(stallStart, BenchmarkClock::now());
+  }
+
+  head = position + size;
+  return position % ringSize;
+}
+
+void UploadQueue::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size)
+{
+  const VkDeviceSize maxChunk = ringSize / 4;
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+  for (VkDeviceSize done = 0; done < size;)
+  {
+    VkDeviceSize chunk = std::min(maxChunk, size - done);
+    VkDeviceSize ringOffset = reserve(chunk, copyAlignment);
+    memcpy(static_cast<uint8_t*>(ringMemory.mapped) + ringOffset, bytes + done, static_cast<size_t>(chunk));
+
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = ringOffset;
+    copyRegion.dstOffset = offset + done;
+    copyRegion.size = chunk;
+    vkCmdCopyBuffer(getCommandBuffer(), ringBuffer, buffer, 1, &copyRegion);
+
+    done += chunk;
+  }
+
+  uploadedBytes += size;
+}
+
+void UploadQueue::beginImageUpload(VkImage image, uint32_t mipLevels)
+{
+  VkImageMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = 0;
+  barrier.subresourceRange.levelCount = mipLevels;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+  vkCmdPipelineBarrier(getCommandBuffer(),
+    VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+    0, nullptr,
+    0, nullptr,
+    1, &barrier);
+}
+
+void UploadQueue::uploadImageLevel(VkImage image, uint32_t mipLevel, uint32_t width, uint32_t height,
+  uint32_t blockSize, uint32_t bytesPerBlock, const void* data)
+{
+  // Large levels are copied in bands of block rows that fit in a quarter of the ring
+  const uint32_t blockRows = (height + blockSize - 1) / blockSize;
+  const VkDeviceSize rowPitch = static_cast<VkDeviceSize>((width + blockSize - 1) / blockSize) * bytesPerBlock;
+  const uint32_t rowsPerChunk = static_cast<uint32_t>(std::max<VkDeviceSize>(1, ringSize / 4 / rowPitch));
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+  for (uint32_t row = 0; row < blockRows;)
+  {
+    uint32_t rows = std::min(rowsPerChunk, blockRows - row);
+    VkDeviceSize chunk = rows * rowPitch;
+    VkDeviceSize ringOffset = reserve(chunk, copyAlignment);
+    memcpy(static_cast<uint8_t*>(ringMemory.mapped) + ringOffset, bytes + row * rowPitch, static_cast<size_t>(chunk));
+
+    // The extent is in texels and only the last band may end inside a block
+    uint32_t firstTexelRow = row * blockSize;
+    uint32_t texelRows = std::min(rows * blockSize, height - firstTexelRow);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = ringOffset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mipLevel;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {0, static_cast<int32_t>(firstTexelRow), 0};
+    region.imageExtent = {width, texelRows, 1};
+
+    vkCmdCopyBufferToImage(getCommandBuffer(), ringBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    row += rows;
+  }
+
+  uploadedBytes += rowPitch * blockRows;
+}
+
+void UploadQueue::uploadImageLevels(VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPerTexel,
+  VkDeviceSize size, const std::function<void(uint8_t*)>& fill)
+{
+  beginImageUpload(image, mipLevels);
+
+  VkBuffer source = ringBuffer;
+  VkDeviceSize sourceOffset = 0;
+  if (size <= ringSize / 2)
+  {
+    sourceOffset = reserve(size, copyAlignment);
+    fill(static_cast<uint8_t*>(ringMemory.mapped) + sourceOffset);
+  }
+  else
+  {
+    VkBufferCreateInfo bufferInfo = {};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateBuffer(device, &bufferInfo, nullptr, &source) != VK_SUCCESS)
+    {
+      std::cerr << "ERROR: Failed to create image staging buffer!" << std::endl;
+      throw std::runtime_error("Failed to create image staging buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(device, source, &memRequirements);
+    Allocation memory = allocator->allocate(memRequirements,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      ResourceLayout::Linear);
+    vkBindBufferMemory(device, source, memory.memory, memory.offset);
+
+    fill(static_cast<uint8_t*>(memory.mapped));
+    getCommandBuffer();
+    current.stagingBuffers.emplace_back(source, memory);
+  }
+
+  std::vector<VkBufferImageCopy> regions(mipLevels);
+  VkDeviceSize offset = sourceOffset;
+  for (uint32_t level = 0; level < mipLevels; level++)
+  {
+    uint32_t levelWidth = std::max(1u, width >> level);
+    uint32_t levelHeight = std::max(1u, height >> level);
+
+    regions[level].bufferOffset = offset;
+    regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    regions[level].imageSubresource.mipLevel = level;
+    regions[level].imageSubresource.baseArrayLayer = 0;
+    regions[level].imageSubresource.layerCount = 1;
+    regions[level].imageOffset = {0, 0, 0};
+    regions[level].imageExtent = {levelWidth, levelHeight, 1};
+
+    offset += static_cast<VkDeviceSize>(levelWidth) * levelHeight * bytesPerTexel;
+  }
+
+  vkCmdCopyBufferToImage(getCommandBuffer(), source, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    static_cast<uint32_t>(regions.size()), regions.data());
+
+  uploadedBytes += size;
+}
+
+void UploadQueue::uploadImage(VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPerTexel, const void* data)
+{
+  beginImageUpload(image, mipLevels);
+  uploadImageLevel(image, 0, width, height, 1, bytesPerTexel, data);
+}
+
+VkSemaphore UploadQueue::flush()
+{
+  if (!recording)
+  {
+    return VK_NULL_HANDLE;
+  }
+
+  submit(true);
+  return inFlight.back().semaphore;
+}
+
+void UploadQueue::submit(bool signal)
+{
+  if (current.profilerSlot != GpuProfiler::INVALID_SLOT)
+  {
+    profiler->endScope(current.profilerSlot, current.commandBuffer, current.profilerScope);
+  }
+  vkEndCommandBuffer(current.commandBuffer);
+  current.ringEnd = head;
+
+  VkSubmitInfo submitInfo = {};
+  submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &current.commandBuffer;
+  submitInfo.signalSemaphoreCount = signal ? 1 : 0;
+  submitInfo.pSignalSemaphores = &current.semaphore;
+
+  if (vkQueueSubmit(queue, 1, &submitInfo, current.fence) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to submit upload batch!" << std::endl;
+    throw std::runtime_error("Failed to submit upload batch!");
+  }
+
+  inFlight.push_back(current);
+  recording = false;
+  ++submittedBatches;
+}
+
+void UploadQueue::retireOldest()
+{
+  Batch batch = inFlight.front();
+  inFlight.pop_front();
+
+  vkWaitForFences(device, 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+  vkResetFences(device, 1, &batch.fence);
+  vkResetCommandBuffer(batch.commandBuffer, 0);
+  if (batch.profilerSlot != GpuProfiler::INVALID_SLOT)
+  {
+    profiler->collectSlot(batch.profilerSlot);
+  }
+
+  for (auto& staging : batch.stagingBuffers)
+  {
+    vkDestroyBuffer(device, staging.first, nullptr);
+    allocator->free(staging.second);
+  }
+  batch.stagingBuffers.clear();
+
+  tail = batch.ringEnd;
+  freeBatches.push_back(batch);
+}
+
+void UploadQueue::collect()
+{
+  while (!inFlight.empty() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS)
+  {
+    retireOldest();
+  }
+}
+
+void UploadQueue::printStatistics() const
+{
+  StreamFormatGuard formatGuard(std::cerr);
+  std::cerr << "INFO: Uploaded " << std::fixed << std::setprecision(2)
+    << uploadedBytes / (1024.0 * 1024.0) << " MiB in " << submittedBatches << " batches through a "
+    << ringSize / (1024 * 1024) << " MiB staging ring, " << stallCount << " stalls on a full ring ("
+    << stallMilliseconds << " ms)" << std::endl;
+}
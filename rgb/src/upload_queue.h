@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "memory_allocator.h"
+
+class GpuProfiler;
+
+// Records copies from a persistently mapped staging ring into batches that
+// are submitted to a transfer queue without waiting for them. The graphics
+// queue waits on the semaphore returned by flush() before it uses the data.
+//
+// Space in the ring is handed out in submission order and given back when a
+// batch's fence signals, so the CPU only blocks when the ring is full. Uploads
+// larger than a quarter of the ring are split into several copies.
+//
+// Resources written here are shared with the graphics queue family, so they
+// must be created with VK_SHARING_MODE_CONCURRENT when the families differ.
+class UploadQueue
+{
+public:
+  static const VkDeviceSize DEFAULT_RING_SIZE = 32ull * 1024 * 1024;
+
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+    uint32_t queueFamilyIndex, VkQueue queue, VkDeviceSize ringSize = DEFAULT_RING_SIZE);
+  // Waits for all uploads and frees the ring
+  void destroy();
+
+  void uploadBuffer(VkBuffer buffer, VkDeviceSize offset, const void* data, VkDeviceSize size);
+
+  // Moves every mip level to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, must be
+  // called before the image's levels are uploaded
+  void beginImageUpload(VkImage image, uint32_t mipLevels);
+
+  // Fills one mip level from tightly packed texel blocks. width and height
+  // are the level's size in texels; uncompressed formats use a block size of 1.
+  void uploadImageLevel(VkImage image, uint32_t mipLevel, uint32_t width, uint32_t height,
+    uint32_t blockSize, uint32_t bytesPerBlock, const void* data);
+
+  // Shorthand for beginImageUpload() followed by filling level 0 with texels
+  void uploadImage(VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPerTexel, const void* data);
+
+  // Uploads every level of an uncompressed image with a single
+  // vkCmdCopyBufferToImage. fill() writes the levels, tightly packed one
+  // after the other, straight into size bytes of staging memory. Chains
+  // larger than half the ring get a staging buffer of their own, which is
+  // freed once the batch completes. Includes beginImageUpload().
+  void uploadImageLevels(VkImage image, uint32_t mipLevels, uint32_t width, uint32_t height, uint32_t bytesPerTexel,
+    VkDeviceSize size, const std::function<void(uint8_t*)>& fill);
+
+  // Submits everything recorded so far and returns a semaphore that signals
+  // once all uploads submitted up to now are complete, or VK_NULL_HANDLE if
+  // nothing was recorded. The semaphore must be waited on exactly once
+  // before the next flush().
+  VkSemaphore flush();
+
+  // Gives back the ring space of completed batches without blocking
+  void collect();
+
+  uint32_t getQueueFamilyIndex() const { return queueFamilyIndex; }
+
+  // Measures every batch on the GPU from now on, on the "transfer" track
+  void setProfiler(GpuProfiler* profiler) { this->profiler = profiler; }
+
+  void printStatistics() const;
+
+private:
+  struct Batch
+  {
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    VkSemaphore semaphore;
+    // Ring position just past the last byte this batch reads
+    VkDeviceSize ringEnd;
+    uint32_t profilerSlot;
+    uint32_t profilerScope;
+    // Staging buffers outside the ring that this batch reads
+    std::vector<std::pair<VkBuffer, Allocation>> stagingBuffers;
+  };
+
+  VkCommandBuffer getCommandBuffer();
+  // Returns a ring offset for size bytes, blocking on old batches when the ring is full
+  VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment);
+  void submit(bool signal);
+  void retireOldest();
+
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+  uint32_t queueFamilyIndex = 0;
+  VkQueue queue = VK_NULL_HANDLE;
+  VkCommandPool commandPool = VK_NULL_HANDLE;
+  VkDeviceSize copyAlignment = 16;
+
+  VkBuffer ringBuffer = VK_NULL_HANDLE;
+  Allocation ringMemory;
+  VkDeviceSize ringSize = 0;
+  // Positions grow without wrapping, the ring offset is position % ringSize
+  VkDeviceSize head = 0;
+  VkDeviceSize tail = 0;
+
+  bool recording = false;
+  Batch current = {};
+  std::deque<Batch> inFlight;
+  std::vector<Batch> freeBatches;
+
+  GpuProfiler* profiler = nullptr;
+
+  VkDeviceSize uploadedBytes = 0;
+  uint32_t submittedBatches = 0;
+  uint32_t stallCount = 0;
+  double stallMilliseconds = 0.0;
+};
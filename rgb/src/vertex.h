@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/gtx/hash.hpp>
+
+struct Vertex
+{
+  glm::vec3 pos;
+  glm::vec3 color;
+  glm::vec2 texCoord;
+
+  bool operator==(const Vertex& other) const
+  {
+    return pos == other.pos && color == other.color && texCoord == other.texCoord;
+  }
+
+  static VkVertexInputBindingDescription getBindingDescription()
+  {
+    VkVertexInputBindingDescription bindingDescription = {};
+    bindingDescription.binding = 0;
+    bindingDescription.stride = sizeof(Vertex);
+    bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    return bindingDescription;
+  }
+
+  static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions()
+  {
+    std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[0].offset = offsetof(Vertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 1;
+    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    attributeDescriptions[1].offset = offsetof(Vertex, color);
+
+    attributeDescriptions[2].binding = 0;
+    attributeDescriptions[2].location = 2;
+    attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
+    attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+
+    return attributeDescriptions;
+  }
+};
+
+// The mesh cache stores vertices verbatim
+static_assert(std::is_trivially_copyable<Vertex>::value, "Vertex must be trivially copyable");
+static_assert(sizeof(Vertex) == 32, "Vertex must not contain padding");
+
+// Compact alternative to Vertex, see vertex_packing.h. Colors are not part
+// of it; a mesh that is not all white gets a separate stream of RGBA8
+// colors in binding 1.
+struct PackedVertex
+{
+  // Position in the mesh bounding box, 0 at its minimum and 65535 at its
+  // maximum along every axis, w is unused
+  uint16_t pos[4];
+  // Half floats, or 16-bit unsigned normalized if every coordinate of the
+  // mesh is within [0, 1]
+  uint16_t texCoord[2];
+
+  static std::vector<VkVertexInputBindingDescription> getBindingDescriptions(bool hasColors)
+  {
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions(hasColors ? 2 : 1);
+
+    bindingDescriptions[0].binding = 0;
+    bindingDescriptions[0].stride = sizeof(PackedVertex);
+    bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+    if (hasColors)
+    {
+      bindingDescriptions[1].binding = 1;
+      bindingDescriptions[1].stride = sizeof(uint32_t);
+      bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    }
+
+    return bindingDescriptions;
+  }
+
+  // Same locations as Vertex, so the shaders only differ in how they
+  // turn the position back into model space
+  static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions(bool hasColors, VkFormat texCoordFormat)
+  {
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions(hasColors ? 3 : 2);
+
+    attributeDescriptions[0].binding = 0;
+    attributeDescriptions[0].location = 0;
+    attributeDescriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+    attributeDescriptions[0].offset = offsetof(PackedVertex, pos);
+
+    attributeDescriptions[1].binding = 0;
+    attributeDescriptions[1].location = 2;
+    attributeDescriptions[1].format = texCoordFormat;
+    attributeDescriptions[1].offset = offsetof(PackedVertex, texCoord);
+
+    if (hasColors)
+    {
+      attributeDescriptions[2].binding = 1;
+      attributeDescriptions[2].location = 1;
+      attributeDescriptions[2].format = VK_FORMAT_R8G8B8A8_UNORM;
+      attributeDescriptions[2].offset = 0;
+    }
+
+    return attributeDescriptions;
+  }
+};
+
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must not contain padding");
+
+namespace std
+{
+  template<> struct hash<Vertex>
+  {
+    size_t operator()(Vertex const& vertex) const
+    {
+      return ((hash<glm::vec3>()(vertex.pos) ^
+        (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
+        (hash<glm::vec2>()(vertex.texCoord) << 1);
+    }
+  };
+}
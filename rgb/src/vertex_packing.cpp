@@ -0,0 +1,147 @@
+#include "vertex_packing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+uint16_t floatToHalf(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const uint32_t sign = (bits >> 16) & 0x8000u;
+  const uint32_t exponent = (bits >> 23) & 0xFFu;
+  uint32_t mantissa = bits & 0x7FFFFFu;
+
+  if (exponent == 0xFFu)
+  {
+    // Infinity stays infinity, NaN stays a quiet NaN
+    return static_cast<uint16_t>(sign | 0x7C00u | (mantissa != 0 ? 0x200u : 0u));
+  }
+
+  const int32_t halfExponent = static_cast<int32_t>(exponent) - 127 + 15;
+  if (halfExponent >= 31)
+  {
+    return static_cast<uint16_t>(sign | 0x7C00u);
+  }
+
+  uint32_t half;
+  uint32_t remainder;
+  uint32_t halfway;
+  if (halfExponent <= 0)
+  {
+    // Subnormal, or zero once even the implicit leading bit is shifted out
+    if (halfExponent < -10)
+    {
+      return static_cast<uint16_t>(sign);
+    }
+
+    mantissa |= 0x800000u;
+    const uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+    half = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  }
+  else
+  {
+    half = (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+    remainder = mantissa & 0x1FFFu;
+    halfway = 0x1000u;
+  }
+
+  // A carry out of the mantissa correctly bumps the exponent, up to infinity
+  if (remainder > halfway || (remainder == halfway && (half & 1u) != 0))
+  {
+    ++half;
+  }
+
+  return static_cast<uint16_t>(sign | half);
+}
+
+static uint16_t quantizeUnorm16(float value)
+{
+  return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+}
+
+static uint8_t quantizeUnorm8(float value)
+{
+  return static_cast<uint8_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+}
+
+PackedVertexLayout packVertices(const Vertex* vertices, size_t vertexCount,
+  std::vector<PackedVertex>& packed, std::vector<uint32_t>& colors)
+{
+  PackedVertexLayout layout = {};
+
+  glm::vec3 minimum(std::numeric_limits<float>::max());
+  glm::vec3 maximum(-std::numeric_limits<float>::max());
+  bool texCoordsNormalized = true;
+  layout.hasColors = false;
+  for (size_t i = 0; i < vertexCount; ++i)
+  {
+    const Vertex& vertex = vertices[i];
+    minimum = glm::min(minimum, vertex.pos);
+    maximum = glm::max(maximum, vertex.pos);
+    texCoordsNormalized = texCoordsNormalized
+      && vertex.texCoord.x >= 0.0f && vertex.texCoord.x <= 1.0f
+      && vertex.texCoord.y >= 0.0f && vertex.texCoord.y <= 1.0f;
+    layout.hasColors = layout.hasColors
+      || vertex.color.x != 1.0f || vertex.color.y != 1.0f || vertex.color.z != 1.0f;
+  }
+
+  if (vertexCount == 0)
+  {
+    minimum = glm::vec3(0.0f);
+    maximum = glm::vec3(0.0f);
+  }
+
+  // Unsigned normalized coordinates are exact to 1/65535 across the whole
+  // range, half floats only near zero, so they are kept for meshes whose
+  // textures repeat
+  layout.texCoordFormat = texCoordsNormalized ? VK_FORMAT_R16G16_UNORM : VK_FORMAT_R16G16_SFLOAT;
+  layout.positionOffset = minimum;
+  layout.positionScale = maximum - minimum;
+
+  const float extent[3] = {layout.positionScale.x, layout.positionScale.y, layout.positionScale.z};
+  const float offset[3] = {minimum.x, minimum.y, minimum.z};
+
+  packed.resize(vertexCount);
+  for (size_t i = 0; i < vertexCount; ++i)
+  {
+    const Vertex& vertex = vertices[i];
+    const float position[3] = {vertex.pos.x, vertex.pos.y, vertex.pos.z};
+    for (size_t axis = 0; axis < 3; ++axis)
+    {
+      packed[i].pos[axis] = extent[axis] > 0.0f ? quantizeUnorm16((position[axis] - offset[axis]) / extent[axis]) : 0;
+    }
+    packed[i].pos[3] = 0;
+
+    if (texCoordsNormalized)
+    {
+      packed[i].texCoord[0] = quantizeUnorm16(vertex.texCoord.x);
+      packed[i].texCoord[1] = quantizeUnorm16(vertex.texCoord.y);
+    }
+    else
+    {
+      packed[i].texCoord[0] = floatToHalf(vertex.texCoord.x);
+      packed[i].texCoord[1] = floatToHalf(vertex.texCoord.y);
+    }
+  }
+
+  colors.clear();
+  if (layout.hasColors)
+  {
+    colors.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i)
+    {
+      const glm::vec3& color = vertices[i].color;
+      colors[i] = static_cast<uint32_t>(quantizeUnorm8(color.x)) |
+        (static_cast<uint32_t>(quantizeUnorm8(color.y)) << 8) |
+        (static_cast<uint32_t>(quantizeUnorm8(color.z)) << 16) |
+        (0xFFu << 24);
+    }
+  }
+
+  return layout;
+}
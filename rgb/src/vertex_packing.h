@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "vertex.h"
+
+// Vertices are either uploaded as Vertex, 32 bytes each, or packed into a
+// PackedVertex, 12 bytes each, plus 4 bytes of color for meshes that are
+// not all white. Packing is lossy: positions are quantized to 1/65535 of
+// the mesh bounding box.
+enum class VertexFormat
+{
+  Float,
+  Packed
+};
+
+// Everything the pipeline's vertex input and the vertex shader need to
+// read packed vertices back
+struct PackedVertexLayout
+{
+  // The model space position is positionOffset + pos * positionScale, with
+  // pos read as normalized values in [0, 1]
+  glm::vec3 positionOffset;
+  glm::vec3 positionScale;
+  VkFormat texCoordFormat;
+  bool hasColors;
+};
+
+// Round to nearest even, overflows to infinity
+uint16_t floatToHalf(float value);
+
+// colors is left empty if every vertex is white
+PackedVertexLayout packVertices(const Vertex* vertices, size_t vertexCount,
+  std::vector<PackedVertex>& packed, std::vector<uint32_t>& colors);
@@ -0,0 +1,812 @@
+#include "virtual_texture.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include <stb_image.h>
+
+#include "benchmark.h"
+#include "hash.h"
+
+static const uint64_t PAGE_FILE_ALIGNMENT = 64;
+static const VkDeviceSize TILE_BYTES = static_cast<VkDeviceSize>(VirtualTexture::TILE_SIZE) * VirtualTexture::TILE_SIZE * 4;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t packEntry(uint32_t slotX, uint32_t slotY, uint32_t level)
+{
+  return slotX | (slotY << 8) | (level << 16);
+}
+
+static void createBuffer(VkDevice device, MemoryAllocator& allocator, VkDeviceSize size, VkBufferUsageFlags usage,
+  VkBuffer& buffer, Allocation& memory)
+{
+  VkBufferCreateInfo bufferInfo = {};
+  bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  bufferInfo.size = size;
+  bufferInfo.usage = usage;
+  bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create virtual texture buffer!" << std::endl;
+    throw std::runtime_error("Failed to create virtual texture buffer!");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+  memory = allocator.allocate(memRequirements,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+    ResourceLayout::Linear);
+  vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+static void createImage(VkDevice device, MemoryAllocator& allocator, VkFormat format, uint32_t size, uint32_t mipLevels,
+  VkImage& image, Allocation& memory, VkImageView& view)
+{
+  VkImageCreateInfo imageInfo = {};
+  imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  imageInfo.imageType = VK_IMAGE_TYPE_2D;
+  imageInfo.extent = {size, size, 1};
+  imageInfo.mipLevels = mipLevels;
+  imageInfo.arrayLayers = 1;
+  imageInfo.format = format;
+  imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+  imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+  imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create virtual texture image!" << std::endl;
+    throw std::runtime_error("Failed to create virtual texture image!");
+  }
+
+  VkMemoryRequirements memRequirements;
+  vkGetImageMemoryRequirements(device, image, &memRequirements);
+  memory = allocator.allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ResourceLayout::Optimal);
+  vkBindImageMemory(device, image, memory.memory, memory.offset);
+
+  VkImageViewCreateInfo viewInfo = {};
+  viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  viewInfo.image = image;
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.format = format;
+  viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  viewInfo.subresourceRange.baseMipLevel = 0;
+  viewInfo.subresourceRange.levelCount = mipLevels;
+  viewInfo.subresourceRange.baseArrayLayer = 0;
+  viewInfo.subresourceRange.layerCount = 1;
+
+  if (vkCreateImageView(device, &viewInfo, nullptr, &view) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create virtual texture view!" << std::endl;
+    throw std::runtime_error("Failed to create virtual texture view!");
+  }
+}
+
+static VkSampler createSampler(VkDevice device, VkFilter filter)
+{
+  VkSamplerCreateInfo samplerInfo = {};
+  samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  samplerInfo.magFilter = filter;
+  samplerInfo.minFilter = filter;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.minLod = 0.0f;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+  VkSampler sampler;
+  if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+  {
+    std::cerr << "ERROR: Failed to create virtual texture sampler!" << std::endl;
+    throw std::runtime_error("Failed to create virtual texture sampler!");
+  }
+  return sampler;
+}
+
+void VirtualTexture::init(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+  const std::string& sourcePath, MipFilter filter, uint32_t framesInFlight, unsigned threadCount)
+{
+  this->device = device;
+  this->allocator = &allocator;
+
+  MappedFile source;
+  if (!source.open(sourcePath, FileAccess::Sequential))
+  {
+    std::cerr << "ERROR: Failed to open virtual texture source! " << sourcePath << std::endl;
+    throw std::runtime_error("Failed to open virtual texture source!");
+  }
+
+  const uint64_t sourceHash = xxhash64(source.data(), source.size());
+  const std::string path = sourcePath.substr(0, sourcePath.rfind('.')) + ".rgbvt";
+  if (!openPageFile(path, source.size(), sourceHash))
+  {
+    buildPageFile(path, source, sourceHash, filter, threadCount);
+    if (!openPageFile(path, source.size(), sourceHash))
+    {
+      std::cerr << "ERROR: Failed to open virtual texture pages " << path << std::endl;
+      throw std::runtime_error("Failed to open virtual texture pages!");
+    }
+  }
+  source.close();
+
+  levelFirstPage.assign(1, 0);
+  for (uint32_t level = 0; level < levelCount; level++)
+  {
+    const uint32_t side = pagesPerSide >> level;
+    levelFirstPage.push_back(levelFirstPage.back() + side * side);
+  }
+  const uint32_t pageCount = levelFirstPage.back();
+
+  createResources(physicalDevice, framesInFlight);
+
+  // The coarsest page is pinned to slot 0 and everything falls back to it
+  // until finer pages arrive; update() uploads it with the first frame
+  slots.assign(static_cast<size_t>(atlasTiles) * atlasTiles, {NO_PAGE, 0});
+  pageSlots.assign(pageCount, 0);
+  pageRequested.assign(pageCount, 0);
+  const uint32_t coarsestPage = getPageId(levelCount - 1, 0, 0);
+  slots[0] = {coarsestPage, std::numeric_limits<uint64_t>::max()};
+  pageSlots[coarsestPage] = 1;
+
+  pageTableLevels.resize(levelCount);
+  dirtyRects.resize(levelCount);
+  for (uint32_t level = 0; level < levelCount; level++)
+  {
+    const uint32_t side = pagesPerSide >> level;
+    pageTableLevels[level].assign(static_cast<size_t>(side) * side, packEntry(0, 0, levelCount - 1));
+    dirtyRects[level] = {0, 0, side - 1, side - 1};
+  }
+  initialized = false;
+
+  std::cerr << "INFO: Virtual texture " << width << "x" << height << ", " << levelCount << " levels of up to "
+    << pagesPerSide << "x" << pagesPerSide << " pages, atlas of " << atlasTiles * atlasTiles << " pages ("
+    << atlasMemory.size << " bytes of device memory)" << std::endl;
+}
+
+void VirtualTexture::destroy()
+{
+  if (device == VK_NULL_HANDLE)
+  {
+    return;
+  }
+
+  vkDestroySampler(device, atlasSampler, nullptr);
+  vkDestroyImageView(device, atlasView, nullptr);
+  vkDestroyImage(device, atlas, nullptr);
+  allocator->free(atlasMemory);
+
+  vkDestroySampler(device, pageTableSampler, nullptr);
+  vkDestroyImageView(device, pageTableView, nullptr);
+  vkDestroyImage(device, pageTable, nullptr);
+  allocator->free(pageTableMemory);
+
+  for (size_t i = 0; i < feedbackBuffers.size(); i++)
+  {
+    vkDestroyBuffer(device, feedbackBuffers[i], nullptr);
+    allocator->free(feedbackMemory[i]);
+    vkDestroyBuffer(device, stagingBuffers[i], nullptr);
+    allocator->free(stagingMemory[i]);
+  }
+  feedbackBuffers.clear();
+  feedbackMemory.clear();
+  stagingBuffers.clear();
+  stagingMemory.clear();
+
+  pageFile.close();
+  device = VK_NULL_HANDLE;
+}
+
+bool VirtualTexture::openPageFile(const std::string& path, uint64_t sourceSize, uint64_t sourceHash)
+{
+  if (!pageFile.open(path, FileAccess::Random))
+  {
+    return false;
+  }
+
+  VirtualTextureHeader header;
+  if (pageFile.size() < sizeof(header))
+  {
+    std::cerr << "WARNING: Virtual texture pages " << path << " are truncated" << std::endl;
+    pageFile.close();
+    return false;
+  }
+  memcpy(&header, pageFile.data(), sizeof(header));
+
+  if (header.magic != VIRTUAL_TEXTURE_MAGIC || header.version != VIRTUAL_TEXTURE_VERSION)
+  {
+    std::cerr << "INFO: Virtual texture pages " << path << " have an old format, rebuilding" << std::endl;
+    pageFile.close();
+    return false;
+  }
+
+  if (header.sourceSize != sourceSize || header.sourceHash != sourceHash)
+  {
+    std::cerr << "INFO: Virtual texture pages " << path << " are out of date, rebuilding" << std::endl;
+    pageFile.close();
+    return false;
+  }
+
+  const uint64_t tableEnd = sizeof(header) + static_cast<uint64_t>(header.levelCount) * sizeof(VirtualTextureLevel);
+  if (header.levelCount == 0 || header.pagesPerSide != 1u << (header.levelCount - 1) || tableEnd > pageFile.size())
+  {
+    std::cerr << "WARNING: Virtual texture pages " << path << " are malformed" << std::endl;
+    pageFile.close();
+    return false;
+  }
+
+  levels.resize(header.levelCount);
+  memcpy(levels.data(), pageFile.data() + sizeof(header), levels.size() * sizeof(VirtualTextureLevel));
+  for (uint32_t level = 0; level < header.levelCount; level++)
+  {
+    const VirtualTextureLevel& entry = levels[level];
+    const uint64_t size = static_cast<uint64_t>(entry.pagesX) * entry.pagesY * TILE_BYTES;
+    if (entry.pagesX == 0 || entry.pagesY == 0 || entry.pagesX > header.pagesPerSide >> level || entry.pagesY > header.pagesPerSide >> level
+      || entry.offset < tableEnd || entry.offset > pageFile.size() || size > pageFile.size() - entry.offset)
+    {
+      std::cerr << "WARNING: Virtual texture pages " << path << " are malformed" << std::endl;
+      pageFile.close();
+      return false;
+    }
+  }
+
+  width = header.width;
+  height = header.height;
+  pagesPerSide = header.pagesPerSide;
+  levelCount = header.levelCount;
+  return true;
+}
+
+// Cuts every level of the source into bordered tiles. Levels are filtered
+// one after the other, so only two of them are in memory at a time.
+void VirtualTexture::buildPageFile(const std::string& path, const MappedFile& source, uint64_t sourceHash,
+  MipFilter filter, unsigned threadCount)
+{
+  auto buildStart = BenchmarkClock::now();
+
+  // stb_image takes the encoded size as an int and decodes the whole image
+  // at once, which it refuses beyond INT_MAX bytes of pixels
+  const uint64_t maxDecodeBytes = static_cast<uint64_t>(std::numeric_limits<int>::max());
+  if (source.size() > maxDecodeBytes)
+  {
+    std::cerr << "ERROR: Virtual texture source of " << source.size() << " bytes is larger than the "
+      << maxDecodeBytes << " bytes stb_image can decode!" << std::endl;
+    throw std::runtime_error("Virtual texture source is too large!");
+  }
+
+  int texWidth, texHeight, texChannels;
+  if (!stbi_info_from_memory(source.data(), static_cast<int>(source.size()), &texWidth, &texHeight, &texChannels))
+  {
+    std::cerr << "ERROR: Failed to load virtual texture source!" << std::endl;
+    throw std::runtime_error("Failed to load virtual texture source!");
+  }
+  if (static_cast<uint64_t>(texWidth) * static_cast<uint64_t>(texHeight) * 4 > maxDecodeBytes)
+  {
+    std::cerr << "ERROR: Virtual texture source of " << texWidth << "x" << texHeight << " decodes to more than the "
+      << maxDecodeBytes << " bytes stb_image can decode!" << std::endl;
+    throw std::runtime_error("Virtual texture source is too large!");
+  }
+
+  stbi_uc* pixels = stbi_load_from_memory(source.data(), static_cast<int>(source.size()), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+  if (!pixels)
+  {
+    std::cerr << "ERROR: Failed to load virtual texture source!" << std::endl;
+    throw std::runtime_error("Failed to load virtual texture source!");
+  }
+
+  VirtualTextureHeader header = {};
+  header.magic = VIRTUAL_TEXTURE_MAGIC;
+  header.version = VIRTUAL_TEXTURE_VERSION;
+  header.sourceSize = source.size();
+  header.sourceHash = sourceHash;
+  header.width = static_cast<uint32_t>(texWidth);
+  header.height = static_cast<uint32_t>(texHeight);
+  header.pagesPerSide = 1;
+  header.levelCount = 1;
+  while (header.pagesPerSide * PAGE_SIZE < std::max(header.width, header.height))
+  {
+    header.pagesPerSide *= 2;
+    header.levelCount++;
+  }
+
+  if (header.pagesPerSide > MAX_PAGES_PER_SIDE)
+  {
+    stbi_image_free(pixels);
+    std::cerr << "ERROR: Virtual texture of " << texWidth << "x" << texHeight << " needs more than "
+      << MAX_PAGES_PER_SIDE << " pages per side!" << std::endl;
+    throw std::runtime_error("Virtual texture is too large!");
+  }
+
+  std::vector<VirtualTextureLevel> table(header.levelCount);
+  uint64_t offset = alignUp(sizeof(header) + table.size() * sizeof(VirtualTextureLevel), PAGE_FILE_ALIGNMENT);
+  for (uint32_t level = 0; level < header.levelCount; level++)
+  {
+    const uint32_t levelWidth = std::max(1u, header.width >> level);
+    const uint32_t levelHeight = std::max(1u, header.height >> level);
+    table[level].pagesX = (levelWidth + PAGE_SIZE - 1) / PAGE_SIZE;
+    table[level].pagesY = (levelHeight + PAGE_SIZE - 1) / PAGE_SIZE;
+    table[level].offset = offset;
+    offset += static_cast<uint64_t>(table[level].pagesX) * table[level].pagesY * TILE_BYTES;
+  }
+
+  const std::string temporaryPath = path + ".tmp";
+  {
+    std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+    {
+      stbi_image_free(pixels);
+      std::cerr << "ERROR: Failed to create virtual texture pages " << temporaryPath << std::endl;
+      throw std::runtime_error("Failed to create virtual texture pages!");
+    }
+
+    static const char padding[PAGE_FILE_ALIGNMENT] = {};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(table.data()), static_cast<std::streamsize>(table.size() * sizeof(VirtualTextureLevel)));
+    out.write(padding, static_cast<std::streamsize>(table[0].offset - sizeof(header) - table.size() * sizeof(VirtualTextureLevel)));
+
+    std::vector<uint8_t> current;
+    std::vector<uint8_t> next;
+    const uint8_t* levelPixels = pixels;
+    std::vector<uint8_t> tileRow(static_cast<size_t>(table[0].pagesX) * TILE_BYTES);
+
+    for (uint32_t level = 0; level < header.levelCount; level++)
+    {
+      const uint32_t levelWidth = std::max(1u, header.width >> level);
+      const uint32_t levelHeight = std::max(1u, header.height >> level);
+
+      // Border texels outside the image repeat its edge
+      for (uint32_t pageY = 0; pageY < table[level].pagesY; pageY++)
+      {
+        for (uint32_t pageX = 0; pageX < table[level].pagesX; pageX++)
+        {
+          uint8_t* tile = tileRow.data() + pageX * TILE_BYTES;
+          for (uint32_t y = 0; y < TILE_SIZE; y++)
+          {
+            const int64_t sourceY = std::clamp<int64_t>(static_cast<int64_t>(pageY) * PAGE_SIZE + y - PAGE_BORDER, 0, levelHeight - 1);
+            const uint8_t* row = levelPixels + static_cast<size_t>(sourceY) * levelWidth * 4;
+            for (uint32_t x = 0; x < TILE_SIZE; x++)
+            {
+              const int64_t sourceX = std::clamp<int64_t>(static_cast<int64_t>(pageX) * PAGE_SIZE + x - PAGE_BORDER, 0, levelWidth - 1);
+              memcpy(tile + (static_cast<size_t>(y) * TILE_SIZE + x) * 4, row + sourceX * 4, 4);
+            }
+          }
+        }
+        out.write(reinterpret_cast<const char*>(tileRow.data()), static_cast<std::streamsize>(table[level].pagesX * TILE_BYTES));
+      }
+
+      if (level + 1 < header.levelCount)
+      {
+        next.resize(static_cast<size_t>(std::max(1u, levelWidth / 2)) * std::max(1u, levelHeight / 2) * 4);
+        buildMipLevel(levelPixels, levelWidth, levelHeight, filter, next.data(), threadCount);
+        current.swap(next);
+        levelPixels = current.data();
+        if (level == 0)
+        {
+          stbi_image_free(pixels);
+          pixels = nullptr;
+        }
+      }
+    }
+
+    if (pixels != nullptr)
+    {
+      stbi_image_free(pixels);
+    }
+
+    if (!out)
+    {
+      std::cerr << "ERROR: Failed to write virtual texture pages " << temporaryPath << std::endl;
+      throw std::runtime_error("Failed to write virtual texture pages!");
+    }
+  }
+
+  std::error_code error;
+  std::filesystem::rename(temporaryPath, path, error);
+  if (error)
+  {
+    std::filesystem::remove(temporaryPath, error);
+    std::cerr << "ERROR: Failed to replace virtual texture pages " << path << ": " << error.message() << std::endl;
+    throw std::runtime_error("Failed to replace virtual texture pages!");
+  }
+
+  std::cerr << "INFO: Built " << offset / TILE_BYTES << " virtual texture pages of " << texWidth << "x" << texHeight
+    << " into " << path << " in " << elapsedMilliseconds(buildStart, BenchmarkClock::now()) << " ms" << std::endl;
+}
+
+void VirtualTexture::createResources(VkPhysicalDevice physicalDevice, uint32_t framesInFlight)
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  const uint32_t maxTiles = properties.limits.maxImageDimension2D / TILE_SIZE;
+  atlasTiles = maxTiles < ATLAS_TILES ? maxTiles : ATLAS_TILES;
+  if (pagesPerSide > properties.limits.maxImageDimension2D)
+  {
+    std::cerr << "ERROR: Virtual texture page table of " << pagesPerSide << "x" << pagesPerSide << " is too large!" << std::endl;
+    throw std::runtime_error("Virtual texture page table is too large!");
+  }
+
+  createImage(device, *allocator, VK_FORMAT_R8G8B8A8_UNORM, atlasTiles * TILE_SIZE, 1, atlas, atlasMemory, atlasView);
+  createImage(device, *allocator, VK_FORMAT_R8G8B8A8_UINT, pagesPerSide, levelCount, pageTable, pageTableMemory, pageTableView);
+  // Pages carry their own borders, so bilinear filtering never reads a neighbouring tile
+  atlasSampler = createSampler(device, VK_FILTER_LINEAR);
+  pageTableSampler = createSampler(device, VK_FILTER_NEAREST);
+
+  // One bit per page of every level
+  feedbackSize = (levelFirstPage.back() + 31) / 32 * sizeof(uint32_t);
+
+  VkDeviceSize pageTableBytes = 0;
+  for (uint32_t level = 0; level < levelCount; level++)
+  {
+    pageTableBytes += static_cast<VkDeviceSize>(pagesPerSide >> level) * (pagesPerSide >> level) * 4;
+  }
+
+  feedbackBuffers.resize(framesInFlight);
+  feedbackMemory.resize(framesInFlight);
+  stagingBuffers.resize(framesInFlight);
+  stagingMemory.resize(framesInFlight);
+  for (uint32_t i = 0; i < framesInFlight; i++)
+  {
+    createBuffer(device, *allocator, feedbackSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, feedbackBuffers[i], feedbackMemory[i]);
+    memset(feedbackMemory[i].mapped, 0, static_cast<size_t>(feedbackSize));
+    createBuffer(device, *allocator, MAX_PAGE_UPLOADS * TILE_BYTES + pageTableBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      stagingBuffers[i], stagingMemory[i]);
+  }
+}
+
+void VirtualTexture::update(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameNumber)
+{
+  // Pages the fragment shaders of this slot's previous frame asked for
+  missingPages.clear();
+  uint32_t* feedback = static_cast<uint32_t*>(feedbackMemory[frame].mapped);
+  const size_t wordCount = static_cast<size_t>(feedbackSize / sizeof(uint32_t));
+  for (size_t word = 0; word < wordCount; word++)
+  {
+    const uint32_t bits = feedback[word];
+    if (bits == 0)
+    {
+      continue;
+    }
+    feedback[word] = 0;
+    for (uint32_t bit = 0; bit < 32; bit++)
+    {
+      if (bits & (1u << bit))
+      {
+        requestPage(static_cast<uint32_t>(word * 32 + bit), frameNumber);
+      }
+    }
+  }
+
+  // Coarser levels have higher ids and go first, so that a region that
+  // comes into view gets a blurry version quickly
+  std::sort(missingPages.begin(), missingPages.end(), std::greater<uint32_t>());
+
+  uint8_t* staging = static_cast<uint8_t*>(stagingMemory[frame].mapped);
+  std::vector<VkBufferImageCopy> tileCopies;
+  auto copyTile = [&](uint32_t page, uint32_t slot)
+  {
+    const uint8_t* tile = pageFile.data() + getTileOffset(page);
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = tileCopies.size() * TILE_BYTES;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {static_cast<int32_t>(slot % atlasTiles * TILE_SIZE), static_cast<int32_t>(slot / atlasTiles * TILE_SIZE), 0};
+    region.imageExtent = {TILE_SIZE, TILE_SIZE, 1};
+
+    memcpy(staging + region.bufferOffset, tile, static_cast<size_t>(TILE_BYTES));
+    tileCopies.push_back(region);
+    uploadedPages++;
+  };
+
+  // init() already made the pinned coarsest page resident in slot 0, only
+  // its texels are missing
+  if (!initialized)
+  {
+    copyTile(slots[0].page, 0);
+  }
+  for (size_t i = 0; i < missingPages.size(); i++)
+  {
+    uint32_t slot = tileCopies.size() < MAX_PAGE_UPLOADS ? acquireSlot(frameNumber) : NO_PAGE;
+    if (slot == NO_PAGE)
+    {
+      if (tileCopies.size() < MAX_PAGE_UPLOADS && !atlasFullReported)
+      {
+        std::cerr << "WARNING: The virtual texture atlas cannot hold every page in view, some stay blurry" << std::endl;
+        atlasFullReported = true;
+      }
+      deferredPages += missingPages.size() - i;
+
+      // The next frame will likely ask for the same pages, have them read
+      // from disk by then instead of faulting them in during the copy
+      for (size_t j = i; j < std::min<size_t>(missingPages.size(), i + MAX_PAGE_UPLOADS); j++)
+      {
+        pageFile.prefetch(static_cast<size_t>(getTileOffset(missingPages[j])), static_cast<size_t>(TILE_BYTES));
+      }
+      break;
+    }
+    const uint32_t page = missingPages[i];
+    copyTile(page, slot);
+
+    const uint32_t level = getPageLevel(page);
+    const uint32_t side = pagesPerSide >> level;
+    slots[slot] = {page, frameNumber};
+    pageSlots[page] = slot + 1;
+    refreshPageTable(level, (page - levelFirstPage[level]) % side, (page - levelFirstPage[level]) / side);
+  }
+
+  // Dirty page table regions go after the tiles in the staging buffer
+  std::vector<VkBufferImageCopy> tableCopies;
+  VkDeviceSize stagingOffset = MAX_PAGE_UPLOADS * TILE_BYTES;
+  for (uint32_t level = 0; level < levelCount; level++)
+  {
+    DirtyRect& rect = dirtyRects[level];
+    if (rect.minX > rect.maxX)
+    {
+      continue;
+    }
+
+    const uint32_t side = pagesPerSide >> level;
+    const uint32_t rectWidth = rect.maxX - rect.minX + 1;
+    const uint32_t rectHeight = rect.maxY - rect.minY + 1;
+    for (uint32_t y = 0; y < rectHeight; y++)
+    {
+      memcpy(staging + stagingOffset + static_cast<size_t>(y) * rectWidth * 4,
+        &pageTableLevels[level][static_cast<size_t>(rect.minY + y) * side + rect.minX], static_cast<size_t>(rectWidth) * 4);
+    }
+
+    VkBufferImageCopy region = {};
+    region.bufferOffset = stagingOffset;
+    region.bufferRowLength = rectWidth;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = level;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = {static_cast<int32_t>(rect.minX), static_cast<int32_t>(rect.minY), 0};
+    region.imageExtent = {rectWidth, rectHeight, 1};
+    tableCopies.push_back(region);
+
+    stagingOffset += static_cast<VkDeviceSize>(rectWidth) * rectHeight * 4;
+    rect = {1, 1, 0, 0};
+  }
+
+  if (tileCopies.empty() && tableCopies.empty())
+  {
+    return;
+  }
+
+  // Earlier frames sampling the atlas and page table are in the first
+  // scope, since they were submitted to the same queue before this one
+  std::array<VkImageMemoryBarrier, 2> barriers = {};
+  for (size_t i = 0; i < barriers.size(); i++)
+  {
+    barriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[i].oldLayout = initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[i].image = i == 0 ? atlas : pageTable;
+    barriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barriers[i].subresourceRange.baseMipLevel = 0;
+    barriers[i].subresourceRange.levelCount = i == 0 ? 1 : levelCount;
+    barriers[i].subresourceRange.baseArrayLayer = 0;
+    barriers[i].subresourceRange.layerCount = 1;
+    barriers[i].srcAccessMask = 0;
+    barriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  }
+  vkCmdPipelineBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+    0, nullptr,
+    0, nullptr,
+    static_cast<uint32_t>(barriers.size()), barriers.data());
+
+  if (!tileCopies.empty())
+  {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffers[frame], atlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      static_cast<uint32_t>(tileCopies.size()), tileCopies.data());
+  }
+  if (!tableCopies.empty())
+  {
+    vkCmdCopyBufferToImage(commandBuffer, stagingBuffers[frame], pageTable, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      static_cast<uint32_t>(tableCopies.size()), tableCopies.data());
+  }
+
+  for (auto& barrier : barriers)
+  {
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  }
+  vkCmdPipelineBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+    0, nullptr,
+    0, nullptr,
+    static_cast<uint32_t>(barriers.size()), barriers.data());
+
+  initialized = true;
+}
+
+void VirtualTexture::recordFeedbackBarrier(VkCommandBuffer commandBuffer)
+{
+  VkMemoryBarrier barrier = {};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+  vkCmdPipelineBarrier(commandBuffer,
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+    1, &barrier,
+    0, nullptr,
+    0, nullptr);
+}
+
+void VirtualTexture::printStatistics() const
+{
+  uint32_t residentPages = 0;
+  for (const Slot& slot : slots)
+  {
+    residentPages += slot.page != NO_PAGE ? 1 : 0;
+  }
+
+  std::cerr << "INFO: Virtual texture: " << residentPages << " of " << slots.size() << " atlas pages resident, "
+    << uploadedPages << " uploaded, " << evictedPages << " evicted, " << deferredPages << " requests deferred" << std::endl;
+}
+
+uint32_t VirtualTexture::getPageId(uint32_t level, uint32_t x, uint32_t y) const
+{
+  return levelFirstPage[level] + y * (pagesPerSide >> level) + x;
+}
+
+uint32_t VirtualTexture::getPageLevel(uint32_t page) const
+{
+  uint32_t level = 0;
+  while (page >= levelFirstPage[level + 1])
+  {
+    level++;
+  }
+  return level;
+}
+
+uint64_t VirtualTexture::getTileOffset(uint32_t page) const
+{
+  const uint32_t level = getPageLevel(page);
+  const uint32_t side = pagesPerSide >> level;
+  const uint32_t x = (page - levelFirstPage[level]) % side;
+  const uint32_t y = (page - levelFirstPage[level]) / side;
+  return levels[level].offset + (static_cast<uint64_t>(y) * levels[level].pagesX + x) * TILE_BYTES;
+}
+
+bool VirtualTexture::isStored(uint32_t level, uint32_t x, uint32_t y) const
+{
+  return x < levels[level].pagesX && y < levels[level].pagesY;
+}
+
+void VirtualTexture::requestPage(uint32_t page, uint64_t frameNumber)
+{
+  if (page >= levelFirstPage.back())
+  {
+    return;
+  }
+
+  uint32_t level = getPageLevel(page);
+  const uint32_t side = pagesPerSide >> level;
+  uint32_t x = (page - levelFirstPage[level]) % side;
+  uint32_t y = (page - levelFirstPage[level]) / side;
+
+  // Ancestors are kept resident as long as any of their descendants is
+  // wanted, they are what the page table falls back to
+  for (;;)
+  {
+    if (pageRequested[page] == frameNumber)
+    {
+      return;
+    }
+    pageRequested[page] = frameNumber;
+
+    if (isStored(level, x, y))
+    {
+      if (pageSlots[page] != 0)
+      {
+        Slot& slot = slots[pageSlots[page] - 1];
+        slot.lastUsed = std::max(slot.lastUsed, frameNumber);
+      }
+      else
+      {
+        missingPages.push_back(page);
+      }
+    }
+
+    if (level + 1 >= levelCount)
+    {
+      return;
+    }
+    level++;
+    x /= 2;
+    y /= 2;
+    page = getPageId(level, x, y);
+  }
+}
+
+uint32_t VirtualTexture::acquireSlot(uint64_t frameNumber)
+{
+  uint32_t oldest = NO_PAGE;
+  for (uint32_t i = 0; i < slots.size(); i++)
+  {
+    if (slots[i].lastUsed < frameNumber && (oldest == NO_PAGE || slots[i].lastUsed < slots[oldest].lastUsed))
+    {
+      oldest = i;
+    }
+  }
+
+  if (oldest != NO_PAGE && slots[oldest].page != NO_PAGE)
+  {
+    const uint32_t page = slots[oldest].page;
+    const uint32_t level = getPageLevel(page);
+    const uint32_t side = pagesPerSide >> level;
+    pageSlots[page] = 0;
+    slots[oldest].page = NO_PAGE;
+    refreshPageTable(level, (page - levelFirstPage[level]) % side, (page - levelFirstPage[level]) / side);
+    evictedPages++;
+  }
+  return oldest;
+}
+
+void VirtualTexture::refreshPageTable(uint32_t level, uint32_t x, uint32_t y)
+{
+  // Walks down from the page, so every parent entry is final before its
+  // children inherit it
+  for (uint32_t k = level + 1; k-- > 0;)
+  {
+    const uint32_t shift = level - k;
+    const uint32_t side = pagesPerSide >> k;
+    const uint32_t minX = x << shift;
+    const uint32_t minY = y << shift;
+    const uint32_t maxX = std::min(minX + (1u << shift), side) - 1;
+    const uint32_t maxY = std::min(minY + (1u << shift), side) - 1;
+
+    for (uint32_t j = minY; j <= maxY; j++)
+    {
+      for (uint32_t i = minX; i <= maxX; i++)
+      {
+        const uint32_t slot = pageSlots[getPageId(k, i, j)];
+        uint32_t entry;
+        if (slot != 0)
+        {
+          entry = packEntry((slot - 1) % atlasTiles, (slot - 1) / atlasTiles, k);
+        }
+        else
+        {
+          // The coarsest page is pinned, so only finer levels get here
+          entry = pageTableLevels[k + 1][static_cast<size_t>(j / 2) * (side / 2) + i / 2];
+        }
+        pageTableLevels[k][static_cast<size_t>(j) * side + i] = entry;
+      }
+    }
+
+    DirtyRect& rect = dirtyRects[k];
+    if (rect.minX > rect.maxX)
+    {
+      rect = {minX, minY, maxX, maxY};
+    }
+    else
+    {
+      rect = {std::min(rect.minX, minX), std::min(rect.minY, minY), std::max(rect.maxX, maxX), std::max(rect.maxY, maxY)};
+    }
+  }
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "mapped_file.h"
+#include "memory_allocator.h"
+#include "mip_builder.h"
+
+// Software virtual texturing for images too large to keep in device memory.
+// Needs no sparse residency, so it also runs on software implementations.
+//
+// The source image is padded to a square power of two, the virtual
+// texture, whose levels are cut into pages of PAGE_SIZE texels. Every page
+// is stored with a border of PAGE_BORDER texels from its neighbours in a
+// page file next to the source:
+//
+//   VirtualTextureHeader
+//   VirtualTextureLevel[levelCount]
+//   pages, level 0 first, row by row, each TILE_SIZE x TILE_SIZE RGBA8
+//
+// Only the pages that cover the image are stored. The page file records
+// the size and hash of the source it was built from and is rebuilt when
+// either changes. Building it decodes the whole source with stb_image,
+// which limits sources to 2 GB and 2 GB of RGBA8 pixels, about 23K x 23K
+// texels; the page table itself would allow up to 256K x 256K.
+//
+// On the GPU a fixed atlas of tiles holds the resident pages, and a page
+// table with one texel per page and level points at the finest resident
+// page covering it. The single page of the coarsest level is always
+// resident, so every lookup finds something. The fragment shader sets a
+// bit in the frame's feedback buffer for every page it wanted. Once the
+// frame has completed, update() marks those pages used, uploads the missing
+// ones coarsest first and evicts the least recently used pages to make
+// room. Uploads and page table updates are recorded into the frame's own
+// command buffer, so they are ordered after the earlier frames that read
+// the atlas.
+
+const uint32_t VIRTUAL_TEXTURE_MAGIC = 0x54564752; // "RGVT"
+const uint32_t VIRTUAL_TEXTURE_VERSION = 1;
+
+struct VirtualTextureHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t sourceSize;
+  uint64_t sourceHash;
+  uint32_t width;
+  uint32_t height;
+  // The virtual texture's size in pages at level 0
+  uint32_t pagesPerSide;
+  uint32_t levelCount;
+};
+
+struct VirtualTextureLevel
+{
+  // Stored pages, the ones that cover the image
+  uint32_t pagesX;
+  uint32_t pagesY;
+  uint64_t offset;
+};
+
+class VirtualTexture
+{
+public:
+  // Match virtual.frag
+  static const uint32_t PAGE_SIZE = 128;
+  static const uint32_t PAGE_BORDER = 4;
+  static const uint32_t TILE_SIZE = PAGE_SIZE + 2 * PAGE_BORDER;
+  // Tiles per side of the atlas, fewer if the device limits images to less
+  static const uint32_t ATLAS_TILES = 32;
+  // Bounds the time update() spends copying pages, and the staging memory
+  static const uint32_t MAX_PAGE_UPLOADS = 16;
+  // Keeps the level 0 page table at 16 MB, enough for a 256K x 256K image
+  static const uint32_t MAX_PAGES_PER_SIDE = 2048;
+
+  // Opens the page file next to sourcePath, building it first with filter
+  // if it is missing or stale, and creates the atlas, page table and
+  // feedback buffers
+  void init(VkPhysicalDevice physicalDevice, VkDevice device, MemoryAllocator& allocator,
+    const std::string& sourcePath, MipFilter filter, uint32_t framesInFlight, unsigned threadCount);
+  void destroy();
+
+  // Reads the feedback the frame slot's previous frame left, which must have
+  // completed, and records the page uploads it asks for. Must be recorded
+  // outside a render pass, before the draws that sample the atlas.
+  void update(VkCommandBuffer commandBuffer, uint32_t frame, uint64_t frameNumber);
+
+  // Makes the feedback written by the frame's fragment shaders visible to
+  // the host, recorded after the render pass
+  void recordFeedbackBarrier(VkCommandBuffer commandBuffer);
+
+  VkImageView getAtlasView() const { return atlasView; }
+  VkSampler getAtlasSampler() const { return atlasSampler; }
+  VkImageView getPageTableView() const { return pageTableView; }
+  VkSampler getPageTableSampler() const { return pageTableSampler; }
+  VkBuffer getFeedbackBuffer(uint32_t frame) const { return feedbackBuffers[frame]; }
+  VkDeviceSize getFeedbackSize() const { return feedbackSize; }
+
+  // Share of the virtual texture the image covers, in texture coordinates
+  float getScaleX() const { return static_cast<float>(width) / (pagesPerSide * PAGE_SIZE); }
+  float getScaleY() const { return static_cast<float>(height) / (pagesPerSide * PAGE_SIZE); }
+  uint32_t getPagesPerSide() const { return pagesPerSide; }
+  uint32_t getLevelCount() const { return levelCount; }
+
+  void printStatistics() const;
+
+private:
+  static const uint32_t NO_PAGE = ~0u;
+
+  struct Slot
+  {
+    uint32_t page;
+    uint64_t lastUsed;
+  };
+
+  // Dirty region of one page table level, empty if minX > maxX
+  struct DirtyRect
+  {
+    uint32_t minX;
+    uint32_t minY;
+    uint32_t maxX;
+    uint32_t maxY;
+  };
+
+  bool openPageFile(const std::string& path, uint64_t sourceSize, uint64_t sourceHash);
+  void buildPageFile(const std::string& path, const MappedFile& source, uint64_t sourceHash,
+    MipFilter filter, unsigned threadCount);
+  void createResources(VkPhysicalDevice physicalDevice, uint32_t framesInFlight);
+
+  uint32_t getPageId(uint32_t level, uint32_t x, uint32_t y) const;
+  uint32_t getPageLevel(uint32_t page) const;
+  bool isStored(uint32_t level, uint32_t x, uint32_t y) const;
+  // Offset of a stored page's tile in the page file
+  uint64_t getTileOffset(uint32_t page) const;
+  // Marks the page and its ancestors used by this frame and queues the
+  // ones that are not resident
+  void requestPage(uint32_t page, uint64_t frameNumber);
+  // Finds a slot whose page was not used this frame, evicting its page.
+  // Returns NO_PAGE if every slot is in use.
+  uint32_t acquireSlot(uint64_t frameNumber);
+  // Rewrites the entries of a page and every finer page it covers
+  void refreshPageTable(uint32_t level, uint32_t x, uint32_t y);
+
+  VkDevice device = VK_NULL_HANDLE;
+  MemoryAllocator* allocator = nullptr;
+
+  MappedFile pageFile;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t pagesPerSide = 0;
+  uint32_t levelCount = 0;
+  std::vector<VirtualTextureLevel> levels;
+  // Id of the first page of every level, followed by the total page count
+  std::vector<uint32_t> levelFirstPage;
+
+  uint32_t atlasTiles = 0;
+  VkImage atlas = VK_NULL_HANDLE;
+  Allocation atlasMemory;
+  VkImageView atlasView = VK_NULL_HANDLE;
+  VkSampler atlasSampler = VK_NULL_HANDLE;
+
+  VkImage pageTable = VK_NULL_HANDLE;
+  Allocation pageTableMemory;
+  VkImageView pageTableView = VK_NULL_HANDLE;
+  VkSampler pageTableSampler = VK_NULL_HANDLE;
+
+  VkDeviceSize feedbackSize = 0;
+  std::vector<VkBuffer> feedbackBuffers;
+  std::vector<Allocation> feedbackMemory;
+  // Per frame in flight, room for MAX_PAGE_UPLOADS tiles and the whole page table
+  std::vector<VkBuffer> stagingBuffers;
+  std::vector<Allocation> stagingMemory;
+
+  // Per page: atlas slot + 1, 0 if not resident
+  std::vector<uint32_t> pageSlots;
+  // Per page: last frame that requested it, so each page is handled once per frame
+  std::vector<uint64_t> pageRequested;
+  std::vector<Slot> slots;
+  // Per level, one RGBA8 texel per page: atlas x and y and level of the
+  // finest resident page covering it
+  std::vector<std::vector<uint32_t>> pageTableLevels;
+  std::vector<DirtyRect> dirtyRects;
+  std::vector<uint32_t> missingPages;
+  bool initialized = false;
+
+  uint64_t uploadedPages = 0;
+  uint64_t evictedPages = 0;
+  uint64_t deferredPages = 0;
+  bool atlasFullReported = false;
+};
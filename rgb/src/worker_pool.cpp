@@ -0,0 +1,114 @@
+#include "worker_pool.h"
+
+#include <algorithm>
+
+WorkerPool::~WorkerPool()
+{
+  stop();
+}
+
+void WorkerPool::start(unsigned threadCount)
+{
+  stop();
+
+  stopping = false;
+  for (unsigned t = 1; t < std::max(1u, threadCount); ++t)
+  {
+    workers.emplace_back(&WorkerPool::workerMain, this, t, generation);
+  }
+}
+
+void WorkerPool::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for (auto& worker : workers)
+  {
+    worker.join();
+  }
+  workers.clear();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t, unsigned)>& task)
+{
+  if (workers.empty() || count <= 1)
+  {
+    for (size_t i = 0; i < count; ++i)
+    {
+      task(i, 0);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    currentTask = &task;
+    taskCount = count;
+    nextTask.store(0, std::memory_order_relaxed);
+    busyWorkers = static_cast<unsigned>(workers.size());
+    ++generation;
+  }
+  wake.notify_all();
+
+  runTasks(0);
+
+  // The task is owned by the caller, so every worker has to be done with it
+  // before returning, not just every task
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this]() { return busyWorkers == 0; });
+  currentTask = nullptr;
+
+  if (firstError)
+  {
+    std::exception_ptr error = firstError;
+    firstError = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+void WorkerPool::workerMain(unsigned threadIndex, uint64_t seenGeneration)
+{
+  for (;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this, seenGeneration]() { return stopping || generation != seenGeneration; });
+      if (stopping)
+      {
+        return;
+      }
+      seenGeneration = generation;
+    }
+
+    runTasks(threadIndex);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      --busyWorkers;
+    }
+    done.notify_one();
+  }
+}
+
+void WorkerPool::runTasks(unsigned threadIndex)
+{
+  for (size_t i = nextTask.fetch_add(1, std::memory_order_relaxed); i < taskCount; i = nextTask.fetch_add(1, std::memory_order_relaxed))
+  {
+    try
+    {
+      (*currentTask)(i, threadIndex);
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!firstError)
+      {
+        firstError = std::current_exception();
+      }
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads that stay alive between jobs, for work that is
+// split up every frame where starting threads the way parallelFor() does
+// would cost more than the work itself.
+//
+// run() hands tasks out one at a time and returns once all of them have
+// finished. The calling thread works on tasks too, so a pool of N threads
+// starts N - 1 workers.
+class WorkerPool
+{
+public:
+  WorkerPool() = default;
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void start(unsigned threadCount);
+  void stop();
+
+  unsigned getThreadCount() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+  // Calls task(taskIndex, threadIndex) for every taskIndex in [0, taskCount).
+  // threadIndex is below getThreadCount() and no two tasks running at the
+  // same time share it, so it can select per-thread scratch data. If a task
+  // throws, the first exception is rethrown here once no task is running.
+  void run(size_t taskCount, const std::function<void(size_t, unsigned)>& task);
+
+private:
+  // seenGeneration is the last job the worker should not take part in
+  void workerMain(unsigned threadIndex, uint64_t seenGeneration);
+  void runTasks(unsigned threadIndex);
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  // Bumped for every run() so that workers can tell a new job from a spurious wakeup
+  uint64_t generation = 0;
+  unsigned busyWorkers = 0;
+  bool stopping = false;
+
+  const std::function<void(size_t, unsigned)>* currentTask = nullptr;
+  size_t taskCount = 0;
+  std::atomic<size_t> nextTask{0};
+  std::exception_ptr firstError;
+};